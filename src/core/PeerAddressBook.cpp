@@ -0,0 +1,277 @@
+#include "core/PeerAddressBook.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+// A failed address is retried after 30 s, doubling with every failure in
+// a row.
+constexpr auto kRetryDelay = std::chrono::seconds(30);
+// How long a forgotten address is refused when it is reported again.
+constexpr auto kForgetFor = std::chrono::hours(1);
+// Weight given to the newest session when updating the average rate.
+constexpr double kSmoothingFactor = 0.5;
+}  // namespace
+
+PeerAddressBook::PeerAddressBook(size_t capacity) : capacity_(capacity) {}
+
+size_t PeerAddressBook::add(std::vector<std::unique_ptr<Peer>> peers,
+                            PeerSource source, Clock::time_point now) {
+  size_t added = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (closed_) {
+      return 0;
+    }
+    std::erase_if(forgotten_,
+                  [now](const auto& item) { return item.second <= now; });
+    for (auto& peer : peers) {
+      if (entries_.size() >= capacity_) {
+        break;
+      }
+      const std::string address = key(*peer);
+      if (forgotten_.contains(address)) {
+        continue;
+      }
+      Entry entry{.record = PeerRecord{.source = source, .nextAttempt = now},
+                  .peer = *peer,
+                  .order = nextOrder_};
+      auto [it, inserted] = entries_.try_emplace(address, std::move(entry));
+      if (inserted) {
+        nextOrder_++;
+        makeReady(address, it->second);
+        added++;
+      } else if (source == PeerSource::kLocal &&
+                 it->second.record.source != PeerSource::kLocal) {
+        const bool ready = ready_.erase(candidate(address, it->second)) > 0;
+        it->second.record.source = PeerSource::kLocal;
+        if (ready) {
+          makeReady(address, it->second);
+        }
+      }
+    }
+  }
+  if (added > 0) {
+    available_.notify_all();
+  }
+  return added;
+}
+
+/**
+ * Waits until an address is ready, sleeping until the next one comes out of
+ * its backoff when all of them are backing off.
+ */
+std::unique_ptr<Peer> PeerAddressBook::acquire() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!closed_) {
+    wakeWaiting(Clock::now());
+    if (!ready_.empty()) {
+      return take();
+    }
+    if (waiting_.empty()) {
+      available_.wait(lock);
+    } else {
+      available_.wait_until(lock, waiting_.begin()->first);
+    }
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Peer> PeerAddressBook::tryAcquire(Clock::time_point now) {
+  std::lock_guard<std::mutex> guard(lock_);
+  wakeWaiting(now);
+  if (closed_ || ready_.empty()) {
+    return nullptr;
+  }
+  return take();
+}
+
+void PeerAddressBook::connected(const Peer& peer, Clock::duration latency) {
+  std::lock_guard<std::mutex> guard(lock_);
+  Entry* entry = inUse(peer);
+  if (!entry) {
+    return;
+  }
+  PeerRecord& record = entry->record;
+  record.connectLatency =
+      record.connectLatency == Clock::duration::zero()
+          ? latency
+          : std::chrono::duration_cast<Clock::duration>(
+                kSmoothingFactor * latency +
+                (1 - kSmoothingFactor) * record.connectLatency);
+}
+
+void PeerAddressBook::connectFailed(const Peer& peer, Clock::time_point now) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    Entry* entry = inUse(peer);
+    if (!entry) {
+      return;
+    }
+    PeerRecord& record = entry->record;
+    record.inUse = false;
+    record.lastOutcome = ConnectOutcome::kFailed;
+    if (++record.failures >= kMaxFailures) {
+      forgotten_[key(peer)] = now + kForgetFor;
+      entries_.erase(key(peer));
+      return;
+    }
+    record.nextAttempt = now + kRetryDelay * (1 << (record.failures - 1));
+    waiting_.emplace(record.nextAttempt, key(peer));
+  }
+  available_.notify_all();
+}
+
+void PeerAddressBook::disconnected(const Peer& peer, uint64_t bytes,
+                                   Clock::duration duration,
+                                   Clock::time_point now) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    Entry* entry = inUse(peer);
+    if (!entry) {
+      return;
+    }
+    PeerRecord& record = entry->record;
+    record.inUse = false;
+    record.lastOutcome = ConnectOutcome::kConnected;
+    record.failures = 0;
+    record.lastConnected = now;
+    const double seconds = std::chrono::duration<double>(duration).count();
+    if (bytes > 0 && seconds > 0) {
+      const double rate = static_cast<double>(bytes) / seconds;
+      record.bytesPerSecond =
+          record.bytesPerSecond > 0
+              ? kSmoothingFactor * rate +
+                    (1 - kSmoothingFactor) * record.bytesPerSecond
+              : rate;
+    }
+    record.nextAttempt = now;
+    makeReady(key(peer), *entry);
+  }
+  available_.notify_all();
+}
+
+void PeerAddressBook::close() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    closed_ = true;
+  }
+  available_.notify_all();
+}
+
+size_t PeerAddressBook::size() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return entries_.size();
+}
+
+size_t PeerAddressBook::available(Clock::time_point now) const {
+  std::lock_guard<std::mutex> guard(lock_);
+  size_t count = ready_.size();
+  for (auto it = waiting_.begin(); it != waiting_.end() && it->first <= now;
+       ++it) {
+    count++;
+  }
+  return count;
+}
+
+std::optional<PeerRecord> PeerAddressBook::record(const Peer& peer) const {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = entries_.find(key(peer));
+  if (it == entries_.end()) {
+    return std::nullopt;
+  }
+  return it->second.record;
+}
+
+std::vector<std::pair<Peer, PeerRecord>> PeerAddressBook::best(
+    size_t count) const {
+  std::vector<std::pair<Peer, PeerRecord>> peers;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (const auto& [address, entry] : entries_) {
+      if (entry.record.bytesPerSecond > 0) {
+        peers.emplace_back(entry.peer, entry.record);
+      }
+    }
+  }
+
+  const auto better = [](const auto& a, const auto& b) {
+    if (a.second.bytesPerSecond != b.second.bytesPerSecond) {
+      return a.second.bytesPerSecond > b.second.bytesPerSecond;
+    }
+    return a.second.lastConnected > b.second.lastConnected;
+  };
+  if (peers.size() > count) {
+    std::ranges::partial_sort(peers, peers.begin() + count, better);
+    peers.resize(count);
+  } else {
+    std::ranges::sort(peers, better);
+  }
+  return peers;
+}
+
+std::string PeerAddressBook::key(const Peer& peer) {
+  return peer.ip + ":" + std::to_string(peer.port);
+}
+
+/**
+ * Higher is better. Rates are at least 1, addresses never tried score 0.5,
+ * addresses that connected without delivering anything up to 0.25, less
+ * the slower they were to connect, and failed ones below 0.
+ */
+double PeerAddressBook::score(const PeerRecord& record) {
+  if (record.failures > 0) {
+    return -record.failures;
+  }
+  if (record.bytesPerSecond > 0) {
+    return 1 + record.bytesPerSecond;
+  }
+  if (record.lastOutcome == ConnectOutcome::kUnknown) {
+    return 0.5;
+  }
+  const double latency =
+      std::chrono::duration<double>(record.connectLatency).count();
+  return 0.25 / (1 + latency);
+}
+
+PeerAddressBook::Candidate PeerAddressBook::candidate(const std::string& key,
+                                                     const Entry& entry) {
+  const bool local = entry.record.source == PeerSource::kLocal &&
+                     entry.record.failures == 0;
+  return {!local, -score(entry.record), entry.order, key};
+}
+
+void PeerAddressBook::makeReady(const std::string& key, const Entry& entry) {
+  ready_.insert(candidate(key, entry));
+}
+
+void PeerAddressBook::wakeWaiting(Clock::time_point now) {
+  while (!waiting_.empty() && waiting_.begin()->first <= now) {
+    auto it = entries_.find(waiting_.begin()->second);
+    waiting_.erase(waiting_.begin());
+    if (it != entries_.end() && !it->second.record.inUse) {
+      makeReady(it->first, it->second);
+    }
+  }
+}
+
+std::unique_ptr<Peer> PeerAddressBook::take() {
+  auto best = ready_.begin();
+  Entry& entry = entries_.at(std::get<3>(*best));
+  ready_.erase(best);
+  entry.record.inUse = true;
+  return std::make_unique<Peer>(entry.peer);
+}
+
+PeerAddressBook::Entry* PeerAddressBook::inUse(const Peer& peer) {
+  auto it = entries_.find(key(peer));
+  if (it == entries_.end() || !it->second.record.inUse) {
+    return nullptr;
+  }
+  return &it->second;
+}
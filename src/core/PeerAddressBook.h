@@ -0,0 +1,143 @@
+#ifndef BITTORRENTCLIENT_PEERADDRESSBOOK_H
+#define BITTORRENTCLIENT_PEERADDRESSBOOK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "network/Peer.h"
+
+// Where an address was learnt from.
+enum class PeerSource {
+  kTracker,
+  kPex,
+  // Persisted from a previous run.
+  kCache,
+  // Announced on the local network (BEP 14).
+  kLocal,
+};
+
+enum class ConnectOutcome {
+  kUnknown,
+  kConnected,
+  kFailed,
+};
+
+// What is known about a peer address.
+struct PeerRecord {
+  PeerSource source = PeerSource::kTracker;
+  ConnectOutcome lastOutcome = ConnectOutcome::kUnknown;
+  // Failed connection attempts in a row.
+  int failures = 0;
+  // Average download rate over the sessions that delivered data, 0 if none
+  // did.
+  double bytesPerSecond = 0;
+  // Average time connecting took, zero until a connect succeeded.
+  std::chrono::steady_clock::duration connectLatency{};
+  // Handed out to a connection and not released yet.
+  bool inUse = false;
+  std::chrono::steady_clock::time_point nextAttempt;
+  // End of the last session with the peer.
+  std::chrono::steady_clock::time_point lastConnected;
+};
+
+/**
+ * Every peer address learnt for the torrent, from trackers or from other
+ * peers, along with how connecting to it went. Connection slots take the
+ * best candidate: addresses that delivered data come first by throughput,
+ * then those never tried, then those that connected without delivering,
+ * quickest to connect first, and last those that failed. An address that
+ * fails is backed off exponentially and forgotten after kMaxFailures
+ * failures in a row, so dead addresses stop costing connection attempts.
+ * A forgotten address is not taken back for a while when trackers or other
+ * peers report it again.
+ * An address is never handed out twice at once.
+ *
+ * Addresses on the local network come before all others as long as they
+ * do not fail, so data already on the LAN is fetched from there rather
+ * than over the uplink.
+ */
+class PeerAddressBook {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kMaxFailures = 5;
+
+  explicit PeerAddressBook(size_t capacity = 2000);
+
+  // Adds the addresses not known yet and returns their number. Known
+  // addresses keep their history, and once `capacity` addresses are known
+  // new ones are dropped. Known addresses announced on the local network
+  // are marked as local.
+  size_t add(std::vector<std::unique_ptr<Peer>> peers, PeerSource source,
+             Clock::time_point now = Clock::now());
+
+  // Waits for the best candidate. Returns nullptr once closed.
+  std::unique_ptr<Peer> acquire();
+  // The best candidate at `now`, or nullptr if none is available.
+  std::unique_ptr<Peer> tryAcquire(Clock::time_point now = Clock::now());
+
+  // A connect to an acquired address succeeded after `latency`; the
+  // address stays in use.
+  void connected(const Peer& peer, Clock::duration latency);
+  // Hand an acquired address back, with the result of connecting to it.
+  // `bytes` were downloaded from the peer over `duration`.
+  void connectFailed(const Peer& peer, Clock::time_point now = Clock::now());
+  void disconnected(const Peer& peer, uint64_t bytes, Clock::duration duration,
+                    Clock::time_point now = Clock::now());
+
+  // Wakes every acquire(), which return nullptr from then on.
+  void close();
+
+  size_t size() const;
+  // Addresses that could be handed out at `now`.
+  size_t available(Clock::time_point now = Clock::now()) const;
+  std::optional<PeerRecord> record(const Peer& peer) const;
+  // Up to `count` addresses that delivered data, fastest first and, at
+  // equal speed, most recently seen first.
+  std::vector<std::pair<Peer, PeerRecord>> best(size_t count) const;
+
+ private:
+  // Candidates sorted local first, then by descending score, ties broken
+  // by insertion order.
+  using Candidate = std::tuple<bool, double, uint64_t, std::string>;
+  struct Entry {
+    PeerRecord record;
+    Peer peer;
+    uint64_t order = 0;
+  };
+
+  const size_t capacity_;
+  mutable std::mutex lock_;
+  std::condition_variable available_;
+  bool closed_ = false;
+  uint64_t nextOrder_ = 0;
+
+  std::unordered_map<std::string, Entry> entries_;
+  // Addresses that can be handed out, best first.
+  std::set<Candidate> ready_;
+  // Addresses backing off, by the time they become ready again.
+  std::multimap<Clock::time_point, std::string> waiting_;
+  // Addresses forgotten, by the time they can be added again.
+  std::unordered_map<std::string, Clock::time_point> forgotten_;
+
+  static std::string key(const Peer& peer);
+  static double score(const PeerRecord& record);
+  static Candidate candidate(const std::string& key, const Entry& entry);
+  void makeReady(const std::string& key, const Entry& entry);
+  void wakeWaiting(Clock::time_point now);
+  std::unique_ptr<Peer> take();
+  Entry* inUse(const Peer& peer);
+};
+
+#endif  // BITTORRENTCLIENT_PEERADDRESSBOOK_H
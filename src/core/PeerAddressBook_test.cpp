@@ -0,0 +1,186 @@
+#include "core/PeerAddressBook.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using std::chrono::seconds;
+
+namespace {
+std::vector<std::unique_ptr<Peer>> makePeers(std::vector<int> ports) {
+  std::vector<std::unique_ptr<Peer>> peers;
+  for (int port : ports) {
+    peers.push_back(
+        std::make_unique<Peer>(Peer{.ip = "10.0.0.1", .port = port}));
+  }
+  return peers;
+}
+}  // namespace
+
+TEST(PeerAddressBook, DeduplicatesAndNeverHandsOutTwice) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  EXPECT_EQ(book.add(makePeers({1, 2}), PeerSource::kTracker, now), 2);
+  EXPECT_EQ(book.add(makePeers({2, 3}), PeerSource::kPex, now), 1);
+  EXPECT_EQ(book.size(), 3);
+  EXPECT_EQ(book.record(Peer{"10.0.0.1", 3})->source, PeerSource::kPex);
+
+  std::vector<int> ports;
+  while (auto peer = book.tryAcquire(now)) {
+    ports.push_back(peer->port);
+  }
+  EXPECT_EQ(ports, (std::vector<int>{1, 2, 3}));
+
+  // Addresses in use are not handed out again, even when re-learnt.
+  book.add(makePeers({1}), PeerSource::kPex, now);
+  EXPECT_EQ(book.tryAcquire(now), nullptr);
+}
+
+TEST(PeerAddressBook, KeepsPexPeersAcrossAnnounces) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1, 2}), PeerSource::kPex, now);
+  // A tracker announce adds to what other peers reported.
+  EXPECT_EQ(book.add(makePeers({2, 3}), PeerSource::kTracker, now), 1);
+  EXPECT_EQ(book.size(), 3);
+  EXPECT_EQ(book.record(Peer{"10.0.0.1", 2})->source, PeerSource::kPex);
+
+  std::vector<int> ports;
+  while (auto peer = book.tryAcquire(now)) {
+    ports.push_back(peer->port);
+  }
+  EXPECT_EQ(ports, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(PeerAddressBook, PrefersPeersThatDelivered) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1, 2, 3}), PeerSource::kTracker, now);
+
+  auto slow = book.tryAcquire(now);
+  auto idle = book.tryAcquire(now);
+  auto fast = book.tryAcquire(now);
+  book.disconnected(*slow, 1000, seconds(10), now);
+  book.disconnected(*idle, 0, seconds(10), now);
+  book.disconnected(*fast, 100000, seconds(10), now);
+  book.add(makePeers({4}), PeerSource::kTracker, now);
+
+  // By throughput, then never tried, then connected without delivering.
+  std::vector<int> ports;
+  while (auto peer = book.tryAcquire(now)) {
+    ports.push_back(peer->port);
+  }
+  EXPECT_EQ(ports, (std::vector<int>{3, 1, 4, 2}));
+  EXPECT_DOUBLE_EQ(book.record(Peer{"10.0.0.1", 3})->bytesPerSecond, 10000);
+}
+
+TEST(PeerAddressBook, PrefersPeersQuickerToConnect) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1, 2}), PeerSource::kTracker, now);
+
+  auto far = book.tryAcquire(now);
+  auto near = book.tryAcquire(now);
+  book.connected(*far, std::chrono::milliseconds(800));
+  book.connected(*near, std::chrono::milliseconds(20));
+  book.connected(*near, std::chrono::milliseconds(40));
+  EXPECT_EQ(book.record(*near)->connectLatency, std::chrono::milliseconds(30));
+  book.disconnected(*far, 0, seconds(10), now);
+  book.disconnected(*near, 0, seconds(10), now);
+
+  std::vector<int> ports;
+  while (auto peer = book.tryAcquire(now)) {
+    ports.push_back(peer->port);
+  }
+  EXPECT_EQ(ports, (std::vector<int>{2, 1}));
+}
+
+TEST(PeerAddressBook, PrefersLocalPeers) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1, 2}), PeerSource::kTracker, now);
+  auto fast = book.tryAcquire(now);
+  book.disconnected(*fast, 100000, seconds(10), now);
+  book.add(makePeers({3}), PeerSource::kLocal, now);
+  // A tracker peer later announced on the LAN is moved up as well.
+  book.add(makePeers({2}), PeerSource::kLocal, now);
+  EXPECT_EQ(book.record(Peer{"10.0.0.1", 2})->source, PeerSource::kLocal);
+
+  std::vector<int> ports;
+  while (auto peer = book.tryAcquire(now)) {
+    ports.push_back(peer->port);
+  }
+  EXPECT_EQ(ports, (std::vector<int>{2, 3, 1}));
+
+  // Local peers that fail lose their precedence.
+  book.connectFailed(Peer{"10.0.0.1", 2}, now);
+  book.disconnected(Peer{"10.0.0.1", 1}, 100000, seconds(10), now);
+  auto first = book.tryAcquire(now + seconds(60));
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(first->port, 1);
+}
+
+TEST(PeerAddressBook, BacksOffAndForgetsDeadPeers) {
+  PeerAddressBook book;
+  auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1}), PeerSource::kTracker, now);
+
+  auto delay = seconds(30);
+  for (int failure = 1; failure < PeerAddressBook::kMaxFailures; failure++) {
+    auto peer = book.tryAcquire(now);
+    ASSERT_NE(peer, nullptr);
+    book.connectFailed(*peer, now);
+    EXPECT_EQ(book.record(*peer)->failures, failure);
+    EXPECT_EQ(book.tryAcquire(now + delay - seconds(1)), nullptr);
+    EXPECT_EQ(book.available(now + delay), 1);
+    now += delay;
+    delay *= 2;
+  }
+
+  auto peer = book.tryAcquire(now);
+  ASSERT_NE(peer, nullptr);
+  book.connectFailed(*peer, now);
+  EXPECT_EQ(book.size(), 0);
+
+  // Reported again, a forgotten address is not tried as if it were new.
+  EXPECT_EQ(book.add(makePeers({1}), PeerSource::kPex, now), 0);
+  EXPECT_EQ(book.tryAcquire(now), nullptr);
+  const auto later = now + std::chrono::hours(1);
+  EXPECT_EQ(book.add(makePeers({1}), PeerSource::kTracker, later), 1);
+  EXPECT_NE(book.tryAcquire(later), nullptr);
+}
+
+TEST(PeerAddressBook, CloseWakesWaitingConnections) {
+  PeerAddressBook book;
+  std::unique_ptr<Peer> acquired = std::make_unique<Peer>();
+  std::thread waiter([&] { acquired = book.acquire(); });
+  book.close();
+  waiter.join();
+  EXPECT_EQ(acquired, nullptr);
+}
+
+TEST(PeerAddressBook, ExportsTheBestPeersForTheCache) {
+  PeerAddressBook book;
+  const auto now = PeerAddressBook::Clock::now();
+  book.add(makePeers({1, 2, 3, 4}), PeerSource::kTracker, now);
+
+  auto a = book.tryAcquire(now);
+  auto b = book.tryAcquire(now);
+  auto c = book.tryAcquire(now);
+  auto d = book.tryAcquire(now);
+  book.disconnected(*a, 1000, seconds(1), now);
+  book.disconnected(*b, 0, seconds(1), now);
+  book.disconnected(*c, 1000, seconds(1), now + seconds(5));
+  book.disconnected(*d, 5000, seconds(1), now);
+
+  // Peers that never delivered are left out; equal rates favour the most
+  // recent session.
+  auto best = book.best(2);
+  ASSERT_EQ(best.size(), 2);
+  EXPECT_EQ(best[0].first.port, 4);
+  EXPECT_EQ(best[1].first.port, 3);
+  EXPECT_EQ(book.best(10).size(), 3);
+}
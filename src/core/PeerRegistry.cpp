@@ -3,97 +3,282 @@
 #include <fmt/base.h>
 #include <fmt/format.h>
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <utility>
+#include <vector>
+
+#include "infra/EpochDomain.h"
+#include "utils/Bitset.h"
 
 // TODO(slim): add a injectable peerRegistry.
-PeerRegistry::PeerRegistry() = default;
+PeerRegistry::PeerRegistry(size_t pieceCount)
+    : pieceCount_(pieceCount),
+      snapshot_(new Snapshot{
+          .availability =
+              std::make_shared<std::vector<std::atomic<uint32_t>>>(
+                  pieceCount)}) {}
+
+PeerRegistry::~PeerRegistry() { delete snapshot_.load(); }
 
 namespace {
-bool hasPiece(const std::string& bitField, int index) {
-  size_t byte_index = index / 8;
-  int offset = index % 8;
-  return (bitField[byte_index] >> (7 - offset) & 1) != 0;
+void addAvailability(std::vector<std::atomic<uint32_t>>& availability,
+                     const Bitset& pieces, int delta) {
+  for (size_t i = pieces.findFirst(); i != Bitset::npos;
+       i = pieces.findNext(i + 1)) {
+    availability[i].fetch_add(delta, std::memory_order_relaxed);
+  }
 }
+}  // namespace
 
-void setPiece(std::string& bitField, int index) {
-  int byte_index = index >> 3;
-  int offset = index & 7;
-  bitField[byte_index] |= (1 << (7 - offset));
+const PeerRegistry::PeerState* PeerRegistry::find(const Snapshot& snapshot,
+                                                  PeerHandle peer) {
+  if (peer >= snapshot.peers.size() || !snapshot.peers[peer].registered()) {
+    return nullptr;
+  }
+  return &snapshot.peers[peer];
 }
-}  // namespace
 
-void PeerRegistry::addPeer(const std::string& peerId,
-                           const std::string& bitField) {
-  size_t current_count = 0;
-  {
-    std::lock_guard<std::mutex> lock(lock_);
-    peers_[peerId] = std::move(bitField);
-    current_count = peers_.size();
+/**
+ * Swaps in a new snapshot. The previous one is destroyed once no reader can
+ * still be looking at it. Must be called with lock_ held.
+ */
+void PeerRegistry::publish(std::unique_ptr<Snapshot> next) {
+  const Snapshot* previous =
+      snapshot_.exchange(next.release(), std::memory_order_seq_cst);
+  epochs_.retire([previous] { delete previous; });
+  epochs_.reclaim();
+}
+
+/**
+ * Replaces whatever is registered for the peer with the given pieces, or
+ * with a seed if `pieces` is null. Must be called with lock_ held.
+ */
+void PeerRegistry::registerPeer(PeerHandle peer,
+                                std::shared_ptr<Bitset> pieces) {
+  auto next = std::make_unique<Snapshot>(*snapshot_.load());
+
+  if (pieces && next->availability->size() < pieces->size()) {
+    auto grown =
+        std::make_shared<std::vector<std::atomic<uint32_t>>>(pieces->size());
+    for (size_t i = 0; i < next->availability->size(); i++) {
+      (*grown)[i].store((*next->availability)[i].load());
+    }
+    next->availability = std::move(grown);
+  }
+
+  if (next->peers.size() <= peer) {
+    next->peers.resize(peer + 1);
+    pieceCounts_.resize(peer + 1);
   }
+  PeerState& state = next->peers[peer];
+  if (state.seed) {
+    next->seedCount--;
+  } else if (state.pieces) {
+    addAvailability(*next->availability, *state.pieces, -1);
+  } else {
+    next->peerCount++;
+  }
+
+  if (pieces) {
+    addAvailability(*next->availability, *pieces, 1);
+    pieceCounts_[peer] = pieces->count();
+    state = PeerState{std::move(pieces), false};
+  } else {
+    next->seedCount++;
+    state = PeerState{nullptr, true};
+  }
+
+  publish(std::move(next));
+}
+
+void PeerRegistry::addPeer(PeerHandle peer, const std::string& bitField) {
+  auto pieces = std::make_shared<Bitset>(Bitset::fromBitfield(bitField));
+  // The spare bits of the last byte are not pieces, whatever the peer set.
+  if (pieceCount_ > 0) {
+    for (size_t i = pieces->findNext(pieceCount_); i != Bitset::npos;
+         i = pieces->findNext(i + 1)) {
+      pieces->reset(i);
+    }
+  }
+  const bool seed = pieceCount_ > 0 && pieces->count() >= pieceCount_;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  registerPeer(peer, seed ? nullptr : std::move(pieces));
+}
+
+void PeerRegistry::addSeed(PeerHandle peer) {
+  std::lock_guard<std::mutex> lock(lock_);
+  registerPeer(peer, nullptr);
 }
 
 std::expected<void, PeerRegistryError> PeerRegistry::updatePeer(
-    const std::string& peerId, int index) {
+    PeerHandle peer, int index) {
   std::lock_guard<std::mutex> lock(lock_);
+  const Snapshot* snapshot = snapshot_.load();
 
-  auto it = peers_.find(peerId);
+  const PeerState* state = find(*snapshot, peer);
+  if (!state) {
+    return std::unexpected(PeerRegistryError{fmt::format(
+        "Attempting to update a peer {} with whom a connection has not been "
+        "established.",
+        peer)});
+  }
+  if (state->seed) {
+    return {};
+  }
 
-  if (it != peers_.end()) {
-    setPiece(it->second, index);
+  Bitset& pieces = *state->pieces;
+  if (index < 0 || static_cast<size_t>(index) >= pieces.size() ||
+      (pieceCount_ > 0 && static_cast<size_t>(index) >= pieceCount_)) {
+    return std::unexpected(PeerRegistryError{fmt::format(
+        "Peer {} announced piece {} outside of its bitfield.", peer, index)});
+  }
+  if (pieces.atomicTest(index)) {
     return {};
   }
 
-  return std::unexpected(
-      PeerRegistryError{"Attempting to update a peer " + peerId +
-                        " with whom a connection has not been established."});
+  pieces.atomicSet(index);
+  (*snapshot->availability)[index].fetch_add(1, std::memory_order_relaxed);
+  if (pieceCount_ > 0 && ++pieceCounts_[peer] >= pieceCount_) {
+    registerPeer(peer, nullptr);
+  }
+  return {};
 }
 
-size_t PeerRegistry::peerCount() const { return peers_.size(); }
+size_t PeerRegistry::peerCount() const {
+  EpochDomain::Guard guard(epochs_);
+  return snapshot_.load(std::memory_order_seq_cst)->peerCount;
+}
+
+size_t PeerRegistry::seedCount() const {
+  EpochDomain::Guard guard(epochs_);
+  return snapshot_.load(std::memory_order_seq_cst)->seedCount;
+}
 
 std::expected<std::string, PeerRegistryError> PeerRegistry::getPeer(
-    const std::string& peerId) {
-  std::lock_guard<std::mutex> lock(lock_);
+    PeerHandle peer) {
+  EpochDomain::Guard guard(epochs_);
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_seq_cst);
 
-  auto it = peers_.find(peerId);
-  if (it != peers_.end()) {
-    return it->second;
+  if (const PeerState* state = find(*snapshot, peer)) {
+    return state->seed ? Bitset(pieceCount_, true).toBitfield()
+                       : state->pieces->toBitfield();
   }
 
-  return std::unexpected(PeerRegistryError{"Attempting to get peer " + peerId});
+  return std::unexpected(
+      PeerRegistryError{fmt::format("Attempting to get peer {}", peer)});
 }
 
-bool PeerRegistry::peerHasPiece(const std::string& peerId,
-                                int pieceIndex) const {
-  auto it = peers_.find(peerId);
-  if (it != peers_.end()) {
-    std::string peer = it->second;
-    return hasPiece(peer, pieceIndex);
+bool PeerRegistry::peerHasPiece(PeerHandle peer, int pieceIndex) const {
+  EpochDomain::Guard guard(epochs_);
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_seq_cst);
+
+  if (const PeerState* state = find(*snapshot, peer)) {
+    if (state->seed) {
+      return pieceIndex >= 0 && static_cast<size_t>(pieceIndex) < pieceCount_;
+    }
+    return pieceIndex >= 0 &&
+           static_cast<size_t>(pieceIndex) < state->pieces->size() &&
+           state->pieces->atomicTest(pieceIndex);
   }
   // If the peer was not found, return false or handle the error case
   return false;
 }
 
-bool PeerRegistry::hasPeer(const std::string& peerId) const {
-  auto it = peers_.find(peerId);
+bool PeerRegistry::hasPeer(PeerHandle peer) const {
+  EpochDomain::Guard guard(epochs_);
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_seq_cst);
 
-  if (it != peers_.end()) {
-    return it->second != "";
+  const PeerState* state = find(*snapshot, peer);
+  return state && (state->seed || state->pieces->size() != 0);
+}
+
+bool PeerRegistry::isSeed(PeerHandle peer) const {
+  EpochDomain::Guard guard(epochs_);
+  const PeerState* state =
+      find(*snapshot_.load(std::memory_order_seq_cst), peer);
+  return state && state->seed;
+}
+
+uint32_t PeerRegistry::pieceAvailability(int pieceIndex) const {
+  EpochDomain::Guard guard(epochs_);
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_seq_cst);
+  const auto& availability = *snapshot->availability;
+  if (pieceIndex < 0 ||
+      static_cast<size_t>(pieceIndex) >= availability.size()) {
+    return 0;
   }
+  return availability[pieceIndex].load(std::memory_order_relaxed) +
+         snapshot->seedCount;
+}
 
-  return false;
+/**
+ * Walks the pieces that are both in `candidates` and in the peer's bitfield,
+ * using the vectorised AND scan to skip whole blocks the peer cannot serve,
+ * and returns the one the fewest peers have. Seeds add the same amount to
+ * every piece, so only the partial peers' counts are compared, and a seed
+ * simply walks all the candidates. A piece no other partial peer has cannot
+ * be beaten, so the scan stops there.
+ */
+int PeerRegistry::rarestPieceIn(PeerHandle peer,
+                                const Bitset& candidates) const {
+  EpochDomain::Guard guard(epochs_);
+  const Snapshot* snapshot = snapshot_.load(std::memory_order_seq_cst);
+
+  const PeerState* state = find(*snapshot, peer);
+  if (!state) {
+    return -1;
+  }
+
+  const auto& availability = *snapshot->availability;
+  // A partial peer counts itself in the availability of its pieces.
+  const uint32_t floor = state->seed ? 0 : 1;
+  auto next = [&](size_t from) {
+    if (state->seed) {
+      size_t i = candidates.findNext(from);
+      return i < pieceCount_ ? i : Bitset::npos;
+    }
+    return state->pieces->findNextAnd(candidates, from);
+  };
+
+  int rarest = -1;
+  uint32_t least = UINT32_MAX;
+  for (size_t i = next(0); i != Bitset::npos; i = next(i + 1)) {
+    uint32_t count = i < availability.size()
+                         ? availability[i].load(std::memory_order_relaxed)
+                         : 0;
+    if (count < least) {
+      least = count;
+      rarest = static_cast<int>(i);
+      if (least <= floor) {
+        break;
+      }
+    }
+  }
+  return rarest;
 }
 
 std::expected<void, PeerRegistryError> PeerRegistry::removePeer(
-    const std::string& peerId) {
-  size_t remaining_peers = 0;
+    PeerHandle peer) {
   bool peer_found = false;
 
   {
     std::lock_guard<std::mutex> lock(lock_);
-    auto iter = peers_.find(peerId);
-    if (iter != peers_.end()) {
-      peers_.erase(iter);
-      remaining_peers = peers_.size();
+    const Snapshot* snapshot = snapshot_.load();
+    if (find(*snapshot, peer)) {
+      auto next = std::make_unique<Snapshot>(*snapshot);
+      PeerState& state = next->peers[peer];
+      if (state.seed) {
+        next->seedCount--;
+      } else {
+        addAvailability(*next->availability, *state.pieces, -1);
+      }
+      state = PeerState{};
+      next->peerCount--;
+      publish(std::move(next));
       peer_found = true;
     }
   }
@@ -104,5 +289,5 @@ std::expected<void, PeerRegistryError> PeerRegistry::removePeer(
 
   // Return error if peer wasn't found
   return std::unexpected(PeerRegistryError{fmt::format(
-      "Attempting to remove peer {} (connection not established).", peerId)});
+      "Attempting to remove peer {} (connection not established).", peer)});
 }
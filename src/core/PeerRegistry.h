@@ -1,42 +1,103 @@
-
 #ifndef BITTORRENTCLIENT_PEERREGISTRY_H
 #define BITTORRENTCLIENT_PEERREGISTRY_H
 
+#include <atomic>
+#include <cstdint>
 #include <expected>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
+#include <vector>
+
+#include "core/PeerTable.h"
+#include "infra/EpochDomain.h"
+#include "utils/Bitset.h"
 
 struct PeerRegistryError {
   std::string message;
 };
 
+/**
+ * Pieces announced by each connected peer, and how many peers have each
+ * piece. Lookups happen for every candidate piece of every request, while
+ * peers come and go rarely, so reads go through an immutable snapshot
+ * protected by an EpochDomain and take no lock. Adding or removing a peer
+ * publishes a copy of the snapshot; a Have message sets the bit in place
+ * through the peer's atomic words.
+ *
+ * Seeds, peers that have every piece, are kept as a flag without a bitset
+ * and counted once in a swarm-wide seed counter instead of in every
+ * per-piece availability counter. A partial peer whose last missing piece
+ * is announced becomes a seed.
+ */
 class PeerRegistry {
  private:
+  struct PeerState {
+    // Pieces of a partial peer; null for a seed.
+    std::shared_ptr<Bitset> pieces;
+    bool seed = false;
+
+    bool registered() const { return seed || pieces; }
+  };
+
+  struct Snapshot {
+    // Indexed by peer handle.
+    std::vector<PeerState> peers;
+    size_t peerCount = 0;
+    size_t seedCount = 0;
+    // Number of partial peers that have each piece. Shared by successive
+    // snapshots until it has to grow.
+    std::shared_ptr<std::vector<std::atomic<uint32_t>>> availability;
+  };
+
+  // Number of pieces in the torrent, or 0 if unknown, in which case no
+  // peer is recognised as a seed from its bitfield.
+  const size_t pieceCount_;
+
   // Deps
-  std::unordered_map<std::string, std::string> peers_;
+  std::atomic<const Snapshot*> snapshot_;
+  mutable EpochDomain epochs_;
+  // Serialises writers.
   std::mutex lock_;
+  // Pieces announced by each partial peer, so that completing a bitfield is
+  // noticed without counting it. Only touched by writers.
+  std::vector<size_t> pieceCounts_;
+
+  void publish(std::unique_ptr<Snapshot> next);
+  void registerPeer(PeerHandle peer, std::shared_ptr<Bitset> pieces);
+  static const PeerState* find(const Snapshot& snapshot, PeerHandle peer);
 
  public:
-  explicit PeerRegistry();
+  explicit PeerRegistry(size_t pieceCount = 0);
   // Destructor
-  ~PeerRegistry() = default;
+  ~PeerRegistry();
 
-  void addPeer(const std::string& peerId, const std::string& bitField);
+  void addPeer(PeerHandle peer, const std::string& bitField);
+  // Registers a peer known to have every piece (e.g. from HaveAll).
+  void addSeed(PeerHandle peer);
 
-  std::expected<void, PeerRegistryError> updatePeer(const std::string& peerId,
+  std::expected<void, PeerRegistryError> updatePeer(PeerHandle peer,
                                                     int index);
 
-  std::expected<void, PeerRegistryError> removePeer(const std::string& peerId);
+  std::expected<void, PeerRegistryError> removePeer(PeerHandle peer);
+
+  std::expected<std::string, PeerRegistryError> getPeer(PeerHandle peer);
 
-  std::expected<std::string, PeerRegistryError> getPeer(
-      const std::string& peerId);
+  bool hasPeer(PeerHandle peer) const;
 
-  bool hasPeer(const std::string& peerId) const;
+  bool peerHasPiece(PeerHandle peer, int pieceIndex) const;
 
-  bool peerHasPiece(const std::string& peerId, int pieceIndex) const;
+  bool isSeed(PeerHandle peer) const;
 
   size_t peerCount() const;
+
+  size_t seedCount() const;
+
+  // Number of connected peers that have the piece, seeds included.
+  uint32_t pieceAvailability(int pieceIndex) const;
+
+  // Rarest of the pieces in `candidates` that the peer has, or -1.
+  int rarestPieceIn(PeerHandle peer, const Bitset& candidates) const;
 };
 
 #endif  // BITTORRENTCLIENT_PEERREGISTRY_H
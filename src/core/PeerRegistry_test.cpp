@@ -2,21 +2,181 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr PeerHandle kPeer = 7;
+constexpr PeerHandle kA = 0;
+constexpr PeerHandle kB = 1;
+constexpr PeerHandle kC = 2;
+constexpr PeerHandle kUnknown = 42;
+
 TEST(PeerRegistryTest, d) {
   PeerRegistry peer_registry = PeerRegistry();
 
-  peer_registry.addPeer("peerID", "bitRegistry");
+  peer_registry.addPeer(kPeer, "bitRegistry");
 
-  auto res = peer_registry.getPeer("peerID");
+  auto res = peer_registry.getPeer(kPeer);
   EXPECT_EQ(res.value(), "bitRegistry");
 
-  peer_registry.updatePeer("peerID", 1);
+  peer_registry.updatePeer(kPeer, 1);
 
-  res = peer_registry.getPeer("peerID");
+  res = peer_registry.getPeer(kPeer);
   EXPECT_EQ(res.value(), "bitRegistry");
 
-  peer_registry.removePeer("peerID");
+  peer_registry.removePeer(kPeer);
+
+  res = peer_registry.getPeer(kPeer);
+  EXPECT_EQ(res.error().message, "Attempting to get peer 7");
+}
+
+TEST(PeerRegistryTest, TracksPieceAvailability) {
+  PeerRegistry peer_registry;
+
+  // Piece 0 is the high bit of the first byte.
+  peer_registry.addPeer(kA, std::string("\xC0", 1));  // pieces 0, 1
+  peer_registry.addPeer(kB, std::string("\x80", 1));  // piece 0
+
+  EXPECT_TRUE(peer_registry.peerHasPiece(kA, 1));
+  EXPECT_FALSE(peer_registry.peerHasPiece(kB, 1));
+  EXPECT_EQ(peer_registry.pieceAvailability(0), 2);
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 1);
+
+  EXPECT_TRUE(peer_registry.updatePeer(kB, 2).has_value());
+  EXPECT_EQ(peer_registry.pieceAvailability(2), 1);
+  EXPECT_FALSE(peer_registry.updatePeer(kB, 8).has_value());
+
+  peer_registry.removePeer(kA);
+  EXPECT_EQ(peer_registry.pieceAvailability(0), 1);
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 0);
+}
+
+TEST(PeerRegistryTest, PicksRarestCandidatePiece) {
+  PeerRegistry peer_registry;
+  peer_registry.addPeer(kA, std::string("\xE0", 1));  // pieces 0, 1, 2
+  peer_registry.addPeer(kB, std::string("\xC0", 1));  // pieces 0, 1
+  peer_registry.addPeer(kC, std::string("\x80", 1));  // piece 0
+
+  Bitset candidates(8, true);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kA, candidates), 2);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kB, candidates), 1);
+
+  candidates.reset(1);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kB, candidates), 0);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kUnknown, candidates), -1);
+}
+
+TEST(PeerRegistryTest, ReadsRaceWithWritersSafely) {
+  PeerRegistry peer_registry;
+  std::atomic<bool> done = false;
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; r++) {
+    readers.emplace_back([&] {
+      Bitset candidates(16, true);
+      while (!done) {
+        peer_registry.hasPeer(kPeer);
+        peer_registry.peerHasPiece(kPeer, 3);
+        peer_registry.rarestPieceIn(kPeer, candidates);
+        peer_registry.pieceAvailability(3);
+      }
+    });
+  }
+
+  for (int i = 0; i < 2000; i++) {
+    peer_registry.addPeer(kPeer, std::string("\x10\x00", 2));
+    peer_registry.updatePeer(kPeer, i % 16);
+    peer_registry.removePeer(kPeer);
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(peer_registry.peerCount(), 0);
+  EXPECT_EQ(peer_registry.pieceAvailability(3), 0);
+}
+
+TEST(PeerRegistryTest, StoresCompleteBitfieldAsSeed) {
+  PeerRegistry peer_registry(3);
+  peer_registry.addPeer(kA, std::string("\xE0", 1));  // pieces 0, 1, 2
+  peer_registry.addPeer(kB, std::string("\x80", 1));  // piece 0
+
+  EXPECT_TRUE(peer_registry.isSeed(kA));
+  EXPECT_FALSE(peer_registry.isSeed(kB));
+  EXPECT_EQ(peer_registry.peerCount(), 2);
+  EXPECT_EQ(peer_registry.seedCount(), 1);
+  EXPECT_TRUE(peer_registry.peerHasPiece(kA, 2));
+  EXPECT_FALSE(peer_registry.peerHasPiece(kA, 3));
+  EXPECT_EQ(peer_registry.getPeer(kA).value(), std::string("\xE0", 1));
+  EXPECT_EQ(peer_registry.pieceAvailability(0), 2);
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 1);
+
+  // Have messages from a seed change nothing.
+  EXPECT_TRUE(peer_registry.updatePeer(kA, 1).has_value());
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 1);
+
+  peer_registry.removePeer(kA);
+  EXPECT_EQ(peer_registry.seedCount(), 0);
+  EXPECT_EQ(peer_registry.pieceAvailability(0), 1);
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 0);
+}
+
+TEST(PeerRegistryTest, PromotesPeerToSeedOnLastHave) {
+  PeerRegistry peer_registry(3);
+  peer_registry.addPeer(kA, std::string("\xC0", 1));  // pieces 0, 1
+  EXPECT_FALSE(peer_registry.isSeed(kA));
+  EXPECT_EQ(peer_registry.pieceAvailability(2), 0);
+
+  EXPECT_TRUE(peer_registry.updatePeer(kA, 2).has_value());
+  EXPECT_TRUE(peer_registry.isSeed(kA));
+  EXPECT_EQ(peer_registry.seedCount(), 1);
+  EXPECT_EQ(peer_registry.peerCount(), 1);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(peer_registry.pieceAvailability(i), 1);
+  }
+}
+
+TEST(PeerRegistryTest, IgnoresSpareBitsOfTheBitfield) {
+  PeerRegistry peer_registry(3);
+  // Pieces 0 and 1, and three of the five spare bits.
+  peer_registry.addPeer(kA, std::string("\xDC", 1));
+
+  EXPECT_FALSE(peer_registry.isSeed(kA));
+  EXPECT_EQ(peer_registry.seedCount(), 0);
+  EXPECT_FALSE(peer_registry.peerHasPiece(kA, 3));
+  EXPECT_EQ(peer_registry.getPeer(kA).value(), std::string("\xC0", 1));
+}
+
+TEST(PeerRegistryTest, RejectsHaveForSpareBits) {
+  PeerRegistry peer_registry(3);
+  peer_registry.addPeer(kA, std::string("\xC0", 1));  // pieces 0, 1
+
+  EXPECT_FALSE(peer_registry.updatePeer(kA, 3).has_value());
+  EXPECT_FALSE(peer_registry.updatePeer(kA, 7).has_value());
+  EXPECT_FALSE(peer_registry.isSeed(kA));
+  EXPECT_FALSE(peer_registry.peerHasPiece(kA, 3));
+
+  EXPECT_TRUE(peer_registry.updatePeer(kA, 2).has_value());
+  EXPECT_TRUE(peer_registry.isSeed(kA));
+}
+
+TEST(PeerRegistryTest, AddsSeedWithoutBitfield) {
+  PeerRegistry peer_registry(3);
+  peer_registry.addSeed(kA);
+  peer_registry.addPeer(kB, std::string("\x40", 1));  // piece 1
+
+  EXPECT_TRUE(peer_registry.hasPeer(kA));
+  EXPECT_TRUE(peer_registry.isSeed(kA));
+  EXPECT_EQ(peer_registry.pieceAvailability(1), 2);
 
-  res = peer_registry.getPeer("peerID");
-  EXPECT_EQ(res.error().message, "Attempting to get peer peerID");
+  Bitset candidates(3, true);
+  // The seed prefers the piece no partial peer has.
+  EXPECT_EQ(peer_registry.rarestPieceIn(kA, candidates), 0);
+  candidates.reset(0);
+  candidates.reset(2);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kA, candidates), 1);
+  EXPECT_EQ(peer_registry.rarestPieceIn(kB, candidates), 1);
 }
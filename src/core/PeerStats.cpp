@@ -0,0 +1,218 @@
+#include "core/PeerStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <vector>
+
+namespace {
+constexpr auto kSampleWindow = std::chrono::seconds(1);
+// Weight given to the newest window when updating the moving average.
+constexpr double kSmoothingFactor = 0.3;
+// Each piece that failed the hash check halves the score once more.
+constexpr double kHashFailurePenalty = 2;
+
+double windowRate(const PeerThroughput& stats,
+                  std::chrono::steady_clock::time_point now) {
+  std::chrono::duration<double> elapsed = now - stats.windowStart;
+  if (elapsed.count() <= 0) {
+    return 0;
+  }
+  return static_cast<double>(stats.windowBytes) / elapsed.count();
+}
+}  // namespace
+
+/**
+ * Accounts for a block received from the given peer. Once a sampling window
+ * has elapsed, its average rate is folded into the moving average.
+ */
+void PeerStats::blockReceived(PeerHandle peer, size_t bytes,
+                              Clock::time_point now) {
+  PeerThroughput& stats = entry(peer, now).throughput;
+
+  if (!stats.started) {
+    stats.started = true;
+    stats.windowStart = now;
+    stats.windowBytes = bytes;
+    return;
+  }
+
+  stats.windowBytes += bytes;
+  if (now - stats.windowStart < kSampleWindow) {
+    return;
+  }
+
+  double sample = windowRate(stats, now);
+  stats.bytesPerSecond =
+      stats.hasSample ? kSmoothingFactor * sample +
+                            (1 - kSmoothingFactor) * stats.bytesPerSecond
+                      : sample;
+  stats.hasSample = true;
+  stats.windowStart = now;
+  stats.windowBytes = 0;
+}
+
+/**
+ * Returns the estimated throughput of the peer. A window that has run past
+ * its length without being closed means the peer has stalled, so it is
+ * blended in to let the estimate decay instead of staying at its last value.
+ */
+double PeerStats::throughput(PeerHandle peer,
+                             Clock::time_point now) const {
+  if (peer >= peers_.size()) {
+    return 0;
+  }
+
+  const PeerThroughput& stats = peers_[peer].throughput;
+  if (!stats.hasSample) {
+    return windowRate(stats, now);
+  }
+  if (now - stats.windowStart < kSampleWindow) {
+    return stats.bytesPerSecond;
+  }
+  return kSmoothingFactor * windowRate(stats, now) +
+         (1 - kSmoothingFactor) * stats.bytesPerSecond;
+}
+
+void PeerStats::requestServed(PeerHandle peer,
+                              RttEstimator::Duration rtt) {
+  entry(peer).latency.addSample(rtt);
+}
+
+void PeerStats::requestExpired(PeerHandle peer) {
+  entry(peer).latency.backoff();
+}
+
+RttEstimator::Duration PeerStats::requestTimeout(
+    PeerHandle peer) const {
+  if (peer >= peers_.size()) {
+    return RttEstimator::kInitialTimeout;
+  }
+  return peers_[peer].latency.timeout();
+}
+
+void PeerStats::peerChoked(PeerHandle peer, bool choked,
+                           Clock::time_point now) {
+  PeerEntry& peer_entry = entry(peer, now);
+  if (peer_entry.choking == choked) {
+    return;
+  }
+  if (peer_entry.choking) {
+    peer_entry.chokedTime += now - peer_entry.chokingSince;
+  }
+  peer_entry.choking = choked;
+  peer_entry.chokingSince = now;
+}
+
+void PeerStats::hashFailed(PeerHandle peer) { entry(peer).hashFailures++; }
+
+double PeerStats::chokeRatio(PeerHandle peer, Clock::time_point now) const {
+  if (peer >= peers_.size() || peers_[peer].since == Clock::time_point{}) {
+    return 0;
+  }
+  const PeerEntry& peer_entry = peers_[peer];
+  auto choked = peer_entry.chokedTime;
+  if (peer_entry.choking) {
+    choked += now - peer_entry.chokingSince;
+  }
+  const auto known = now - peer_entry.since;
+  if (known <= Clock::duration::zero()) {
+    return peer_entry.choking ? 1 : 0;
+  }
+  return std::chrono::duration<double>(choked) /
+         std::chrono::duration<double>(known);
+}
+
+/**
+ * A peer that keeps us choked half of the time scores half of its
+ * throughput; one with a second of service time scores half of it again.
+ */
+double PeerStats::score(PeerHandle peer, Clock::time_point now) const {
+  if (peer >= peers_.size()) {
+    return 0;
+  }
+  const PeerEntry& peer_entry = peers_[peer];
+  const double latency =
+      std::chrono::duration<double>(peer_entry.latency.srtt()).count();
+  return throughput(peer, now) * (1 - chokeRatio(peer, now)) /
+         std::pow(kHashFailurePenalty, peer_entry.hashFailures) /
+         (1 + latency);
+}
+
+/**
+ * Recently connected peers are left alone until their estimates mean
+ * something, and nothing is rotated while fewer than two peers are known.
+ */
+std::optional<PeerHandle> PeerStats::rotationCandidate(
+    Clock::duration minAge, double fraction, Clock::time_point now) const {
+  std::vector<double> scores;
+  std::optional<PeerHandle> worst;
+  double worst_score = 0;
+  for (PeerHandle peer = 0; peer < peers_.size(); peer++) {
+    if (peers_[peer].since == Clock::time_point{}) {
+      continue;
+    }
+    const double peer_score = score(peer, now);
+    scores.push_back(peer_score);
+    if (now - peers_[peer].since >= minAge &&
+        (!worst || peer_score < worst_score)) {
+      worst = peer;
+      worst_score = peer_score;
+    }
+  }
+  if (!worst || scores.size() < 2) {
+    return std::nullopt;
+  }
+
+  auto median = scores.begin() + scores.size() / 2;
+  std::ranges::nth_element(scores, median);
+  if (worst_score >= fraction * *median) {
+    return std::nullopt;
+  }
+  return worst;
+}
+
+void PeerStats::allowFast(PeerHandle peer, int pieceIndex) {
+  std::vector<int>& pieces = entry(peer).allowedFast;
+  if (std::ranges::find(pieces, pieceIndex) == pieces.end()) {
+    pieces.push_back(pieceIndex);
+  }
+}
+
+void PeerStats::suggestPiece(PeerHandle peer, int pieceIndex) {
+  std::vector<int>& pieces = entry(peer).suggested;
+  if (std::ranges::find(pieces, pieceIndex) == pieces.end()) {
+    pieces.push_back(pieceIndex);
+  }
+}
+
+const std::vector<int>& PeerStats::allowedFast(PeerHandle peer) const {
+  static const std::vector<int> kNone;
+  return peer < peers_.size() ? peers_[peer].allowedFast : kNone;
+}
+
+std::vector<int>& PeerStats::suggested(PeerHandle peer) {
+  return entry(peer).suggested;
+}
+
+void PeerStats::removePeer(PeerHandle peer) {
+  if (peer < peers_.size()) {
+    peers_[peer] = PeerEntry{};
+  }
+}
+
+PeerEntry& PeerStats::entry(PeerHandle peer) {
+  if (peer >= peers_.size()) {
+    peers_.resize(peer + 1);
+  }
+  return peers_[peer];
+}
+
+PeerEntry& PeerStats::entry(PeerHandle peer, Clock::time_point now) {
+  PeerEntry& peer_entry = entry(peer);
+  if (peer_entry.since == Clock::time_point{}) {
+    peer_entry.since = now;
+  }
+  return peer_entry;
+}
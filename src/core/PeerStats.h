@@ -0,0 +1,102 @@
+#ifndef BITTORRENTCLIENT_PEERSTATS_H
+#define BITTORRENTCLIENT_PEERSTATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "core/PeerTable.h"
+#include "core/RttEstimator.h"
+
+/**
+ * Download statistics kept for a single peer. Throughput is an exponentially
+ * weighted moving average of the bytes received per second, sampled over
+ * fixed windows so that a single block does not swing the estimate.
+ */
+struct PeerThroughput {
+  std::chrono::steady_clock::time_point windowStart;
+  size_t windowBytes = 0;
+  double bytesPerSecond = 0;
+  bool started = false;
+  bool hasSample = false;
+};
+
+struct PeerEntry {
+  PeerThroughput throughput;
+  RttEstimator latency;
+  // When the peer was first heard of; unset until then.
+  std::chrono::steady_clock::time_point since;
+  bool choking = false;
+  std::chrono::steady_clock::time_point chokingSince;
+  // Time the peer kept us choked, up to chokingSince.
+  std::chrono::steady_clock::duration chokedTime{};
+  // Pieces the peer sent blocks of that failed the hash check.
+  int hashFailures = 0;
+  // Pieces the peer lets us request while choked, and pieces it suggested
+  // we download (BEP 6), in the order they were announced.
+  std::vector<int> allowedFast;
+  std::vector<int> suggested;
+};
+
+/**
+ * Keeps track of how fast each connected peer is delivering blocks and how
+ * long it takes to answer a request, along with the piece hints the peer
+ * sent. It is owned by the PieceManager and is only accessed while holding
+ * its lock.
+ *
+ * Peers are scored on all of it, so that the worst of them can be replaced
+ * with fresh candidates and the connected set converges on the fastest.
+ */
+class PeerStats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  void blockReceived(PeerHandle peer, size_t bytes,
+                     Clock::time_point now = Clock::now());
+
+  // Bytes per second, or 0 if nothing has been received from the peer yet.
+  double throughput(PeerHandle peer,
+                    Clock::time_point now = Clock::now()) const;
+
+  // Time between sending a request to the peer and receiving its block.
+  void requestServed(PeerHandle peer, RttEstimator::Duration rtt);
+  void requestExpired(PeerHandle peer);
+  // How long to wait for a block from the peer before requesting it again.
+  RttEstimator::Duration requestTimeout(PeerHandle peer) const;
+
+  // The peer choked or unchoked us.
+  void peerChoked(PeerHandle peer, bool choked,
+                  Clock::time_point now = Clock::now());
+  // The peer sent blocks of a piece that failed the hash check.
+  void hashFailed(PeerHandle peer);
+  // Share of the time since the peer was first heard of that it kept us
+  // choked.
+  double chokeRatio(PeerHandle peer,
+                    Clock::time_point now = Clock::now()) const;
+  // Throughput, discounted for the time the peer keeps us choked, for its
+  // hash failures and for its latency. Higher is better.
+  double score(PeerHandle peer, Clock::time_point now = Clock::now()) const;
+  // The lowest scored of the peers heard of for at least `minAge`, if it
+  // scores below `fraction` of the median peer.
+  std::optional<PeerHandle> rotationCandidate(
+      Clock::duration minAge, double fraction,
+      Clock::time_point now = Clock::now()) const;
+
+  // Fast Extension hints. Duplicates are ignored.
+  void allowFast(PeerHandle peer, int pieceIndex);
+  void suggestPiece(PeerHandle peer, int pieceIndex);
+  const std::vector<int>& allowedFast(PeerHandle peer) const;
+  std::vector<int>& suggested(PeerHandle peer);
+
+  void removePeer(PeerHandle peer);
+
+ private:
+  // Indexed by peer handle.
+  std::vector<PeerEntry> peers_;
+
+  PeerEntry& entry(PeerHandle peer);
+  PeerEntry& entry(PeerHandle peer, Clock::time_point now);
+};
+
+#endif  // BITTORRENTCLIENT_PEERSTATS_H
@@ -0,0 +1,139 @@
+#include "core/PeerStats.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <optional>
+#include <vector>
+
+using std::chrono::milliseconds;
+
+constexpr PeerHandle kPeer = 3;
+
+TEST(PeerStats, UnknownPeerHasNoThroughput) {
+  PeerStats stats;
+  EXPECT_EQ(stats.throughput(kPeer), 0);
+}
+
+TEST(PeerStats, ThroughputAveragesOverWindow) {
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+
+  stats.blockReceived(kPeer, 16384, start);
+  stats.blockReceived(kPeer, 16384, start + milliseconds(500));
+  stats.blockReceived(kPeer, 16384, start + milliseconds(1000));
+
+  // 48 KiB received over one second.
+  EXPECT_DOUBLE_EQ(stats.throughput(kPeer, start + milliseconds(1000)),
+                   49152);
+}
+
+TEST(PeerStats, ThroughputDecaysWhenPeerStalls) {
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+
+  stats.blockReceived(kPeer, 16384, start);
+  stats.blockReceived(kPeer, 16384, start + milliseconds(1000));
+  double rate = stats.throughput(kPeer, start + milliseconds(1000));
+
+  EXPECT_LT(stats.throughput(kPeer, start + milliseconds(10000)), rate);
+}
+
+TEST(PeerStats, RemovePeerForgetsThroughput) {
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+
+  stats.blockReceived(kPeer, 16384, start);
+  stats.blockReceived(kPeer, 16384, start + milliseconds(1000));
+  stats.removePeer(kPeer);
+
+  EXPECT_EQ(stats.throughput(kPeer, start + milliseconds(1000)), 0);
+}
+
+TEST(PeerStats, RequestTimeoutFollowsServiceTime) {
+  PeerStats stats;
+  EXPECT_EQ(stats.requestTimeout(kPeer), RttEstimator::kInitialTimeout);
+
+  for (int i = 0; i < 10; i++) {
+    stats.requestServed(kPeer, milliseconds(100));
+  }
+  EXPECT_LT(stats.requestTimeout(kPeer), RttEstimator::kInitialTimeout);
+
+  stats.requestExpired(kPeer);
+  EXPECT_EQ(stats.requestTimeout(kPeer), 2 * RttEstimator::kMinTimeout);
+}
+
+TEST(PeerStats, KeepsFastExtensionHintsUntilPeerIsRemoved) {
+  PeerStats stats;
+  EXPECT_TRUE(stats.allowedFast(kPeer).empty());
+
+  stats.allowFast(kPeer, 4);
+  stats.allowFast(kPeer, 9);
+  stats.allowFast(kPeer, 4);
+  stats.suggestPiece(kPeer, 2);
+
+  EXPECT_EQ(stats.allowedFast(kPeer), (std::vector<int>{4, 9}));
+  EXPECT_EQ(stats.suggested(kPeer), (std::vector<int>{2}));
+
+  stats.removePeer(kPeer);
+  EXPECT_TRUE(stats.allowedFast(kPeer).empty());
+  EXPECT_TRUE(stats.suggested(kPeer).empty());
+}
+
+TEST(PeerStats, ChokeRatioCountsTheTimeSpentChoked) {
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+  EXPECT_EQ(stats.chokeRatio(kPeer, start), 0);
+
+  stats.peerChoked(kPeer, true, start);
+  stats.peerChoked(kPeer, false, start + milliseconds(3000));
+  EXPECT_DOUBLE_EQ(stats.chokeRatio(kPeer, start + milliseconds(4000)), 0.75);
+
+  stats.peerChoked(kPeer, true, start + milliseconds(6000));
+  EXPECT_DOUBLE_EQ(stats.chokeRatio(kPeer, start + milliseconds(8000)),
+                   0.625);
+}
+
+TEST(PeerStats, ScoreDiscountsChokingAndHashFailures) {
+  constexpr PeerHandle kOther = 5;
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+  for (PeerHandle peer : {kPeer, kOther}) {
+    stats.peerChoked(peer, false, start);
+    stats.blockReceived(peer, 16384, start);
+    stats.blockReceived(peer, 16384, start + milliseconds(1000));
+  }
+  const auto now = start + milliseconds(1000);
+  EXPECT_DOUBLE_EQ(stats.score(kPeer, now), stats.score(kOther, now));
+
+  stats.hashFailed(kOther);
+  EXPECT_DOUBLE_EQ(stats.score(kOther, now), stats.score(kPeer, now) / 2);
+
+  stats.peerChoked(kPeer, true, start);
+  EXPECT_EQ(stats.score(kPeer, now), 0);
+}
+
+TEST(PeerStats, RotatesOutTheWorstPeerWellBelowTheMedian) {
+  PeerStats stats;
+  auto start = PeerStats::Clock::now();
+  const auto deliver = [&stats, start](PeerHandle peer, size_t bytes) {
+    stats.blockReceived(peer, bytes, start);
+    stats.blockReceived(peer, bytes, start + milliseconds(1000));
+  };
+  deliver(0, 100000);
+  deliver(1, 90000);
+  deliver(2, 80000);
+  const auto now = start + milliseconds(1000);
+
+  // All of them are close to the median.
+  EXPECT_EQ(stats.rotationCandidate(milliseconds(0), 0.5, now), std::nullopt);
+
+  deliver(3, 1000);
+  EXPECT_EQ(stats.rotationCandidate(milliseconds(0), 0.5, now), 3);
+  // Too recent to judge.
+  EXPECT_EQ(stats.rotationCandidate(milliseconds(5000), 0.5, now),
+            std::nullopt);
+
+  stats.removePeer(3);
+  EXPECT_EQ(stats.rotationCandidate(milliseconds(0), 0.5, now), std::nullopt);
+}
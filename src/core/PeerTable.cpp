@@ -0,0 +1,50 @@
+#include "core/PeerTable.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+PeerHandle PeerTable::acquire(const std::string& peerId) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (handles_.contains(peerId)) {
+    return kNoPeer;
+  }
+
+  PeerHandle handle;
+  if (!freeHandles_.empty()) {
+    // Reuse the lowest free handle to keep the per-peer arrays short.
+    auto lowest = std::ranges::min_element(freeHandles_);
+    handle = *lowest;
+    *lowest = freeHandles_.back();
+    freeHandles_.pop_back();
+    peerIds_[handle] = peerId;
+    inUse_[handle] = true;
+  } else {
+    handle = static_cast<PeerHandle>(peerIds_.size());
+    peerIds_.push_back(peerId);
+    inUse_.push_back(true);
+  }
+  handles_.emplace(peerId, handle);
+  return handle;
+}
+
+void PeerTable::release(PeerHandle handle) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (handle >= peerIds_.size() || !inUse_[handle]) {
+    return;
+  }
+  inUse_[handle] = false;
+  handles_.erase(peerIds_[handle]);
+  peerIds_[handle].clear();
+  freeHandles_.push_back(handle);
+}
+
+std::string PeerTable::peerId(PeerHandle handle) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return handle < peerIds_.size() ? peerIds_[handle] : "";
+}
+
+size_t PeerTable::size() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return handles_.size();
+}
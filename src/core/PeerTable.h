@@ -0,0 +1,43 @@
+#ifndef BITTORRENTCLIENT_PEERTABLE_H
+#define BITTORRENTCLIENT_PEERTABLE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Small integer standing for a connected peer. Handles are dense, so
+// per-peer state can live in flat arrays indexed by them.
+using PeerHandle = uint32_t;
+constexpr PeerHandle kNoPeer = UINT32_MAX;
+
+/**
+ * Interns the 20-byte peer ids of connected peers into PeerHandles. A
+ * connection acquires a handle once the handshake tells it the peer id, and
+ * releases it after the peer's state has been dropped everywhere. A peer id
+ * holds at most one handle: the per-peer state is keyed by it, so a second
+ * connection to the same peer would share and then drop the state of the
+ * first. Released handles go to the next peer. Only acquire() and release()
+ * take the lock; the per-block path never touches the table.
+ */
+class PeerTable {
+ public:
+  // Returns a handle for the peer, or kNoPeer if it already holds one.
+  // Every handle returned must be released.
+  PeerHandle acquire(const std::string& peerId);
+  void release(PeerHandle handle);
+
+  // Empty if the handle is not in use.
+  std::string peerId(PeerHandle handle);
+  size_t size();
+
+ private:
+  std::mutex lock_;
+  std::unordered_map<std::string, PeerHandle> handles_;
+  std::vector<std::string> peerIds_;
+  std::vector<bool> inUse_;
+  std::vector<PeerHandle> freeHandles_;
+};
+
+#endif  // BITTORRENTCLIENT_PEERTABLE_H
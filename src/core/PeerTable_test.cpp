@@ -0,0 +1,48 @@
+#include "core/PeerTable.h"
+
+#include <gtest/gtest.h>
+
+TEST(PeerTableTest, AssignsDenseHandles) {
+  PeerTable table;
+
+  PeerHandle a = table.acquire("peer-a");
+  PeerHandle b = table.acquire("peer-b");
+
+  EXPECT_EQ(a, 0);
+  EXPECT_EQ(b, 1);
+  EXPECT_EQ(table.peerId(b), "peer-b");
+  EXPECT_EQ(table.size(), 2);
+
+  table.release(a);
+  EXPECT_EQ(table.peerId(a), "");
+  // Released twice, which must not free the handle of another peer.
+  table.release(a);
+  EXPECT_EQ(table.acquire("peer-c"), a);
+  EXPECT_EQ(table.acquire("peer-d"), 2);
+}
+
+TEST(PeerTableTest, RefusesPeersAlreadyConnected) {
+  PeerTable table;
+  PeerHandle a = table.acquire("peer-a");
+
+  EXPECT_EQ(table.acquire("peer-a"), kNoPeer);
+  EXPECT_EQ(table.size(), 1);
+
+  table.release(a);
+  EXPECT_EQ(table.acquire("peer-a"), a);
+}
+
+TEST(PeerTableTest, ReusesReleasedHandles) {
+  PeerTable table;
+  table.acquire("peer-a");
+  PeerHandle b = table.acquire("peer-b");
+  table.acquire("peer-c");
+
+  table.release(b);
+  EXPECT_EQ(table.peerId(b), "");
+  EXPECT_EQ(table.size(), 2);
+
+  EXPECT_EQ(table.acquire("peer-d"), b);
+  EXPECT_EQ(table.peerId(b), "peer-d");
+  EXPECT_EQ(table.acquire("peer-e"), 3);
+}
@@ -12,6 +12,7 @@
 #include <cmath>
 #include <cstdint>
 #include <ctime>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -26,28 +27,55 @@
 #include "utils/utils.h"
 
 #define BLOCK_SIZE 16384    // 2 ^ 14
-#define MAX_PENDING_TIME 5  // 5 sec
+// A peer may take over a block from another peer that is at least this many
+// times slower than itself.
+#define STEAL_SPEED_RATIO 2
+// A peer that can fetch a whole piece within this many seconds is given
+// pieces of its own in PickerMode::kPeerAffine.
+#define WHOLE_PIECE_TIME 10  // 10 sec
+// Once a time-critical piece is this close to its deadline, its outstanding
+// blocks are also requested from other peers.
+#define DEADLINE_URGENCY 2000  // 2 sec
 #define PROGRESS_BAR_WIDTH 40
 #define PROGRESS_DISPLAY_INTERVAL 1  // 1 sec
 
 PieceManager::PieceManager(const std::shared_ptr<TorrentFileParser>& fileParser,
                            const std::shared_ptr<PeerRegistry>& peerRegistry,
                            const std::shared_ptr<DiskManager>& diskManager,
+                           const std::shared_ptr<TimerService>& timerService,
                            const std::string& downloadPath,
                            const int maximumConnections)
     : pieceLength_(fileParser->getPieceLength().value()),
+      fileSize_(fileParser->getFileSize().value()),
       fileParser_(fileParser),
       peerRegistry_(peerRegistry),
       diskManager_(diskManager),
+      timerService_(timerService),
       maximumConnections_(maximumConnections) {
-  missingPieces_ = initiatePieces();
+  setClock(nullptr);
+  pieces_ = initiatePieces();
+  pieceTracker_ = PieceTracker(total_pieces_);
 
-  int64_t file_size = fileParser->getFileSize().value();
-  diskManager_->allocateFile(downloadPath, file_size);
+  diskManager_->allocateFile(downloadPath, fileSize_);
 
   startingTime_ = std::time(nullptr);
-  std::thread progress_thread([this] { this->trackProgress(); });
-  progress_thread.detach();
+  progressThread_ = std::thread([this] { trackProgress(); });
+}
+
+/**
+ * Timers that are already firing hold a reference to the manager, so once
+ * the last reference is gone none of them can still be running.
+ */
+PieceManager::~PieceManager() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+    for (const auto& pending : pendingRequests_) {
+      timerService_->cancel(pending->timer);
+    }
+  }
+  progressStopped_.notify_all();
+  progressThread_.join();
 }
 
 std::vector<std::unique_ptr<Piece>> PieceManager::initiatePieces() {
@@ -61,9 +89,9 @@ std::vector<std::unique_ptr<Piece>> PieceManager::initiatePieces() {
   auto piece_hashes_value = piece_hashes.value();
 
   total_pieces_ = piece_hashes_value.size();
-  missingPieces_.reserve(total_pieces_);
 
   std::vector<std::unique_ptr<Piece>> torrent_pieces;
+  torrent_pieces.reserve(total_pieces_);
 
   tl::expected<int64_t, TorrentFileParserError> total_length_result =
       fileParser_->getFileSize();
@@ -82,7 +110,7 @@ std::vector<std::unique_ptr<Piece>> PieceManager::initiatePieces() {
   for (size_t i = 0; i < total_pieces_; i++) {
     // The final piece is likely to have a smaller size.
     if (i == total_pieces_ - 1) {
-      rem_length = total_length % pieceLength_;
+      rem_length = total_length - static_cast<int64_t>(i) * pieceLength_;
       block_count = std::max(
           static_cast<int>(ceil(static_cast<double>(rem_length) / BLOCK_SIZE)),
           1);
@@ -97,13 +125,8 @@ std::vector<std::unique_ptr<Piece>> PieceManager::initiatePieces() {
       block->status = kMissing;
       block->offset = offset * BLOCK_SIZE;
 
-      int block_size = BLOCK_SIZE;
-
-      if (i == total_pieces_ - 1 && offset == block_count - 1) {
-        block_size = rem_length % BLOCK_SIZE;
-      }
-
-      block->length = block_size;
+      block->length = static_cast<int>(
+          std::min<int64_t>(BLOCK_SIZE, rem_length - block->offset));
       blocks.push_back(std::move(block));
     }
 
@@ -116,20 +139,7 @@ std::vector<std::unique_ptr<Piece>> PieceManager::initiatePieces() {
   return torrent_pieces;
 }
 
-bool PieceManager::isComplete() {
-  std::lock_guard<std::mutex> guard(lock_);
-
-  const size_t header = 4;
-  size_t current_size = havePieces.size();
-  return ((current_size + header) == total_pieces_);
-}
-
-/**
- * Updates the information about which pieces a peer has (i.e. reflects
- * a Have message).
- */
-
-std::vector<Piece*> PieceManager::getPieces() { return havePieces; }
+bool PieceManager::isComplete() const { return pieceTracker_.isComplete(); }
 
 /**
  * Retrieves the next block that should be requested from the given peer.
@@ -137,7 +147,7 @@ std::vector<Piece*> PieceManager::getPieces() { return havePieces; }
  * have any of the missing pieces, None is returned
  * @return pointer to the Block struct to be requested.
  */
-Block* PieceManager::nextRequest(const std::string peerId) {
+Block* PieceManager::nextRequest(const PeerHandle peer, bool choked) {
   // The algorithm implemented for which piece to retrieve is a simple
   // one. This should preferably be replaced with an implementation of
   // "rarest-piece-first" algorithm instead.
@@ -146,65 +156,151 @@ Block* PieceManager::nextRequest(const std::string peerId) {
   //
   // 1. Check any pending blocks to see if any request should be reissued
   // due to timeout
+  // 1b. Serve the time-critical pieces (streaming window), in order of
+  // deadline
   // 2. Check the ongoing pieces to get the next block to request
-  // 3. Check if this peer have any of the missing pieces not yet started
+  // 3. Take over a block that a much slower peer is holding, so that
+  // started pieces finish before new ones are opened
+  // 4. Check if this peer have any of the missing pieces not yet started,
+  // starting with the ones it suggested
+  // 5. In kPeerAffine mode, once no more pieces may be opened, help with
+  // any ongoing piece, whoever it is reserved for
 
   std::unique_lock<std::mutex> lock(lock_);
-  if (missingPieces_.empty()) {
+  if (pieceTracker_.isComplete()) {
     return nullptr;
   }
 
-  if (!peerRegistry_->hasPeer(peerId)) {
+  if (!peerRegistry_->hasPeer(peer)) {
     return nullptr;
   }
 
-  Block* block = expiredRequest(peerId);
+  if (choked) {
+    return nextAllowedFast(peer);
+  }
+
+  const bool affine = pickerMode_ == PickerMode::kPeerAffine;
+
+  Block* block = expiredRequest(peer);
+  if (!block) {
+    block = nextTimeCritical(peer);
+  }
+  if (!block) {
+    block = nextOngoing(peer, affine);
+  }
   if (!block) {
-    block = nextOngoing(peerId);
-    if (!block) {
-      block = getRarestPiece(peerId)->nextRequest();
+    block = stealBlock(peer);
+  }
+  if (!block && canOpenPiece()) {
+    Piece* piece = suggestedPiece(peer);
+    if (!piece) {
+      piece = getRarestPiece(peer);
     }
+    if (piece) {
+      if (affine && isFastPeer(peer)) {
+        pieceOwners_[piece->index] = peer;
+      }
+      block = piece->nextRequest();
+      trackRequest(block, peer);
+    }
+  }
+  if (!block && affine) {
+    block = nextOngoing(peer, false);
   }
 
   return block;
 }
 
 /**
- * Goes through previously requested blocks, if one has been in the
- * requested state for longer than `MAX_PENDING_TIME` returns the block to
- * be re-requested. If no pending blocks exist, None is returned
+ * Returns a block whose request has timed out and that the given peer can
+ * serve, so that it gets requested again. Timeouts are delivered by the
+ * TimerService, so only the requests that actually expired are looked at.
+ * If no such block exists, None is returned
  */
-Block* PieceManager::expiredRequest(std::string peerId) {
-  time_t current_time = std::time(nullptr);
-  for (const auto& pending : pendingRequests_) {
-    if (peerRegistry_->peerHasPiece(peerId, pending->block->piece)) {
-      // If the request has expired
-      auto diff = std::difftime(current_time, pending->timestamp);
-      if (diff >= MAX_PENDING_TIME) {
-        // Resets the timer for that request
-        pending->timestamp = current_time;
-        return pending->block;
+Block* PieceManager::expiredRequest(PeerHandle peer) {
+  for (auto it = expiredRequests_.begin(); it != expiredRequests_.end(); ++it) {
+    PendingRequest* pending = *it;
+    if (peerRegistry_->peerHasPiece(peer, pending->block->piece)) {
+      expiredRequests_.erase(it);
+      // The peer is gone when its requests were handed back by removePeer.
+      if (!pending->rejected && pending->peer != kNoPeer) {
+        peerStats_.requestExpired(pending->peer);
       }
+      return reissueRequest(pending, peer);
     }
   }
   return nullptr;
 }
 
+/**
+ * Called from the TimerService when a request has been pending for longer
+ * than the timeout of the peer it was sent to. With a timeout handler, the
+ * timeout is only applied once the handler hands it back.
+ */
+void PieceManager::timerFired(uint64_t serial) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (timeoutHandler_) {
+      timeoutHandler_(serial);
+      return;
+    }
+  }
+  requestTimedOut(serial);
+}
+
+void PieceManager::requestTimedOut(uint64_t serial) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = std::ranges::find_if(
+      pendingRequests_, [serial](const std::unique_ptr<PendingRequest>& p) {
+        return p->serial == serial;
+      });
+
+  // The block may have arrived while the timer was firing.
+  if (it == pendingRequests_.end() || (*it)->expired) {
+    return;
+  }
+
+  (*it)->expired = true;
+  expiredRequests_.push_back(it->get());
+}
+
+void PieceManager::armRequestTimer(PendingRequest* pending) {
+  pending->expired = false;
+  pending->rejected = false;
+  pending->timer = timerService_->schedule(
+      peerStats_.requestTimeout(pending->peer),
+      [manager = weak_from_this(), serial = pending->serial] {
+        if (auto self = manager.lock()) {
+          self->timerFired(serial);
+        }
+      });
+}
+
 /**
  * Iterates through the pieces that are currently being downloaded, and
  * returns the next Block to be requested or NULL if no Block is left to be
  * requested from the list of Pieces.
+ * With `affineOnly`, a fast peer only considers the pieces reserved for it,
+ * and a slow peer only the pieces that are not reserved for anyone.
  */
-Block* PieceManager::nextOngoing(std::string peerId) {
-  for (std::unique_ptr<Piece>& piece : ongoingPieces_) {
-    if (peerRegistry_->peerHasPiece(peerId, piece->index)) {
+Block* PieceManager::nextOngoing(PeerHandle peer, bool affineOnly) {
+  const bool fast = affineOnly && isFastPeer(peer);
+  for (int index : pieceTracker_.ongoing()) {
+    Piece* piece = pieces_[index].get();
+    if (affineOnly) {
+      auto owner = pieceOwners_.find(piece->index);
+      bool reserved_for_peer =
+          owner != pieceOwners_.end() && owner->second == peer;
+      bool shared = owner == pieceOwners_.end();
+      if (fast ? !reserved_for_peer : !shared) {
+        continue;
+      }
+    }
+
+    if (peerRegistry_->peerHasPiece(peer, piece->index)) {
       Block* block = piece->nextRequest();
       if (block) {
-        auto new_pending_request = std::make_unique<PendingRequest>();
-        new_pending_request->block = block;
-        new_pending_request->timestamp = std::time(nullptr);
-        pendingRequests_.push_back(std::move(new_pending_request));
-
+        trackRequest(block, peer);
         return block;
       }
     }
@@ -212,40 +308,219 @@ Block* PieceManager::nextOngoing(std::string peerId) {
   return nullptr;
 }
 
-Piece* PieceManager::getRarestPiece(const std::string& peerId) {
-  std::map<Piece*, int> piece_count;
+/**
+ * Looks for a block of an ongoing piece that is outstanding with a peer at
+ * least `STEAL_SPEED_RATIO` times slower than the given one, and hands it
+ * over. Without this, a slow peer holding the last blocks of a piece delays
+ * its completion (and its write to disk) long after every other peer is done.
+ * Peers whose speed is not known yet never take blocks from others.
+ */
+Block* PieceManager::stealBlock(PeerHandle peer) {
+  const auto now = clock_();
+  const double own_rate = peerStats_.throughput(peer, now);
+  if (own_rate <= 0) {
+    return nullptr;
+  }
 
-  for (auto& piece_ptr : missingPieces_) {
-    if (peerRegistry_->hasPeer(peerId)) {
-      if (peerRegistry_->peerHasPiece(peerId, piece_ptr->index)) {
-        piece_count[piece_ptr.get()] += 1;
-      }
+  PendingRequest* victim = nullptr;
+  double victim_rate = own_rate / STEAL_SPEED_RATIO;
+  for (const auto& pending : pendingRequests_) {
+    // Expired requests are handed out by expiredRequest instead.
+    if (pending->peer == peer || pending->expired) {
+      continue;
+    }
+
+    double holder_rate = peerStats_.throughput(pending->peer, now);
+    if (holder_rate > victim_rate) {
+      continue;
+    }
+
+    if (peerRegistry_->peerHasPiece(peer, pending->block->piece)) {
+      victim = pending.get();
+      victim_rate = holder_rate;
+    }
+  }
+
+  if (!victim) {
+    return nullptr;
+  }
+
+  return reissueRequest(victim, peer);
+}
+
+/**
+ * Requests an outstanding block again, this time from the given peer, and
+ * restarts its timer with that peer's timeout. The previous peer may still
+ * deliver the block; whichever copy arrives first is used and the other is
+ * dropped in blockReceived.
+ */
+Block* PieceManager::reissueRequest(PendingRequest* pending,
+                                    PeerHandle peer) {
+  timerService_->cancel(pending->timer);
+  if (pending->expired) {
+    std::erase(expiredRequests_, pending);
+  }
+  pending->peer = peer;
+  pending->timestamp = clock_();
+  pending->reissued = true;
+  armRequestTimer(pending);
+  return pending->block;
+}
+
+/**
+ * Returns a block of one of the pieces the peer allows us to request while
+ * it is choking us, starting the piece if needed. The set is small and
+ * chosen by the peer, so the piece limit of kPeerAffine does not apply.
+ */
+Block* PieceManager::nextAllowedFast(PeerHandle peer) {
+  for (int index : peerStats_.allowedFast(peer)) {
+    if (!peerRegistry_->peerHasPiece(peer, index)) {
+      continue;
+    }
+    Piece* piece = findOngoing(index);
+    if (!piece) {
+      piece = openPiece(index);
+    }
+    Block* block = piece ? piece->nextRequest() : nullptr;
+    if (block) {
+      trackRequest(block, peer);
+      return block;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Opens the first missing piece the peer suggested and has. Suggestions
+ * that are no longer missing are dropped along the way.
+ */
+Piece* PieceManager::suggestedPiece(PeerHandle peer) {
+  std::vector<int>& suggested = peerStats_.suggested(peer);
+  for (auto it = suggested.begin(); it != suggested.end();) {
+    if (!pieceTracker_.isMissing(*it)) {
+      it = suggested.erase(it);
+    } else if (peerRegistry_->peerHasPiece(peer, *it)) {
+      Piece* piece = openPiece(*it);
+      suggested.erase(it);
+      return piece;
+    } else {
+      ++it;
     }
   }
+  return nullptr;
+}
+
+/**
+ * Returns the next block of the time-critical pieces the peer has, earliest
+ * deadline first, starting those pieces if needed regardless of how rare
+ * they are. When every block of such a piece has already been requested and
+ * its deadline is less than `DEADLINE_URGENCY` ms away, the block that has
+ * been outstanding the longest is requested from this peer as well.
+ */
+Block* PieceManager::nextTimeCritical(PeerHandle peer) {
+  const auto now = clock_();
+  const auto urgency = std::chrono::milliseconds(DEADLINE_URGENCY);
+
+  for (auto it = pieceDeadlines_.begin(); it != pieceDeadlines_.end();) {
+    if (!peerRegistry_->peerHasPiece(peer, it->piece)) {
+      ++it;
+      continue;
+    }
+
+    Piece* piece = findOngoing(it->piece);
+    if (!piece) {
+      piece = openPiece(it->piece);
+    }
+    if (!piece) {
+      // Already downloaded.
+      it = pieceDeadlines_.erase(it);
+      continue;
+    }
 
-  // Find the piece with the least count
-  Piece* rarest = nullptr;
-  int least_count = INT_MAX;
-  for (auto const& [piece, count] : piece_count) {
-    if (count < least_count) {
-      least_count = count;
-      rarest = piece;
+    Block* block = piece->nextRequest();
+    if (block) {
+      trackRequest(block, peer);
+      return block;
     }
+
+    if (it->deadline - now <= urgency) {
+      PendingRequest* oldest = nullptr;
+      for (const auto& pending : pendingRequests_) {
+        if (pending->block->piece != it->piece || pending->peer == peer ||
+            pending->reissued) {
+          continue;
+        }
+        if (!oldest || pending->timestamp < oldest->timestamp) {
+          oldest = pending.get();
+        }
+      }
+      if (oldest) {
+        return reissueRequest(oldest, peer);
+      }
+    }
+    ++it;
   }
+  return nullptr;
+}
 
-  if (!rarest) return nullptr;  // no piece available
+/**
+ * A peer is fast when, at its current throughput, it can download a whole
+ * piece within `WHOLE_PIECE_TIME` seconds.
+ */
+bool PieceManager::isFastPeer(PeerHandle peer) const {
+  return peerStats_.throughput(peer, clock_()) * WHOLE_PIECE_TIME >=
+         static_cast<double>(pieceLength_);
+}
 
-  // Move the rarest piece from missingPieces_ to ongoingPieces_
-  auto it = std::find_if(
-      missingPieces_.begin(), missingPieces_.end(),
-      [rarest](const std::unique_ptr<Piece>& p) { return p.get() == rarest; });
+bool PieceManager::canOpenPiece() const {
+  return pickerMode_ != PickerMode::kPeerAffine ||
+         pieceTracker_.ongoing().size() < maxOpenPieces_;
+}
 
-  if (it != missingPieces_.end()) {
-    ongoingPieces_.push_back(std::move(*it));
-    missingPieces_.erase(it);
+void PieceManager::trackRequest(Block* block, PeerHandle peer) {
+  if (!block) {
+    return;
   }
 
-  return rarest;
+  auto new_pending_request = std::make_unique<PendingRequest>();
+  new_pending_request->block = block;
+  new_pending_request->timestamp = clock_();
+  new_pending_request->peer = peer;
+  new_pending_request->serial = nextRequestSerial_++;
+  armRequestTimer(new_pending_request.get());
+  pendingRequests_.push_back(std::move(new_pending_request));
+}
+
+/**
+ * Opens the missing piece that the fewest connected peers have, among those
+ * the given peer can serve.
+ */
+Piece* PieceManager::getRarestPiece(PeerHandle peer) {
+  int rarest = peerRegistry_->rarestPieceIn(peer, pieceTracker_.missing());
+  if (rarest < 0) return nullptr;  // no piece available
+
+  return openPiece(rarest);
+}
+
+Piece* PieceManager::findOngoing(int pieceIndex) {
+  if (pieceIndex < 0 || pieceIndex >= static_cast<int>(total_pieces_) ||
+      !pieceTracker_.isOngoing(pieceIndex)) {
+    return nullptr;
+  }
+  return pieces_[pieceIndex].get();
+}
+
+/**
+ * Marks a missing piece as ongoing. Returns nullptr if the piece is not
+ * missing.
+ */
+Piece* PieceManager::openPiece(int pieceIndex) {
+  if (pieceIndex < 0 || pieceIndex >= static_cast<int>(total_pieces_) ||
+      !pieceTracker_.isMissing(pieceIndex)) {
+    return nullptr;
+  }
+  pieceTracker_.markOngoing(pieceIndex);
+  return pieces_[pieceIndex].get();
 }
 
 /**
@@ -258,12 +533,16 @@ Piece* PieceManager::getRarestPiece(const std::string& peerId) {
  */
 
 tl::expected<void, PieceManagerError> PieceManager::blockReceived(
-    int pieceIndex, int blockOffset, const std::string& data) {
+    PeerHandle peer, int pieceIndex, int blockOffset,
+    const std::string& data) {
   Piece* target_piece = nullptr;
 
   {
     std::unique_lock<std::mutex> lock(lock_);
 
+    const auto now = clock_();
+    peerStats_.blockReceived(peer, data.size(), now);
+
     // Remove the received block from pending requests
     auto it = std::ranges::find_if(
         pendingRequests_, [&](const std::unique_ptr<PendingRequest>& p) {
@@ -272,31 +551,57 @@ tl::expected<void, PieceManagerError> PieceManager::blockReceived(
         });
 
     if (it != pendingRequests_.end()) {
+      const PendingRequest& pending = **it;
+      if (!pending.reissued && pending.peer == peer) {
+        peerStats_.requestServed(
+            peer, std::chrono::duration_cast<RttEstimator::Duration>(
+                        now - pending.timestamp));
+      }
+      timerService_->cancel(pending.timer);
+      if (pending.expired) {
+        std::erase(expiredRequests_, it->get());
+      }
       pendingRequests_.erase(it);
     }
 
     // Find target piece
-    for (auto& piece : ongoingPieces_) {
-      if (piece->index == pieceIndex) {
-        target_piece = piece.get();
-        break;
-      }
+    target_piece = findOngoing(pieceIndex);
+    if (!target_piece) {
+      return tl::unexpected(PieceManagerError{
+          "Received block for a piece that is not being downloaded."});
     }
-  }
 
-  if (!target_piece) {
-    return tl::unexpected(PieceManagerError{
-        "Received block for a piece that is not being downloaded."});
-  }
+    // A block requested from several peers (stolen, reissued or
+    // time-critical) is kept from whichever copy arrived first.
+    auto block = std::ranges::find(target_piece->blocks, blockOffset,
+                                   [](const auto& b) { return b->offset; });
+    if (block != target_piece->blocks.end() &&
+        (*block)->status == kRetrieved) {
+      return {};
+    }
+    if (!target_piece->blockReceived(blockOffset, data)) {
+      return tl::unexpected(
+          PieceManagerError{"Received block that is not part of the piece."});
+    }
 
-  target_piece->blockReceived(blockOffset, std::move(data));
+    std::vector<PeerHandle>& contributors = pieceContributors_[pieceIndex];
+    if (std::ranges::find(contributors, peer) == contributors.end()) {
+      contributors.push_back(peer);
+    }
 
-  if (!target_piece->isComplete()) {
-    return {};
+    // Only the block that completes the piece goes on to check and write it.
+    if (!target_piece->isComplete()) {
+      return {};
+    }
   }
 
   if (!target_piece->isHashMatching()) {
+    std::lock_guard<std::mutex> guard(lock_);
     target_piece->reset();
+    for (PeerHandle contributor : pieceContributors_[target_piece->index]) {
+      peerStats_.hashFailed(contributor);
+    }
+    pieceContributors_.erase(target_piece->index);
     return {};
   }
 
@@ -304,40 +609,230 @@ tl::expected<void, PieceManagerError> PieceManager::blockReceived(
 
   {
     std::unique_lock<std::mutex> lock(lock_);
-    auto it = std::find_if(ongoingPieces_.begin(), ongoingPieces_.end(),
-                           [target_piece](const std::unique_ptr<Piece>& p) {
-                             return p.get() == target_piece;
-                           });
+    pieceTracker_.markHave(target_piece->index);
+    pieceContributors_.erase(target_piece->index);
+    pieceOwners_.erase(target_piece->index);
+    std::erase_if(pieceDeadlines_, [target_piece](const PieceDeadline& d) {
+      return d.piece == target_piece->index;
+    });
+
+    piecesDownloadedInInterval_++;
+  }
+  pieceWritten_.notify_all();
+
+  return {};
+}
+
+/**
+ * Forgets the statistics kept for a peer once its connection is closed.
+ * Blocks still outstanding with that peer become free for others to take
+ * right away, and no longer refer to its handle, which may go to another
+ * peer that must not be charged for them.
+ */
+void PieceManager::removePeer(PeerHandle peer) {
+  std::lock_guard<std::mutex> guard(lock_);
+  peerStats_.removePeer(peer);
 
-    if (it != ongoingPieces_.end()) {
-      ongoingPieces_.erase(it);
+  for (const auto& pending : pendingRequests_) {
+    if (pending->peer != peer) {
+      continue;
     }
+    timerService_->cancel(pending->timer);
+    pending->peer = kNoPeer;
+    if (!pending->expired) {
+      pending->expired = true;
+      expiredRequests_.push_back(pending.get());
+    }
+  }
 
-    havePieces.push_back(target_piece);
-    piecesDownloadedInInterval_++;
+  // Pieces reserved for the peer are opened up to everyone else.
+  std::erase_if(pieceOwners_,
+                [&](const auto& owner) { return owner.second == peer; });
+  // The handle may go to another peer, which must not be blamed for the
+  // pieces of this one.
+  for (auto& [index, contributors] : pieceContributors_) {
+    std::erase(contributors, peer);
   }
+}
 
-  std::stringstream info;
-  info << "(" << std::fixed << std::setprecision(2)
-       << (static_cast<float>(havePieces.size()) /
-           static_cast<float>(total_pieces_) * 100)
-       << "%) ";
-  info << havePieces.size() << " / " << total_pieces_
-       << " Pieces downloaded...";
+/**
+ * Called when a peer rejects one of our requests. Rather than waiting for
+ * the request to time out, the block is made available to be requested
+ * again right away. Rejections for blocks that have since been handed to
+ * another peer are ignored.
+ */
+void PieceManager::requestRejected(PeerHandle peer, int pieceIndex,
+                                   int blockOffset) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = std::ranges::find_if(
+      pendingRequests_, [&](const std::unique_ptr<PendingRequest>& p) {
+        return p->block->piece == pieceIndex &&
+               p->block->offset == blockOffset;
+      });
+  if (it == pendingRequests_.end() || (*it)->peer != peer ||
+      (*it)->expired) {
+    return;
+  }
 
-  return {};
+  timerService_->cancel((*it)->timer);
+  (*it)->expired = true;
+  (*it)->rejected = true;
+  expiredRequests_.push_back(it->get());
+}
+
+void PieceManager::peerChoked(PeerHandle peer, bool choked) {
+  std::lock_guard<std::mutex> guard(lock_);
+  peerStats_.peerChoked(peer, choked, clock_());
+}
+
+std::optional<PeerHandle> PieceManager::rotationCandidate(
+    std::chrono::steady_clock::duration minAge, double fraction) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return peerStats_.rotationCandidate(minAge, fraction);
+}
+
+void PieceManager::allowFast(PeerHandle peer, int pieceIndex) {
+  if (pieceIndex < 0 || pieceIndex >= static_cast<int>(total_pieces_)) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  peerStats_.allowFast(peer, pieceIndex);
+}
+
+void PieceManager::suggestPiece(PeerHandle peer, int pieceIndex) {
+  if (pieceIndex < 0 || pieceIndex >= static_cast<int>(total_pieces_)) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  peerStats_.suggestPiece(peer, pieceIndex);
 }
 
 /**
- * Calculates the number of bytes downloaded.
+ * Sets where request timestamps, deadline checks and peer statistics take
+ * the current time from; null restores the steady clock.
  */
-uint64_t PieceManager::bytesDownloaded() {
-  uint64_t bytes_downloaded = 0;
-  {
-    std::unique_lock<std::mutex> lock(lock_);
-    bytes_downloaded = havePieces.size() * pieceLength_;
+void PieceManager::setClock(
+    std::function<std::chrono::steady_clock::time_point()> clock) {
+  std::lock_guard<std::mutex> guard(lock_);
+  clock_ = clock ? std::move(clock) : [] {
+    return std::chrono::steady_clock::now();
+  };
+}
+
+/**
+ * Hands request timeouts to `handler`, called on the timer thread, instead
+ * of applying them there; the handler passes them on to requestTimedOut().
+ * Null applies them on the timer thread again.
+ */
+void PieceManager::setTimeoutHandler(
+    std::function<void(uint64_t serial)> handler) {
+  std::lock_guard<std::mutex> guard(lock_);
+  timeoutHandler_ = std::move(handler);
+}
+
+/**
+ * Selects how blocks of ongoing pieces are distributed among peers. In
+ * kPeerAffine mode at most `maxOpenPieces` pieces are downloaded at once
+ * (at least one), which bounds the memory pinned by partial pieces and
+ * makes pieces complete, and get written, closer to request order.
+ */
+void PieceManager::setPickerMode(PickerMode mode, size_t maxOpenPieces) {
+  std::lock_guard<std::mutex> guard(lock_);
+  pickerMode_ = mode;
+  maxOpenPieces_ = std::max<size_t>(maxOpenPieces, 1);
+  if (mode == PickerMode::kShared) {
+    pieceOwners_.clear();
+  }
+}
+
+/**
+ * Marks a piece as time-critical: it is downloaded ahead of rarest-first,
+ * ordered by deadline, and may be requested from several peers as the
+ * deadline approaches. Setting a new deadline replaces the previous one.
+ */
+void PieceManager::setPieceDeadline(
+    int pieceIndex, std::chrono::steady_clock::time_point deadline) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (isWritten(pieceIndex)) {
+    return;
+  }
+
+  std::erase_if(pieceDeadlines_, [pieceIndex](const PieceDeadline& d) {
+    return d.piece == pieceIndex;
+  });
+
+  auto position = std::ranges::upper_bound(
+      pieceDeadlines_, deadline, {}, &PieceDeadline::deadline);
+  pieceDeadlines_.insert(position, PieceDeadline{pieceIndex, deadline});
+}
+
+/**
+ * Sets the playback position for streaming: the `windowPieces` pieces from
+ * `pieceIndex` on become time-critical, each one due `pieceInterval` after
+ * the previous one. Deadlines outside of the window are dropped, so those
+ * pieces go back to rarest-first.
+ */
+void PieceManager::setStreamingWindow(int pieceIndex, int windowPieces,
+                                      std::chrono::milliseconds pieceInterval) {
+  std::lock_guard<std::mutex> guard(lock_);
+  pieceDeadlines_.clear();
+
+  const auto now = clock_();
+  for (int i = 0; i < windowPieces; i++) {
+    if (pieceIndex + i >= static_cast<int>(total_pieces_)) {
+      break;
+    }
+    pieceDeadlines_.push_back(
+        PieceDeadline{pieceIndex + i, now + (i + 1) * pieceInterval});
   }
-  return bytes_downloaded;
+}
+
+void PieceManager::clearPieceDeadlines() {
+  std::lock_guard<std::mutex> guard(lock_);
+  pieceDeadlines_.clear();
+}
+
+/**
+ * Blocks until the given piece has been verified and written to disk, or
+ * until `timeout` has elapsed. Returns whether the piece is available.
+ */
+bool PieceManager::waitForPiece(int pieceIndex,
+                                std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(lock_);
+  return pieceWritten_.wait_for(
+      lock, timeout, [this, pieceIndex] { return isWritten(pieceIndex); });
+}
+
+bool PieceManager::isWritten(int pieceIndex) const {
+  return pieceIndex >= 0 && pieceIndex < static_cast<int>(total_pieces_) &&
+         pieceTracker_.hasPiece(pieceIndex);
+}
+
+/**
+ * Calculates the number of bytes downloaded. The last piece is usually
+ * shorter than the others.
+ */
+/**
+ * Called from the announce thread, so the pieces we have are read under
+ * the lock. The last piece may be shorter than the others.
+ */
+uint64_t PieceManager::bytesDownloaded() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  int64_t bytes =
+      static_cast<int64_t>(pieceTracker_.haveCount()) * pieceLength_;
+  if (total_pieces_ > 0 && pieceTracker_.hasPiece(total_pieces_ - 1)) {
+    bytes -= static_cast<int64_t>(total_pieces_) * pieceLength_ - fileSize_;
+  }
+  return std::clamp<int64_t>(bytes, 0, fileSize_);
+}
+
+uint64_t PieceManager::bytesLeft() const {
+  return fileSize_ - bytesDownloaded();
+}
+
+void PieceManager::copyBitfield(std::string& out) {
+  std::lock_guard<std::mutex> guard(lock_);
+  out.assign(pieceTracker_.bitfield());
 }
 
 /**
@@ -346,12 +841,16 @@ uint64_t PieceManager::bytesDownloaded() {
  * in the form of a progress bar.
  */
 void PieceManager::trackProgress() {
-  usleep(pow(10, 6));
-  while (!isComplete()) {
+  const auto interval = std::chrono::seconds(PROGRESS_DISPLAY_INTERVAL);
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!progressStopped_.wait_for(lock, interval,
+                                    [this] { return stopping_; }) &&
+         !pieceTracker_.isComplete()) {
+    lock.unlock();
     displayProgressBar();
+    lock.lock();
     // Resets the number of pieces downloaded to 0
     piecesDownloadedInInterval_ = 0;
-    usleep(PROGRESS_DISPLAY_INTERVAL * pow(10, 6));
   }
 }
 
@@ -362,7 +861,7 @@ void PieceManager::trackProgress() {
 void PieceManager::displayProgressBar() {
   std::stringstream info;
   lock_.lock();
-  uint64_t downloaded_pieces = havePieces.size();
+  uint64_t downloaded_pieces = pieceTracker_.haveCount();
   uint64_t downloaded_length = pieceLength_ * piecesDownloadedInInterval_;
 
   // Calculates the average download speed in the last
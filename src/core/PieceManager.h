@@ -2,51 +2,137 @@
 #ifndef BITTORRENTCLIENT_PIECEMANAGER_H
 #define BITTORRENTCLIENT_PIECEMANAGER_H
 
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <ctime>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "core/PeerRegistry.h"
+#include "core/PeerStats.h"
+#include "core/PeerTable.h"
 #include "core/Piece.h"
+#include "core/PieceTracker.h"
 #include "infra/DiskManager.h"
+#include "infra/TimerService.h"
 #include "utils/TorrentFileParser.h"
 
 struct PendingRequest {
   Block* block;
-  time_t timestamp;
+  std::chrono::steady_clock::time_point timestamp;
+  // Peer the block was last requested from.
+  PeerHandle peer = kNoPeer;
+  // Set once the block has been requested again, so that the time it takes
+  // to arrive no longer measures a single request (Karn's algorithm).
+  bool reissued = false;
+  // Identifies the request to its timeout callback.
+  uint64_t serial = 0;
+  TimerId timer = 0;
+  bool expired = false;
+  // Set when the peer explicitly rejected the request, which says nothing
+  // about its latency.
+  bool rejected = false;
 };
 
 struct PieceManagerError {
   std::string message;
 };
 
-class PieceManager {
+/**
+ * How blocks of started pieces are handed out to peers.
+ * - kShared: any peer may take the next block of any ongoing piece.
+ * - kPeerAffine: fast peers get whole pieces to themselves, slow peers share
+ *   the remaining ones, and the number of open pieces is bounded.
+ */
+enum class PickerMode { kShared, kPeerAffine };
+
+/**
+ * A time-critical piece: it is picked ahead of rarest-first, in order of
+ * deadline, and its blocks may be requested from several peers when the
+ * deadline is close.
+ */
+struct PieceDeadline {
+  int piece;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+/**
+ * Must be owned by a std::shared_ptr, which request timers keep a weak
+ * reference to.
+ */
+class PieceManager : public std::enable_shared_from_this<PieceManager> {
  private:
-  std::vector<std::unique_ptr<Piece>> missingPieces_;
-  std::vector<std::unique_ptr<Piece>> ongoingPieces_;
+  // Every piece of the torrent, indexed by piece index.
+  std::vector<std::unique_ptr<Piece>> pieces_;
+  PieceTracker pieceTracker_;
   std::vector<std::unique_ptr<PendingRequest>> pendingRequests_;
+  // Pending requests whose timeout has fired, waiting to be reissued.
+  std::vector<PendingRequest*> expiredRequests_;
+  uint64_t nextRequestSerial_ = 0;
 
   const int64_t pieceLength_;
+  const int64_t fileSize_;
 
   size_t total_pieces_{};
 
   std::shared_ptr<TorrentFileParser> fileParser_;
   std::shared_ptr<PeerRegistry> peerRegistry_;
   std::shared_ptr<DiskManager> diskManager_;
+  std::shared_ptr<TimerService> timerService_;
+
+  PeerStats peerStats_;
 
   const int maximumConnections_;
+
+  PickerMode pickerMode_ = PickerMode::kShared;
+  size_t maxOpenPieces_ = 0;
+  // Piece index -> fast peer the piece is reserved for (kPeerAffine only).
+  std::unordered_map<int, PeerHandle> pieceOwners_;
+  // Piece index -> peers that sent blocks of the piece, blamed if it fails
+  // the hash check.
+  std::unordered_map<int, std::vector<PeerHandle>> pieceContributors_;
+  // Time-critical pieces, sorted by deadline.
+  std::vector<PieceDeadline> pieceDeadlines_;
   int piecesDownloadedInInterval_ = 0;
   time_t startingTime_;
 
+  std::function<std::chrono::steady_clock::time_point()> clock_;
+  std::function<void(uint64_t serial)> timeoutHandler_;
+
   // Uses a lock to prevent race condition
-  std::mutex lock_;
+  mutable std::mutex lock_;
+  // Signalled whenever a piece has been verified and written to disk.
+  std::condition_variable pieceWritten_;
+  // Set by the destructor to end the progress thread.
+  bool stopping_ = false;
+  std::condition_variable progressStopped_;
+  std::thread progressThread_;
 
   std::vector<std::unique_ptr<Piece>> initiatePieces();
 
-  Block* expiredRequest(std::string peerId);
-  Block* nextOngoing(std::string peerId);
-  Piece* getRarestPiece(const std::string& peerId);
+  Block* expiredRequest(PeerHandle peer);
+  Block* nextOngoing(PeerHandle peer, bool affineOnly);
+  Block* nextTimeCritical(PeerHandle peer);
+  Block* stealBlock(PeerHandle peer);
+  Block* nextAllowedFast(PeerHandle peer);
+  Piece* suggestedPiece(PeerHandle peer);
+  Block* reissueRequest(PendingRequest* pending, PeerHandle peer);
+  Piece* getRarestPiece(PeerHandle peer);
+  Piece* findOngoing(int pieceIndex);
+  Piece* openPiece(int pieceIndex);
+  bool isWritten(int pieceIndex) const;
+  void trackRequest(Block* block, PeerHandle peer);
+  void armRequestTimer(PendingRequest* pending);
+  void timerFired(uint64_t serial);
+  bool isFastPeer(PeerHandle peer) const;
+  bool canOpenPiece() const;
 
   void write(Piece* piece);
   void displayProgressBar();
@@ -56,18 +142,50 @@ class PieceManager {
   explicit PieceManager(const std::shared_ptr<TorrentFileParser>& fileParser,
                         const std::shared_ptr<PeerRegistry>& peerRegistry,
                         const std::shared_ptr<DiskManager>& diskManager,
+                        const std::shared_ptr<TimerService>& timerService,
                         const std::string& downloadPath,
                         int maximumConnections);
-  ~PieceManager() = default;
-  bool isComplete();
-  tl::expected<void, PieceManagerError> blockReceived(int pieceIndex,
-                                                      int blockOffset,
-                                                      const std::string& data);
-
-  std::vector<Piece*> getPieces();
-  uint64_t bytesDownloaded();
-  Block* nextRequest(std::string peerId);
-  std::vector<Piece*> havePieces;
+  ~PieceManager();
+  bool isComplete() const;
+  tl::expected<void, PieceManagerError> blockReceived(
+      PeerHandle peer, int pieceIndex, int blockOffset,
+      const std::string& data);
+  void removePeer(PeerHandle peer);
+
+  // Fast Extension (BEP 6).
+  void requestRejected(PeerHandle peer, int pieceIndex, int blockOffset);
+  void allowFast(PeerHandle peer, int pieceIndex);
+  void suggestPiece(PeerHandle peer, int pieceIndex);
+
+  // Peer scoring, see PeerStats.
+  void peerChoked(PeerHandle peer, bool choked);
+  std::optional<PeerHandle> rotationCandidate(
+      std::chrono::steady_clock::duration minAge, double fraction);
+
+  void setPickerMode(PickerMode mode, size_t maxOpenPieces = 0);
+
+  // Lets the PieceScheduler drive the manager from its event stream alone:
+  // the time it sees and when requests time out.
+  void setClock(std::function<std::chrono::steady_clock::time_point()> clock);
+  void setTimeoutHandler(std::function<void(uint64_t serial)> handler);
+  void requestTimedOut(uint64_t serial);
+
+  // Streaming support: time-critical pieces take priority over rarest-first.
+  void setPieceDeadline(int pieceIndex,
+                        std::chrono::steady_clock::time_point deadline);
+  void setStreamingWindow(int pieceIndex, int windowPieces,
+                          std::chrono::milliseconds pieceInterval);
+  void clearPieceDeadlines();
+  bool waitForPiece(int pieceIndex, std::chrono::milliseconds timeout);
+  int64_t pieceLength() const { return pieceLength_; }
+  size_t pieceCount() const { return total_pieces_; }
+
+  uint64_t bytesDownloaded() const;
+  uint64_t bytesLeft() const;
+  // Copies the bitfield of the pieces we have, in wire format, into `out`.
+  void copyBitfield(std::string& out);
+  // While choked, only blocks of the peer's allowed-fast pieces are given.
+  Block* nextRequest(PeerHandle peer, bool choked = false);
 };
 
 #endif  // BITTORRENTCLIENT_PIECEMANAGER_H
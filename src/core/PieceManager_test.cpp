@@ -2,14 +2,263 @@
 
 #include <gtest/gtest.h>
 
-TEST(PieceManagerTest, splitPieceHashes) {
-  std::string download_path = "./piece";
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
 
-  // PieceManager pieceManager(torrentFileParser, downloadPath, 1);
-  //
-  // int result = 2516;
+#include "utils/utils.h"
 
-  // EXPECT_EQ(output.has_value(), true);
-  // EXPECT_EQ(output.value().size(), result);
-  EXPECT_EQ(1, 1);
+using std::chrono::milliseconds;
+
+namespace {
+constexpr int kBlockSize = 16384;
+constexpr int kPieceLength = 2 * kBlockSize;
+constexpr int kPieces = 4;
+
+std::string pieceData(int index) {
+  return std::string(kPieceLength, static_cast<char>('a' + index));
+}
+
+/**
+ * A PieceManager downloading a torrent of `kPieces` pieces of two blocks
+ * each into the temporary directory.
+ */
+class Download {
+ public:
+  Download() {
+    const auto directory = std::filesystem::temp_directory_path();
+    torrentPath_ = (directory / "piece_manager.torrent").string();
+    downloadPath_ = (directory / "piece_manager.bin").string();
+
+    std::string hashes;
+    for (int i = 0; i < kPieces; i++) {
+      hashes += utils::hexDecode(utils::sha1(pieceData(i)));
+    }
+    {
+      std::ofstream file(torrentPath_, std::ios::binary);
+      file << "d8:announce13:http://a/annc4:infod6:lengthi"
+           << kPieces * kPieceLength
+           << "e4:name13:piece_manager12:piece lengthi" << kPieceLength
+           << "e6:pieces" << hashes.size() << ":" << hashes << "ee";
+    }
+
+    registry = std::make_shared<PeerRegistry>(kPieces);
+    manager = std::make_shared<PieceManager>(
+        std::make_shared<TorrentFileParser>(torrentPath_), registry,
+        std::make_shared<DiskManager>(), std::make_shared<TimerService>(),
+        downloadPath_, 8);
+  }
+
+  ~Download() {
+    manager.reset();
+    std::filesystem::remove(torrentPath_);
+    std::filesystem::remove(downloadPath_);
+  }
+
+  tl::expected<void, PieceManagerError> deliver(PeerHandle peer,
+                                                const Block* block) {
+    return manager->blockReceived(
+        peer, block->piece, block->offset,
+        pieceData(block->piece).substr(block->offset, block->length));
+  }
+
+  // Requests every block of the next piece from the peer and delivers them.
+  void fetchPiece(PeerHandle peer) {
+    const Block* first = manager->nextRequest(peer);
+    const Block* second = manager->nextRequest(peer);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    ASSERT_EQ(first->piece, second->piece);
+    ASSERT_TRUE(deliver(peer, first).has_value());
+    ASSERT_TRUE(deliver(peer, second).has_value());
+  }
+
+  std::shared_ptr<PeerRegistry> registry;
+  std::shared_ptr<PieceManager> manager;
+
+ private:
+  std::string torrentPath_;
+  std::string downloadPath_;
+};
+}  // namespace
+
+TEST(PieceManager, FasterPeerStealsBlocksOfSlowerPeers) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+  download.fetchPiece(1);
+
+  const Block* slow = download.manager->nextRequest(0);
+  ASSERT_NE(slow, nullptr);
+  std::this_thread::sleep_for(milliseconds(20));
+  const Block* rest = download.manager->nextRequest(1);
+  ASSERT_NE(rest, nullptr);
+  EXPECT_EQ(rest->piece, slow->piece);
+
+  // Nothing is left of the piece but the block peer 0 holds.
+  EXPECT_EQ(download.manager->nextRequest(1), slow);
+  // Peer 0 has no measured speed, so it starts a new piece instead.
+  const Block* fresh = download.manager->nextRequest(0);
+  ASSERT_NE(fresh, nullptr);
+  EXPECT_NE(fresh->piece, slow->piece);
+}
+
+TEST(PieceManager, KeepsTheFirstCopyOfAStolenBlock) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+  download.fetchPiece(1);
+
+  const Block* slow = download.manager->nextRequest(0);
+  std::this_thread::sleep_for(milliseconds(20));
+  const Block* rest = download.manager->nextRequest(1);
+  ASSERT_EQ(download.manager->nextRequest(1), slow);
+
+  ASSERT_TRUE(download.deliver(1, slow).has_value());
+  // The late copy from the slow peer must not overwrite the block.
+  EXPECT_TRUE(download.manager
+                  ->blockReceived(0, slow->piece, slow->offset,
+                                  std::string(slow->length, 'x'))
+                  .has_value());
+  ASSERT_TRUE(download.deliver(1, rest).has_value());
+
+  EXPECT_EQ(download.manager->bytesDownloaded(), 2 * kPieceLength);
+}
+
+TEST(PieceManager, PeerAffineModeReservesPiecesForFastPeers) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+  download.fetchPiece(1);
+  download.manager->setPickerMode(PickerMode::kPeerAffine, 2);
+
+  const Block* fast = download.manager->nextRequest(1);
+  ASSERT_NE(fast, nullptr);
+  // The slow peer leaves the piece reserved for the fast one alone.
+  const Block* slow = download.manager->nextRequest(0);
+  ASSERT_NE(slow, nullptr);
+  EXPECT_NE(slow->piece, fast->piece);
+
+  const Block* fast_rest = download.manager->nextRequest(1);
+  ASSERT_NE(fast_rest, nullptr);
+  EXPECT_EQ(fast_rest->piece, fast->piece);
+  const Block* slow_rest = download.manager->nextRequest(0);
+  ASSERT_NE(slow_rest, nullptr);
+  EXPECT_EQ(slow_rest->piece, slow->piece);
+
+  // Two pieces are open, which is the limit.
+  EXPECT_EQ(download.manager->nextRequest(0), nullptr);
+}
+
+TEST(PieceManager, TimeCriticalPiecesComeFirstByDeadline) {
+  Download download;
+  download.registry->addSeed(0);
+  const auto now = std::chrono::steady_clock::now();
+  download.manager->setPieceDeadline(3, now + std::chrono::seconds(60));
+  download.manager->setPieceDeadline(2, now + std::chrono::seconds(30));
+
+  for (int piece : {2, 2, 3, 3, 0}) {
+    const Block* block = download.manager->nextRequest(0);
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(block->piece, piece);
+  }
+}
+
+TEST(PieceManager, UrgentBlocksAreRequestedFromAnotherPeer) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+  download.manager->setPieceDeadline(
+      3, std::chrono::steady_clock::now() + std::chrono::seconds(1));
+
+  const Block* first = download.manager->nextRequest(0);
+  const Block* second = download.manager->nextRequest(0);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(first->piece, 3);
+  EXPECT_EQ(second->piece, 3);
+
+  // The oldest outstanding block first, and each of them only once.
+  EXPECT_EQ(download.manager->nextRequest(1), first);
+  EXPECT_EQ(download.manager->nextRequest(1), second);
+  const Block* other = download.manager->nextRequest(1);
+  ASSERT_NE(other, nullptr);
+  EXPECT_NE(other->piece, 3);
+}
+
+TEST(PieceManager, StreamingWindowFollowsTheManagerClock) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+  const auto now = std::chrono::steady_clock::now() + std::chrono::hours(1);
+  download.manager->setClock([now] { return now; });
+  download.manager->setStreamingWindow(2, 1, std::chrono::seconds(60));
+
+  for (int i = 0; i < 2; i++) {
+    const Block* block = download.manager->nextRequest(0);
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(block->piece, 2);
+  }
+  // A minute away from its deadline, the piece is not urgent yet.
+  const Block* other = download.manager->nextRequest(1);
+  ASSERT_NE(other, nullptr);
+  EXPECT_NE(other->piece, 2);
+}
+
+TEST(PieceManager, RejectedBlockIsRequestedAgainRightAway) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+
+  const Block* block = download.manager->nextRequest(0);
+  ASSERT_NE(block, nullptr);
+  // Only the peer the block was requested from can reject it.
+  download.manager->requestRejected(1, block->piece, block->offset);
+  const Block* next = download.manager->nextRequest(1);
+  ASSERT_NE(next, nullptr);
+  EXPECT_NE(next, block);
+
+  download.manager->requestRejected(0, block->piece, block->offset);
+  EXPECT_EQ(download.manager->nextRequest(1), block);
+}
+
+TEST(PieceManager, ChokedPeerOnlyGivesAllowedFastPieces) {
+  Download download;
+  download.registry->addSeed(0);
+
+  EXPECT_EQ(download.manager->nextRequest(0, true), nullptr);
+  download.manager->allowFast(0, 2);
+  for (int i = 0; i < 2; i++) {
+    const Block* block = download.manager->nextRequest(0, true);
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(block->piece, 2);
+  }
+  EXPECT_EQ(download.manager->nextRequest(0, true), nullptr);
+}
+
+TEST(PieceManager, SuggestedPiecesAreStartedFirst) {
+  Download download;
+  download.registry->addSeed(0);
+  download.manager->suggestPiece(0, 3);
+
+  const Block* block = download.manager->nextRequest(0);
+  ASSERT_NE(block, nullptr);
+  EXPECT_EQ(block->piece, 3);
+}
+
+TEST(PieceManager, BlocksOfRemovedPeerAreHandedOutAgain) {
+  Download download;
+  download.registry->addSeed(0);
+  download.registry->addSeed(1);
+
+  const Block* block = download.manager->nextRequest(0);
+  ASSERT_NE(block, nullptr);
+  download.registry->removePeer(0);
+  download.manager->removePeer(0);
+
+  // Without waiting for the request to time out.
+  EXPECT_EQ(download.manager->nextRequest(1), block);
 }
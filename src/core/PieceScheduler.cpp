@@ -0,0 +1,160 @@
+#include "core/PieceScheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+PieceScheduler::PieceScheduler(std::shared_ptr<PieceManager> pieceManager,
+                               std::shared_ptr<PeerRegistry> peerRegistry)
+    : pieceManager_(std::move(pieceManager)),
+      peerRegistry_(std::move(peerRegistry)) {
+  pieceManager_->setClock([this] { return now_; });
+  pieceManager_->setTimeoutHandler([this](uint64_t serial) {
+    post(SchedulerEvent{.type = SchedulerEventType::kRequestTimedOut,
+                        .serial = serial});
+  });
+}
+
+PieceScheduler::~PieceScheduler() {
+  stop();
+  pieceManager_->setTimeoutHandler(nullptr);
+  pieceManager_->setClock(nullptr);
+}
+
+void PieceScheduler::start() {
+  thread_ = std::thread([this] { run(); });
+}
+
+/**
+ * Closes the outboxes, so that connections waiting for a batch the scheduler
+ * will no longer send get an empty one.
+ */
+void PieceScheduler::stop() {
+  {
+    std::lock_guard<std::mutex> guard(outboxLock_);
+    stopped_ = true;
+    for (const auto& outbox : outboxes_) {
+      if (auto open = outbox.lock()) {
+        open->close();
+      }
+    }
+    outboxes_.clear();
+  }
+
+  if (!thread_.joinable()) {
+    return;
+  }
+  post(SchedulerEvent{.type = SchedulerEventType::kStop});
+  thread_.join();
+}
+
+void PieceScheduler::post(SchedulerEvent event) {
+  events_.push(std::move(event));
+}
+
+std::shared_ptr<RequestOutbox> PieceScheduler::openOutbox() {
+  auto outbox = std::make_shared<RequestOutbox>();
+  std::lock_guard<std::mutex> guard(outboxLock_);
+  if (stopped_) {
+    outbox->close();
+    return outbox;
+  }
+  std::erase_if(outboxes_, [](const auto& open) { return open.expired(); });
+  outboxes_.push_back(outbox);
+  return outbox;
+}
+
+void PieceScheduler::setRecorder(
+    std::function<void(const SchedulerEvent&)> recorder) {
+  recorder_ = std::move(recorder);
+}
+
+void PieceScheduler::run() {
+  while (true) {
+    SchedulerEvent event = events_.pop();
+    if (event.type == SchedulerEventType::kStop) {
+      return;
+    }
+    event.time = std::chrono::steady_clock::now();
+    if (recorder_) {
+      recorder_(event);
+    }
+    process(event);
+  }
+}
+
+/**
+ * Applies an event to the piece and peer state. A kRequestSlotFree event is
+ * always answered, with an empty batch if there is nothing to request, since
+ * the connection waits for the reply.
+ */
+void PieceScheduler::process(const SchedulerEvent& event) {
+  now_ = event.time;
+  switch (event.type) {
+    case SchedulerEventType::kPeerBitfield:
+      peerRegistry_->addPeer(event.peer, event.data);
+      break;
+
+    case SchedulerEventType::kPeerHaveAll:
+      peerRegistry_->addSeed(event.peer);
+      break;
+
+    case SchedulerEventType::kBlockArrived:
+      pieceManager_->blockReceived(event.peer, event.pieceIndex,
+                                   event.blockOffset, event.data);
+      break;
+
+    case SchedulerEventType::kPeerHave:
+      peerRegistry_->updatePeer(event.peer, event.pieceIndex);
+      break;
+
+    case SchedulerEventType::kPeerGone:
+      if (!pieceManager_->isComplete()) {
+        peerRegistry_->removePeer(event.peer);
+      }
+      pieceManager_->removePeer(event.peer);
+      break;
+
+    case SchedulerEventType::kRequestSlotFree: {
+      RequestBatch batch;
+      for (int i = 0; i < event.slots; i++) {
+        Block* block = pieceManager_->nextRequest(event.peer, event.choked);
+        if (!block) {
+          break;
+        }
+        batch.push_back(block);
+      }
+      if (event.outbox) {
+        event.outbox->push(std::move(batch));
+      }
+      break;
+    }
+
+    case SchedulerEventType::kRequestRejected:
+      pieceManager_->requestRejected(event.peer, event.pieceIndex,
+                                     event.blockOffset);
+      break;
+
+    case SchedulerEventType::kAllowedFast:
+      pieceManager_->allowFast(event.peer, event.pieceIndex);
+      break;
+
+    case SchedulerEventType::kSuggestPiece:
+      pieceManager_->suggestPiece(event.peer, event.pieceIndex);
+      break;
+
+    case SchedulerEventType::kPeerChoked:
+      pieceManager_->peerChoked(event.peer, event.choked);
+      break;
+
+    case SchedulerEventType::kRequestTimedOut:
+      pieceManager_->requestTimedOut(event.serial);
+      break;
+
+    case SchedulerEventType::kStop:
+      break;
+  }
+}
@@ -0,0 +1,112 @@
+#ifndef BITTORRENTCLIENT_PIECESCHEDULER_H
+#define BITTORRENTCLIENT_PIECESCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/Block.h"
+#include "core/PeerRegistry.h"
+#include "core/PeerTable.h"
+#include "core/PieceManager.h"
+#include "infra/MpscQueue.h"
+
+// Blocks a connection should request next, in order. May be empty.
+using RequestBatch = std::vector<Block*>;
+// Per-connection queue the scheduler sends request batches back through.
+using RequestOutbox = MpscQueue<RequestBatch>;
+
+enum class SchedulerEventType {
+  kPeerBitfield,
+  kPeerHaveAll,
+  kBlockArrived,
+  kPeerHave,
+  kPeerGone,
+  kRequestSlotFree,
+  kRequestRejected,
+  kAllowedFast,
+  kSuggestPiece,
+  kPeerChoked,
+  kRequestTimedOut,
+  kStop,
+};
+
+struct SchedulerEvent {
+  SchedulerEventType type;
+  PeerHandle peer = kNoPeer;
+  int pieceIndex = 0;
+  int blockOffset = 0;
+  // Number of requests the connection has room for (kRequestSlotFree).
+  int slots = 0;
+  // Whether the peer is choking us, so that only allowed-fast pieces may be
+  // requested (kRequestSlotFree), or whether it now chokes us (kPeerChoked).
+  bool choked = false;
+  // Block data (kBlockArrived) or bitfield (kPeerBitfield).
+  std::string data;
+  // Request whose timer fired (kRequestTimedOut).
+  uint64_t serial = 0;
+  // When the scheduler thread took the event, which is the time the
+  // PieceManager sees while applying it. Kept when replaying.
+  std::chrono::steady_clock::time_point time;
+  // Where the reply to kRequestSlotFree goes. Not needed when replaying.
+  std::shared_ptr<RequestOutbox> outbox;
+};
+
+/**
+ * Single-writer front end of the PieceManager and PeerRegistry. Connection
+ * threads post events to a lock-free MPSC queue instead of calling into
+ * them, and one scheduler thread applies the events in the order they were
+ * posted. Since it is the only caller on the download path, the
+ * PieceManager lock is never contended by connections, and the sequence of
+ * decisions follows from the event stream alone, which can be recorded and
+ * replayed through process() for benchmarks: request timeouts come in as
+ * events too, and the PieceManager reads the time from the event applied.
+ */
+class PieceScheduler {
+ public:
+  explicit PieceScheduler(std::shared_ptr<PieceManager> pieceManager,
+                          std::shared_ptr<PeerRegistry> peerRegistry);
+  ~PieceScheduler();
+
+  PieceScheduler(const PieceScheduler&) = delete;
+  PieceScheduler& operator=(const PieceScheduler&) = delete;
+
+  void start();
+  void stop();
+
+  // May be called from any thread.
+  void post(SchedulerEvent event);
+  // The outbox a connection receives its request batches through.
+  std::shared_ptr<RequestOutbox> openOutbox();
+
+  // Applies one event on the calling thread. Used by the scheduler thread,
+  // and to replay a recorded event stream without one.
+  void process(const SchedulerEvent& event);
+
+  // Called with every event before it is applied. Must be set before
+  // start().
+  void setRecorder(std::function<void(const SchedulerEvent&)> recorder);
+
+ private:
+  std::shared_ptr<PieceManager> pieceManager_;
+  std::shared_ptr<PeerRegistry> peerRegistry_;
+
+  MpscQueue<SchedulerEvent> events_;
+  // Time of the event being applied. Only used on the thread applying it.
+  std::chrono::steady_clock::time_point now_;
+  std::function<void(const SchedulerEvent&)> recorder_;
+  std::thread thread_;
+
+  std::mutex outboxLock_;
+  bool stopped_ = false;
+  std::vector<std::weak_ptr<RequestOutbox>> outboxes_;
+
+  void run();
+};
+
+#endif  // BITTORRENTCLIENT_PIECESCHEDULER_H
@@ -0,0 +1,183 @@
+#include "core/PieceScheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace {
+constexpr int kPieceLength = 2 * 16384;
+constexpr int kPieces = 4;
+
+std::string pieceData(int index) {
+  return std::string(kPieceLength, static_cast<char>('a' + index));
+}
+
+/**
+ * A PieceManager downloading a torrent of `kPieces` pieces of two blocks
+ * each into the temporary directory, behind a PieceScheduler.
+ */
+class Download {
+ public:
+  explicit Download(const std::string& name) {
+    const auto directory = std::filesystem::temp_directory_path();
+    torrentPath_ = (directory / (name + ".torrent")).string();
+    downloadPath_ = (directory / (name + ".bin")).string();
+
+    std::string hashes;
+    for (int i = 0; i < kPieces; i++) {
+      hashes += utils::hexDecode(utils::sha1(pieceData(i)));
+    }
+    {
+      std::ofstream file(torrentPath_, std::ios::binary);
+      file << "d8:announce13:http://a/annc4:infod6:lengthi"
+           << kPieces * kPieceLength << "e4:name" << name.size() << ":"
+           << name << "12:piece lengthi" << kPieceLength << "e6:pieces"
+           << hashes.size() << ":" << hashes << "ee";
+    }
+
+    registry = std::make_shared<PeerRegistry>(kPieces);
+    manager = std::make_shared<PieceManager>(
+        std::make_shared<TorrentFileParser>(torrentPath_), registry,
+        std::make_shared<DiskManager>(), std::make_shared<TimerService>(),
+        downloadPath_, 8);
+    scheduler = std::make_unique<PieceScheduler>(manager, registry);
+  }
+
+  ~Download() {
+    scheduler.reset();
+    manager.reset();
+    std::filesystem::remove(torrentPath_);
+    std::filesystem::remove(downloadPath_);
+  }
+
+  std::shared_ptr<PeerRegistry> registry;
+  std::shared_ptr<PieceManager> manager;
+  std::unique_ptr<PieceScheduler> scheduler;
+
+ private:
+  std::string torrentPath_;
+  std::string downloadPath_;
+};
+
+SchedulerEvent blockArrived(PeerHandle peer, const Block* block) {
+  return SchedulerEvent{
+      .type = SchedulerEventType::kBlockArrived,
+      .peer = peer,
+      .pieceIndex = block->piece,
+      .blockOffset = block->offset,
+      .data = pieceData(block->piece).substr(block->offset, block->length)};
+}
+
+using Requests = std::vector<std::pair<int, int>>;
+
+void addBatch(Requests& requests, const RequestBatch& batch) {
+  for (const Block* block : batch) {
+    requests.emplace_back(block->piece, block->offset);
+  }
+}
+}  // namespace
+
+TEST(PieceScheduler, StopWakesConnectionsWaitingForABatch) {
+  Download download("scheduler_stop");
+  download.scheduler->start();
+  auto outbox = download.scheduler->openOutbox();
+
+  // Nobody posted the request, so no answer would ever come.
+  RequestBatch batch{nullptr};
+  std::thread connection([&outbox, &batch] { batch = outbox->pop(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  download.scheduler->stop();
+  connection.join();
+  EXPECT_TRUE(batch.empty());
+
+  EXPECT_TRUE(download.scheduler->openOutbox()->pop().empty());
+}
+
+TEST(PieceScheduler, ReplayingTheEventLogReachesTheSameState) {
+  std::vector<SchedulerEvent> log;
+  Requests live_requests;
+  std::string live_bitfield;
+  uint64_t live_bytes = 0;
+  {
+    Download live("scheduler_live");
+    live.scheduler->setRecorder(
+        [&log](const SchedulerEvent& event) { log.push_back(event); });
+    live.scheduler->start();
+    auto outbox = live.scheduler->openOutbox();
+    auto request = [&](PeerHandle peer, int slots) {
+      live.scheduler->post(
+          SchedulerEvent{.type = SchedulerEventType::kRequestSlotFree,
+                         .peer = peer,
+                         .slots = slots,
+                         .outbox = outbox});
+      RequestBatch batch = outbox->pop();
+      addBatch(live_requests, batch);
+      return batch;
+    };
+
+    live.scheduler->post(
+        SchedulerEvent{.type = SchedulerEventType::kPeerHaveAll, .peer = 0});
+    live.scheduler->post(
+        SchedulerEvent{.type = SchedulerEventType::kPeerBitfield,
+                       .peer = 1,
+                       .data = std::string(1, '\xC0')});
+    const RequestBatch held = request(1, 2);
+    ASSERT_EQ(held.size(), 2);
+    for (const Block* block : request(0, 2)) {
+      live.scheduler->post(blockArrived(0, block));
+    }
+
+    // The first request of peer 1 times out, the second one is rejected.
+    live.scheduler->post(SchedulerEvent{
+        .type = SchedulerEventType::kRequestTimedOut, .serial = 0});
+    live.scheduler->post(
+        SchedulerEvent{.type = SchedulerEventType::kRequestRejected,
+                       .peer = 1,
+                       .pieceIndex = held[1]->piece,
+                       .blockOffset = held[1]->offset});
+    live.scheduler->post(SchedulerEvent{
+        .type = SchedulerEventType::kPeerChoked, .peer = 1, .choked = true});
+    live.scheduler->post(
+        SchedulerEvent{.type = SchedulerEventType::kPeerGone, .peer = 1});
+
+    for (int round = 0; round < 4; round++) {
+      for (const Block* block : request(0, 2)) {
+        live.scheduler->post(blockArrived(0, block));
+      }
+    }
+    request(0, 1);
+    live.scheduler->stop();
+
+    live.manager->copyBitfield(live_bitfield);
+    live_bytes = live.manager->bytesDownloaded();
+  }
+  ASSERT_EQ(live_bytes, kPieces * kPieceLength);
+
+  Download replay("scheduler_replay");
+  auto outbox = std::make_shared<RequestOutbox>();
+  Requests replayed_requests;
+  for (SchedulerEvent event : log) {
+    if (event.outbox) {
+      event.outbox = outbox;
+    }
+    replay.scheduler->process(event);
+    if (event.outbox) {
+      addBatch(replayed_requests, outbox->pop());
+    }
+  }
+
+  EXPECT_EQ(replayed_requests, live_requests);
+  std::string replayed_bitfield;
+  replay.manager->copyBitfield(replayed_bitfield);
+  EXPECT_EQ(replayed_bitfield, live_bitfield);
+  EXPECT_EQ(replay.manager->bytesDownloaded(), live_bytes);
+}
@@ -0,0 +1,93 @@
+#include "core/PieceTracker.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+PieceTracker::PieceTracker(size_t pieceCount)
+    : states_(pieceCount, PieceState::kMissing),
+      ongoingPositions_(pieceCount, kNotOngoing),
+      have_(pieceCount),
+      wanted_(pieceCount, true),
+      missing_(pieceCount, true),
+      bitfield_((pieceCount + 7) / 8, '\0') {}
+
+PieceTracker::PieceTracker(PieceTracker&& other) noexcept {
+  *this = std::move(other);
+}
+
+PieceTracker& PieceTracker::operator=(PieceTracker&& other) noexcept {
+  states_ = std::move(other.states_);
+  ongoingPositions_ = std::move(other.ongoingPositions_);
+  ongoing_ = std::move(other.ongoing_);
+  have_ = std::move(other.have_);
+  wanted_ = std::move(other.wanted_);
+  missing_ = std::move(other.missing_);
+  bitfield_ = std::move(other.bitfield_);
+  haveCount_.store(other.haveCount_.exchange(0, std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  return *this;
+}
+
+bool PieceTracker::markOngoing(int index) {
+  if (states_[index] != PieceState::kMissing) {
+    return false;
+  }
+  states_[index] = PieceState::kOngoing;
+  missing_.reset(index);
+  ongoingPositions_[index] = static_cast<uint32_t>(ongoing_.size());
+  ongoing_.push_back(index);
+  return true;
+}
+
+bool PieceTracker::markMissing(int index) {
+  if (states_[index] != PieceState::kOngoing) {
+    return false;
+  }
+  removeOngoing(index);
+  states_[index] = PieceState::kMissing;
+  if (wanted_.test(index)) {
+    missing_.set(index);
+  }
+  return true;
+}
+
+void PieceTracker::markHave(int index) {
+  if (states_[index] == PieceState::kHave) {
+    return;
+  }
+  if (states_[index] == PieceState::kOngoing) {
+    removeOngoing(index);
+  }
+  states_[index] = PieceState::kHave;
+  have_.set(index);
+  missing_.reset(index);
+  bitfield_[index / 8] =
+      static_cast<char>(bitfield_[index / 8] | (0x80 >> (index % 8)));
+  haveCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PieceTracker::setWanted(int index, bool wanted) {
+  if (wanted) {
+    wanted_.set(index);
+    if (states_[index] == PieceState::kMissing) {
+      missing_.set(index);
+    }
+  } else {
+    wanted_.reset(index);
+    missing_.reset(index);
+  }
+}
+
+/**
+ * Removes a piece from the ongoing list by moving the last entry into its
+ * place.
+ */
+void PieceTracker::removeOngoing(int index) {
+  uint32_t position = ongoingPositions_[index];
+  int last = ongoing_.back();
+  ongoing_[position] = last;
+  ongoingPositions_[last] = position;
+  ongoing_.pop_back();
+  ongoingPositions_[index] = kNotOngoing;
+}
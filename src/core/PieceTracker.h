@@ -0,0 +1,81 @@
+#ifndef BITTORRENTCLIENT_PIECETRACKER_H
+#define BITTORRENTCLIENT_PIECETRACKER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/Bitset.h"
+
+enum class PieceState : uint8_t { kMissing, kOngoing, kHave };
+
+/**
+ * Download state of every piece of the torrent, one byte per piece, with
+ * bitsets of the pieces we have, want, and still need to start. Every
+ * transition is O(1): ongoing pieces are kept in a list that records each
+ * entry's position, so they can be removed without searching.
+ *
+ * The bitfield of pieces we have is kept in wire format (BEP 3) so that
+ * Bitfield and Have messages can be built without converting or allocating.
+ *
+ * The tracker is not thread safe, except for haveCount(), which may be read
+ * from any thread.
+ */
+class PieceTracker {
+ public:
+  explicit PieceTracker(size_t pieceCount = 0);
+  PieceTracker(PieceTracker&& other) noexcept;
+  PieceTracker& operator=(PieceTracker&& other) noexcept;
+
+  size_t pieceCount() const { return states_.size(); }
+  PieceState state(int index) const { return states_[index]; }
+
+  bool isMissing(int index) const { return missing_.test(index); }
+  bool isOngoing(int index) const {
+    return states_[index] == PieceState::kOngoing;
+  }
+  bool hasPiece(int index) const { return have_.test(index); }
+
+  // Missing -> ongoing. Returns false if the piece is not missing.
+  bool markOngoing(int index);
+  // Ongoing -> missing, e.g. when the piece is given up on.
+  bool markMissing(int index);
+  // Any state -> have.
+  void markHave(int index);
+  // Pieces that are not wanted are never reported as missing.
+  void setWanted(int index, bool wanted);
+
+  size_t haveCount() const {
+    return haveCount_.load(std::memory_order_relaxed);
+  }
+  bool isComplete() const { return haveCount() == states_.size(); }
+
+  // Ongoing pieces, in the order they were started unless some finished
+  // out of order.
+  const std::vector<int>& ongoing() const { return ongoing_; }
+  const Bitset& have() const { return have_; }
+  const Bitset& wanted() const { return wanted_; }
+  // Pieces that are wanted and neither ongoing nor downloaded.
+  const Bitset& missing() const { return missing_; }
+  // Wire format bitfield: piece 0 is the high bit of the first byte.
+  const std::string& bitfield() const { return bitfield_; }
+
+ private:
+  static constexpr uint32_t kNotOngoing = UINT32_MAX;
+
+  std::vector<PieceState> states_;
+  // Position of each piece in ongoing_, or kNotOngoing.
+  std::vector<uint32_t> ongoingPositions_;
+  std::vector<int> ongoing_;
+  Bitset have_;
+  Bitset wanted_;
+  Bitset missing_;
+  std::string bitfield_;
+  std::atomic<size_t> haveCount_ = 0;
+
+  void removeOngoing(int index);
+};
+
+#endif  // BITTORRENTCLIENT_PIECETRACKER_H
@@ -0,0 +1,63 @@
+#include "core/PieceTracker.h"
+
+#include <gtest/gtest.h>
+
+TEST(PieceTrackerTest, PiecesStartMissing) {
+  PieceTracker tracker(10);
+
+  EXPECT_EQ(tracker.pieceCount(), 10);
+  EXPECT_TRUE(tracker.isMissing(3));
+  EXPECT_EQ(tracker.haveCount(), 0);
+  EXPECT_FALSE(tracker.isComplete());
+  EXPECT_EQ(tracker.bitfield(), std::string(2, '\0'));
+}
+
+TEST(PieceTrackerTest, TransitionsUpdateOngoingList) {
+  PieceTracker tracker(10);
+
+  EXPECT_TRUE(tracker.markOngoing(1));
+  EXPECT_TRUE(tracker.markOngoing(4));
+  EXPECT_TRUE(tracker.markOngoing(7));
+  EXPECT_FALSE(tracker.markOngoing(4));
+  EXPECT_EQ(tracker.ongoing(), (std::vector<int>{1, 4, 7}));
+
+  tracker.markHave(1);
+  EXPECT_EQ(tracker.ongoing(), (std::vector<int>{7, 4}));
+  EXPECT_EQ(tracker.state(1), PieceState::kHave);
+
+  EXPECT_TRUE(tracker.markMissing(4));
+  EXPECT_TRUE(tracker.isMissing(4));
+  EXPECT_EQ(tracker.ongoing(), (std::vector<int>{7}));
+  EXPECT_FALSE(tracker.markMissing(1));
+}
+
+TEST(PieceTrackerTest, HaveUpdatesCountAndBitfield) {
+  PieceTracker tracker(10);
+
+  tracker.markHave(0);
+  tracker.markHave(9);
+  tracker.markHave(9);
+
+  EXPECT_EQ(tracker.haveCount(), 2);
+  EXPECT_TRUE(tracker.hasPiece(9));
+  EXPECT_EQ(tracker.have().count(), 2);
+  EXPECT_EQ(static_cast<unsigned char>(tracker.bitfield()[0]), 0x80);
+  EXPECT_EQ(static_cast<unsigned char>(tracker.bitfield()[1]), 0x40);
+
+  for (int i = 1; i < 9; i++) {
+    tracker.markHave(i);
+  }
+  EXPECT_TRUE(tracker.isComplete());
+}
+
+TEST(PieceTrackerTest, UnwantedPiecesAreNotMissing) {
+  PieceTracker tracker(4);
+
+  tracker.setWanted(2, false);
+  EXPECT_FALSE(tracker.isMissing(2));
+  EXPECT_EQ(tracker.missing().count(), 3);
+  EXPECT_FALSE(tracker.wanted().test(2));
+
+  tracker.setWanted(2, true);
+  EXPECT_TRUE(tracker.isMissing(2));
+}
@@ -0,0 +1,38 @@
+#include "core/RttEstimator.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// Clock granularity (G in RFC 6298), the lower bound of the variance term.
+constexpr RttEstimator::Duration kGranularity = std::chrono::milliseconds(10);
+constexpr int kMaxBackoffShift = 6;
+}  // namespace
+
+void RttEstimator::addSample(Duration rtt) {
+  if (!hasSample_) {
+    srtt_ = rtt;
+    rttvar_ = rtt / 2;
+    hasSample_ = true;
+  } else {
+    // RTTVAR <- 3/4 * RTTVAR + 1/4 * |SRTT - R'|
+    // SRTT <- 7/8 * SRTT + 1/8 * R'
+    Duration delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+    rttvar_ = (3 * rttvar_ + delta) / 4;
+    srtt_ = (7 * srtt_ + rtt) / 8;
+  }
+  backoffShift_ = 0;
+}
+
+void RttEstimator::backoff() {
+  backoffShift_ = std::min(backoffShift_ + 1, kMaxBackoffShift);
+}
+
+RttEstimator::Duration RttEstimator::timeout() const {
+  Duration base = kInitialTimeout;
+  if (hasSample_) {
+    base = std::clamp(srtt_ + std::max(kGranularity, 4 * rttvar_), kMinTimeout,
+                      kMaxTimeout);
+  }
+  return std::min(base * (1 << backoffShift_), kMaxTimeout);
+}
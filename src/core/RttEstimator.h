@@ -0,0 +1,36 @@
+#ifndef BITTORRENTCLIENT_RTTESTIMATOR_H
+#define BITTORRENTCLIENT_RTTESTIMATOR_H
+
+#include <chrono>
+
+/**
+ * Estimates how long a peer takes to serve a block request, the same way
+ * TCP estimates its retransmission timeout (RFC 6298): a smoothed round trip
+ * time (SRTT) plus four times its mean deviation (RTTVAR).
+ */
+class RttEstimator {
+ public:
+  using Duration = std::chrono::milliseconds;
+
+  // Timeout used until the first sample has been taken.
+  static constexpr Duration kInitialTimeout = std::chrono::seconds(5);
+  static constexpr Duration kMinTimeout = std::chrono::milliseconds(500);
+  static constexpr Duration kMaxTimeout = std::chrono::seconds(60);
+
+  void addSample(Duration rtt);
+  // Doubles the timeout after it expired, until the next sample arrives.
+  void backoff();
+
+  Duration timeout() const;
+  Duration srtt() const { return srtt_; }
+  Duration rttvar() const { return rttvar_; }
+  bool hasSample() const { return hasSample_; }
+
+ private:
+  Duration srtt_{0};
+  Duration rttvar_{0};
+  int backoffShift_ = 0;
+  bool hasSample_ = false;
+};
+
+#endif  // BITTORRENTCLIENT_RTTESTIMATOR_H
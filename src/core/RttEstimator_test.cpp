@@ -0,0 +1,54 @@
+#include "core/RttEstimator.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+using std::chrono::milliseconds;
+
+TEST(RttEstimator, UsesInitialTimeoutWithoutSamples) {
+  RttEstimator estimator;
+  EXPECT_FALSE(estimator.hasSample());
+  EXPECT_EQ(estimator.timeout(), RttEstimator::kInitialTimeout);
+}
+
+TEST(RttEstimator, FirstSampleSetsSrttAndRttvar) {
+  RttEstimator estimator;
+  estimator.addSample(milliseconds(800));
+
+  EXPECT_EQ(estimator.srtt(), milliseconds(800));
+  EXPECT_EQ(estimator.rttvar(), milliseconds(400));
+  // 800 + 4 * 400
+  EXPECT_EQ(estimator.timeout(), milliseconds(2400));
+}
+
+TEST(RttEstimator, SmoothsLaterSamples) {
+  RttEstimator estimator;
+  estimator.addSample(milliseconds(800));
+  estimator.addSample(milliseconds(1600));
+
+  // SRTT = (7 * 800 + 1600) / 8, RTTVAR = (3 * 400 + 800) / 4
+  EXPECT_EQ(estimator.srtt(), milliseconds(900));
+  EXPECT_EQ(estimator.rttvar(), milliseconds(500));
+}
+
+TEST(RttEstimator, ClampsFastPeersToMinimum) {
+  RttEstimator estimator;
+  for (int i = 0; i < 20; i++) {
+    estimator.addSample(milliseconds(2));
+  }
+  EXPECT_EQ(estimator.timeout(), RttEstimator::kMinTimeout);
+}
+
+TEST(RttEstimator, BackoffDoublesUntilNextSample) {
+  RttEstimator estimator;
+  estimator.addSample(milliseconds(800));
+
+  estimator.backoff();
+  EXPECT_EQ(estimator.timeout(), milliseconds(4800));
+  estimator.backoff();
+  EXPECT_EQ(estimator.timeout(), milliseconds(9600));
+
+  estimator.addSample(milliseconds(800));
+  EXPECT_LT(estimator.timeout(), milliseconds(4800));
+}
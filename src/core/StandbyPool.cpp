@@ -0,0 +1,51 @@
+#include "core/StandbyPool.h"
+
+#include <chrono>
+#include <mutex>
+
+StandbyPool::StandbyPool(size_t activeSlots) : activeSlots_(activeSlots) {}
+
+StandbyResult StandbyPool::activate(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(lock_);
+  standby_++;
+  const bool woken = freed_.wait_for(lock, timeout, [this] {
+    return closed_ || active_ < activeSlots_;
+  });
+  standby_--;
+  if (closed_) {
+    return StandbyResult::kClosed;
+  }
+  if (!woken) {
+    return StandbyResult::kTimeout;
+  }
+  active_++;
+  return StandbyResult::kPromoted;
+}
+
+void StandbyPool::release() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (active_ > 0) {
+      active_--;
+    }
+  }
+  freed_.notify_one();
+}
+
+void StandbyPool::close() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    closed_ = true;
+  }
+  freed_.notify_all();
+}
+
+size_t StandbyPool::active() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return active_;
+}
+
+size_t StandbyPool::standby() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return standby_;
+}
@@ -0,0 +1,46 @@
+#ifndef BITTORRENTCLIENT_STANDBYPOOL_H
+#define BITTORRENTCLIENT_STANDBYPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+enum class StandbyResult {
+  kPromoted,
+  kTimeout,
+  kClosed,
+};
+
+/**
+ * Active download slots. Connections that are ready beyond them, connected,
+ * handshaken and with their bitfield known, wait in standby, and one of
+ * them takes over the moment an active connection ends, so a disconnect
+ * does not cost a connect and a handshake before data flows again.
+ */
+class StandbyPool {
+ public:
+  explicit StandbyPool(size_t activeSlots);
+
+  // Takes an active slot, waiting up to `timeout` for one to free up.
+  // Standby connections call it again after a timeout, once they have kept
+  // their connection alive.
+  StandbyResult activate(std::chrono::milliseconds timeout);
+  // Gives back a slot taken by activate().
+  void release();
+  // Wakes every activate(), which return kClosed from then on.
+  void close();
+
+  size_t active() const;
+  size_t standby() const;
+
+ private:
+  const size_t activeSlots_;
+  mutable std::mutex lock_;
+  std::condition_variable freed_;
+  bool closed_ = false;
+  size_t active_ = 0;
+  size_t standby_ = 0;
+};
+
+#endif  // BITTORRENTCLIENT_STANDBYPOOL_H
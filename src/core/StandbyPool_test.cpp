@@ -0,0 +1,44 @@
+#include "core/StandbyPool.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+using std::chrono::milliseconds;
+
+TEST(StandbyPool, PromotesAStandbyConnectionWhenASlotFrees) {
+  StandbyPool pool(2);
+  EXPECT_EQ(pool.activate(milliseconds(0)), StandbyResult::kPromoted);
+  EXPECT_EQ(pool.activate(milliseconds(0)), StandbyResult::kPromoted);
+  EXPECT_EQ(pool.activate(milliseconds(10)), StandbyResult::kTimeout);
+  EXPECT_EQ(pool.active(), 2);
+
+  StandbyResult result = StandbyResult::kTimeout;
+  std::thread standby(
+      [&pool, &result] { result = pool.activate(milliseconds(5000)); });
+  while (pool.standby() == 0) {
+    std::this_thread::yield();
+  }
+  const auto released = std::chrono::steady_clock::now();
+  pool.release();
+  standby.join();
+  EXPECT_EQ(result, StandbyResult::kPromoted);
+  EXPECT_LT(std::chrono::steady_clock::now() - released, milliseconds(1000));
+  EXPECT_EQ(pool.active(), 2);
+  EXPECT_EQ(pool.standby(), 0);
+}
+
+TEST(StandbyPool, CloseWakesStandbyConnections) {
+  StandbyPool pool(0);
+  StandbyResult result = StandbyResult::kPromoted;
+  std::thread standby(
+      [&pool, &result] { result = pool.activate(milliseconds(5000)); });
+  while (pool.standby() == 0) {
+    std::this_thread::yield();
+  }
+  pool.close();
+  standby.join();
+  EXPECT_EQ(result, StandbyResult::kClosed);
+  EXPECT_EQ(pool.activate(milliseconds(0)), StandbyResult::kClosed);
+}
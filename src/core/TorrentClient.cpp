@@ -6,30 +6,103 @@
 #include <fmt/format.h>
 #include <infra/Logger.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <random>
+#include <string>
+#include <unordered_map>
 #include <thread>
+#include <vector>
 
 #include "core/PieceManager.h"
+#include "network/AnnounceScheduler.h"
+#include "network/ConnectionManager.h"
+#include "network/LocalServiceDiscovery.h"
 #include "network/PeerConnection.h"
 #include "network/PeerRetriever.h"
+#include "network/TrackerSet.h"
+#include "network/UtpSocket.h"
 #include "utils/TorrentFileParser.h"
+#include "utils/utils.h"
 
 #define PORT 8080
-#define PEER_QUERY_INTERVAL 60  // 1 minute
+#define COMPLETION_POLL_INTERVAL 100  // 100 ms
+// Connections kept handshaken in standby, beyond the threadNum active ones.
+#define STANDBY_PEERS 2
+// How often the worst peer is considered for replacement. Peers connected
+// for less than CHURN_MIN_AGE are left alone, and the worst one is only
+// replaced when it scores below CHURN_FRACTION of the median.
+#define CHURN_INTERVAL 30  // 30 sec
+#define CHURN_MIN_AGE 60   // 1 min
+#define CHURN_FRACTION 0.5
+// Best peers persisted for the next run, and how often they are saved.
+#define PEER_CACHE_SIZE 50
+#define PEER_CACHE_INTERVAL 60  // 1 minute
+// Announce URL under which the DHT is scheduled like one more tracker tier.
+#define DHT_TRACKER "dht://"
+#define DHT_ANNOUNCE_INTERVAL 900  // 15 minutes
+#define DHT_MIN_ANNOUNCE_INTERVAL 60  // 1 minute
+// Below this many known nodes, the DHT is bootstrapped again.
+#define DHT_MIN_NODES 16
+#define DHT_NODE_CACHE_SIZE 200
+
+namespace {
+// Well-known nodes used to join the DHT when no cached node answers.
+const std::vector<Peer> kDhtRouters = {
+    {.ip = "router.bittorrent.com", .port = 6881},
+    {.ip = "dht.transmissionbt.com", .port = 6881},
+    {.ip = "router.utorrent.com", .port = 6881}};
+
+/**
+ * Announces to the DHT as if it were one more tracker: the node joins the
+ * network on its first use, or again once it knows too few nodes, and
+ * keeps its buckets fresh before each lookup. Nodes only hold announces
+ * for a while, so we come back every DHT_ANNOUNCE_INTERVAL.
+ */
+tl::expected<AnnounceResponse, TrackerError> announceToDht(
+    DhtNode& dht, const std::string& infoHash, const AnnounceParams& params,
+    const std::vector<Peer>& seeds) {
+  AnnounceResponse response{.interval = DHT_ANNOUNCE_INTERVAL,
+                            .minInterval = DHT_MIN_ANNOUNCE_INTERVAL};
+  // Announces expire by themselves, there is nothing to withdraw
+  if (params.event == TrackerEvent::kStopped) {
+    return response;
+  }
+
+  if (dht.nodes().size() < DHT_MIN_NODES) {
+    if (dht.bootstrap(seeds) == 0) {
+      return tl::unexpected(TrackerError{"Failed to join the DHT"});
+    }
+  } else {
+    dht.refresh();
+  }
+
+  response.peers = dht.announce(infoHash, PORT);
+  return response;
+}
+}  // namespace
 
 TorrentClient::TorrentClient(
-    std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue,
+    std::shared_ptr<PeerAddressBook> addressBook,
     std::shared_ptr<TorrentState> torrentState,
     std::shared_ptr<PieceManager> pieceManager,
     std::shared_ptr<PeerRegistry> peerRegistry,
-    std::shared_ptr<TorrentFileParser> torrentFileParser, int threadNum)
+    std::shared_ptr<PeerTable> peerTable,
+    std::shared_ptr<TorrentFileParser> torrentFileParser,
+    std::shared_ptr<TimerService> timerService,
+    std::shared_ptr<PieceScheduler> scheduler, std::shared_ptr<DhtNode> dht,
+    int threadNum)
 
-    : queue_(std::move(queue)),
+    : addressBook_(std::move(addressBook)),
       torrentState_(std::move(torrentState)),
       pieceManager_(std::move(pieceManager)),
       peerRegistry_(std::move(peerRegistry)),
+      peerTable_(std::move(peerTable)),
       torrentFileParser_(std::move(torrentFileParser)),
+      timerService_(std::move(timerService)),
+      scheduler_(std::move(scheduler)),
+      dht_(std::move(dht)),
       threadNum_(threadNum),
       peerId_("-UT2021-") {
   std::random_device rd;
@@ -84,7 +157,11 @@ void TorrentClient::start(const std::string& downloadDirectory) {
     return;
   }
 
-  downloadFile(downloadDirectory);
+  // Only a finished download is recorded
+  if (auto downloaded = downloadFile(downloadDirectory); !downloaded) {
+    Logger::log(downloaded.error().message);
+    return;
+  }
 
   auto res = torrentState_->storeState(info_hash, filename);
 
@@ -94,69 +171,258 @@ void TorrentClient::start(const std::string& downloadDirectory) {
   }
 }
 
-void TorrentClient::downloadFile(const std::string& file) {
+tl::expected<void, TorrentClientError> TorrentClient::downloadFile(
+    const std::string& file) {
   // Retrieve torrent metadata
   // TODO(slim): lets check expected before .value()
-  const auto announce_url = torrentFileParser_->getAnnounce().value();
+  // A torrent without trackers can still be downloaded through the DHT.
+  auto announce_tiers = torrentFileParser_->getAnnounceList().value_or(
+      std::vector<std::vector<std::string>>{});
+  if (dht_) {
+    announce_tiers.push_back({DHT_TRACKER});
+  } else if (announce_tiers.empty()) {
+    return tl::unexpected(TorrentClientError{
+        "The torrent has no tracker and the DHT is disabled."});
+  }
   const auto file_size = torrentFileParser_->getFileSize().value();
   const auto info_hash = torrentFileParser_->getInfoHash();
   const auto file_name = torrentFileParser_->getFileName().value();
 
-  // Initialize vectors for threads and connections
-  connections_.reserve(threadNum_);
-  threadPool_.reserve(threadNum_);
+  // Peers that served us before are dialled straight away, without waiting
+  // for the trackers
+  if (auto cached = torrentState_->getPeers(info_hash, PEER_CACHE_SIZE)) {
+    std::vector<std::unique_ptr<Peer>> peers;
+    for (const auto& record : *cached) {
+      peers.push_back(
+          std::make_unique<Peer>(Peer{.ip = record.ip, .port = record.port}));
+    }
+    addressBook_->add(std::move(peers), PeerSource::kCache);
+  }
+
+  // Peers are reached over uTP when they support it, which yields to other
+  // traffic on the link, and over TCP otherwise. The connects of every slot
+  // run side by side on the connection manager
+  utp_ = std::make_shared<UtpSocket>();
+  if (auto started = utp_->start(PORT); !started) {
+    Logger::log(started.error().message);
+    utp_ = nullptr;
+  }
+  connectionManager_ = std::make_shared<ConnectionManager>(addressBook_, utp_);
+  if (auto started = connectionManager_->start(); !started) {
+    terminate();
+    return tl::unexpected(TorrentClientError{started.error().message});
+  }
+
+  // Initialize vectors for threads and connections. threadNum connections
+  // download; the others wait in standby to replace the ones that drop
+  standbyPool_ = std::make_shared<StandbyPool>(threadNum_);
+  const int connection_count = threadNum_ + STANDBY_PEERS;
+  connections_.reserve(connection_count);
+  threadPool_.reserve(connection_count);
 
-  for (int i = 0; i < threadNum_; ++i) {
+  for (int i = 0; i < connection_count; ++i) {
     auto connection = std::make_shared<PeerConnection>(
-        queue_, peerId_, info_hash, pieceManager_, peerRegistry_);
+        addressBook_, connectionManager_, peerId_, info_hash, pieceManager_,
+        peerRegistry_, peerTable_, timerService_, scheduler_, standbyPool_);
     threadPool_.emplace_back([connection]() { connection->start(); });
     connections_.push_back(connection);
   }
 
-  auto last_peer_query = static_cast<time_t>(-1);
+  // One retriever per tracker, kept for the whole download so that UDP
+  // tracker connections are reused.
+  auto retrievers = std::make_shared<
+      std::unordered_map<std::string, std::unique_ptr<PeerRetriever>>>();
+  for (const auto& tier : announce_tiers) {
+    for (const auto& url : tier) {
+      if (url == DHT_TRACKER) {
+        continue;
+      }
+      (*retrievers)[url] =
+          std::make_unique<PeerRetriever>(peerId_, url, info_hash, PORT);
+    }
+  }
+  // Nodes that answered in the previous run are tried before the routers
+  std::vector<Peer> dht_seeds;
+  if (auto cached = torrentState_->getDhtNodes(DHT_NODE_CACHE_SIZE)) {
+    for (const auto& node : *cached) {
+      dht_seeds.push_back(Peer{.ip = node.ip, .port = node.port});
+    }
+  }
+  dht_seeds.insert(dht_seeds.end(), kDhtRouters.begin(), kDhtRouters.end());
+
+  auto trackers = std::make_shared<TrackerSet>(
+      announce_tiers,
+      // Announces run on threads of their own, which may outlive the
+      // client: only shared state is captured
+      [dht = dht_, retrievers, dht_seeds,
+       raw_info_hash = utils::hexDecode(info_hash)](
+          const std::string& url, const AnnounceParams& params)
+          -> tl::expected<AnnounceResponse, TrackerError> {
+        if (url == DHT_TRACKER) {
+          return announceToDht(*dht, raw_info_hash, params, dht_seeds);
+        }
+        auto response = retrievers->at(url)->announce(params);
+        if (!response) {
+          return tl::unexpected(TrackerError{response.error().message});
+        }
+        return std::move(*response);
+      });
+
+  // Nothing is uploaded yet, so `uploaded` stays at 0.
+  AnnounceScheduler announcer(
+      trackers,
+      [pieces = pieceManager_] {
+        return TransferProgress{.downloaded = pieces->bytesDownloaded(),
+                                .left = pieces->bytesLeft()};
+      },
+      [this] {
+        return std::max(0, threadNum_ + STANDBY_PEERS -
+                               static_cast<int>(peerRegistry_->peerCount()) -
+                               static_cast<int>(addressBook_->available()));
+      },
+      [book = addressBook_](std::vector<std::unique_ptr<Peer>> peers) {
+        book->add(std::move(peers), PeerSource::kTracker);
+      });
+  announcer.start();
+
+  // Peers on the same network segment, which the address book tries first
+  LocalServiceDiscovery local_discovery(
+      PORT, [book = addressBook_](const std::string&,
+                                  std::vector<std::unique_ptr<Peer>> peers) {
+        book->add(std::move(peers), PeerSource::kLocal);
+      });
+  local_discovery.addTorrent(info_hash);
+  if (auto started = local_discovery.start(); !started) {
+    Logger::log(started.error().message);
+  }
 
+  auto next_cache_store = std::chrono::steady_clock::now() +
+                          std::chrono::seconds(PEER_CACHE_INTERVAL);
+  auto next_rotation = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(CHURN_INTERVAL);
   while (!pieceManager_->isComplete()) {
-    const time_t now = std::time(nullptr);
-    const double elapsed = std::difftime(now, last_peer_query);
-
-    // Determine if we should query the tracker
-    const bool should_query_tracker = last_peer_query == -1 ||
-                                      elapsed >= PEER_QUERY_INTERVAL ||
-                                      queue_->is_empty();
-
-    if (!should_query_tracker) {
-      // prevent busy-waiting
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      continue;
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(COMPLETION_POLL_INTERVAL));
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= next_cache_store) {
+      storePeerCache(info_hash);
+      next_cache_store += std::chrono::seconds(PEER_CACHE_INTERVAL);
     }
+    if (now >= next_rotation) {
+      rotateWorstPeer();
+      next_rotation += std::chrono::seconds(CHURN_INTERVAL);
+    }
+  }
 
-    // Retrieve peers from tracker
-    PeerRetriever retriever(peerId_, announce_url, info_hash, PORT, file_size);
+  local_discovery.stop();
+  terminate();
+  storePeerCache(info_hash);
+  storeDhtNodes();
+  announcer.stop();
 
-    auto peers = retriever.retrievePeers(pieceManager_->bytesDownloaded());
+  Logger::log("Download completed!");
+  Logger::log(fmt::format("Torrent file '{}' downloaded.", file));
+  return {};
+}
 
-    last_peer_query = now;
+/**
+ * Persists the peers that delivered the most, so that a restarted download
+ * can reconnect to them at once.
+ */
+void TorrentClient::storePeerCache(const std::string& infoHash) {
+  const auto steady_now = std::chrono::steady_clock::now();
+  const auto system_now = std::chrono::system_clock::now();
+
+  std::vector<CachedPeerRecord> records;
+  for (const auto& [peer, record] : addressBook_->best(PEER_CACHE_SIZE)) {
+    const auto last_seen =
+        system_now - std::chrono::duration_cast<std::chrono::seconds>(
+                         steady_now - record.lastConnected);
+    records.push_back(CachedPeerRecord{
+        .ip = peer.ip,
+        .port = peer.port,
+        .bytesPerSecond = record.bytesPerSecond,
+        .lastSeen = std::chrono::duration_cast<std::chrono::seconds>(
+                        last_seen.time_since_epoch())
+                        .count()});
+  }
+  if (records.empty()) {
+    return;
+  }
 
-    if (!peers.empty()) {
-      queue_->clear();
-      for (auto& peer : peers) {
-        queue_->push_back(std::move(peer));
-      }
+  if (auto res = torrentState_->storePeers(infoHash, std::move(records));
+      !res) {
+    Logger::log(res.error().message);
+  }
+}
+
+/**
+ * Persists the nodes of the routing table, so that the next run joins the
+ * DHT without depending on the bootstrap routers.
+ */
+void TorrentClient::storeDhtNodes() {
+  if (!dht_) {
+    return;
+  }
+
+  std::vector<CachedDhtNode> nodes;
+  for (const auto& contact : dht_->nodes()) {
+    if (contact.failures == 0) {
+      nodes.push_back(CachedDhtNode{.ip = contact.endpoint.ip,
+                                    .port = contact.endpoint.port});
+    }
+    if (nodes.size() >= DHT_NODE_CACHE_SIZE) {
+      break;
     }
   }
+  if (nodes.empty()) {
+    return;
+  }
 
-  terminate();
+  if (auto res = torrentState_->storeDhtNodes(std::move(nodes)); !res) {
+    Logger::log(res.error().message);
+  }
+}
 
-  Logger::log("Download completed!");
-  Logger::log(fmt::format("Torrent file '{}' downloaded.", file));
+/**
+ * Drops the worst connected peer, by throughput, choking, hash failures and
+ * latency, when a replacement is at hand: a connection in standby or an
+ * address ready to be dialled. Its rate goes to the address book, so that
+ * the connected set converges on the fastest sources.
+ */
+void TorrentClient::rotateWorstPeer() {
+  if (standbyPool_->standby() == 0 && addressBook_->available() == 0) {
+    return;
+  }
+  auto worst = pieceManager_->rotationCandidate(
+      std::chrono::seconds(CHURN_MIN_AGE), CHURN_FRACTION);
+  if (!worst) {
+    return;
+  }
+  // The handle may be released and given to another peer meanwhile, whose
+  // connection must be left alone.
+  const std::string peer_id = peerTable_->peerId(*worst);
+  if (peer_id.empty()) {
+    return;
+  }
+  for (auto& connection : connections_) {
+    if (connection->drop(*worst)) {
+      if (peerTable_->peerId(*worst) != peer_id) {
+        connection->drop(kNoPeer);
+      }
+      return;
+    }
+  }
 }
 
 void TorrentClient::terminate() {
-  // Signal all worker threads to stop by pushing dummy peers
-  for (int i = 0; i < threadNum_; ++i) {
-    Peer p = Peer{.ip = "0.0.0.0", .port = 0};
-    auto dummy_peer = std::make_unique<Peer>(p);
-    queue_->push_back(std::move(dummy_peer));
+  // Wakes up the worker threads waiting for a peer, which then stop
+  addressBook_->close();
+  if (connectionManager_) {
+    connectionManager_->stop();
+  }
+  if (standbyPool_) {
+    standbyPool_->close();
   }
 
   for (auto& connection : connections_) {
@@ -172,4 +438,8 @@ void TorrentClient::terminate() {
 
   // Clear thread pool vector
   threadPool_.clear();
+
+  if (utp_) {
+    utp_->stop();
+  }
 }
@@ -4,11 +4,19 @@
 
 #include <memory>
 #include <string>
+#include <tl/expected.hpp>
 
+#include "core/PeerAddressBook.h"
 #include "core/PieceManager.h"
+#include "core/PieceScheduler.h"
+#include "core/StandbyPool.h"
 #include "core/TorrentState.h"
-#include "infra/Queue.h"
+#include "infra/TimerService.h"
+#include "network/Announce.h"
+#include "network/ConnectionManager.h"
+#include "network/DhtNode.h"
 #include "network/PeerConnection.h"
+#include "network/UtpSocket.h"
 #include "utils/TorrentFileParser.h"
 
 struct TorrentClientError {
@@ -22,21 +30,38 @@ class TorrentClient {
   std::shared_ptr<PieceManager> pieceManager_;
   std::shared_ptr<TorrentFileParser> torrentFileParser_;
   std::shared_ptr<PeerRegistry> peerRegistry_;
+  std::shared_ptr<PeerTable> peerTable_;
+  std::shared_ptr<TimerService> timerService_;
+  std::shared_ptr<PieceScheduler> scheduler_;
+  // Null when the DHT is disabled.
+  std::shared_ptr<DhtNode> dht_;
 
   const int threadNum_ = 5;
 
   std::string peerId_;
-  std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue_;
+  std::shared_ptr<PeerAddressBook> addressBook_;
+  // Null when the uTP port could not be bound.
+  std::shared_ptr<UtpSocket> utp_;
+  std::shared_ptr<ConnectionManager> connectionManager_;
+  std::shared_ptr<StandbyPool> standbyPool_;
   std::vector<std::thread> threadPool_;
   std::vector<std::shared_ptr<PeerConnection>> connections_;
 
+  void storePeerCache(const std::string& infoHash);
+  void storeDhtNodes();
+  void rotateWorstPeer();
+
  public:
   // Constructor that accepts a shared_ptr to TorrentState
-  explicit TorrentClient(std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue,
+  explicit TorrentClient(std::shared_ptr<PeerAddressBook> addressBook,
                          std::shared_ptr<TorrentState> torrentState,
                          std::shared_ptr<PieceManager> pieceManager,
                          std::shared_ptr<PeerRegistry> peerRegistry,
+                         std::shared_ptr<PeerTable> peerTable,
                          std::shared_ptr<TorrentFileParser> torrentFileParser,
+                         std::shared_ptr<TimerService> timerService,
+                         std::shared_ptr<PieceScheduler> scheduler,
+                         std::shared_ptr<DhtNode> dht = nullptr,
                          int threadNum = 5);
   // Destructor
   ~TorrentClient();
@@ -48,7 +73,8 @@ class TorrentClient {
   void start(const std::string& downloadDirectory);
 
   // Method to download file from torrent
-  void downloadFile(const std::string& downloadDirectory);
+  tl::expected<void, TorrentClientError> downloadFile(
+      const std::string& downloadDirectory);
 };
 
 #endif  // BITTORRENTCLIENT_TORRENTCLIENT_H
@@ -22,3 +22,43 @@ tl::expected<TorrentRecord, TorrentStateError> TorrentState::getState(
   auto val = databaseSvc_->getTorrent(std::move(hashinfo));
   return val.value();
 }
+
+tl::expected<void, TorrentStateError> TorrentState::storePeers(
+    std::string hashinfo, std::vector<CachedPeerRecord> peers) {
+  auto val = databaseSvc_->storePeers(std::move(hashinfo), std::move(peers));
+  if (!val) {
+    return tl::unexpected(TorrentStateError{"failed to save peers"});
+  }
+
+  return {};
+}
+
+tl::expected<std::vector<CachedPeerRecord>, TorrentStateError>
+TorrentState::getPeers(std::string hashinfo, int limit) {
+  auto val = databaseSvc_->getPeers(std::move(hashinfo), limit);
+  if (!val) {
+    return tl::unexpected(TorrentStateError{"failed to load peers"});
+  }
+
+  return std::move(*val);
+}
+
+tl::expected<void, TorrentStateError> TorrentState::storeDhtNodes(
+    std::vector<CachedDhtNode> nodes) {
+  auto val = databaseSvc_->storeDhtNodes(std::move(nodes));
+  if (!val) {
+    return tl::unexpected(TorrentStateError{"failed to save DHT nodes"});
+  }
+
+  return {};
+}
+
+tl::expected<std::vector<CachedDhtNode>, TorrentStateError>
+TorrentState::getDhtNodes(int limit) {
+  auto val = databaseSvc_->getDhtNodes(limit);
+  if (!val) {
+    return tl::unexpected(TorrentStateError{"failed to load DHT nodes"});
+  }
+
+  return std::move(*val);
+}
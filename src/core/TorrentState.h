@@ -4,6 +4,7 @@
 
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 #include "infra/DatabaseService.h"
 
@@ -28,6 +29,18 @@ class TorrentState {
 
   tl::expected<TorrentRecord, TorrentStateError> getState(std::string hashinfo);
 
+  tl::expected<void, TorrentStateError> storePeers(
+      std::string hashinfo, std::vector<CachedPeerRecord> peers);
+
+  tl::expected<std::vector<CachedPeerRecord>, TorrentStateError> getPeers(
+      std::string hashinfo, int limit);
+
+  tl::expected<void, TorrentStateError> storeDhtNodes(
+      std::vector<CachedDhtNode> nodes);
+
+  tl::expected<std::vector<CachedDhtNode>, TorrentStateError> getDhtNodes(
+      int limit);
+
   ~TorrentState();
 };
 #endif  // BITTORRENTCLIENT_TORRENTSTATE_H
@@ -38,3 +38,35 @@ TEST(TorrentState, storeStateHandlesInsertOK) {
 
   ASSERT_TRUE(val.has_value());
 }
+
+TEST(TorrentState, getPeersHandlesQueryError) {
+  std::shared_ptr<MockDatabaseService> db_service =
+      std::make_shared<MockDatabaseService>();
+
+  TorrentState ts = TorrentState(db_service);
+
+  EXPECT_CALL(*db_service, getPeers("mockHashMock", 10))
+      .WillOnce(::testing::Return(tl::unexpected<DatabaseServiceError>{
+          DatabaseServiceError::kQueryError}));
+
+  auto val = ts.getPeers("mockHashMock", 10);
+
+  ASSERT_FALSE(val.has_value());
+  EXPECT_EQ(val.error().message, "failed to load peers");
+}
+
+TEST(TorrentState, getDhtNodesHandlesQueryError) {
+  std::shared_ptr<MockDatabaseService> db_service =
+      std::make_shared<MockDatabaseService>();
+
+  TorrentState ts = TorrentState(db_service);
+
+  EXPECT_CALL(*db_service, getDhtNodes(100))
+      .WillOnce(::testing::Return(tl::unexpected<DatabaseServiceError>{
+          DatabaseServiceError::kQueryError}));
+
+  auto val = ts.getDhtNodes(100);
+
+  ASSERT_FALSE(val.has_value());
+  EXPECT_EQ(val.error().message, "failed to load DHT nodes");
+}
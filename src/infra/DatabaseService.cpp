@@ -5,16 +5,31 @@
 #include <fmt/format.h>
 #include <infra/Logger.h>
 
+#include <exception>
 #include <memory>
 #include <string>
 #include <tl/expected.hpp>
 #include <utility>
+#include <vector>
 
 // SQL
 // CREATE TABLE Torrents (
 // 	name TEXT NOT NULL,
 // 	hashinfo TEXT NOT NULL,
 // 	CONSTRAINT Torrents_PK PRIMARY KEY (hashinfo)
+//
+// CREATE TABLE Peers (
+// 	hashinfo TEXT NOT NULL,
+// 	ip TEXT NOT NULL,
+// 	port INTEGER NOT NULL,
+// 	bytesPerSecond REAL NOT NULL,
+// 	lastSeen INTEGER NOT NULL,
+// 	CONSTRAINT Peers_PK PRIMARY KEY (hashinfo, ip, port)
+//
+// CREATE TABLE DhtNodes (
+// 	ip TEXT NOT NULL,
+// 	port INTEGER NOT NULL,
+// 	CONSTRAINT DhtNodes_PK PRIMARY KEY (ip, port)
 
 const std::string kDbState = std::string("torrent_state.db");
 
@@ -40,13 +55,38 @@ DatabaseService::DatabaseService(std::shared_ptr<SQLite::Database> dbState) {
 }
 
 tl::expected<void, DatabaseServiceError> DatabaseService::up() {
-  SQLite::Statement query{
-      *this->db_,
-      "CREATE TABLE Torrents(name TEXT NOT NULL, hashinfo TEXT NOT NULL, "
-      "CONSTRAINT Torrents_PK PRIMARY KEY(hashinfo));"};
-
-  int d = query.exec();
-  Logger::log(fmt::format("applied migration: {}", d));
+  try {
+    SQLite::Statement query{
+        *this->db_,
+        "CREATE TABLE IF NOT EXISTS Torrents(name TEXT NOT NULL, "
+        "hashinfo TEXT NOT NULL, CONSTRAINT Torrents_PK PRIMARY "
+        "KEY(hashinfo));"};
+
+    int d = query.exec();
+    Logger::log(fmt::format("applied migration: {}", d));
+
+    SQLite::Statement peers{
+        *this->db_,
+        "CREATE TABLE IF NOT EXISTS Peers(hashinfo TEXT NOT NULL, "
+        "ip TEXT NOT NULL, port INTEGER NOT NULL, "
+        "bytesPerSecond REAL NOT NULL, lastSeen INTEGER NOT NULL, "
+        "CONSTRAINT Peers_PK PRIMARY KEY(hashinfo, ip, port));"};
+
+    d = peers.exec();
+    Logger::log(fmt::format("applied migration: {}", d));
+
+    SQLite::Statement dht_nodes{
+        *this->db_,
+        "CREATE TABLE IF NOT EXISTS DhtNodes(ip TEXT NOT NULL, "
+        "port INTEGER NOT NULL, "
+        "CONSTRAINT DhtNodes_PK PRIMARY KEY(ip, port));"};
+
+    d = dht_nodes.exec();
+    Logger::log(fmt::format("applied migration: {}", d));
+  } catch (const std::exception& e) {
+    Logger::log(fmt::format("failed to apply migrations: {}", e.what()));
+    return tl::unexpected(DatabaseServiceError::kUpdateError);
+  }
   return {};
 }
 
@@ -81,3 +121,109 @@ tl::expected<TorrentRecord, DatabaseServiceError> DatabaseService::getTorrent(
 
   return {};
 }
+
+/**
+ * Replaces the cached peers of the torrent in a single transaction, so a
+ * crash never leaves a half-written list behind.
+ */
+tl::expected<void, DatabaseServiceError> DatabaseService::storePeers(
+    std::string hashinfo, std::vector<CachedPeerRecord> peers) {
+  try {
+    SQLite::Transaction transaction{*this->db_};
+
+    SQLite::Statement clear{*this->db_, "DELETE FROM Peers WHERE hashinfo = ?"};
+    clear.bind(1, hashinfo);
+    clear.exec();
+
+    SQLite::Statement insert{
+        *this->db_,
+        "INSERT INTO Peers (hashinfo, ip, port, bytesPerSecond, lastSeen) "
+        "VALUES (?, ?, ?, ?, ?)"};
+    for (const CachedPeerRecord& peer : peers) {
+      insert.bind(1, hashinfo);
+      insert.bind(2, peer.ip);
+      insert.bind(3, peer.port);
+      insert.bind(4, peer.bytesPerSecond);
+      insert.bind(5, peer.lastSeen);
+      insert.exec();
+      insert.reset();
+    }
+
+    transaction.commit();
+  } catch (const std::exception& e) {
+    Logger::log(fmt::format("failed to store peers: {}", e.what()));
+    return tl::unexpected(DatabaseServiceError::kInsertError);
+  }
+  return {};
+}
+
+tl::expected<std::vector<CachedPeerRecord>, DatabaseServiceError>
+DatabaseService::getPeers(std::string hashinfo, int limit) {
+  std::vector<CachedPeerRecord> peers;
+  try {
+    SQLite::Statement query{
+        *this->db_,
+        "SELECT ip, port, bytesPerSecond, lastSeen FROM Peers "
+        "WHERE hashinfo = ? ORDER BY bytesPerSecond DESC, lastSeen DESC "
+        "LIMIT ?"};
+
+    query.bind(1, hashinfo);
+    query.bind(2, limit);
+
+    while (query.executeStep()) {
+      peers.push_back(CachedPeerRecord{
+          .ip = query.getColumn(0).getString(),
+          .port = query.getColumn(1).getInt(),
+          .bytesPerSecond = query.getColumn(2).getDouble(),
+          .lastSeen = query.getColumn(3).getInt64()});
+    }
+  } catch (const std::exception& e) {
+    Logger::log(fmt::format("failed to load peers: {}", e.what()));
+    return tl::unexpected(DatabaseServiceError::kQueryError);
+  }
+  return peers;
+}
+
+tl::expected<void, DatabaseServiceError> DatabaseService::storeDhtNodes(
+    std::vector<CachedDhtNode> nodes) {
+  try {
+    SQLite::Transaction transaction{*this->db_};
+
+    SQLite::Statement clear{*this->db_, "DELETE FROM DhtNodes"};
+    clear.exec();
+
+    SQLite::Statement insert{
+        *this->db_, "INSERT OR IGNORE INTO DhtNodes (ip, port) VALUES (?, ?)"};
+    for (const CachedDhtNode& node : nodes) {
+      insert.bind(1, node.ip);
+      insert.bind(2, node.port);
+      insert.exec();
+      insert.reset();
+    }
+
+    transaction.commit();
+  } catch (const std::exception& e) {
+    Logger::log(fmt::format("failed to store DHT nodes: {}", e.what()));
+    return tl::unexpected(DatabaseServiceError::kInsertError);
+  }
+  return {};
+}
+
+tl::expected<std::vector<CachedDhtNode>, DatabaseServiceError>
+DatabaseService::getDhtNodes(int limit) {
+  std::vector<CachedDhtNode> nodes;
+  try {
+    SQLite::Statement query{*this->db_,
+                            "SELECT ip, port FROM DhtNodes LIMIT ?"};
+    query.bind(1, limit);
+
+    while (query.executeStep()) {
+      nodes.push_back(CachedDhtNode{.ip = query.getColumn(0).getString(),
+                                    .port = query.getColumn(1).getInt()});
+    }
+  } catch (const std::exception& e) {
+    Logger::log(fmt::format("failed to load DHT nodes: {}", e.what()));
+    return tl::unexpected(DatabaseServiceError::kQueryError);
+  }
+  return nodes;
+}
@@ -4,9 +4,11 @@
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <sqlite3.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <tl/expected.hpp>
+#include <vector>
 
 enum class DatabaseServiceError {
   kOpenError,
@@ -20,6 +22,21 @@ struct TorrentRecord {
   std::string name;
 };
 
+// A peer that served a torrent, kept to reconnect to it on restart.
+struct CachedPeerRecord {
+  std::string ip;
+  int port = 0;
+  double bytesPerSecond = 0;
+  // Unix time of the last session with the peer.
+  int64_t lastSeen = 0;
+};
+
+// A DHT node we knew, kept to bootstrap from on the next run.
+struct CachedDhtNode {
+  std::string ip;
+  int port = 0;
+};
+
 // SQLiteDeleter functor to properly close the SQLite connection
 struct SQLiteDeleter {
   void operator()(sqlite3* db) const {
@@ -42,6 +59,22 @@ class DatabaseService {
   virtual tl::expected<TorrentRecord, DatabaseServiceError> getTorrent(
       std::string hashinfo);
 
+  // Replaces the cached peers of the torrent.
+  virtual tl::expected<void, DatabaseServiceError> storePeers(
+      std::string hashinfo, std::vector<CachedPeerRecord> peers);
+
+  // The `limit` best cached peers of the torrent, fastest and most recently
+  // seen first.
+  virtual tl::expected<std::vector<CachedPeerRecord>, DatabaseServiceError>
+  getPeers(std::string hashinfo, int limit);
+
+  // Replaces the cached DHT nodes.
+  virtual tl::expected<void, DatabaseServiceError> storeDhtNodes(
+      std::vector<CachedDhtNode> nodes);
+
+  virtual tl::expected<std::vector<CachedDhtNode>, DatabaseServiceError>
+  getDhtNodes(int limit);
+
   virtual tl::expected<void, DatabaseServiceError> up();
 
   // deconsutrctor
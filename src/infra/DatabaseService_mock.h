@@ -15,4 +15,18 @@ class MockDatabaseService : public DatabaseService {
 
   MOCK_METHOD((tl::expected<TorrentRecord, DatabaseServiceError>), getTorrent,
               (std::string), (override));
+
+  MOCK_METHOD((tl::expected<void, DatabaseServiceError>), storePeers,
+              (std::string, std::vector<CachedPeerRecord>), (override));
+
+  MOCK_METHOD((tl::expected<std::vector<CachedPeerRecord>,
+                            DatabaseServiceError>),
+              getPeers, (std::string, int), (override));
+
+  MOCK_METHOD((tl::expected<void, DatabaseServiceError>), storeDhtNodes,
+              (std::vector<CachedDhtNode>), (override));
+
+  MOCK_METHOD((tl::expected<std::vector<CachedDhtNode>,
+                            DatabaseServiceError>),
+              getDhtNodes, (int), (override));
 };
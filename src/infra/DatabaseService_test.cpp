@@ -26,3 +26,38 @@ TEST(DatabaseService, InsertOneAndGetOne) {
   EXPECT_EQ(obj->id, mock_hash);
   EXPECT_EQ(obj->name, mock_torrent_name);
 }
+
+TEST(DatabaseService, StorePeersReplacesTheCachedPeers) {
+  auto db = initDB(":memory:");
+  DatabaseService database_svc = DatabaseService(db);
+  database_svc.up();
+
+  database_svc.storePeers("mockHash", {{"10.0.0.1", 6881, 100, 10},
+                                       {"10.0.0.2", 6881, 500, 20}});
+  database_svc.storePeers("otherHash", {{"10.0.0.3", 6881, 900, 30}});
+  database_svc.storePeers("mockHash", {{"10.0.0.1", 6881, 100, 10},
+                                       {"10.0.0.4", 6881, 100, 40},
+                                       {"10.0.0.5", 6881, 300, 50}});
+
+  auto peers = database_svc.getPeers("mockHash", 2);
+  ASSERT_TRUE(peers.has_value());
+  ASSERT_EQ(peers->size(), 2);
+  EXPECT_EQ((*peers)[0].ip, "10.0.0.5");
+  EXPECT_EQ((*peers)[1].ip, "10.0.0.4");
+  EXPECT_EQ((*peers)[1].lastSeen, 40);
+}
+
+TEST(DatabaseService, StoreDhtNodesReplacesTheCachedNodes) {
+  auto db = initDB(":memory:");
+  DatabaseService database_svc = DatabaseService(db);
+  database_svc.up();
+
+  database_svc.storeDhtNodes({{"10.0.0.1", 6881}, {"10.0.0.2", 6881}});
+  database_svc.storeDhtNodes({{"10.0.0.3", 6881}, {"10.0.0.3", 6881}});
+
+  auto nodes = database_svc.getDhtNodes(10);
+  ASSERT_TRUE(nodes.has_value());
+  ASSERT_EQ(nodes->size(), 1);
+  EXPECT_EQ((*nodes)[0].ip, "10.0.0.3");
+  EXPECT_EQ((*nodes)[0].port, 6881);
+}
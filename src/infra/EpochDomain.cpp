@@ -0,0 +1,134 @@
+#include "infra/EpochDomain.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+struct ThreadEntry {
+  const EpochDomain::Slots* owner;
+  std::shared_ptr<EpochDomain::Slots> keepAlive;
+  EpochDomain::Slot* slot;
+  // Guards may nest; only the outermost one publishes an epoch.
+  int depth = 0;
+};
+
+namespace {
+// Slots claimed by the current thread, one per domain it has read from.
+struct ThreadSlots {
+  std::vector<std::unique_ptr<ThreadEntry>> entries;
+
+  ~ThreadSlots() {
+    for (auto& entry : entries) {
+      entry->slot->epoch.store(0, std::memory_order_release);
+      entry->slot->claimed.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ThreadSlots thread_slots;
+
+ThreadEntry* threadEntry(const std::shared_ptr<EpochDomain::Slots>& slots) {
+  for (auto& entry : thread_slots.entries) {
+    if (entry->owner == slots.get()) {
+      return entry.get();
+    }
+  }
+
+  // First read from this domain on this thread: claim a free slot. This is
+  // the only read-modify-write a reader ever does.
+  for (auto& slot : slots->slots) {
+    bool expected = false;
+    if (!slot.claimed.load(std::memory_order_relaxed) &&
+        slot.claimed.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire)) {
+      thread_slots.entries.push_back(std::make_unique<ThreadEntry>(
+          ThreadEntry{slots.get(), slots, &slot}));
+      return thread_slots.entries.back().get();
+    }
+  }
+  throw std::runtime_error("EpochDomain: too many reader threads");
+}
+}  // namespace
+
+EpochDomain::EpochDomain() : slots_(std::make_shared<Slots>()) {}
+
+EpochDomain::~EpochDomain() {
+  // Nobody can be reading any more; run whatever is left.
+  std::lock_guard<std::mutex> guard(retireLock_);
+  for (auto& [epoch, deleter] : retired_) {
+    deleter();
+  }
+}
+
+/**
+ * Enters a read-side critical section. The slot store is sequentially
+ * consistent, so a writer that swaps the pointer afterwards and then scans
+ * the slots is guaranteed to see this reader's epoch.
+ */
+EpochDomain::Guard::Guard(const EpochDomain& domain)
+    : entry_(threadEntry(domain.slots_)) {
+  if (entry_->depth++ == 0) {
+    // Acquire: a reader that sees the epoch bumped by retire() also sees
+    // the pointer swap that preceded it.
+    entry_->slot->epoch.store(
+        domain.globalEpoch_.load(std::memory_order_acquire),
+        std::memory_order_seq_cst);
+  }
+}
+
+EpochDomain::Guard::~Guard() {
+  if (--entry_->depth == 0) {
+    entry_->slot->epoch.store(0, std::memory_order_release);
+  }
+}
+
+void EpochDomain::retire(std::function<void()> deleter) {
+  std::lock_guard<std::mutex> guard(retireLock_);
+  // Readers that may still see the retired data entered at or before the
+  // current epoch; readers entering from now on get a later one.
+  retired_.emplace_back(globalEpoch_.fetch_add(1, std::memory_order_seq_cst),
+                        std::move(deleter));
+}
+
+void EpochDomain::reclaim() {
+  std::vector<std::function<void()>> ready;
+  {
+    std::lock_guard<std::mutex> guard(retireLock_);
+    const uint64_t oldest = oldestActiveEpoch();
+    std::erase_if(retired_, [&](auto& retired) {
+      if (retired.first < oldest) {
+        ready.push_back(std::move(retired.second));
+        return true;
+      }
+      return false;
+    });
+  }
+  for (auto& deleter : ready) {
+    deleter();
+  }
+}
+
+size_t EpochDomain::pendingReclaims() {
+  std::lock_guard<std::mutex> guard(retireLock_);
+  return retired_.size();
+}
+
+/**
+ * Smallest epoch a reader is currently in, or UINT64_MAX if no reader is
+ * inside a Guard.
+ */
+uint64_t EpochDomain::oldestActiveEpoch() const {
+  uint64_t oldest = UINT64_MAX;
+  for (const auto& slot : slots_->slots) {
+    uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+    if (epoch != 0 && epoch < oldest) {
+      oldest = epoch;
+    }
+  }
+  return oldest;
+}
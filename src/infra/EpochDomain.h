@@ -0,0 +1,74 @@
+#ifndef BITTORRENTCLIENT_EPOCHDOMAIN_H
+#define BITTORRENTCLIENT_EPOCHDOMAIN_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Epoch-based reclamation for read-mostly data published through an atomic
+ * pointer. Readers wrap their accesses in a Guard, which costs two plain
+ * atomic stores to a per-thread slot: no locks and no read-modify-writes.
+ * Writers swap in a new version and retire() the old one; it is destroyed
+ * by reclaim() once no reader that could still see it is inside a Guard.
+ *
+ * Each thread claims a slot the first time it reads (up to kMaxThreads at
+ * once) and gives it back when it exits.
+ */
+class EpochDomain {
+ public:
+  static constexpr size_t kMaxThreads = 1024;
+
+  EpochDomain();
+  ~EpochDomain();
+
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  class Guard {
+   public:
+    explicit Guard(const EpochDomain& domain);
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    struct ThreadEntry* entry_;
+  };
+
+  // Schedules `deleter` to run once every reader that entered a Guard
+  // before this call has left it.
+  void retire(std::function<void()> deleter);
+  // Runs the deleters that are safe to run now.
+  void reclaim();
+  size_t pendingReclaims();
+
+  struct Slot {
+    // Epoch the reader entered at, or 0 outside of a Guard.
+    alignas(64) std::atomic<uint64_t> epoch = 0;
+    std::atomic<bool> claimed = false;
+  };
+  struct Slots {
+    std::array<Slot, kMaxThreads> slots;
+  };
+
+ private:
+  // Shared with the threads holding a slot, so that a thread exiting after
+  // the domain is destroyed can still release its slot.
+  std::shared_ptr<Slots> slots_;
+  std::atomic<uint64_t> globalEpoch_ = 1;
+
+  std::mutex retireLock_;
+  std::vector<std::pair<uint64_t, std::function<void()>>> retired_;
+
+  uint64_t oldestActiveEpoch() const;
+};
+
+#endif  // BITTORRENTCLIENT_EPOCHDOMAIN_H
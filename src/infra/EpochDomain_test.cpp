@@ -0,0 +1,61 @@
+#include "infra/EpochDomain.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+TEST(EpochDomain, ReclaimsImmediatelyWithoutReaders) {
+  EpochDomain epochs;
+  bool deleted = false;
+
+  epochs.retire([&] { deleted = true; });
+  epochs.reclaim();
+
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(epochs.pendingReclaims(), 0);
+}
+
+TEST(EpochDomain, WaitsForReadersThatMaySeeRetiredData) {
+  EpochDomain epochs;
+  bool deleted = false;
+
+  {
+    EpochDomain::Guard outer(epochs);
+    {
+      // Nested guards keep the outer epoch.
+      EpochDomain::Guard inner(epochs);
+    }
+    epochs.retire([&] { deleted = true; });
+    epochs.reclaim();
+    EXPECT_FALSE(deleted);
+  }
+
+  epochs.reclaim();
+  EXPECT_TRUE(deleted);
+}
+
+TEST(EpochDomain, ReadersEnteringLaterDoNotDelayReclaim) {
+  EpochDomain epochs;
+  bool deleted = false;
+
+  epochs.retire([&] { deleted = true; });
+  EpochDomain::Guard guard(epochs);
+  epochs.reclaim();
+
+  EXPECT_TRUE(deleted);
+}
+
+TEST(EpochDomain, ExitingThreadsReleaseTheirSlots) {
+  EpochDomain epochs;
+
+  // More threads over time than there are slots.
+  for (size_t i = 0; i < EpochDomain::kMaxThreads + 8; i++) {
+    std::thread([&] { EpochDomain::Guard guard(epochs); }).join();
+  }
+
+  bool deleted = false;
+  epochs.retire([&] { deleted = true; });
+  epochs.reclaim();
+  EXPECT_TRUE(deleted);
+}
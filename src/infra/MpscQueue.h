@@ -0,0 +1,120 @@
+#ifndef BITTORRENTCLIENT_MPSCQUEUE_H
+#define BITTORRENTCLIENT_MPSCQUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+/**
+ * Unbounded lock-free multi-producer, single-consumer queue (Vyukov's
+ * node-based design). Producers publish with a single atomic exchange and
+ * never wait on each other or on the consumer. Only one thread may pop.
+ *
+ * pop() blocks when the queue is empty using an atomic wait on a counter
+ * bumped by every push, so an idle consumer sleeps instead of spinning.
+ * Once the queue is closed, pop() returns a default-constructed item instead
+ * of waiting for more.
+ */
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue();
+  ~MpscQueue();
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // May be called from any thread.
+  void push(T item);
+  void close();
+
+  // Consumer only.
+  std::optional<T> tryPop();
+  T pop();
+
+ private:
+  struct Node {
+    std::atomic<Node*> next = nullptr;
+    std::optional<T> value;
+  };
+
+  // Producers append at head_, the consumer removes from tail_, which always
+  // points to an already consumed (or stub) node.
+  alignas(64) std::atomic<Node*> head_;
+  alignas(64) Node* tail_;
+  alignas(64) std::atomic<uint32_t> pushes_ = 0;
+  std::atomic<bool> closed_ = false;
+};
+
+template <typename T>
+MpscQueue<T>::MpscQueue() {
+  Node* stub = new Node();
+  head_.store(stub, std::memory_order_relaxed);
+  tail_ = stub;
+}
+
+template <typename T>
+MpscQueue<T>::~MpscQueue() {
+  while (tail_) {
+    Node* next = tail_->next.load(std::memory_order_relaxed);
+    delete tail_;
+    tail_ = next;
+  }
+}
+
+template <typename T>
+void MpscQueue<T>::push(T item) {
+  Node* node = new Node();
+  node->value.emplace(std::move(item));
+
+  Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+  previous->next.store(node, std::memory_order_release);
+
+  pushes_.fetch_add(1, std::memory_order_release);
+  pushes_.notify_one();
+}
+
+template <typename T>
+void MpscQueue<T>::close() {
+  closed_.store(true, std::memory_order_release);
+  pushes_.fetch_add(1, std::memory_order_release);
+  pushes_.notify_all();
+}
+
+template <typename T>
+std::optional<T> MpscQueue<T>::tryPop() {
+  Node* next = tail_->next.load(std::memory_order_acquire);
+  if (!next) {
+    return std::nullopt;
+  }
+
+  std::optional<T> item = std::move(next->value);
+  next->value.reset();
+  delete tail_;
+  tail_ = next;
+  return item;
+}
+
+template <typename T>
+T MpscQueue<T>::pop() {
+  while (true) {
+    if (std::optional<T> item = tryPop()) {
+      return std::move(*item);
+    }
+
+    // A producer that has exchanged head_ but not linked its node yet bumps
+    // the counter afterwards, so waiting on the value read here cannot miss
+    // it.
+    uint32_t seen = pushes_.load(std::memory_order_acquire);
+    if (std::optional<T> item = tryPop()) {
+      return std::move(*item);
+    }
+    if (closed_.load(std::memory_order_acquire)) {
+      return T{};
+    }
+    pushes_.wait(seen, std::memory_order_acquire);
+  }
+}
+
+#endif  // BITTORRENTCLIENT_MPSCQUEUE_H
@@ -0,0 +1,74 @@
+#include "infra/MpscQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(MpscQueue, PopsInPushOrder) {
+  MpscQueue<int> queue;
+  EXPECT_FALSE(queue.tryPop().has_value());
+
+  queue.push(1);
+  queue.push(2);
+  queue.push(3);
+
+  EXPECT_EQ(queue.pop(), 1);
+  EXPECT_EQ(queue.tryPop(), 2);
+  EXPECT_EQ(queue.pop(), 3);
+  EXPECT_FALSE(queue.tryPop().has_value());
+}
+
+TEST(MpscQueue, HoldsMoveOnlyItems) {
+  MpscQueue<std::unique_ptr<int>> queue;
+  queue.push(std::make_unique<int>(7));
+
+  EXPECT_EQ(*queue.pop(), 7);
+}
+
+TEST(MpscQueue, KeepsPerProducerOrderAcrossThreads) {
+  constexpr int kProducers = 4;
+  constexpr int kItems = 20000;
+  MpscQueue<std::pair<int, int>> queue;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&queue, p] {
+      for (int i = 0; i < kItems; i++) {
+        queue.push({p, i});
+      }
+    });
+  }
+
+  // Blocks in pop() whenever the producers fall behind.
+  std::vector<int> next(kProducers, 0);
+  for (int n = 0; n < kProducers * kItems; n++) {
+    auto [producer, item] = queue.pop();
+    ASSERT_EQ(item, next[producer]);
+    next[producer]++;
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_FALSE(queue.tryPop().has_value());
+}
+
+TEST(MpscQueue, CloseWakesTheConsumer) {
+  MpscQueue<int> queue;
+  queue.push(1);
+
+  int popped = -1;
+  std::thread consumer([&queue, &popped] {
+    queue.pop();
+    popped = queue.pop();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  queue.close();
+  consumer.join();
+
+  EXPECT_EQ(popped, 0);
+  EXPECT_EQ(queue.pop(), 0);
+}
@@ -0,0 +1,109 @@
+#include "infra/TimerService.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+TimerService::TimerService(std::chrono::milliseconds tick)
+    : tick_(tick), start_(std::chrono::steady_clock::now()) {
+  thread_ = std::thread([this] { run(); });
+}
+
+TimerService::~TimerService() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+/**
+ * Runs `callback` on the timer thread once `delay` has elapsed. The
+ * deadline is rounded up to the next tick.
+ */
+TimerId TimerService::schedule(std::chrono::steady_clock::duration delay,
+                               Callback callback) {
+  auto deadline = std::chrono::steady_clock::now() + delay;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  uint64_t slot;
+  if (!freeCallbacks_.empty()) {
+    slot = freeCallbacks_.back();
+    freeCallbacks_.pop_back();
+    callbacks_[slot] = std::move(callback);
+  } else {
+    slot = callbacks_.size();
+    callbacks_.push_back(std::move(callback));
+  }
+
+  bool was_idle = wheel_.size() == 0;
+  if (was_idle) {
+    // Catches up with the time spent idle; nothing can expire on the way.
+    std::vector<uint64_t> none;
+    wheel_.advance(ticksAt(deadline - delay), none);
+  }
+  TimerId id = wheel_.arm(ticksAt(deadline) + 1, slot);
+  if (was_idle) {
+    cond_.notify_one();
+  }
+  return id;
+}
+
+bool TimerService::cancel(TimerId id) {
+  std::lock_guard<std::mutex> guard(lock_);
+  uint64_t slot;
+  if (!wheel_.cancel(id, &slot)) {
+    return false;
+  }
+  callbacks_[slot] = nullptr;
+  freeCallbacks_.push_back(slot);
+  return true;
+}
+
+size_t TimerService::pending() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return wheel_.size();
+}
+
+uint64_t TimerService::ticksAt(
+    std::chrono::steady_clock::time_point time) const {
+  return (time - start_) / tick_;
+}
+
+void TimerService::run() {
+  std::vector<uint64_t> expired;
+  std::vector<Callback> batch;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      // Sleeps without waking up every tick while there is nothing to do.
+      if (wheel_.size() == 0) {
+        cond_.wait(lock, [this] { return stopped_ || wheel_.size() > 0; });
+      } else {
+        cond_.wait_for(lock, tick_, [this] { return stopped_; });
+      }
+      if (stopped_) {
+        return;
+      }
+
+      wheel_.advance(ticksAt(std::chrono::steady_clock::now()), expired);
+      for (uint64_t slot : expired) {
+        batch.push_back(std::move(callbacks_[slot]));
+        callbacks_[slot] = nullptr;
+        freeCallbacks_.push_back(slot);
+      }
+      expired.clear();
+    }
+
+    for (Callback& callback : batch) {
+      callback();
+    }
+    batch.clear();
+  }
+}
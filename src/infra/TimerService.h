@@ -0,0 +1,59 @@
+#ifndef BITTORRENTCLIENT_TIMERSERVICE_H
+#define BITTORRENTCLIENT_TIMERSERVICE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "infra/TimerWheel.h"
+
+/**
+ * Thread safe timer service shared by the whole client. Deadlines (block
+ * requests, handshakes, keep-alives, re-announces) are kept in a single
+ * TimerWheel driven by a background thread at `tick` resolution. Callbacks
+ * of all the timers that expire on the same tick are collected under the
+ * lock and then run as one batch on the timer thread, outside of it, so
+ * callbacks may arm and cancel timers freely.
+ */
+class TimerService {
+ public:
+  using Callback = std::function<void()>;
+
+  explicit TimerService(
+      std::chrono::milliseconds tick = std::chrono::milliseconds(10));
+  ~TimerService();
+
+  TimerService(const TimerService&) = delete;
+  TimerService& operator=(const TimerService&) = delete;
+
+  TimerId schedule(std::chrono::steady_clock::duration delay,
+                   Callback callback);
+  // Returns false if the timer has already fired (or is firing).
+  bool cancel(TimerId id);
+
+  size_t pending();
+
+ private:
+  const std::chrono::milliseconds tick_;
+  const std::chrono::steady_clock::time_point start_;
+
+  std::mutex lock_;
+  std::condition_variable cond_;
+  bool stopped_ = false;
+
+  TimerWheel wheel_;
+  // Callbacks are stored in a slab indexed by the timer payload.
+  std::vector<Callback> callbacks_;
+  std::vector<uint64_t> freeCallbacks_;
+
+  std::thread thread_;
+
+  uint64_t ticksAt(std::chrono::steady_clock::time_point time) const;
+  void run();
+};
+
+#endif  // BITTORRENTCLIENT_TIMERSERVICE_H
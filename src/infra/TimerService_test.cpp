@@ -0,0 +1,34 @@
+#include "infra/TimerService.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using std::chrono::milliseconds;
+
+TEST(TimerService, RunsScheduledCallbacks) {
+  TimerService timers(milliseconds(1));
+  std::atomic<int> fired = 0;
+
+  timers.schedule(milliseconds(5), [&] { fired++; });
+  timers.schedule(milliseconds(10), [&] { fired++; });
+
+  for (int i = 0; i < 500 && fired < 2; i++) {
+    std::this_thread::sleep_for(milliseconds(2));
+  }
+  EXPECT_EQ(fired, 2);
+  EXPECT_EQ(timers.pending(), 0);
+}
+
+TEST(TimerService, CancelledCallbacksDoNotRun) {
+  TimerService timers(milliseconds(1));
+  std::atomic<bool> fired = false;
+
+  TimerId id = timers.schedule(milliseconds(20), [&] { fired = true; });
+  EXPECT_TRUE(timers.cancel(id));
+
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_FALSE(fired);
+}
@@ -0,0 +1,169 @@
+#include "infra/TimerWheel.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+// Timers further away than the outermost level can reach are parked at its
+// far end and re-linked when they get there.
+constexpr uint64_t kMaxSpan = (uint64_t{1} << 32) - 1;
+}  // namespace
+
+TimerWheel::TimerWheel(uint64_t now) : now_(now) { buckets_.fill(kNil); }
+
+TimerId TimerWheel::arm(uint64_t deadline, uint64_t payload) {
+  uint32_t index;
+  if (freeList_ != kNil) {
+    index = freeList_;
+    freeList_ = nodes_[index].next;
+  } else {
+    index = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+  }
+
+  Node& node = nodes_[index];
+  node.deadline = deadline > now_ ? deadline : now_ + 1;
+  node.payload = payload;
+  link(index);
+  size_++;
+
+  return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+bool TimerWheel::cancel(TimerId id, uint64_t* payload) {
+  auto index = static_cast<uint32_t>(id);
+  auto generation = static_cast<uint32_t>(id >> 32);
+  if (index >= nodes_.size()) {
+    return false;
+  }
+
+  Node& node = nodes_[index];
+  if (node.generation != generation || node.bucket == kNil) {
+    return false;
+  }
+
+  if (payload) {
+    *payload = node.payload;
+  }
+  unlink(index);
+  release(index);
+  return true;
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<uint64_t>& expired) {
+  while (now_ < now) {
+    if (size_ == 0) {
+      now_ = now;
+      return;
+    }
+
+    // Nothing can expire before the lowest occupied level wraps around,
+    // so jump to the tick just before that.
+    int lowest = 0;
+    while (levelSizes_[lowest] == 0) {
+      lowest++;
+    }
+    if (lowest > 0) {
+      uint64_t span = uint64_t{1} << (kSlotBits * lowest);
+      uint64_t boundary = (now_ | (span - 1)) + 1;
+      if (boundary > now) {
+        now_ = now;
+        return;
+      }
+      now_ = boundary - 1;
+    }
+
+    now_++;
+
+    // Refill the lower levels from every level that just wrapped around,
+    // starting with the outermost one.
+    int wrapped = 0;
+    while (wrapped + 1 < kLevels &&
+           (now_ & ((uint64_t{1} << (kSlotBits * (wrapped + 1))) - 1)) == 0) {
+      wrapped++;
+    }
+    for (int level = wrapped; level > 0; level--) {
+      cascade(level);
+    }
+
+    uint32_t index = detach(now_ & (kSlots - 1));
+    while (index != kNil) {
+      uint32_t next = nodes_[index].next;
+      if (nodes_[index].deadline > now_) {
+        link(index);
+      } else {
+        expired.push_back(nodes_[index].payload);
+        release(index);
+      }
+      index = next;
+    }
+  }
+}
+
+void TimerWheel::link(uint32_t index) {
+  Node& node = nodes_[index];
+
+  uint64_t delta = node.deadline > now_ ? node.deadline - now_ : 0;
+  uint64_t target = delta > kMaxSpan ? now_ + kMaxSpan : node.deadline;
+
+  int level = 0;
+  while (level + 1 < kLevels &&
+         delta >= (uint64_t{1} << (kSlotBits * (level + 1)))) {
+    level++;
+  }
+
+  uint32_t slot = (target >> (kSlotBits * level)) & (kSlots - 1);
+  levelSizes_[level]++;
+  node.bucket = level * kSlots + slot;
+  node.prev = kNil;
+  node.next = buckets_[node.bucket];
+  if (node.next != kNil) {
+    nodes_[node.next].prev = index;
+  }
+  buckets_[node.bucket] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+  Node& node = nodes_[index];
+  levelSizes_[node.bucket / kSlots]--;
+  if (node.prev != kNil) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    buckets_[node.bucket] = node.next;
+  }
+  if (node.next != kNil) {
+    nodes_[node.next].prev = node.prev;
+  }
+}
+
+void TimerWheel::release(uint32_t index) {
+  Node& node = nodes_[index];
+  node.generation++;
+  node.bucket = kNil;
+  node.prev = kNil;
+  node.next = freeList_;
+  freeList_ = index;
+  size_--;
+}
+
+/**
+ * Empties a slot and returns the first node of the list it held.
+ */
+uint32_t TimerWheel::detach(uint32_t bucket) {
+  uint32_t head = buckets_[bucket];
+  buckets_[bucket] = kNil;
+  for (uint32_t index = head; index != kNil; index = nodes_[index].next) {
+    levelSizes_[bucket / kSlots]--;
+  }
+  return head;
+}
+
+void TimerWheel::cascade(int level) {
+  uint32_t index = detach(level * kSlots +
+                          ((now_ >> (kSlotBits * level)) & (kSlots - 1)));
+  while (index != kNil) {
+    uint32_t next = nodes_[index].next;
+    link(index);
+    index = next;
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef BITTORRENTCLIENT_TIMERWHEEL_H
+#define BITTORRENTCLIENT_TIMERWHEEL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Identifies an armed timer: the node index in the low 32 bits and the
+// node's generation in the high 32 bits, so stale ids are never confused
+// with a timer that later reused the same node.
+using TimerId = uint64_t;
+
+/**
+ * Hierarchical timing wheel (Varghese & Lauck). Time is measured in ticks.
+ * Each level has 256 slots; a timer is placed on the lowest level whose
+ * range covers its deadline and moves down a level whenever the level
+ * below wraps around. Arming and cancelling are O(1). Advancing skips over
+ * stretches in which the lower levels are empty, so its cost depends on the
+ * number of timers that expire or cascade rather than on the elapsed time.
+ *
+ * Timers live in a flat node pool linked by 32-bit indices, so millions of
+ * them can be pending at once. The wheel is not thread safe; see
+ * TimerService for the shared, thread safe wrapper.
+ */
+class TimerWheel {
+ public:
+  explicit TimerWheel(uint64_t now = 0);
+
+  // Arms a timer; `payload` is handed back by advance() once `deadline`
+  // (in ticks) has passed. Deadlines in the past fire on the next tick.
+  TimerId arm(uint64_t deadline, uint64_t payload);
+
+  // Disarms a pending timer. Returns false if it already fired or was
+  // cancelled. The payload of the cancelled timer is stored in `payload`.
+  bool cancel(TimerId id, uint64_t* payload = nullptr);
+
+  // Moves the wheel forward to `now`, appending the payloads of every timer
+  // that expired on the way to `expired`.
+  void advance(uint64_t now, std::vector<uint64_t>& expired);
+
+  uint64_t now() const { return now_; }
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  static constexpr uint32_t kNil = UINT32_MAX;
+
+  struct Node {
+    uint64_t deadline = 0;
+    uint64_t payload = 0;
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    uint32_t generation = 0;
+    // Slot the node is linked into, or kNil when it is free.
+    uint32_t bucket = kNil;
+  };
+
+  std::vector<Node> nodes_;
+  uint32_t freeList_ = kNil;
+  std::array<uint32_t, kLevels * kSlots> buckets_;
+  // Number of timers linked into each level.
+  std::array<size_t, kLevels> levelSizes_{};
+  uint64_t now_;
+  size_t size_ = 0;
+
+  void link(uint32_t index);
+  void unlink(uint32_t index);
+  void release(uint32_t index);
+  uint32_t detach(uint32_t bucket);
+  void cascade(int level);
+};
+
+#endif  // BITTORRENTCLIENT_TIMERWHEEL_H
@@ -0,0 +1,91 @@
+#include "infra/TimerWheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+TEST(TimerWheel, ExpiresTimersAtTheirDeadline) {
+  TimerWheel wheel;
+  wheel.arm(5, 1);
+  wheel.arm(3, 2);
+
+  std::vector<uint64_t> expired;
+  wheel.advance(2, expired);
+  EXPECT_TRUE(expired.empty());
+
+  wheel.advance(3, expired);
+  EXPECT_EQ(expired, std::vector<uint64_t>{2});
+
+  wheel.advance(10, expired);
+  EXPECT_EQ(expired, (std::vector<uint64_t>{2, 1}));
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheel, CascadesFarDeadlines) {
+  TimerWheel wheel;
+  // One deadline per level, plus one beyond the outermost level.
+  const std::vector<uint64_t> deadlines = {200, 70000, 20000000, 5000000000};
+  for (uint64_t deadline : deadlines) {
+    wheel.arm(deadline, deadline);
+  }
+
+  std::vector<uint64_t> expired;
+  for (uint64_t deadline : deadlines) {
+    wheel.advance(deadline - 1, expired);
+    EXPECT_EQ(std::ranges::count(expired, deadline), 0);
+    wheel.advance(deadline, expired);
+    EXPECT_EQ(std::ranges::count(expired, deadline), 1);
+  }
+}
+
+TEST(TimerWheel, CancelledTimersNeverFire) {
+  TimerWheel wheel;
+  TimerId first = wheel.arm(100, 1);
+  wheel.arm(100, 2);
+
+  uint64_t payload = 0;
+  EXPECT_TRUE(wheel.cancel(first, &payload));
+  EXPECT_EQ(payload, 1);
+  EXPECT_FALSE(wheel.cancel(first));
+
+  std::vector<uint64_t> expired;
+  wheel.advance(100, expired);
+  EXPECT_EQ(expired, std::vector<uint64_t>{2});
+}
+
+TEST(TimerWheel, StaleIdDoesNotCancelReusedNode) {
+  TimerWheel wheel;
+  TimerId first = wheel.arm(10, 1);
+  std::vector<uint64_t> expired;
+  wheel.advance(10, expired);
+
+  TimerId second = wheel.arm(20, 2);
+  EXPECT_NE(first, second);
+  EXPECT_FALSE(wheel.cancel(first));
+  EXPECT_TRUE(wheel.cancel(second));
+}
+
+TEST(TimerWheel, PastDeadlinesFireOnNextTick) {
+  TimerWheel wheel(1000);
+  wheel.arm(10, 7);
+
+  std::vector<uint64_t> expired;
+  wheel.advance(1001, expired);
+  EXPECT_EQ(expired, std::vector<uint64_t>{7});
+}
+
+TEST(TimerWheel, HandlesManyTimers) {
+  TimerWheel wheel;
+  const uint64_t count = 1000000;
+  for (uint64_t i = 0; i < count; i++) {
+    wheel.arm(1 + (i * 7919) % 100000, i);
+  }
+  EXPECT_EQ(wheel.size(), count);
+
+  std::vector<uint64_t> expired;
+  wheel.advance(100000, expired);
+  EXPECT_EQ(expired.size(), count);
+  EXPECT_EQ(wheel.size(), 0);
+}
@@ -3,26 +3,47 @@
 #include <fmt/base.h>
 #include <fmt/color.h>
 
+#include <charconv>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <tl/expected.hpp>
 #include <utility>
 
+#include "core/PeerAddressBook.h"
+#include "core/PeerTable.h"
+#include "core/PieceScheduler.h"
 #include "core/TorrentClient.h"
 #include "core/TorrentState.h"
 #include "infra/DatabaseService.h"
 #include "infra/DiskManager.h"
 #include "infra/Logger.h"
-#include "infra/Queue.h"
+#include "infra/TimerService.h"
+#include "network/DhtNode.h"
+#include "network/HttpRangeServer.h"
 #include "utils/TorrentFileParser.h"
 
+#define DHT_PORT 6881
+
 int main(int argc, char* argv[]) {
   int threads = 50;
   std::string download_directory = "./";
 
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <file_path>" << std::endl;
+  int http_port = 0;
+  if (argc == 3) {
+    const std::string_view port = argv[2];
+    auto [end, error] =
+        std::from_chars(port.data(), port.data() + port.size(), http_port);
+    if (error != std::errc() || end != port.data() + port.size() ||
+        http_port < 1 || http_port > 65535) {
+      http_port = 0;
+    }
+  }
+  if ((argc != 2 && argc != 3) || (argc == 3 && http_port == 0)) {
+    std::cerr << "Usage: " << argv[0] << " <file_path> [http_port]"
+              << std::endl;
     return 1;
   }
 
@@ -34,6 +55,10 @@ int main(int argc, char* argv[]) {
   // Database Service
   std::shared_ptr<DatabaseService> database_service =
       std::make_shared<DatabaseService>(database);
+  if (auto migrated = database_service->up(); !migrated) {
+    std::cerr << "Failed to set up the database" << std::endl;
+    return 1;
+  }
 
   // Torrent State
   std::shared_ptr<TorrentState> torrent_state =
@@ -45,23 +70,60 @@ int main(int argc, char* argv[]) {
 
   auto downloaded_file_name = torrent_file_parser->getFileName().value();
 
+  // Knowing the piece count lets the registry recognise seeds
   std::shared_ptr<PeerRegistry> peer_registry =
-      std::make_shared<PeerRegistry>();
+      std::make_shared<PeerRegistry>(
+          torrent_file_parser->splitPieceHashes().value().size());
+
+  // Interns peer ids into the handles used by the registry and piece manager
+  std::shared_ptr<PeerTable> peer_table = std::make_shared<PeerTable>();
 
   std::shared_ptr<DiskManager> disk_manager = std::make_shared<DiskManager>();
 
+  // Timers shared by all connections, the piece manager and the tracker loop
+  std::shared_ptr<TimerService> timer_service =
+      std::make_shared<TimerService>();
+
   // Torrent Piece Manager
   std::shared_ptr<PieceManager> piece_manager = std::make_shared<PieceManager>(
-      torrent_file_parser, peer_registry, disk_manager, downloaded_file_name,
-      threads);
-
-  std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue =
-      std::make_shared<Queue<std::unique_ptr<Peer>>>();
+      torrent_file_parser, peer_registry, disk_manager, timer_service,
+      downloaded_file_name, threads);
+  piece_manager->setPickerMode(PickerMode::kPeerAffine, threads);
+
+  // Single writer of the piece and peer state; connections post events to it
+  std::shared_ptr<PieceScheduler> scheduler =
+      std::make_shared<PieceScheduler>(piece_manager, peer_registry);
+  scheduler->start();
+
+  // Every peer address learnt, handed out best first to the connections
+  std::shared_ptr<PeerAddressBook> address_book =
+      std::make_shared<PeerAddressBook>();
+
+  // Finds peers without a tracker; the client goes on without it if the
+  // port is taken
+  std::shared_ptr<DhtNode> dht = std::make_shared<DhtNode>();
+  if (auto started = dht->start(DHT_PORT); !started) {
+    Logger::log(started.error().message);
+    dht = nullptr;
+  }
 
   // TODO(slim): add where to save torrent
   TorrentClient torrent_client =
-      TorrentClient(std::move(queue), torrent_state, piece_manager,
-                    peer_registry, torrent_file_parser, threads);
+      TorrentClient(std::move(address_book), torrent_state, piece_manager,
+                    peer_registry, peer_table, torrent_file_parser,
+                    timer_service, scheduler, dht, threads);
+
+  // Optionally serves the file over HTTP while it is being downloaded
+  std::unique_ptr<HttpRangeServer> http_server;
+  if (argc == 3) {
+    http_server = std::make_unique<HttpRangeServer>(
+        piece_manager, downloaded_file_name, downloaded_file_name,
+        torrent_file_parser->getFileSize().value());
+    auto started = http_server->start(http_port);
+    if (!started) {
+      Logger::log(started.error().message);
+    }
+  }
 
   Logger::log("Parsing Torrent file " + download_path);
 
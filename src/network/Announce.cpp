@@ -0,0 +1,17 @@
+#include "network/Announce.h"
+
+#include <string>
+
+std::string trackerEventName(TrackerEvent event) {
+  switch (event) {
+    case TrackerEvent::kCompleted:
+      return "completed";
+    case TrackerEvent::kStarted:
+      return "started";
+    case TrackerEvent::kStopped:
+      return "stopped";
+    case TrackerEvent::kNone:
+      break;
+  }
+  return "";
+}
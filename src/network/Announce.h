@@ -0,0 +1,46 @@
+#ifndef BITTORRENTCLIENT_ANNOUNCE_H
+#define BITTORRENTCLIENT_ANNOUNCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "network/Peer.h"
+
+struct TrackerError {
+  std::string message;
+};
+
+// Values match the UDP tracker protocol.
+enum class TrackerEvent : int32_t {
+  kNone = 0,
+  kCompleted = 1,
+  kStarted = 2,
+  kStopped = 3,
+};
+
+// What an announce reports to the tracker, besides who we are.
+struct AnnounceParams {
+  uint64_t downloaded = 0;
+  uint64_t uploaded = 0;
+  uint64_t left = 0;
+  TrackerEvent event = TrackerEvent::kNone;
+  // Number of peers wanted, or -1 to let the tracker decide.
+  int numWant = -1;
+};
+
+struct AnnounceResponse {
+  // Seconds to wait before the next regular announce, and before any
+  // announce at all. 0 when the tracker did not say.
+  int interval = 0;
+  int minInterval = 0;
+  int leechers = 0;
+  int seeders = 0;
+  std::vector<std::unique_ptr<Peer>> peers;
+};
+
+// Name of the event in HTTP announces; empty for kNone.
+std::string trackerEventName(TrackerEvent event);
+
+#endif  // BITTORRENTCLIENT_ANNOUNCE_H
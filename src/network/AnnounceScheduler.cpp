@@ -0,0 +1,107 @@
+#include "network/AnnounceScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+// Peers asked for in a regular announce, and when connection slots are
+// free.
+constexpr int kNumWant = 50;
+constexpr int kNumWantStarved = 200;
+}  // namespace
+
+AnnounceScheduler::AnnounceScheduler(std::shared_ptr<TrackerSet> trackers,
+                                     ProgressFunction progress,
+                                     DemandFunction demand,
+                                     TrackerSet::PeersCallback onPeers,
+                                     std::chrono::milliseconds tick)
+    : trackers_(std::move(trackers)),
+      progress_(std::move(progress)),
+      demand_(std::move(demand)),
+      onPeers_(std::move(onPeers)),
+      tick_(tick) {}
+
+AnnounceScheduler::~AnnounceScheduler() {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (running_) {
+    lock.unlock();
+    stop(std::chrono::milliseconds(0));
+  }
+}
+
+void AnnounceScheduler::start() {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (running_) {
+    return;
+  }
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+}
+
+/**
+ * Lets the running announces finish so that every tracker is free to
+ * receive `stopped`, sends it, then waits for the answers. All of it within
+ * `grace`.
+ */
+void AnnounceScheduler::stop(std::chrono::milliseconds grace) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  wakeUp_.notify_all();
+  thread_.join();
+
+  const auto deadline = TrackerSet::Clock::now() + grace;
+  waitIdle(deadline);
+  trackers_->announce(params(TrackerEvent::kStopped),
+                      [](std::vector<std::unique_ptr<Peer>>) {});
+  waitIdle(deadline);
+}
+
+void AnnounceScheduler::run() {
+  trackers_->announce(params(TrackerEvent::kStarted), onPeers_);
+
+  std::unique_lock<std::mutex> lock(lock_);
+  while (running_) {
+    const auto wake_up =
+        std::min(TrackerSet::Clock::now() + tick_, trackers_->nextDue());
+    wakeUp_.wait_until(lock, wake_up, [this] { return !running_; });
+    if (!running_) {
+      break;
+    }
+    lock.unlock();
+
+    // The trackers that have not answered `completed` yet are sent it
+    AnnounceParams announce = params(TrackerEvent::kNone);
+    if (announce.left == 0) {
+      announce.event = TrackerEvent::kCompleted;
+    }
+    const bool starved = demand_() > 0;
+    announce.numWant = starved ? kNumWantStarved : kNumWant;
+    trackers_->announce(announce, onPeers_, starved);
+
+    lock.lock();
+  }
+}
+
+AnnounceParams AnnounceScheduler::params(TrackerEvent event) const {
+  const TransferProgress progress = progress_();
+  return AnnounceParams{.downloaded = progress.downloaded,
+                        .uploaded = progress.uploaded,
+                        .left = progress.left,
+                        .event = event,
+                        .numWant = kNumWant};
+}
+
+void AnnounceScheduler::waitIdle(TrackerSet::Clock::time_point deadline) const {
+  while (trackers_->inFlight() > 0 && TrackerSet::Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef BITTORRENTCLIENT_ANNOUNCESCHEDULER_H
+#define BITTORRENTCLIENT_ANNOUNCESCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "network/Announce.h"
+#include "network/TrackerSet.h"
+
+struct TransferProgress {
+  uint64_t downloaded = 0;
+  uint64_t uploaded = 0;
+  uint64_t left = 0;
+};
+
+/**
+ * Keeps the trackers of a torrent announced to from a thread of its own, so
+ * that the download never waits on them. Sends `started` first, `completed`
+ * once nothing is left, each until the tracker has answered it, and
+ * `stopped` on stop(). In between, each tracker is announced to when its
+ * interval has passed, or, while more peers are wanted, as soon as its min
+ * interval allows it.
+ */
+class AnnounceScheduler {
+ public:
+  using ProgressFunction = std::function<TransferProgress()>;
+  // Number of peers that could be connected to right now.
+  using DemandFunction = std::function<int()>;
+
+  explicit AnnounceScheduler(
+      std::shared_ptr<TrackerSet> trackers, ProgressFunction progress,
+      DemandFunction demand, TrackerSet::PeersCallback onPeers,
+      std::chrono::milliseconds tick = std::chrono::seconds(1));
+  ~AnnounceScheduler();
+
+  void start();
+  // Announces `stopped` and waits up to `grace` for the trackers to answer.
+  void stop(std::chrono::milliseconds grace = std::chrono::seconds(5));
+
+ private:
+  std::shared_ptr<TrackerSet> trackers_;
+  ProgressFunction progress_;
+  DemandFunction demand_;
+  TrackerSet::PeersCallback onPeers_;
+  const std::chrono::milliseconds tick_;
+
+  std::mutex lock_;
+  std::condition_variable wakeUp_;
+  bool running_ = false;
+  std::thread thread_;
+
+  void run();
+  AnnounceParams params(TrackerEvent event) const;
+  void waitIdle(TrackerSet::Clock::time_point deadline) const;
+};
+
+#endif  // BITTORRENTCLIENT_ANNOUNCESCHEDULER_H
@@ -0,0 +1,122 @@
+#include "network/AnnounceScheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::chrono::milliseconds;
+
+namespace {
+/**
+ * Records every announce it receives and answers with an interval of an
+ * hour and a min interval of a second, so that only events and early
+ * announces reach it again.
+ */
+struct FakeTracker {
+  std::mutex lock;
+  std::vector<AnnounceParams> announces;
+
+  TrackerSet::AnnounceFunction function() {
+    return [this](const std::string&, const AnnounceParams& params)
+               -> tl::expected<AnnounceResponse, TrackerError> {
+      std::lock_guard<std::mutex> guard(lock);
+      announces.push_back(params);
+      AnnounceResponse response;
+      response.interval = 3600;
+      response.minInterval = 1;
+      return response;
+    };
+  }
+
+  std::vector<TrackerEvent> events() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<TrackerEvent> result;
+    for (const AnnounceParams& params : announces) {
+      if (params.event != TrackerEvent::kNone) {
+        result.push_back(params.event);
+      }
+    }
+    return result;
+  }
+};
+
+template <typename Predicate>
+bool eventually(Predicate predicate) {
+  for (int i = 0; i < 600; i++) {
+    if (predicate()) {
+      return true;
+    }
+    std::this_thread::sleep_for(milliseconds(5));
+  }
+  return false;
+}
+}  // namespace
+
+TEST(AnnounceScheduler, SendsLifecycleEvents) {
+  FakeTracker tracker;
+  auto trackers =
+      std::make_shared<TrackerSet>(std::vector<std::vector<std::string>>{
+                                       {"http://a"}},
+                                   tracker.function());
+  std::atomic<uint64_t> left = 100;
+
+  AnnounceScheduler scheduler(
+      trackers, [&] { return TransferProgress{.left = left}; },
+      [] { return 0; }, [](std::vector<std::unique_ptr<Peer>>) {},
+      milliseconds(5));
+  scheduler.start();
+  ASSERT_TRUE(eventually([&] { return tracker.events().size() == 1; }));
+  EXPECT_EQ(tracker.events()[0], TrackerEvent::kStarted);
+
+  left = 0;
+  ASSERT_TRUE(eventually([&] { return tracker.events().size() == 2; }));
+  EXPECT_EQ(tracker.events()[1], TrackerEvent::kCompleted);
+
+  scheduler.stop(milliseconds(500));
+  EXPECT_EQ(tracker.events(),
+            (std::vector<TrackerEvent>{TrackerEvent::kStarted,
+                                       TrackerEvent::kCompleted,
+                                       TrackerEvent::kStopped}));
+}
+
+TEST(AnnounceScheduler, AnnouncesEarlyWhenPeersAreWanted) {
+  FakeTracker tracker;
+  auto trackers =
+      std::make_shared<TrackerSet>(std::vector<std::vector<std::string>>{
+                                       {"http://a"}},
+                                   tracker.function());
+  std::atomic<int> demand = 0;
+
+  AnnounceScheduler scheduler(
+      trackers, [] { return TransferProgress{.left = 100}; },
+      [&] { return demand.load(); },
+      [](std::vector<std::unique_ptr<Peer>>) {}, milliseconds(5));
+  scheduler.start();
+  ASSERT_TRUE(eventually([&] { return tracker.events().size() == 1; }));
+
+  // The interval has not passed, so nothing is sent while no peer is
+  // wanted.
+  std::this_thread::sleep_for(milliseconds(50));
+  {
+    std::lock_guard<std::mutex> guard(tracker.lock);
+    EXPECT_EQ(tracker.announces.size(), 1);
+  }
+
+  demand = 3;
+  ASSERT_TRUE(eventually([&] {
+    std::lock_guard<std::mutex> guard(tracker.lock);
+    return tracker.announces.size() > 1;
+  }));
+  {
+    std::lock_guard<std::mutex> guard(tracker.lock);
+    EXPECT_EQ(tracker.announces[1].event, TrackerEvent::kNone);
+    EXPECT_EQ(tracker.announces[1].numWant, 200);
+  }
+  scheduler.stop(milliseconds(500));
+}
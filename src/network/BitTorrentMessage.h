@@ -16,9 +16,21 @@ enum MessageId {
   kPiece = 7,
   kCancel = 8,
   kPort = 9,
-  kSeeding = 10
+  kSeeding = 10,
+  // Fast Extension (BEP 6)
+  kSuggestPiece = 13,
+  kHaveAll = 14,
+  kHaveNone = 15,
+  kRejectRequest = 16,
+  kAllowedFast = 17,
+  // Extension protocol (BEP 10)
+  kExtended = 20
 };
 
+// Bit of the last reserved handshake byte that advertises the Fast
+// Extension.
+constexpr uint8_t kFastExtensionBit = 0x04;
+
 class BitTorrentMessage {
  private:
   const uint32_t messageLength_;
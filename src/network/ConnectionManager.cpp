@@ -0,0 +1,311 @@
+#include "network/ConnectionManager.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tl/expected.hpp>
+#include <utility>
+#include <vector>
+
+#define EVENT_BATCH 64
+// Connects in flight for each slot waiting.
+#define DIALS_PER_SLOT 4
+// How long a connection no slot asked for is kept.
+#define SPARE_TTL 30  // 30 sec
+// How often the address book is polled while slots wait and no address is
+// ready, and how often connects are checked for their timeout.
+#define DIAL_TICK 50  // 50 ms
+
+ConnectionManager::ConnectionManager(
+    std::shared_ptr<PeerAddressBook> addressBook,
+    std::shared_ptr<UtpSocket> utp, size_t maxHalfOpen,
+    std::chrono::milliseconds connectTimeout)
+    : addressBook_(std::move(addressBook)),
+      utp_(std::move(utp)),
+      maxHalfOpen_(maxHalfOpen),
+      connectTimeout_(connectTimeout) {}
+
+ConnectionManager::~ConnectionManager() { stop(); }
+
+tl::expected<void, ConnectError> ConnectionManager::start() {
+  epollFd_ = epoll_create1(0);
+  wakeFd_ = eventfd(0, EFD_NONBLOCK);
+  epoll_event event{.events = EPOLLIN, .data = {.fd = wakeFd_}};
+  if (epollFd_ < 0 || wakeFd_ < 0 ||
+      epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) != 0) {
+    close(epollFd_);
+    close(wakeFd_);
+    epollFd_ = -1;
+    wakeFd_ = -1;
+    return tl::unexpected(
+        ConnectError{"Failed to create the connection reactor"});
+  }
+
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+  return {};
+}
+
+void ConnectionManager::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  wake();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    established_.clear();
+    utpResults_.clear();
+    // Under the lock: uTP connects that end later check running_ before
+    // waking the reactor up.
+    close(epollFd_);
+    close(wakeFd_);
+    epollFd_ = -1;
+    wakeFd_ = -1;
+  }
+  ready_.notify_all();
+}
+
+/**
+ * Registers the slot as waiting, which lets the reactor start one more
+ * connect, and waits for the first connection established.
+ */
+std::optional<EstablishedConnection> ConnectionManager::acquire() {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (!running_) {
+    return std::nullopt;
+  }
+  waiting_++;
+  wake();
+  ready_.wait(lock,
+              [this] { return !running_ || !established_.empty(); });
+  waiting_--;
+  if (established_.empty()) {
+    return std::nullopt;
+  }
+  EstablishedConnection connection =
+      std::move(established_.front().connection);
+  established_.pop_front();
+  return connection;
+}
+
+void ConnectionManager::run() {
+  std::array<epoll_event, EVENT_BATCH> events;
+  while (running_) {
+    dial();
+    int count = epoll_wait(epollFd_, events.data(), events.size(), DIAL_TICK);
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.fd == wakeFd_) {
+        uint64_t wakeups;
+        [[maybe_unused]] auto drained =
+            read(wakeFd_, &wakeups, sizeof(wakeups));
+      } else {
+        finishTcp(events[i].data.fd);
+      }
+    }
+    handleUtpResults();
+    expire(Clock::now());
+  }
+
+  // Abandoned: the address book is closed along with the manager.
+  for (auto& [sock, dial] : tcpDials_) {
+    close(sock);
+  }
+  tcpDials_.clear();
+  halfOpen_ = 0;
+}
+
+void ConnectionManager::wake() const {
+  const uint64_t one = 1;
+  [[maybe_unused]] auto written = write(wakeFd_, &one, sizeof(one));
+}
+
+/**
+ * Tops up the connects in flight to DIALS_PER_SLOT for each waiting slot
+ * that no established connection is left for, within the half-open limit.
+ */
+void ConnectionManager::dial() {
+  size_t wanted = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (waiting_ > established_.size()) {
+      const size_t dials = (waiting_ - established_.size()) * DIALS_PER_SLOT;
+      wanted = dials > halfOpen_ ? dials - halfOpen_ : 0;
+    }
+  }
+
+  for (; wanted > 0 && halfOpen_ < maxHalfOpen_; wanted--) {
+    auto peer = addressBook_->tryAcquire();
+    if (!peer) {
+      return;
+    }
+    if (!utp_) {
+      startTcp(std::move(peer));
+      continue;
+    }
+
+    // The connect may end after the manager is gone
+    halfOpen_++;
+    utp_->connectAsync(*peer, [manager = weak_from_this(), address = *peer,
+                               started = Clock::now()](auto stream) {
+      if (auto self = manager.lock()) {
+        self->addUtpResult(UtpResult{.peer = std::make_unique<Peer>(address),
+                                     .started = started,
+                                     .stream = std::move(stream)});
+      }
+    });
+  }
+}
+
+void ConnectionManager::addUtpResult(UtpResult result) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!running_) {
+    return;
+  }
+  utpResults_.push_back(std::move(result));
+  wake();
+}
+
+void ConnectionManager::startTcp(std::unique_ptr<Peer> peer) {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(peer->port);
+  if (inet_pton(AF_INET, peer->ip.c_str(), &address.sin_addr) != 1) {
+    fail(*peer);
+    return;
+  }
+
+  const int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sock < 0) {
+    fail(*peer);
+    return;
+  }
+  const auto started = Clock::now();
+  epoll_event event{.events = EPOLLOUT, .data = {.fd = sock}};
+  if ((connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+           0 &&
+       errno != EINPROGRESS) ||
+      epoll_ctl(epollFd_, EPOLL_CTL_ADD, sock, &event) != 0) {
+    close(sock);
+    fail(*peer);
+    return;
+  }
+  tcpDials_[sock] = TcpDial{.peer = std::move(peer), .started = started};
+  halfOpen_++;
+}
+
+/**
+ * The socket became writable: the connect either succeeded or failed, as
+ * SO_ERROR tells. Established sockets are made blocking again, which is
+ * what the streams expect.
+ */
+void ConnectionManager::finishTcp(int sock) {
+  auto it = tcpDials_.find(sock);
+  if (it == tcpDials_.end()) {
+    return;
+  }
+  TcpDial dial = std::move(it->second);
+  tcpDials_.erase(it);
+  halfOpen_--;
+  epoll_ctl(epollFd_, EPOLL_CTL_DEL, sock, nullptr);
+
+  int error = 0;
+  socklen_t length = sizeof(error);
+  getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length);
+  const int flags = fcntl(sock, F_GETFL, 0);
+  if (error != 0 || flags == -1 ||
+      fcntl(sock, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    close(sock);
+    fail(*dial.peer);
+    return;
+  }
+  deliver(std::move(dial.peer), std::make_unique<TcpStream>(sock),
+          dial.started);
+}
+
+/**
+ * Peers that did not answer over uTP are dialled again over TCP, in the
+ * half-open slot the uTP connect held.
+ */
+void ConnectionManager::handleUtpResults() {
+  std::vector<UtpResult> results;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    results.swap(utpResults_);
+  }
+  for (UtpResult& result : results) {
+    halfOpen_--;
+    if (result.stream) {
+      deliver(std::move(result.peer), std::move(*result.stream),
+              result.started);
+    } else {
+      startTcp(std::move(result.peer));
+    }
+  }
+}
+
+/**
+ * Fails the TCP connects that reached the connect timeout and hands the
+ * spare connections nobody took back to the address book.
+ */
+void ConnectionManager::expire(Clock::time_point now) {
+  const auto spare_ttl = std::chrono::seconds(SPARE_TTL);
+  std::vector<EstablishedConnection> stale;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    while (!established_.empty() &&
+           now - established_.front().since >= spare_ttl) {
+      stale.push_back(std::move(established_.front().connection));
+      established_.pop_front();
+    }
+  }
+  for (const EstablishedConnection& connection : stale) {
+    addressBook_->disconnected(*connection.peer, 0, Clock::duration::zero(),
+                               now);
+  }
+
+  for (auto it = tcpDials_.begin(); it != tcpDials_.end();) {
+    if (now - it->second.started < connectTimeout_) {
+      ++it;
+      continue;
+    }
+    close(it->first);
+    fail(*it->second.peer);
+    it = tcpDials_.erase(it);
+    halfOpen_--;
+  }
+}
+
+void ConnectionManager::deliver(std::unique_ptr<Peer> peer,
+                                std::unique_ptr<PeerStream> stream,
+                                Clock::time_point started) {
+  addressBook_->connected(*peer, Clock::now() - started);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    established_.push_back(
+        Spare{.connection = EstablishedConnection{.peer = std::move(peer),
+                                                  .stream = std::move(stream)},
+              .since = Clock::now()});
+  }
+  ready_.notify_one();
+}
+
+void ConnectionManager::fail(const Peer& peer) {
+  addressBook_->connectFailed(peer);
+}
@@ -0,0 +1,119 @@
+#ifndef BITTORRENTCLIENT_CONNECTIONMANAGER_H
+#define BITTORRENTCLIENT_CONNECTIONMANAGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "core/PeerAddressBook.h"
+#include "network/Peer.h"
+#include "network/Transport.h"
+#include "network/UtpSocket.h"
+
+struct EstablishedConnection {
+  std::unique_ptr<Peer> peer;
+  std::unique_ptr<PeerStream> stream;
+};
+
+/**
+ * Dials the peers of the address book from a single reactor thread, with
+ * up to `maxHalfOpen` connects in flight at once across every connection
+ * slot, and hands the established streams to the slots waiting in
+ * acquire(). Unreachable addresses time out side by side instead of each
+ * holding up a slot for the whole connect timeout.
+ *
+ * Connects are only started while slots wait, a few per slot, so that one
+ * slot does not go through the dead addresses one at a time either. The
+ * connections left over are handed to the next slots that ask, or handed
+ * back to the address book if none asks for a while. With a uTP socket,
+ * peers are tried over uTP first and over TCP when that fails.
+ * Failed connects are reported to the address book, and successful ones
+ * along with how long they took.
+ *
+ * Must be owned by a std::shared_ptr, which uTP connects in flight keep a
+ * weak reference to.
+ */
+class ConnectionManager
+    : public std::enable_shared_from_this<ConnectionManager> {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kMaxHalfOpen = 32;
+
+  explicit ConnectionManager(
+      std::shared_ptr<PeerAddressBook> addressBook,
+      std::shared_ptr<UtpSocket> utp = nullptr,
+      size_t maxHalfOpen = kMaxHalfOpen,
+      std::chrono::milliseconds connectTimeout = std::chrono::seconds(5));
+  ~ConnectionManager();
+
+  tl::expected<void, ConnectError> start();
+  // Abandons the connects in flight and wakes every acquire().
+  void stop();
+
+  // Waits for a connection to the next peer. Returns std::nullopt once
+  // stopped.
+  std::optional<EstablishedConnection> acquire();
+
+  // Connects in flight.
+  size_t halfOpen() const { return halfOpen_; }
+
+ private:
+  struct Spare {
+    EstablishedConnection connection;
+    Clock::time_point since;
+  };
+  struct TcpDial {
+    std::unique_ptr<Peer> peer;
+    Clock::time_point started;
+  };
+  struct UtpResult {
+    std::unique_ptr<Peer> peer;
+    Clock::time_point started;
+    tl::expected<std::unique_ptr<PeerStream>, ConnectError> stream;
+  };
+
+  std::shared_ptr<PeerAddressBook> addressBook_;
+  std::shared_ptr<UtpSocket> utp_;
+  const size_t maxHalfOpen_;
+  const std::chrono::milliseconds connectTimeout_;
+
+  int epollFd_ = -1;
+  // Wakes up the reactor when a slot starts waiting or a uTP connect ends.
+  int wakeFd_ = -1;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+  std::atomic<size_t> halfOpen_ = 0;
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<Spare> established_;
+  // Slots blocked in acquire().
+  size_t waiting_ = 0;
+  std::vector<UtpResult> utpResults_;
+
+  // Reactor thread only, by socket.
+  std::unordered_map<int, TcpDial> tcpDials_;
+
+  void run();
+  void wake() const;
+  void dial();
+  void startTcp(std::unique_ptr<Peer> peer);
+  void finishTcp(int sock);
+  void addUtpResult(UtpResult result);
+  void handleUtpResults();
+  void expire(Clock::time_point now);
+  void deliver(std::unique_ptr<Peer> peer, std::unique_ptr<PeerStream> stream,
+               Clock::time_point started);
+  void fail(const Peer& peer);
+};
+
+#endif  // BITTORRENTCLIENT_CONNECTIONMANAGER_H
@@ -0,0 +1,196 @@
+#include "network/ConnectionManager.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "network/UtpSocket.h"
+
+using std::chrono::milliseconds;
+
+namespace {
+// A TCP socket listening on loopback.
+class Listener {
+ public:
+  explicit Listener(int backlog = 16) {
+    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(sock_, reinterpret_cast<sockaddr*>(&address), length);
+    listen(sock_, backlog);
+    getsockname(sock_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+  }
+  ~Listener() { close(sock_); }
+
+  int port() const { return port_; }
+
+  // The next connection, or -1 if none arrives in time.
+  int accept(milliseconds timeout) const {
+    pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+    if (poll(&descriptor, 1, static_cast<int>(timeout.count())) != 1) {
+      return -1;
+    }
+    return ::accept(sock_, nullptr, nullptr);
+  }
+
+ private:
+  int sock_;
+  int port_;
+};
+
+/**
+ * A port whose connects never complete: the listener's queue is full, so
+ * its SYNs are dropped as on a peer behind a firewall.
+ */
+class BlackHole {
+ public:
+  BlackHole() : listener_(0) {
+    filler_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(listener_.port());
+    connect(filler_, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  }
+  ~BlackHole() { close(filler_); }
+
+  int port() const { return listener_.port(); }
+
+ private:
+  Listener listener_;
+  int filler_;
+};
+
+// A loopback port nothing listens on.
+int refusedPort() {
+  Listener listener;
+  return listener.port();
+}
+
+std::vector<std::unique_ptr<Peer>> loopbackPeers(std::vector<int> ports) {
+  std::vector<std::unique_ptr<Peer>> peers;
+  for (int port : ports) {
+    peers.push_back(
+        std::make_unique<Peer>(Peer{.ip = "127.0.0.1", .port = port}));
+  }
+  return peers;
+}
+}  // namespace
+
+TEST(ConnectionManager, DeadPeersDoNotStallTheSlot) {
+  std::vector<std::unique_ptr<BlackHole>> holes;
+  std::vector<int> ports;
+  for (int i = 0; i < 6; i++) {
+    holes.push_back(std::make_unique<BlackHole>());
+    ports.push_back(holes.back()->port());
+  }
+  const int refused = refusedPort();
+  ports.push_back(refused);
+  Listener listener;
+  ports.push_back(listener.port());
+
+  auto book = std::make_shared<PeerAddressBook>();
+  book->add(loopbackPeers(ports), PeerSource::kTracker);
+  auto manager = std::make_shared<ConnectionManager>(book, nullptr, 32,
+                                                     milliseconds(500));
+  ASSERT_TRUE(manager->start().has_value());
+
+  // One connect at a time would wait for six timeouts, 3 s in all.
+  const auto start = std::chrono::steady_clock::now();
+  auto connection = manager->acquire();
+  ASSERT_TRUE(connection.has_value());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, milliseconds(2000));
+  EXPECT_EQ(connection->peer->port, listener.port());
+
+  const int accepted = listener.accept(milliseconds(1000));
+  ASSERT_GE(accepted, 0);
+  ASSERT_TRUE(connection->stream->send("ping").has_value());
+  char buffer[4];
+  EXPECT_EQ(recv(accepted, buffer, sizeof(buffer), MSG_WAITALL), 4);
+  EXPECT_EQ(std::string(buffer, 4), "ping");
+  close(accepted);
+
+  EXPECT_GT(book->record(*connection->peer)->connectLatency,
+            std::chrono::steady_clock::duration::zero());
+  EXPECT_EQ(book->record(Peer{"127.0.0.1", refused})->failures, 1);
+  EXPECT_EQ(book->record(Peer{"127.0.0.1", ports[0]})->failures, 1);
+  manager->stop();
+}
+
+TEST(ConnectionManager, KeepsTheHalfOpenLimit) {
+  std::vector<std::unique_ptr<BlackHole>> holes;
+  std::vector<int> ports;
+  for (int i = 0; i < 20; i++) {
+    holes.push_back(std::make_unique<BlackHole>());
+    ports.push_back(holes.back()->port());
+  }
+  auto book = std::make_shared<PeerAddressBook>();
+  book->add(loopbackPeers(ports), PeerSource::kTracker);
+  auto manager = std::make_shared<ConnectionManager>(book, nullptr, 5,
+                                                     milliseconds(10000));
+  ASSERT_TRUE(manager->start().has_value());
+
+  // Three slots would dial twelve peers at once.
+  std::vector<std::thread> slots;
+  std::vector<std::optional<EstablishedConnection>> connections(3);
+  for (auto& connection : connections) {
+    slots.emplace_back(
+        [&manager, &connection] { connection = manager->acquire(); });
+  }
+  for (int i = 0; i < 100 && manager->halfOpen() < 5; i++) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  std::this_thread::sleep_for(milliseconds(200));
+  EXPECT_EQ(manager->halfOpen(), 5);
+  EXPECT_EQ(book->available(), 15);
+
+  manager->stop();
+  for (auto& slot : slots) {
+    slot.join();
+  }
+  for (const auto& connection : connections) {
+    EXPECT_FALSE(connection.has_value());
+  }
+}
+
+TEST(ConnectionManager, FallsBackToTcpWhenUtpIsNotAnswered) {
+  auto server = std::make_shared<UtpSocket>();
+  auto client = std::make_shared<UtpSocket>(milliseconds(200));
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  ASSERT_TRUE(client->start(0, "127.0.0.1").has_value());
+  server->listen();
+  Listener listener;
+
+  auto book = std::make_shared<PeerAddressBook>();
+  book->add(loopbackPeers({server->port(), listener.port()}),
+            PeerSource::kTracker);
+  auto manager = std::make_shared<ConnectionManager>(book, client);
+  ASSERT_TRUE(manager->start().has_value());
+
+  std::set<int> ports;
+  for (int i = 0; i < 2; i++) {
+    auto connection = manager->acquire();
+    ASSERT_TRUE(connection.has_value());
+    ports.insert(connection->peer->port);
+  }
+  EXPECT_EQ(ports, (std::set<int>{server->port(), listener.port()}));
+  EXPECT_TRUE(server->accept(milliseconds(1000)).has_value());
+  const int accepted = listener.accept(milliseconds(1000));
+  EXPECT_GE(accepted, 0);
+  close(accepted);
+  manager->stop();
+}
@@ -0,0 +1,641 @@
+#include "network/DhtNode.h"
+
+#include <arpa/inet.h>
+#include <bencode/bencoding.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tl/expected.hpp>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+#define MAX_DATAGRAM 2048
+#define RECEIVE_POLL 1000  // 1 sec
+// Tokens are valid for one to two secret lifetimes.
+#define SECRET_LIFETIME 300  // 5 min
+#define PEER_LIFETIME 1800   // 30 min, unless announced again
+#define MAX_STORED_PEERS 200
+// Announces for further info-hashes are not stored.
+#define MAX_STORED_INFO_HASHES 1000
+#define MAX_RETURNED_PEERS 50
+
+namespace {
+// A node in the compact format: its id followed by its compact address.
+constexpr size_t kCompactNodeSize = kNodeIdSize + kCompactPeerSize;
+
+/**
+ * Looks a key up in a dictionary without descending into nested values,
+ * unlike BDictionary::getValue.
+ */
+template <typename T>
+std::shared_ptr<T> findValue(const bencoding::BDictionary& dict,
+                             const std::string& key) {
+  for (const auto& [name, value] : dict) {
+    if (name->value() == key) {
+      return std::dynamic_pointer_cast<T>(value);
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<bencoding::BString> bstring(const std::string& value) {
+  return bencoding::BString::create(value);
+}
+
+std::string peerKey(const Peer& peer) {
+  return peer.ip + ":" + std::to_string(peer.port);
+}
+
+std::string encodeNodes(const std::vector<DhtContact>& nodes) {
+  std::string compact;
+  for (const DhtContact& node : nodes) {
+    std::string address = encodeCompactPeer(node.endpoint);
+    if (!address.empty()) {
+      compact += node.id + address;
+    }
+  }
+  return compact;
+}
+
+std::vector<DhtContact> decodeNodes(const std::string& compact) {
+  std::vector<DhtContact> nodes;
+  for (size_t offset = 0; offset + kCompactNodeSize <= compact.size();
+       offset += kCompactNodeSize) {
+    auto address =
+        decodeCompactPeers(compact.substr(offset + kNodeIdSize,
+                                          kCompactPeerSize));
+    nodes.push_back(DhtContact{.id = compact.substr(offset, kNodeIdSize),
+                               .endpoint = *address.front()});
+  }
+  return nodes;
+}
+
+// Returns the first IPv4 address of the host, or an empty string.
+std::string resolve(const std::string& host) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo* results = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &results) != 0) {
+    return "";
+  }
+
+  char ip[INET_ADDRSTRLEN] = {};
+  const auto* address = reinterpret_cast<sockaddr_in*>(results->ai_addr);
+  inet_ntop(AF_INET, &address->sin_addr, ip, sizeof(ip));
+  freeaddrinfo(results);
+  return ip;
+}
+}  // namespace
+
+DhtNode::DhtNode(NodeId id, std::chrono::milliseconds queryTimeout)
+    : id_(std::move(id)),
+      queryTimeout_(queryTimeout),
+      routingTable_(id_),
+      secret_(randomNodeId()),
+      previousSecret_(secret_),
+      secretRotated_(Clock::now()) {}
+
+DhtNode::~DhtNode() { stop(); }
+
+tl::expected<void, DhtError> DhtNode::start(int port,
+                                            const std::string& address) {
+  sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock_ < 0) {
+    return tl::unexpected(DhtError{"Socket creation error"});
+  }
+
+  sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  socklen_t length = sizeof(local);
+  if (inet_pton(AF_INET, address.c_str(), &local.sin_addr) != 1 ||
+      bind(sock_, reinterpret_cast<sockaddr*>(&local), length) < 0 ||
+      getsockname(sock_, reinterpret_cast<sockaddr*>(&local), &length) < 0) {
+    close(sock_);
+    sock_ = -1;
+    return tl::unexpected(
+        DhtError{"Failed to bind the DHT to port " + std::to_string(port)});
+  }
+
+  port_ = ntohs(local.sin_port);
+  running_ = true;
+  thread_ = std::thread([this] { receiveLoop(); });
+  return {};
+}
+
+void DhtNode::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  answered_.notify_all();
+  // Wakes up the receive loop, even though the socket is not connected.
+  shutdown(sock_, SHUT_RDWR);
+  thread_.join();
+  close(sock_);
+  sock_ = -1;
+}
+
+/**
+ * Asks the bootstrap nodes for the nodes closest to us, then looks our own
+ * id up from those, which fills the buckets close to us and makes us known
+ * to our neighbours.
+ */
+size_t DhtNode::bootstrap(const std::vector<Peer>& nodes) {
+  std::vector<Query> queries;
+  for (const Peer& node : nodes) {
+    std::string ip = resolve(node.ip);
+    if (!ip.empty()) {
+      queries.push_back(Query{
+          .endpoint = Peer{.ip = ip, .port = node.port},
+          .method = "find_node",
+          .arguments = bencoding::BDictionary::create(
+              {{bstring("target"), bstring(id_)}})});
+    }
+  }
+
+  std::vector<DhtContact> seeds;
+  for (const auto& response : queryAll(queries)) {
+    if (!response) {
+      continue;
+    }
+    if (auto compact = findValue<bencoding::BString>(*response, "nodes")) {
+      for (DhtContact& node : decodeNodes(compact->value())) {
+        seeds.push_back(std::move(node));
+      }
+    }
+  }
+
+  lookup(id_, false, seeds);
+  refresh();
+  std::lock_guard<std::mutex> guard(lock_);
+  return routingTable_.size();
+}
+
+void DhtNode::refresh() {
+  std::vector<NodeId> targets;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    targets = routingTable_.refreshTargets();
+  }
+  for (const NodeId& target : targets) {
+    lookup(target, false);
+  }
+}
+
+std::vector<std::unique_ptr<Peer>> DhtNode::getPeers(const NodeId& infoHash) {
+  return lookup(infoHash, true).peers;
+}
+
+std::vector<std::unique_ptr<Peer>> DhtNode::announce(const NodeId& infoHash,
+                                                     int port) {
+  LookupResult result = lookup(infoHash, true);
+
+  std::vector<Query> queries;
+  for (const auto& [node, token] : result.closest) {
+    if (token.empty()) {
+      continue;
+    }
+    queries.push_back(Query{
+        .endpoint = node.endpoint,
+        .method = "announce_peer",
+        .arguments = bencoding::BDictionary::create(
+            {{bstring("info_hash"), bstring(infoHash)},
+             {bstring("port"), bencoding::BInteger::create(port)},
+             {bstring("token"), bstring(token)},
+             {bstring("implied_port"), bencoding::BInteger::create(0)}})});
+  }
+  queryAll(queries);
+
+  return std::move(result.peers);
+}
+
+std::vector<DhtContact> DhtNode::nodes() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return routingTable_.contacts();
+}
+
+size_t DhtNode::storedInfoHashes() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return storedPeers_.size();
+}
+
+void DhtNode::receiveLoop() {
+  char buffer[MAX_DATAGRAM];
+  while (running_) {
+    pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+    if (poll(&descriptor, 1, RECEIVE_POLL) <= 0) {
+      continue;
+    }
+
+    sockaddr_in from{};
+    socklen_t length = sizeof(from);
+    ssize_t n = recvfrom(sock_, buffer, sizeof(buffer), 0,
+                         reinterpret_cast<sockaddr*>(&from), &length);
+    if (n <= 0) {
+      continue;
+    }
+
+    char ip[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+    // Whatever a datagram does, it must not take the node down.
+    try {
+      handleMessage(std::string(buffer, n),
+                    Peer{.ip = ip, .port = ntohs(from.sin_port)});
+    } catch (const std::exception& e) {
+      continue;
+    }
+  }
+}
+
+/**
+ * Answers a query, or hands a response over to the lookup waiting for it.
+ * Malformed messages are dropped.
+ */
+void DhtNode::handleMessage(const std::string& datagram, const Peer& sender) {
+  if (!utils::bencodedStringsFit(datagram)) {
+    return;
+  }
+  std::shared_ptr<bencoding::BItem> decoded;
+  try {
+    decoded = bencoding::decode(datagram);
+  } catch (const bencoding::DecodingError& e) {
+    return;
+  }
+  auto message = std::dynamic_pointer_cast<bencoding::BDictionary>(decoded);
+  if (!message) {
+    return;
+  }
+  auto transaction = findValue<bencoding::BString>(*message, "t");
+  auto type = findValue<bencoding::BString>(*message, "y");
+  if (!transaction || !type) {
+    return;
+  }
+
+  if (type->value() == "q") {
+    auto method = findValue<bencoding::BString>(*message, "q");
+    auto arguments = findValue<bencoding::BDictionary>(*message, "a");
+    if (!method || !arguments) {
+      return;
+    }
+
+    tl::expected<std::shared_ptr<bencoding::BDictionary>, KrpcError> reply;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (auto id = findValue<bencoding::BString>(*arguments, "id")) {
+        routingTable_.heardFrom(id->value(), sender);
+      }
+      reply = answer(method->value(), *arguments, sender);
+    }
+
+    std::shared_ptr<bencoding::BDictionary> response =
+        bencoding::BDictionary::create({{bstring("t"), transaction}});
+    if (reply) {
+      (*response)[bstring("y")] = bstring("r");
+      (*response)[bstring("r")] = *reply;
+    } else {
+      (*response)[bstring("y")] = bstring("e");
+      (*response)[bstring("e")] = bencoding::BList::create(
+          {bencoding::BInteger::create(reply.error().code),
+           bstring(reply.error().message)});
+    }
+    send(sender, bencoding::encode(response));
+    return;
+  }
+
+  if (type->value() != "r" && type->value() != "e") {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  auto pending = pending_.find(transaction->value());
+  if (pending == pending_.end() || pending->second.done ||
+      peerKey(pending->second.endpoint) != peerKey(sender)) {
+    return;
+  }
+  pending->second.done = true;
+  if (type->value() == "r") {
+    auto response = findValue<bencoding::BDictionary>(*message, "r");
+    if (response) {
+      if (auto id = findValue<bencoding::BString>(*response, "id")) {
+        routingTable_.heardFrom(id->value(), sender);
+      }
+    }
+    pending->second.response = response;
+  }
+  answered_.notify_all();
+}
+
+/**
+ * Builds the answer to a query. Called with the lock held.
+ */
+tl::expected<std::shared_ptr<bencoding::BDictionary>, KrpcError>
+DhtNode::answer(const std::string& method,
+                const bencoding::BDictionary& arguments, const Peer& sender) {
+  std::shared_ptr<bencoding::BDictionary> reply =
+      bencoding::BDictionary::create({{bstring("id"), bstring(id_)}});
+  if (method == "ping") {
+    return reply;
+  }
+
+  if (method == "find_node") {
+    auto target = findValue<bencoding::BString>(arguments, "target");
+    if (!target || target->value().size() != kNodeIdSize) {
+      return tl::unexpected(KrpcError{203, "Invalid target"});
+    }
+    (*reply)[bstring("nodes")] = bstring(encodeNodes(routingTable_.closest(
+        target->value(), DhtRoutingTable::kBucketSize)));
+    return reply;
+  }
+
+  auto info_hash = findValue<bencoding::BString>(arguments, "info_hash");
+  if (method != "get_peers" && method != "announce_peer") {
+    return tl::unexpected(KrpcError{204, "Method Unknown"});
+  }
+  if (!info_hash || info_hash->value().size() != kNodeIdSize) {
+    return tl::unexpected(KrpcError{203, "Invalid info_hash"});
+  }
+  const auto now = Clock::now();
+  std::vector<StoredPeer>* stored = storedPeers(info_hash->value(), now);
+
+  if (method == "get_peers") {
+    (*reply)[bstring("token")] = bstring(token(sender.ip));
+    if (stored) {
+      std::shared_ptr<bencoding::BList> values = bencoding::BList::create();
+      for (size_t i = 0; i < stored->size() && i < MAX_RETURNED_PEERS; i++) {
+        values->push_back(bstring(encodeCompactPeer((*stored)[i].peer)));
+      }
+      (*reply)[bstring("values")] = values;
+    }
+    (*reply)[bstring("nodes")] = bstring(encodeNodes(routingTable_.closest(
+        info_hash->value(), DhtRoutingTable::kBucketSize)));
+    return reply;
+  }
+
+  auto token = findValue<bencoding::BString>(arguments, "token");
+  auto port = findValue<bencoding::BInteger>(arguments, "port");
+  auto implied_port = findValue<bencoding::BInteger>(arguments, "implied_port");
+  if (!token || !validToken(sender.ip, token->value())) {
+    return tl::unexpected(KrpcError{203, "Bad token"});
+  }
+  if (!port && !(implied_port && implied_port->value() != 0)) {
+    return tl::unexpected(KrpcError{203, "Missing port"});
+  }
+
+  Peer peer{.ip = sender.ip,
+            .port = implied_port && implied_port->value() != 0
+                        ? sender.port
+                        : static_cast<int>(port->value())};
+  if (!stored) {
+    if (storedPeers_.size() >= MAX_STORED_INFO_HASHES) {
+      expireStoredPeers(now);
+    }
+    if (storedPeers_.size() >= MAX_STORED_INFO_HASHES) {
+      return reply;
+    }
+    stored = &storedPeers_[info_hash->value()];
+  }
+  auto known = std::ranges::find_if(*stored, [&peer](const StoredPeer& entry) {
+    return peerKey(entry.peer) == peerKey(peer);
+  });
+  if (known != stored->end()) {
+    known->announced = now;
+  } else if (stored->size() < MAX_STORED_PEERS) {
+    stored->push_back(StoredPeer{.peer = peer, .announced = now});
+  }
+  return reply;
+}
+
+/**
+ * The peers stored for the info-hash that are still alive, or nullptr if
+ * none is. Expired peers are dropped along the way, and the info-hash with
+ * them once none is left.
+ */
+std::vector<DhtNode::StoredPeer>* DhtNode::storedPeers(
+    const std::string& infoHash, Clock::time_point now) {
+  auto it = storedPeers_.find(infoHash);
+  if (it == storedPeers_.end()) {
+    return nullptr;
+  }
+  std::erase_if(it->second, [now](const StoredPeer& peer) {
+    return now - peer.announced >= std::chrono::seconds(PEER_LIFETIME);
+  });
+  if (it->second.empty()) {
+    storedPeers_.erase(it);
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void DhtNode::expireStoredPeers(Clock::time_point now) {
+  for (auto it = storedPeers_.begin(); it != storedPeers_.end();) {
+    std::erase_if(it->second, [now](const StoredPeer& peer) {
+      return now - peer.announced >= std::chrono::seconds(PEER_LIFETIME);
+    });
+    it = it->second.empty() ? storedPeers_.erase(it) : std::next(it);
+  }
+}
+
+void DhtNode::send(const Peer& endpoint, const std::string& message) const {
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(endpoint.port);
+  if (inet_pton(AF_INET, endpoint.ip.c_str(), &to.sin_addr) != 1) {
+    return;
+  }
+  sendto(sock_, message.data(), message.size(), 0,
+         reinterpret_cast<sockaddr*>(&to), sizeof(to));
+}
+
+std::vector<std::shared_ptr<bencoding::BDictionary>> DhtNode::queryAll(
+    const std::vector<Query>& queries) {
+  std::vector<std::string> transactions;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (const Query& query : queries) {
+      std::string transaction;
+      do {
+        transaction = {static_cast<char>(nextTransaction_ >> 8),
+                       static_cast<char>(nextTransaction_ & 0xFF)};
+        nextTransaction_++;
+      } while (pending_.contains(transaction));
+      pending_[transaction] = Pending{.endpoint = query.endpoint};
+      transactions.push_back(transaction);
+    }
+  }
+
+  for (size_t i = 0; i < queries.size(); i++) {
+    (*queries[i].arguments)[bstring("id")] = bstring(id_);
+    std::shared_ptr<bencoding::BDictionary> message =
+        bencoding::BDictionary::create(
+            {{bstring("t"), bstring(transactions[i])},
+             {bstring("y"), bstring("q")},
+             {bstring("q"), bstring(queries[i].method)},
+             {bstring("a"), queries[i].arguments}});
+    send(queries[i].endpoint, bencoding::encode(message));
+  }
+
+  std::unique_lock<std::mutex> lock(lock_);
+  answered_.wait_until(lock, Clock::now() + queryTimeout_, [&] {
+    return !running_ ||
+           std::ranges::all_of(transactions, [this](const std::string& t) {
+             return pending_[t].done;
+           });
+  });
+
+  std::vector<std::shared_ptr<bencoding::BDictionary>> responses;
+  for (const std::string& transaction : transactions) {
+    responses.push_back(pending_[transaction].response);
+    pending_.erase(transaction);
+  }
+  return responses;
+}
+
+/**
+ * Iterative lookup of the nodes closest to `target`, collecting the peers
+ * they return when looking up an info hash.
+ */
+DhtNode::LookupResult DhtNode::lookup(const NodeId& target, bool getPeers,
+                                      const std::vector<DhtContact>& seeds) {
+  enum class State { kNew, kQueried, kAnswered, kFailed };
+  struct Candidate {
+    DhtContact contact;
+    State state = State::kNew;
+    std::string token;
+  };
+
+  std::vector<Candidate> candidates;
+  std::unordered_set<std::string> seen_nodes;
+  const auto consider = [&](const DhtContact& node) {
+    if (node.id.size() == kNodeIdSize && node.id != id_ &&
+        seen_nodes.insert(node.id).second) {
+      candidates.push_back(Candidate{.contact = node});
+    }
+  };
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (const DhtContact& node :
+         routingTable_.closest(target, DhtRoutingTable::kBucketSize)) {
+      consider(node);
+    }
+  }
+  for (const DhtContact& node : seeds) {
+    consider(node);
+  }
+
+  LookupResult result;
+  std::unordered_set<std::string> seen_peers;
+  const auto closer = [&target](const Candidate& a, const Candidate& b) {
+    return closerTo(target, a.contact.id, b.contact.id);
+  };
+  while (running_) {
+    // Queries the closest nodes not queried yet among the kBucketSize
+    // closest that have not failed.
+    std::ranges::sort(candidates, closer);
+    std::vector<size_t> batch;
+    size_t considered = 0;
+    for (size_t i = 0; i < candidates.size() &&
+                       considered < DhtRoutingTable::kBucketSize &&
+                       batch.size() < kAlpha;
+         i++) {
+      if (candidates[i].state == State::kFailed) {
+        continue;
+      }
+      considered++;
+      if (candidates[i].state == State::kNew) {
+        batch.push_back(i);
+      }
+    }
+    if (batch.empty()) {
+      break;
+    }
+
+    std::vector<Query> queries;
+    for (size_t i : batch) {
+      candidates[i].state = State::kQueried;
+      queries.push_back(Query{
+          .endpoint = candidates[i].contact.endpoint,
+          .method = getPeers ? "get_peers" : "find_node",
+          .arguments = bencoding::BDictionary::create(
+              {{bstring(getPeers ? "info_hash" : "target"),
+                bstring(target)}})});
+    }
+    auto responses = queryAll(queries);
+
+    for (size_t j = 0; j < batch.size(); j++) {
+      const size_t i = batch[j];
+      if (!responses[j]) {
+        candidates[i].state = State::kFailed;
+        std::lock_guard<std::mutex> guard(lock_);
+        routingTable_.failed(candidates[i].contact.id);
+        continue;
+      }
+
+      const bencoding::BDictionary& response = *responses[j];
+      candidates[i].state = State::kAnswered;
+      if (auto token = findValue<bencoding::BString>(response, "token")) {
+        candidates[i].token = token->value();
+      }
+      if (auto values = findValue<bencoding::BList>(response, "values")) {
+        for (const auto& value : *values) {
+          auto compact = std::dynamic_pointer_cast<bencoding::BString>(value);
+          if (!compact || compact->value().size() != kCompactPeerSize) {
+            continue;
+          }
+          for (auto& peer : decodeCompactPeers(compact->value())) {
+            if (seen_peers.insert(peerKey(*peer)).second) {
+              result.peers.push_back(std::move(peer));
+            }
+          }
+        }
+      }
+      if (auto nodes = findValue<bencoding::BString>(response, "nodes")) {
+        for (const DhtContact& node : decodeNodes(nodes->value())) {
+          consider(node);
+        }
+      }
+    }
+  }
+
+  std::ranges::sort(candidates, closer);
+  for (const Candidate& candidate : candidates) {
+    if (result.closest.size() >= DhtRoutingTable::kBucketSize) {
+      break;
+    }
+    if (candidate.state == State::kAnswered) {
+      result.closest.emplace_back(candidate.contact, candidate.token);
+    }
+  }
+  return result;
+}
+
+std::string DhtNode::token(const std::string& ip) {
+  rotateSecret(Clock::now());
+  return utils::sha1(secret_ + ip).substr(0, 16);
+}
+
+bool DhtNode::validToken(const std::string& ip, const std::string& token) {
+  rotateSecret(Clock::now());
+  return token == utils::sha1(secret_ + ip).substr(0, 16) ||
+         token == utils::sha1(previousSecret_ + ip).substr(0, 16);
+}
+
+void DhtNode::rotateSecret(Clock::time_point now) {
+  if (now - secretRotated_ >= std::chrono::seconds(SECRET_LIFETIME)) {
+    previousSecret_ = secret_;
+    secret_ = randomNodeId();
+    secretRotated_ = now;
+  }
+}
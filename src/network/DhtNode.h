@@ -0,0 +1,147 @@
+#ifndef BITTORRENTCLIENT_DHTNODE_H
+#define BITTORRENTCLIENT_DHTNODE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "network/DhtRoutingTable.h"
+#include "network/Peer.h"
+
+namespace bencoding {
+class BDictionary;
+}
+
+struct DhtError {
+  std::string message;
+};
+
+// Error answered to a KRPC query.
+struct KrpcError {
+  int code;
+  std::string message;
+};
+
+/**
+ * A node of the mainline DHT (BEP 5), used to find the peers of a torrent
+ * without a tracker. It answers the KRPC queries of other nodes on a UDP
+ * socket from a thread of its own, and stores the peers announced to it.
+ *
+ * Lookups are iterative and run on the calling thread: the closest known
+ * nodes to the target are queried kAlpha at a time, the nodes they return
+ * are queried in turn, until the kBucketSize closest nodes have all
+ * answered or failed. Announcing runs a get_peers lookup and then sends
+ * announce_peer, with the token each node gave, to the closest of them.
+ */
+class DhtNode {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kAlpha = 3;
+
+  explicit DhtNode(NodeId id = randomNodeId(),
+                   std::chrono::milliseconds queryTimeout =
+                       std::chrono::seconds(2));
+  ~DhtNode();
+
+  // Binds the UDP socket (port 0 picks a free one, see port()) and starts
+  // answering queries.
+  tl::expected<void, DhtError> start(int port,
+                                     const std::string& address = "0.0.0.0");
+  void stop();
+
+  // Joins the network through the given nodes, which may be host names,
+  // with a lookup of our own id, then refreshes the buckets. Returns the
+  // size of the routing table.
+  size_t bootstrap(const std::vector<Peer>& nodes);
+  // Looks up a random id in each bucket that is not full or has not
+  // changed for a while, so that we know nodes in every part of the
+  // network and not only those close to us.
+  void refresh();
+
+  // Peers of the torrent with the given (raw) info hash.
+  std::vector<std::unique_ptr<Peer>> getPeers(const NodeId& infoHash);
+  // Announces that we download the torrent on `port`, and returns the peers
+  // found on the way.
+  std::vector<std::unique_ptr<Peer>> announce(const NodeId& infoHash,
+                                              int port);
+
+  const NodeId& id() const { return id_; }
+  int port() const { return port_; }
+  // Nodes of the routing table, to bootstrap from on the next run.
+  std::vector<DhtContact> nodes() const;
+  // Info-hashes that announced peers are stored for.
+  size_t storedInfoHashes() const;
+
+ private:
+  struct Pending {
+    Peer endpoint;
+    bool done = false;
+    // Null when the node answered with an error.
+    std::shared_ptr<bencoding::BDictionary> response;
+  };
+  struct Query {
+    Peer endpoint;
+    std::string method;
+    std::shared_ptr<bencoding::BDictionary> arguments;
+  };
+  struct StoredPeer {
+    Peer peer;
+    Clock::time_point announced;
+  };
+  struct LookupResult {
+    std::vector<std::unique_ptr<Peer>> peers;
+    // Closest nodes that answered, with the token they gave.
+    std::vector<std::pair<DhtContact, std::string>> closest;
+  };
+
+  const NodeId id_;
+  const std::chrono::milliseconds queryTimeout_;
+
+  int sock_ = -1;
+  int port_ = 0;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+
+  mutable std::mutex lock_;
+  std::condition_variable answered_;
+  DhtRoutingTable routingTable_;
+  std::unordered_map<std::string, Pending> pending_;
+  uint16_t nextTransaction_ = 0;
+  std::unordered_map<std::string, std::vector<StoredPeer>> storedPeers_;
+  std::string secret_;
+  std::string previousSecret_;
+  Clock::time_point secretRotated_;
+
+  void receiveLoop();
+  void handleMessage(const std::string& datagram, const Peer& sender);
+  tl::expected<std::shared_ptr<bencoding::BDictionary>, KrpcError> answer(
+      const std::string& method, const bencoding::BDictionary& arguments,
+      const Peer& sender);
+  void send(const Peer& endpoint, const std::string& message) const;
+
+  // Sends the queries at once and waits for all of them to be answered or
+  // to time out. Answers are in the order of the queries, null if none.
+  std::vector<std::shared_ptr<bencoding::BDictionary>> queryAll(
+      const std::vector<Query>& queries);
+  // Starts from the closest nodes of the routing table, and `seeds`.
+  LookupResult lookup(const NodeId& target, bool getPeers,
+                      const std::vector<DhtContact>& seeds = {});
+
+  std::string token(const std::string& ip);
+  bool validToken(const std::string& ip, const std::string& token);
+  void rotateSecret(Clock::time_point now);
+  std::vector<StoredPeer>* storedPeers(const std::string& infoHash,
+                                       Clock::time_point now);
+  void expireStoredPeers(Clock::time_point now);
+};
+
+#endif  // BITTORRENTCLIENT_DHTNODE_H
@@ -0,0 +1,162 @@
+#include "network/DhtNode.h"
+
+#include <arpa/inet.h>
+#include <bencode/bencoding.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::chrono::milliseconds;
+
+namespace {
+constexpr int kNetworkSize = 200;
+
+/**
+ * Sends a raw KRPC message to the node and returns its decoded answer.
+ */
+std::shared_ptr<bencoding::BDictionary> exchange(const DhtNode& node,
+                                                 const std::string& message) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(node.port());
+  inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+  sendto(sock, message.data(), message.size(), 0,
+         reinterpret_cast<sockaddr*>(&to), sizeof(to));
+
+  pollfd descriptor{.fd = sock, .events = POLLIN, .revents = 0};
+  std::shared_ptr<bencoding::BDictionary> answer;
+  if (poll(&descriptor, 1, 1000) > 0) {
+    char buffer[2048];
+    ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+    std::shared_ptr<bencoding::BItem> decoded =
+        bencoding::decode(std::string(buffer, n));
+    answer = std::dynamic_pointer_cast<bencoding::BDictionary>(decoded);
+  }
+  close(sock);
+  return answer;
+}
+
+std::string stringAt(const std::shared_ptr<bencoding::BDictionary>& dict,
+                     const std::string& key) {
+  auto value =
+      std::dynamic_pointer_cast<bencoding::BString>(dict->getValue(key));
+  return value ? value->value() : "";
+}
+}  // namespace
+
+TEST(DhtNode, AnswersKrpcQueries) {
+  DhtNode node(std::string(kNodeIdSize, 'n'));
+  ASSERT_TRUE(node.start(0, "127.0.0.1"));
+
+  auto pong = exchange(node, "d1:ad2:id20:abcdefghij0123456789e1:q4:ping"
+                             "1:t2:aa1:y1:qe");
+  ASSERT_NE(pong, nullptr);
+  EXPECT_EQ(stringAt(pong, "t"), "aa");
+  EXPECT_EQ(stringAt(pong, "y"), "r");
+  EXPECT_EQ(stringAt(pong, "id"), std::string(kNodeIdSize, 'n'));
+  // The querying node was added to the routing table.
+  EXPECT_EQ(node.nodes().size(), 1);
+
+  auto rejected = exchange(
+      node, "d1:ad2:id20:abcdefghij0123456789"
+            "9:info_hash20:mnopqrstuvwxyz1234564:porti6881e5:token5:bogus"
+            "e1:q13:announce_peer1:t2:bb1:y1:qe");
+  ASSERT_NE(rejected, nullptr);
+  EXPECT_EQ(stringAt(rejected, "y"), "e");
+
+  auto unknown = exchange(node, "d1:ad2:id20:abcdefghij0123456789e"
+                                "1:q6:vote_x1:t2:cc1:y1:qe");
+  ASSERT_NE(unknown, nullptr);
+  auto error =
+      std::dynamic_pointer_cast<bencoding::BList>(unknown->getValue("e"));
+  ASSERT_NE(error, nullptr);
+  EXPECT_EQ(std::dynamic_pointer_cast<bencoding::BInteger>(error->front())
+                ->value(),
+            204);
+}
+
+TEST(DhtNode, SurvivesForgedStringLengths) {
+  DhtNode node(std::string(kNodeIdSize, 'n'));
+  ASSERT_TRUE(node.start(0, "127.0.0.1"));
+
+  // Decoding these would allocate a string of the announced length.
+  EXPECT_EQ(exchange(node, "d1:t99999999999999999:aa1:y1:qe"), nullptr);
+  EXPECT_EQ(exchange(node, "d1:t99999999999999999999999:aae"), nullptr);
+  EXPECT_EQ(exchange(node, "d1:ad2:id2000:abce1:q4:ping1:t2:aa1:y1:qe"),
+            nullptr);
+
+  auto pong = exchange(node, "d1:ad2:id20:abcdefghij0123456789e1:q4:ping"
+                             "1:t2:aa1:y1:qe");
+  ASSERT_NE(pong, nullptr);
+  EXPECT_EQ(stringAt(pong, "y"), "r");
+}
+
+TEST(DhtNode, StoresPeersOnlyForAnnouncedInfoHashes) {
+  DhtNode node(std::string(kNodeIdSize, 'n'));
+  ASSERT_TRUE(node.start(0, "127.0.0.1"));
+
+  auto peers = exchange(node, "d1:ad2:id20:abcdefghij0123456789"
+                              "9:info_hash20:mnopqrstuvwxyz123456e"
+                              "1:q9:get_peers1:t2:aa1:y1:qe");
+  ASSERT_NE(peers, nullptr);
+  auto values =
+      std::dynamic_pointer_cast<bencoding::BDictionary>(peers->getValue("r"));
+  ASSERT_NE(values, nullptr);
+  const std::string token = stringAt(values, "token");
+  EXPECT_EQ(node.storedInfoHashes(), 0);
+
+  const std::string announce =
+      "d1:ad2:id20:abcdefghij0123456789"
+      "9:info_hash20:mnopqrstuvwxyz1234564:porti6881e5:token" +
+      std::to_string(token.size()) + ":" + token +
+      "e1:q13:announce_peer1:t2:bb1:y1:qe";
+  // Qualified, or std::exchange would be found for the std::string.
+  auto announced = ::exchange(node, announce);
+  ASSERT_NE(announced, nullptr);
+  EXPECT_EQ(stringAt(announced, "y"), "r");
+  EXPECT_EQ(node.storedInfoHashes(), 1);
+}
+
+/**
+ * A few hundred nodes on loopback, each joining through the first one. A
+ * peer announced through one node must be found from any other.
+ */
+TEST(DhtNode, FindsAnnouncedPeersInSimulatedNetwork) {
+  std::vector<std::unique_ptr<DhtNode>> network;
+  for (int i = 0; i < kNetworkSize; i++) {
+    network.push_back(
+        std::make_unique<DhtNode>(randomNodeId(), milliseconds(500)));
+    ASSERT_TRUE(network.back()->start(0, "127.0.0.1"));
+  }
+  const Peer entry{.ip = "127.0.0.1", .port = network[0]->port()};
+  for (int i = 1; i < kNetworkSize; i++) {
+    EXPECT_GT(network[i]->bootstrap({entry}), 0);
+  }
+
+  const NodeId info_hash = randomNodeId();
+  network[17]->announce(info_hash, 6881);
+  network[123]->announce(info_hash, 6882);
+
+  for (int i : {1, 64, 150, kNetworkSize - 1}) {
+    auto peers = network[i]->getPeers(info_hash);
+    std::vector<int> ports;
+    for (const auto& peer : peers) {
+      EXPECT_EQ(peer->ip, "127.0.0.1");
+      ports.push_back(peer->port);
+    }
+    std::ranges::sort(ports);
+    EXPECT_EQ(ports, (std::vector<int>{6881, 6882})) << "from node " << i;
+  }
+
+  // Unknown torrents have no peers.
+  EXPECT_TRUE(network[42]->getPeers(randomNodeId()).empty());
+}
@@ -0,0 +1,145 @@
+#include "network/DhtRoutingTable.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+NodeId randomNodeId() {
+  static thread_local std::mt19937 gen(std::random_device{}());
+  std::uniform_int_distribution<int> byte(0, UINT8_MAX);
+  NodeId id(kNodeIdSize, '\0');
+  for (char& c : id) {
+    c = static_cast<char>(byte(gen));
+  }
+  return id;
+}
+
+int commonPrefixBits(const NodeId& a, const NodeId& b) {
+  for (size_t i = 0; i < kNodeIdSize; i++) {
+    const auto diff = static_cast<uint8_t>(a[i] ^ b[i]);
+    if (diff != 0) {
+      return static_cast<int>(i * 8) + std::countl_zero(diff);
+    }
+  }
+  return kNodeIdSize * 8;
+}
+
+bool closerTo(const NodeId& target, const NodeId& a, const NodeId& b) {
+  for (size_t i = 0; i < kNodeIdSize; i++) {
+    const auto da = static_cast<uint8_t>(a[i] ^ target[i]);
+    const auto db = static_cast<uint8_t>(b[i] ^ target[i]);
+    if (da != db) {
+      return da < db;
+    }
+  }
+  return false;
+}
+
+DhtRoutingTable::DhtRoutingTable(NodeId self) : self_(std::move(self)) {}
+
+bool DhtRoutingTable::heardFrom(const NodeId& id, const Peer& endpoint,
+                                Clock::time_point now) {
+  if (id.size() != kNodeIdSize || id == self_) {
+    return false;
+  }
+
+  const size_t index = bucketIndex(id);
+  std::vector<DhtContact>& nodes = buckets_[index];
+  auto known = std::ranges::find(nodes, id, &DhtContact::id);
+  if (known != nodes.end()) {
+    nodes.erase(known);
+  } else if (nodes.size() >= kBucketSize) {
+    // Replaces the node that failed the most, if any did.
+    auto worst = std::ranges::max_element(nodes, {}, &DhtContact::failures);
+    if (worst->failures == 0) {
+      return false;
+    }
+    nodes.erase(worst);
+  }
+  nodes.push_back(DhtContact{.id = id, .endpoint = endpoint, .lastSeen = now});
+  refreshed_[index] = now;
+  return true;
+}
+
+void DhtRoutingTable::failed(const NodeId& id) {
+  if (id.size() != kNodeIdSize || id == self_) {
+    return;
+  }
+
+  std::vector<DhtContact>& nodes = buckets_[bucketIndex(id)];
+  auto known = std::ranges::find(nodes, id, &DhtContact::id);
+  if (known != nodes.end() && ++known->failures >= kMaxFailures) {
+    nodes.erase(known);
+  }
+}
+
+std::vector<DhtContact> DhtRoutingTable::closest(const NodeId& target,
+                                                 size_t count) const {
+  std::vector<DhtContact> nodes = contacts();
+  const auto closer = [&target](const DhtContact& a, const DhtContact& b) {
+    return closerTo(target, a.id, b.id);
+  };
+  if (nodes.size() > count) {
+    std::ranges::partial_sort(nodes, nodes.begin() + count, closer);
+    nodes.resize(count);
+  } else {
+    std::ranges::sort(nodes, closer);
+  }
+  return nodes;
+}
+
+/**
+ * Also marks the buckets as refreshed, so that they are not looked up
+ * again before kRefreshInterval even if the lookups do not fill them.
+ */
+std::vector<NodeId> DhtRoutingTable::refreshTargets(Clock::time_point now) {
+  size_t deepest = 0;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    if (!buckets_[i].empty()) {
+      deepest = i;
+    }
+  }
+
+  std::vector<NodeId> targets;
+  for (size_t i = 0; i <= deepest; i++) {
+    if (buckets_[i].size() < kBucketSize ||
+        now - refreshed_[i] >= kRefreshInterval) {
+      // Shares the first i bits with us and differs on the next one.
+      NodeId target = randomNodeId();
+      for (size_t bit = 0; bit <= i; bit++) {
+        const auto mask = static_cast<uint8_t>(0x80 >> (bit % 8));
+        const bool ours = (static_cast<uint8_t>(self_[bit / 8]) & mask) != 0;
+        const bool wanted = bit < i ? ours : !ours;
+        target[bit / 8] = static_cast<char>(
+            wanted ? target[bit / 8] | mask : target[bit / 8] & ~mask);
+      }
+      targets.push_back(std::move(target));
+      refreshed_[i] = now;
+    }
+  }
+  return targets;
+}
+
+std::vector<DhtContact> DhtRoutingTable::contacts() const {
+  std::vector<DhtContact> nodes;
+  for (const auto& bucket : buckets_) {
+    nodes.insert(nodes.end(), bucket.begin(), bucket.end());
+  }
+  return nodes;
+}
+
+size_t DhtRoutingTable::size() const {
+  size_t count = 0;
+  for (const auto& bucket : buckets_) {
+    count += bucket.size();
+  }
+  return count;
+}
+
+size_t DhtRoutingTable::bucketIndex(const NodeId& id) const {
+  return std::min<size_t>(commonPrefixBits(self_, id), buckets_.size() - 1);
+}
@@ -0,0 +1,74 @@
+#ifndef BITTORRENTCLIENT_DHTROUTINGTABLE_H
+#define BITTORRENTCLIENT_DHTROUTINGTABLE_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "network/Peer.h"
+
+// Node ids and info hashes are 160-bit strings, compared by XOR distance.
+using NodeId = std::string;
+constexpr size_t kNodeIdSize = 20;
+
+NodeId randomNodeId();
+
+// Number of leading bits `a` and `b` have in common.
+int commonPrefixBits(const NodeId& a, const NodeId& b);
+
+// Whether `a` is closer to `target` than `b`.
+bool closerTo(const NodeId& target, const NodeId& a, const NodeId& b);
+
+struct DhtContact {
+  NodeId id;
+  Peer endpoint;
+  std::chrono::steady_clock::time_point lastSeen;
+  // Queries in a row the node did not answer.
+  int failures = 0;
+};
+
+/**
+ * The nodes of the DHT we know about (BEP 5), in one bucket of up to
+ * kBucketSize nodes per length of the prefix they share with our own id,
+ * so that we know many nodes close to us and a few far away. Instead of
+ * pinging questionable nodes when a bucket is full, a node that failed to
+ * answer is replaced, and nodes are dropped after kMaxFailures failures in
+ * a row. The table is not thread safe.
+ */
+class DhtRoutingTable {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kBucketSize = 8;
+  static constexpr int kMaxFailures = 3;
+  static constexpr auto kRefreshInterval = std::chrono::minutes(15);
+
+  explicit DhtRoutingTable(NodeId self);
+
+  // Records a message from the node. Returns false if it was not added
+  // because its bucket is full of nodes that answer.
+  bool heardFrom(const NodeId& id, const Peer& endpoint,
+                 Clock::time_point now = Clock::now());
+  // Records a query the node did not answer.
+  void failed(const NodeId& id);
+
+  // Up to `count` nodes, closest to `target` first.
+  std::vector<DhtContact> closest(const NodeId& target, size_t count) const;
+  // Random ids to look up to fill the buckets, up to the deepest occupied
+  // one, that are not full or have not changed for kRefreshInterval.
+  std::vector<NodeId> refreshTargets(Clock::time_point now = Clock::now());
+  std::vector<DhtContact> contacts() const;
+  size_t size() const;
+
+ private:
+  NodeId self_;
+  // Nodes by the number of bits they share with `self_`, least recently
+  // seen first.
+  std::array<std::vector<DhtContact>, kNodeIdSize * 8> buckets_;
+  std::array<Clock::time_point, kNodeIdSize * 8> refreshed_{};
+
+  size_t bucketIndex(const NodeId& id) const;
+};
+
+#endif  // BITTORRENTCLIENT_DHTROUTINGTABLE_H
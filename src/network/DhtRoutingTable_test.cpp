@@ -0,0 +1,60 @@
+#include "network/DhtRoutingTable.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+// An id that differs from the all-zero id from bit `bit` on, and ends with
+// `suffix` to tell ids of the same bucket apart.
+NodeId makeId(int bit, char suffix) {
+  NodeId id(kNodeIdSize, '\0');
+  id[bit / 8] = static_cast<char>(0x80 >> (bit % 8));
+  id[kNodeIdSize - 1] |= suffix;
+  return id;
+}
+
+Peer endpoint(int port) { return Peer{.ip = "127.0.0.1", .port = port}; }
+}  // namespace
+
+TEST(DhtRoutingTable, MeasuresDistanceWithXor) {
+  const NodeId zero(kNodeIdSize, '\0');
+  EXPECT_EQ(commonPrefixBits(zero, zero), 160);
+  EXPECT_EQ(commonPrefixBits(zero, makeId(0, 0)), 0);
+  EXPECT_EQ(commonPrefixBits(zero, makeId(13, 0)), 13);
+  EXPECT_TRUE(closerTo(zero, makeId(20, 0), makeId(3, 0)));
+  EXPECT_FALSE(closerTo(zero, makeId(3, 0), makeId(20, 0)));
+}
+
+TEST(DhtRoutingTable, KeepsBucketsBoundedAndReplacesFailingNodes) {
+  DhtRoutingTable table(NodeId(kNodeIdSize, '\0'));
+  for (char i = 1; i <= 8; i++) {
+    EXPECT_TRUE(table.heardFrom(makeId(0, i), endpoint(i)));
+  }
+  EXPECT_FALSE(table.heardFrom(makeId(0, 9), endpoint(9)));
+  // Other buckets are not affected.
+  EXPECT_TRUE(table.heardFrom(makeId(1, 1), endpoint(10)));
+
+  table.failed(makeId(0, 4));
+  EXPECT_TRUE(table.heardFrom(makeId(0, 9), endpoint(9)));
+  EXPECT_EQ(table.size(), 9);
+
+  for (int i = 0; i < DhtRoutingTable::kMaxFailures; i++) {
+    table.failed(makeId(1, 1));
+  }
+  EXPECT_EQ(table.size(), 8);
+}
+
+TEST(DhtRoutingTable, ReturnsClosestNodesFirst) {
+  DhtRoutingTable table(NodeId(kNodeIdSize, '\0'));
+  for (int bit = 0; bit < 40; bit += 4) {
+    table.heardFrom(makeId(bit, 0), endpoint(bit));
+  }
+
+  auto closest = table.closest(makeId(36, 0), 3);
+  ASSERT_EQ(closest.size(), 3);
+  EXPECT_EQ(closest[0].endpoint.port, 36);
+  EXPECT_EQ(closest[1].endpoint.port, 32);
+  EXPECT_EQ(closest[2].endpoint.port, 28);
+}
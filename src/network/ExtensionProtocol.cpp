@@ -0,0 +1,126 @@
+#include "network/ExtensionProtocol.h"
+
+#include <bencode/bencoding.h>
+
+#include <memory>
+#include <string>
+#include <tl/expected.hpp>
+#include <utility>
+
+#include "utils/utils.h"
+
+#define CLIENT_NAME "BitTorrentClient"
+
+namespace {
+/**
+ * Looks a key up in a dictionary without descending into nested values,
+ * unlike BDictionary::getValue.
+ */
+template <typename T>
+std::shared_ptr<T> findValue(const bencoding::BDictionary& dict,
+                             const std::string& key) {
+  for (const auto& [name, value] : dict) {
+    if (name->value() == key) {
+      return std::dynamic_pointer_cast<T>(value);
+    }
+  }
+  return nullptr;
+}
+
+tl::expected<std::shared_ptr<bencoding::BDictionary>, ExtensionProtocolError>
+decodeDictionary(const std::string& payload) {
+  if (!utils::bencodedStringsFit(payload)) {
+    return tl::unexpected(ExtensionProtocolError{
+        "Extended message announces a string longer than itself"});
+  }
+  std::shared_ptr<bencoding::BItem> decoded;
+  try {
+    decoded = bencoding::decode(payload);
+  } catch (const bencoding::DecodingError& e) {
+    return tl::unexpected(ExtensionProtocolError{e.what()});
+  }
+
+  auto dict = std::dynamic_pointer_cast<bencoding::BDictionary>(decoded);
+  if (!dict) {
+    return tl::unexpected(
+        ExtensionProtocolError{"Extended message is not a dictionary"});
+  }
+  return dict;
+}
+
+tl::expected<std::vector<std::unique_ptr<Peer>>, ExtensionProtocolError>
+decodePeerList(const bencoding::BDictionary& dict, const std::string& key) {
+  auto compact = findValue<bencoding::BString>(dict, key);
+  if (!compact) {
+    return std::vector<std::unique_ptr<Peer>>{};
+  }
+  if (compact->value().length() % kCompactPeerSize != 0) {
+    return tl::unexpected(ExtensionProtocolError{
+        "Malformed '" + key + "' in ut_pex message [length needs to be "
+        "divisible by 6]"});
+  }
+  return decodeCompactPeers(compact->value());
+}
+}  // namespace
+
+std::string encodeExtensionHandshake(int listenPort) {
+  std::shared_ptr<bencoding::BDictionary> messages =
+      bencoding::BDictionary::create(
+          {{bencoding::BString::create("ut_pex"),
+            bencoding::BInteger::create(kPexMessageId)}});
+
+  std::shared_ptr<bencoding::BDictionary> handshake =
+      bencoding::BDictionary::create(
+          {{bencoding::BString::create("m"), messages},
+           {bencoding::BString::create("v"),
+            bencoding::BString::create(CLIENT_NAME)}});
+  if (listenPort > 0) {
+    (*handshake)[bencoding::BString::create("p")] =
+        bencoding::BInteger::create(listenPort);
+  }
+
+  return bencoding::encode(handshake);
+}
+
+tl::expected<ExtensionHandshake, ExtensionProtocolError>
+decodeExtensionHandshake(const std::string& payload) {
+  auto dict = decodeDictionary(payload);
+  if (!dict) {
+    return tl::unexpected(dict.error());
+  }
+
+  ExtensionHandshake handshake;
+  if (auto messages = findValue<bencoding::BDictionary>(**dict, "m")) {
+    for (const auto& [name, value] : *messages) {
+      auto id = std::dynamic_pointer_cast<bencoding::BInteger>(value);
+      if (id && id->value() > 0 && id->value() <= UINT8_MAX) {
+        handshake.messages[name->value()] = static_cast<uint8_t>(id->value());
+      }
+    }
+  }
+  if (auto port = findValue<bencoding::BInteger>(**dict, "p")) {
+    handshake.listenPort = static_cast<int>(port->value());
+  }
+  if (auto client = findValue<bencoding::BString>(**dict, "v")) {
+    handshake.client = client->value();
+  }
+  return handshake;
+}
+
+tl::expected<PexMessage, ExtensionProtocolError> decodePexMessage(
+    const std::string& payload) {
+  auto dict = decodeDictionary(payload);
+  if (!dict) {
+    return tl::unexpected(dict.error());
+  }
+
+  auto added = decodePeerList(**dict, "added");
+  if (!added) {
+    return tl::unexpected(added.error());
+  }
+  auto dropped = decodePeerList(**dict, "dropped");
+  if (!dropped) {
+    return tl::unexpected(dropped.error());
+  }
+  return PexMessage{.added = std::move(*added), .dropped = std::move(*dropped)};
+}
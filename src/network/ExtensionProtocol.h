@@ -0,0 +1,57 @@
+#ifndef BITTORRENTCLIENT_EXTENSIONPROTOCOL_H
+#define BITTORRENTCLIENT_EXTENSIONPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "network/Peer.h"
+
+struct ExtensionProtocolError {
+  std::string message;
+};
+
+// Reserved handshake byte and bit that advertise the extension protocol
+// (BEP 10).
+constexpr size_t kExtensionProtocolByte = 5;
+constexpr uint8_t kExtensionProtocolBit = 0x10;
+
+// Extended message id of the extension handshake.
+constexpr uint8_t kExtensionHandshakeId = 0;
+// Extended message id peers are asked to use for the ut_pex messages they
+// send us.
+constexpr uint8_t kPexMessageId = 1;
+
+struct ExtensionHandshake {
+  // Extension name -> extended message id to send it with. Extensions the
+  // peer does not support, or has disabled (id 0), are left out.
+  std::unordered_map<std::string, uint8_t> messages;
+  // Port the peer listens on, or 0 if it did not say.
+  int listenPort = 0;
+  // Client name and version, if given.
+  std::string client;
+};
+
+// Peers a connected peer reports having connected to or dropped since its
+// previous ut_pex message (BEP 11).
+struct PexMessage {
+  std::vector<std::unique_ptr<Peer>> added;
+  std::vector<std::unique_ptr<Peer>> dropped;
+};
+
+// Payload of the extension handshake we send, advertising ut_pex. The
+// listen port is left out when it is 0.
+std::string encodeExtensionHandshake(int listenPort = 0);
+
+tl::expected<ExtensionHandshake, ExtensionProtocolError>
+decodeExtensionHandshake(const std::string& payload);
+
+// Only the IPv4 lists ("added", "dropped") are read.
+tl::expected<PexMessage, ExtensionProtocolError> decodePexMessage(
+    const std::string& payload);
+
+#endif  // BITTORRENTCLIENT_EXTENSIONPROTOCOL_H
@@ -0,0 +1,60 @@
+#include "network/ExtensionProtocol.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(ExtensionProtocol, HandshakeRoundTrips) {
+  std::string payload = encodeExtensionHandshake(6881);
+  EXPECT_EQ(payload, "d1:md6:ut_pexi1ee1:pi6881e1:v16:BitTorrentCliente");
+
+  auto handshake = decodeExtensionHandshake(payload);
+  ASSERT_TRUE(handshake.has_value());
+  EXPECT_EQ(handshake->messages.at("ut_pex"), kPexMessageId);
+  EXPECT_EQ(handshake->listenPort, 6881);
+  EXPECT_EQ(handshake->client, "BitTorrentClient");
+
+  EXPECT_EQ(encodeExtensionHandshake(),
+            "d1:md6:ut_pexi1ee1:v16:BitTorrentCliente");
+}
+
+TEST(ExtensionProtocol, IgnoresDisabledExtensions) {
+  auto handshake =
+      decodeExtensionHandshake("d1:md11:ut_metadatai3e6:ut_pexi0eee");
+  ASSERT_TRUE(handshake.has_value());
+  EXPECT_EQ(handshake->messages.size(), 1);
+  EXPECT_EQ(handshake->messages.at("ut_metadata"), 3);
+  EXPECT_EQ(handshake->listenPort, 0);
+}
+
+TEST(ExtensionProtocol, RejectsMalformedHandshake) {
+  EXPECT_FALSE(decodeExtensionHandshake("li1ee").has_value());
+  EXPECT_FALSE(decodeExtensionHandshake("d1:m").has_value());
+}
+
+TEST(ExtensionProtocol, DecodesPexPeers) {
+  std::string added("\x0A\x00\x00\x01\x1A\xE1\xC0\xA8\x01\x02\x00\x50", 12);
+  std::string dropped("\x7F\x00\x00\x01\x1A\xE1", 6);
+  std::string payload = "d5:added12:" + added + "7:added.f" +
+                        std::string("2:\0\0", 4) + "7:dropped6:" + dropped +
+                        "e";
+
+  auto message = decodePexMessage(payload);
+  ASSERT_TRUE(message.has_value());
+  ASSERT_EQ(message->added.size(), 2);
+  EXPECT_EQ(message->added[0]->ip, "10.0.0.1");
+  EXPECT_EQ(message->added[0]->port, 6881);
+  EXPECT_EQ(message->added[1]->ip, "192.168.1.2");
+  EXPECT_EQ(message->added[1]->port, 80);
+  ASSERT_EQ(message->dropped.size(), 1);
+  EXPECT_EQ(message->dropped[0]->ip, "127.0.0.1");
+}
+
+TEST(ExtensionProtocol, RejectsTruncatedPexPeers) {
+  EXPECT_FALSE(decodePexMessage("d5:added5:abcdee").has_value());
+}
+
+TEST(ExtensionProtocol, RejectsStringsLongerThanTheMessage) {
+  EXPECT_FALSE(decodePexMessage("d5:added4000000000:e").has_value());
+  EXPECT_FALSE(decodeExtensionHandshake("d1:md99999999999:ee").has_value());
+}
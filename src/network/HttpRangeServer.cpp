@@ -0,0 +1,392 @@
+#include "network/HttpRangeServer.h"
+
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tl/expected.hpp>
+#include <utility>
+
+#include "infra/Logger.h"
+
+#define MAX_REQUEST_HEAD 8192
+// Number of pieces ahead of the one being sent that are made time-critical.
+#define READ_AHEAD_PIECES 8
+#define READ_AHEAD_INTERVAL 500  // 500 ms between consecutive piece deadlines
+#define PIECE_WAIT_POLL 1000     // 1 sec
+
+namespace {
+std::string toLower(std::string value) {
+  std::ranges::transform(value, value.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return value;
+}
+
+std::string trim(const std::string& value) {
+  size_t first = value.find_first_not_of(" \t");
+  if (first == std::string::npos) {
+    return "";
+  }
+  size_t last = value.find_last_not_of(" \t\r");
+  return value.substr(first, last - first + 1);
+}
+
+tl::expected<int64_t, HttpRangeServerError> parseOffset(
+    const std::string& value) {
+  int64_t offset = 0;
+  auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), offset);
+  if (value.empty() || value.front() == '-' || error != std::errc() ||
+      end != value.data() + value.size()) {
+    return tl::unexpected(
+        HttpRangeServerError{"Invalid range offset: " + value});
+  }
+  return offset;
+}
+
+bool sendAll(int sock, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n =
+        send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+std::string statusLine(int status) {
+  switch (status) {
+    case 200:
+      return "HTTP/1.1 200 OK\r\n";
+    case 206:
+      return "HTTP/1.1 206 Partial Content\r\n";
+    case 400:
+      return "HTTP/1.1 400 Bad Request\r\n";
+    case 404:
+      return "HTTP/1.1 404 Not Found\r\n";
+    case 405:
+      return "HTTP/1.1 405 Method Not Allowed\r\n";
+    case 500:
+      return "HTTP/1.1 500 Internal Server Error\r\n";
+    default:
+      return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+  }
+}
+}  // namespace
+
+tl::expected<HttpRequest, HttpRangeServerError> parseHttpRequest(
+    const std::string& head) {
+  std::istringstream stream(head);
+  std::string line;
+  if (!std::getline(stream, line)) {
+    return tl::unexpected(HttpRangeServerError{"Empty request"});
+  }
+
+  HttpRequest request;
+  std::string version;
+  std::istringstream request_line(trim(line));
+  if (!(request_line >> request.method >> request.target >> version) ||
+      !version.starts_with("HTTP/1.")) {
+    return tl::unexpected(
+        HttpRangeServerError{"Malformed request line: " + line});
+  }
+
+  while (std::getline(stream, line)) {
+    line = trim(line);
+    if (line.empty()) {
+      break;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      return tl::unexpected(HttpRangeServerError{"Malformed header: " + line});
+    }
+    request.headers[toLower(trim(line.substr(0, colon)))] =
+        trim(line.substr(colon + 1));
+  }
+  return request;
+}
+
+tl::expected<ByteRange, HttpRangeServerError> parseByteRange(
+    const std::string& value, int64_t fileSize) {
+  const std::string prefix = "bytes=";
+  if (!value.starts_with(prefix) || value.find(',') != std::string::npos) {
+    return tl::unexpected(HttpRangeServerError{"Unsupported range: " + value});
+  }
+
+  std::string spec = trim(value.substr(prefix.size()));
+  size_t dash = spec.find('-');
+  if (dash == std::string::npos || fileSize <= 0) {
+    return tl::unexpected(HttpRangeServerError{"Invalid range: " + value});
+  }
+
+  std::string first = spec.substr(0, dash);
+  std::string last = spec.substr(dash + 1);
+
+  // Suffix range: the last N bytes of the file.
+  if (first.empty()) {
+    auto suffix = parseOffset(last);
+    if (!suffix || *suffix == 0) {
+      return tl::unexpected(HttpRangeServerError{"Invalid range: " + value});
+    }
+    return ByteRange{std::max<int64_t>(fileSize - *suffix, 0), fileSize - 1};
+  }
+
+  auto begin = parseOffset(first);
+  if (!begin || *begin >= fileSize) {
+    return tl::unexpected(HttpRangeServerError{"Invalid range: " + value});
+  }
+  if (last.empty()) {
+    return ByteRange{*begin, fileSize - 1};
+  }
+
+  auto end = parseOffset(last);
+  if (!end || *end < *begin) {
+    return tl::unexpected(HttpRangeServerError{"Invalid range: " + value});
+  }
+  return ByteRange{*begin, std::min(*end, fileSize - 1)};
+}
+
+HttpRangeServer::HttpRangeServer(std::shared_ptr<PieceManager> pieceManager,
+                                 std::string filePath, std::string fileName,
+                                 int64_t fileSize)
+    : pieceManager_(std::move(pieceManager)),
+      filePath_(std::move(filePath)),
+      fileName_(std::move(fileName)),
+      fileSize_(fileSize) {}
+
+HttpRangeServer::~HttpRangeServer() { stop(); }
+
+/**
+ * Starts listening on the given port (0 picks a free one, see port()) and
+ * serving connections on background threads.
+ */
+tl::expected<void, HttpRangeServerError> HttpRangeServer::start(int port) {
+  listenSock_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenSock_ < 0) {
+    return tl::unexpected(HttpRangeServerError{"Socket creation error"});
+  }
+
+  int reuse = 1;
+  setsockopt(listenSock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  socklen_t length = sizeof(address);
+  if (bind(listenSock_, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+      listen(listenSock_, SOMAXCONN) < 0 ||
+      getsockname(listenSock_, reinterpret_cast<sockaddr*>(&address),
+                  &length) < 0) {
+    close(listenSock_);
+    listenSock_ = -1;
+    return tl::unexpected(HttpRangeServerError{
+        "Failed to listen on port " + std::to_string(port)});
+  }
+
+  port_ = ntohs(address.sin_port);
+  running_ = true;
+  acceptThread_ = std::thread([this] { acceptLoop(); });
+
+  Logger::log(fmt::format("Serving {} on http://127.0.0.1:{}/{}", fileName_,
+                          port_, fileName_));
+  return {};
+}
+
+void HttpRangeServer::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+
+  // Wakes up the accept loop and every client blocked in recv.
+  shutdown(listenSock_, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> guard(clientsLock_);
+    for (int sock : clientSocks_) {
+      shutdown(sock, SHUT_RDWR);
+    }
+  }
+
+  if (acceptThread_.joinable()) {
+    acceptThread_.join();
+  }
+  close(listenSock_);
+  listenSock_ = -1;
+
+  std::unique_lock<std::mutex> lock(clientsLock_);
+  clientsDone_.wait(lock, [this] { return clientSocks_.empty(); });
+}
+
+void HttpRangeServer::acceptLoop() {
+  while (running_) {
+    int sock = accept(listenSock_, nullptr, nullptr);
+    if (sock < 0) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> guard(clientsLock_);
+    if (!running_) {
+      close(sock);
+      break;
+    }
+    clientSocks_.push_back(sock);
+    std::thread([this, sock] { serveClient(sock); }).detach();
+  }
+}
+
+/**
+ * Serves requests on a persistent connection until the client closes it,
+ * asks for it to be closed, or sends something we cannot handle. If the
+ * file cannot be opened, the first request for it is answered with a 500
+ * and the connection closed.
+ */
+void HttpRangeServer::serveClient(int sock) {
+  int fd = open(filePath_.c_str(), O_RDONLY);
+  std::string buffer;
+  char chunk[4096];
+  bool keep_alive = true;
+
+  while (keep_alive && running_) {
+    size_t end_of_head;
+    while ((end_of_head = buffer.find("\r\n\r\n")) == std::string::npos &&
+           buffer.size() < MAX_REQUEST_HEAD) {
+      ssize_t n = recv(sock, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        keep_alive = false;
+        break;
+      }
+      buffer.append(chunk, n);
+    }
+    if (!keep_alive || end_of_head == std::string::npos) {
+      break;
+    }
+
+    auto request = parseHttpRequest(buffer.substr(0, end_of_head + 2));
+    buffer.erase(0, end_of_head + 4);
+
+    int status = 200;
+    ByteRange range{0, fileSize_ - 1};
+    if (!request) {
+      status = 400;
+    } else if (request->method != "GET" && request->method != "HEAD") {
+      status = 405;
+    } else if (request->target != "/" && request->target != "/" + fileName_) {
+      status = 404;
+    } else if (auto header = request->headers.find("range");
+               header != request->headers.end()) {
+      auto parsed = parseByteRange(header->second, fileSize_);
+      status = parsed ? 206 : 416;
+      if (parsed) {
+        range = *parsed;
+      }
+    }
+
+    if (request) {
+      auto connection = request->headers.find("connection");
+      keep_alive = connection == request->headers.end() ||
+                   toLower(connection->second) != "close";
+    }
+    if (fd < 0 && (status == 200 || status == 206)) {
+      status = 500;
+      keep_alive = false;
+    }
+
+    std::string head = statusLine(status);
+    head += "Accept-Ranges: bytes\r\n";
+    if (status == 200 || status == 206) {
+      head += "Content-Type: application/octet-stream\r\n";
+      head += fmt::format("Content-Length: {}\r\n",
+                          range.last - range.first + 1);
+      if (status == 206) {
+        head += fmt::format("Content-Range: bytes {}-{}/{}\r\n", range.first,
+                            range.last, fileSize_);
+      }
+    } else {
+      if (status == 416) {
+        head += fmt::format("Content-Range: bytes */{}\r\n", fileSize_);
+      }
+      head += "Content-Length: 0\r\n";
+    }
+    head += keep_alive ? "Connection: keep-alive\r\n\r\n"
+                       : "Connection: close\r\n\r\n";
+
+    if (!sendAll(sock, head)) {
+      break;
+    }
+    if ((status == 200 || status == 206) && request->method == "GET") {
+      if (!sendRange(sock, fd, range)) {
+        break;
+      }
+    }
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  // Last access to the server, which stop() may destroy once notified. The
+  // socket is closed under the lock, so that stop() does not shut down a
+  // descriptor reused in the meantime.
+  std::lock_guard<std::mutex> guard(clientsLock_);
+  std::erase(clientSocks_, sock);
+  close(sock);
+  clientsDone_.notify_all();
+}
+
+/**
+ * Sends the range piece by piece. Before waiting for a piece, it and the
+ * next READ_AHEAD_PIECES pieces are given deadlines so the PieceManager
+ * fetches them ahead of everything else. Verified pieces are sent straight
+ * from the page cache with sendfile.
+ */
+tl::expected<void, HttpRangeServerError> HttpRangeServer::sendRange(
+    int sock, int fd, ByteRange range) {
+  const int64_t piece_length = pieceManager_->pieceLength();
+  const int last_piece = static_cast<int>(range.last / piece_length);
+
+  off_t offset = range.first;
+  while (offset <= range.last) {
+    const int piece = static_cast<int>(offset / piece_length);
+
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i <= READ_AHEAD_PIECES && piece + i <= last_piece; i++) {
+      pieceManager_->setPieceDeadline(
+          piece + i, now + i * std::chrono::milliseconds(READ_AHEAD_INTERVAL));
+    }
+
+    while (!pieceManager_->waitForPiece(
+        piece, std::chrono::milliseconds(PIECE_WAIT_POLL))) {
+      if (!running_) {
+        return tl::unexpected(HttpRangeServerError{"Server stopped"});
+      }
+    }
+
+    const int64_t piece_end =
+        std::min<int64_t>((piece + 1) * piece_length, range.last + 1);
+    while (offset < piece_end) {
+      ssize_t sent = sendfile(sock, fd, &offset, piece_end - offset);
+      if (sent <= 0) {
+        return tl::unexpected(HttpRangeServerError{
+            "Failed to send data to socket " + std::to_string(sock)});
+      }
+    }
+  }
+  return {};
+}
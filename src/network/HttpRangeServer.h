@@ -0,0 +1,84 @@
+#ifndef BITTORRENTCLIENT_HTTPRANGESERVER_H
+#define BITTORRENTCLIENT_HTTPRANGESERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "core/PieceManager.h"
+
+struct HttpRangeServerError {
+  std::string message;
+};
+
+// Inclusive byte range of the served file.
+struct ByteRange {
+  int64_t first;
+  int64_t last;
+};
+
+struct HttpRequest {
+  std::string method;
+  std::string target;
+  // Header names are lower-cased.
+  std::unordered_map<std::string, std::string> headers;
+};
+
+tl::expected<HttpRequest, HttpRangeServerError> parseHttpRequest(
+    const std::string& head);
+
+// Parses the value of a Range header ("bytes=0-99", "bytes=100-",
+// "bytes=-100") against a file of `fileSize` bytes. Multiple ranges are not
+// supported.
+tl::expected<ByteRange, HttpRangeServerError> parseByteRange(
+    const std::string& value, int64_t fileSize);
+
+/**
+ * Minimal HTTP/1.1 server that serves the file being downloaded, with Range
+ * support, so consumers can read it while the download is in progress.
+ * Pieces covering a requested range are made time-critical in the
+ * PieceManager, and the response streams each piece with sendfile as soon
+ * as it has been verified and written.
+ */
+class HttpRangeServer {
+ public:
+  explicit HttpRangeServer(std::shared_ptr<PieceManager> pieceManager,
+                           std::string filePath, std::string fileName,
+                           int64_t fileSize);
+  ~HttpRangeServer();
+
+  tl::expected<void, HttpRangeServerError> start(int port);
+  void stop();
+  int port() const { return port_; }
+
+ private:
+  std::shared_ptr<PieceManager> pieceManager_;
+  const std::string filePath_;
+  const std::string fileName_;
+  const int64_t fileSize_;
+
+  int listenSock_ = -1;
+  int port_ = 0;
+  std::atomic<bool> running_ = false;
+  std::thread acceptThread_;
+
+  // Clients are served on detached threads, each of which removes its socket
+  // when done; stop() waits for none to be left.
+  std::mutex clientsLock_;
+  std::condition_variable clientsDone_;
+  std::vector<int> clientSocks_;
+
+  void acceptLoop();
+  void serveClient(int sock);
+  tl::expected<void, HttpRangeServerError> sendRange(int sock, int fd,
+                                                     ByteRange range);
+};
+
+#endif  // BITTORRENTCLIENT_HTTPRANGESERVER_H
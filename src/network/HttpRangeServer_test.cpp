@@ -0,0 +1,55 @@
+#include "network/HttpRangeServer.h"
+
+#include <gtest/gtest.h>
+
+TEST(HttpRangeServer, ParsesRequestLineAndHeaders) {
+  auto request = parseHttpRequest(
+      "GET /file.iso HTTP/1.1\r\nHost: localhost\r\nRange: bytes=0-99\r\n");
+
+  ASSERT_TRUE(request.has_value());
+  EXPECT_EQ(request->method, "GET");
+  EXPECT_EQ(request->target, "/file.iso");
+  EXPECT_EQ(request->headers["host"], "localhost");
+  EXPECT_EQ(request->headers["range"], "bytes=0-99");
+}
+
+TEST(HttpRangeServer, RejectsMalformedRequest) {
+  EXPECT_FALSE(parseHttpRequest("GET\r\n").has_value());
+  EXPECT_FALSE(parseHttpRequest("GET / SPDY/3\r\n").has_value());
+}
+
+TEST(HttpRangeServer, ParsesByteRanges) {
+  auto closed = parseByteRange("bytes=10-19", 100);
+  ASSERT_TRUE(closed.has_value());
+  EXPECT_EQ(closed->first, 10);
+  EXPECT_EQ(closed->last, 19);
+
+  auto open_ended = parseByteRange("bytes=90-", 100);
+  ASSERT_TRUE(open_ended.has_value());
+  EXPECT_EQ(open_ended->first, 90);
+  EXPECT_EQ(open_ended->last, 99);
+
+  auto suffix = parseByteRange("bytes=-30", 100);
+  ASSERT_TRUE(suffix.has_value());
+  EXPECT_EQ(suffix->first, 70);
+  EXPECT_EQ(suffix->last, 99);
+
+  auto clamped = parseByteRange("bytes=50-1000", 100);
+  ASSERT_TRUE(clamped.has_value());
+  EXPECT_EQ(clamped->last, 99);
+}
+
+TEST(HttpRangeServer, RejectsUnsatisfiableRanges) {
+  EXPECT_FALSE(parseByteRange("bytes=100-", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=20-10", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=0-1,5-6", 100).has_value());
+  EXPECT_FALSE(parseByteRange("items=0-1", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=-0", 100).has_value());
+}
+
+TEST(HttpRangeServer, RejectsOffsetsOutOfRange) {
+  EXPECT_FALSE(parseByteRange("bytes=99999999999999999999-", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=0-99999999999999999999", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=-99999999999999999999", 100).has_value());
+  EXPECT_FALSE(parseByteRange("bytes=--5", 100).has_value());
+}
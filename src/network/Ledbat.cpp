@@ -0,0 +1,57 @@
+#include "network/Ledbat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+Ledbat::Ledbat(size_t mss) : mss_(mss), window_(2.0 * mss) {}
+
+void Ledbat::addDelaySample(uint32_t delay, Clock::time_point now) {
+  if (baseDelays_.empty() || now - lastRollover_ >= std::chrono::minutes(1)) {
+    baseDelays_.push_back(delay);
+    if (baseDelays_.size() > kBaseHistory) {
+      baseDelays_.pop_front();
+    }
+    lastRollover_ = now;
+  } else {
+    baseDelays_.back() = std::min(baseDelays_.back(), delay);
+  }
+
+  currentDelays_[samples_ % kCurrentFilter] = delay;
+  samples_++;
+}
+
+uint32_t Ledbat::queuingDelay() const {
+  if (samples_ == 0) {
+    return 0;
+  }
+  const size_t count = std::min<size_t>(samples_, kCurrentFilter);
+  const uint32_t current =
+      *std::min_element(currentDelays_.begin(), currentDelays_.begin() + count);
+  const uint32_t base = *std::ranges::min_element(baseDelays_);
+  return current > base ? current - base : 0;
+}
+
+/**
+ * cwnd += GAIN * off_target * bytes_acked * MSS / cwnd, where off_target
+ * is how far below the target the queuing delay is, as a fraction of the
+ * target. The window only grows while it is what limits the sender.
+ */
+void Ledbat::onAck(size_t bytesAcked, size_t flightSize) {
+  const double off_target =
+      std::max(-1.0, (static_cast<double>(kTargetDelay) - queuingDelay()) /
+                         kTargetDelay);
+  if (off_target > 0 && flightSize + mss_ < window()) {
+    return;
+  }
+  window_ += kGain * off_target * static_cast<double>(bytesAcked) *
+             static_cast<double>(mss_) / window_;
+  window_ = std::clamp(window_, static_cast<double>(minWindow()),
+                       static_cast<double>(kMaxWindow));
+}
+
+void Ledbat::onLoss() {
+  window_ = std::max(window_ / 2, static_cast<double>(minWindow()));
+}
+
+void Ledbat::onTimeout() { window_ = static_cast<double>(mss_); }
@@ -0,0 +1,59 @@
+#ifndef BITTORRENTCLIENT_LEDBAT_H
+#define BITTORRENTCLIENT_LEDBAT_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/**
+ * LEDBAT congestion control (RFC 6817), as used by uTP. The window grows
+ * while the queuing delay the sender adds on the path stays below
+ * kTargetDelay and shrinks as it goes above, so a bulk transfer backs off
+ * before it fills the buffers other traffic goes through.
+ *
+ * Delays are one-way and in microseconds, measured against the receiver's
+ * clock. The queuing delay is the current delay minus the base delay, the
+ * lowest one seen over the last kBaseHistory minutes, which cancels out
+ * the offset between the two clocks.
+ */
+class Ledbat {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr uint32_t kTargetDelay = 100000;  // 100 ms
+  static constexpr double kGain = 1;
+  static constexpr int kBaseHistory = 10;
+  static constexpr size_t kMaxWindow = size_t{4} << 20;
+
+  explicit Ledbat(size_t mss);
+
+  void addDelaySample(uint32_t delay, Clock::time_point now = Clock::now());
+  // `bytesAcked` were newly acknowledged while `flightSize` bytes were in
+  // flight.
+  void onAck(size_t bytesAcked, size_t flightSize);
+  // A packet was lost and is being retransmitted.
+  void onLoss();
+  // Nothing was acknowledged within the retransmission timeout.
+  void onTimeout();
+
+  size_t window() const { return static_cast<size_t>(window_); }
+  // 0 until the first delay sample.
+  uint32_t queuingDelay() const;
+
+ private:
+  static constexpr int kCurrentFilter = 4;
+
+  const size_t mss_;
+  double window_;
+
+  // Lowest delay of each of the last minutes, newest last.
+  std::deque<uint32_t> baseDelays_;
+  Clock::time_point lastRollover_;
+  std::array<uint32_t, kCurrentFilter> currentDelays_{};
+  size_t samples_ = 0;
+
+  size_t minWindow() const { return 2 * mss_; }
+};
+
+#endif  // BITTORRENTCLIENT_LEDBAT_H
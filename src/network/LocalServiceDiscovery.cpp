@@ -0,0 +1,288 @@
+#include "network/LocalServiceDiscovery.h"
+
+#include <arpa/inet.h>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tl/expected.hpp>
+#include <utility>
+#include <vector>
+
+#include "infra/Logger.h"
+
+#define MAX_DATAGRAM 1400
+#define RECEIVE_POLL 1000  // 1 sec
+#define INFO_HASH_LENGTH 40
+
+namespace {
+std::string toLower(std::string value) {
+  std::ranges::transform(value, value.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return value;
+}
+
+std::string trim(const std::string& value) {
+  size_t first = value.find_first_not_of(" \t");
+  if (first == std::string::npos) {
+    return "";
+  }
+  size_t last = value.find_last_not_of(" \t\r");
+  return value.substr(first, last - first + 1);
+}
+
+std::string randomCookie() {
+  std::random_device rd;
+  std::uniform_int_distribution<uint32_t> distrib;
+  return fmt::format("{:08x}", distrib(rd));
+}
+}  // namespace
+
+std::string formatLsdAnnounce(const LsdAnnounce& announce,
+                              const std::string& host) {
+  std::string message = "BT-SEARCH * HTTP/1.1\r\n";
+  message += fmt::format("Host: {}\r\n", host);
+  message += fmt::format("Port: {}\r\n", announce.port);
+  for (const std::string& info_hash : announce.infoHashes) {
+    message += fmt::format("Infohash: {}\r\n", info_hash);
+  }
+  if (!announce.cookie.empty()) {
+    message += fmt::format("cookie: {}\r\n", announce.cookie);
+  }
+  message += "\r\n\r\n";
+  return message;
+}
+
+/**
+ * Parses a BT-SEARCH message. Header names are case-insensitive and info
+ * hashes are returned in lower case; hashes that are not 40 hex digits are
+ * skipped.
+ */
+tl::expected<LsdAnnounce, LsdError> parseLsdAnnounce(
+    const std::string& message) {
+  std::istringstream stream(message);
+  std::string line;
+  if (!std::getline(stream, line) ||
+      trim(line) != "BT-SEARCH * HTTP/1.1") {
+    return tl::unexpected(LsdError{"Not a BT-SEARCH message"});
+  }
+
+  LsdAnnounce announce;
+  while (std::getline(stream, line)) {
+    line = trim(line);
+    if (line.empty()) {
+      break;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      return tl::unexpected(LsdError{"Malformed header: " + line});
+    }
+    const std::string name = toLower(trim(line.substr(0, colon)));
+    const std::string value = trim(line.substr(colon + 1));
+
+    if (name == "port") {
+      if (value.empty() || value.size() > 5 ||
+          !std::ranges::all_of(value, [](unsigned char c) {
+            return std::isdigit(c);
+          })) {
+        return tl::unexpected(LsdError{"Invalid port: " + value});
+      }
+      announce.port = std::stoi(value);
+    } else if (name == "infohash") {
+      if (value.size() == INFO_HASH_LENGTH &&
+          std::ranges::all_of(value, [](unsigned char c) {
+            return std::isxdigit(c);
+          })) {
+        announce.infoHashes.push_back(toLower(value));
+      }
+    } else if (name == "cookie") {
+      announce.cookie = value;
+    }
+  }
+
+  if (announce.port <= 0 || announce.port > 65535) {
+    return tl::unexpected(LsdError{"Missing or invalid port"});
+  }
+  if (announce.infoHashes.empty()) {
+    return tl::unexpected(LsdError{"No info hash"});
+  }
+  return announce;
+}
+
+LocalServiceDiscovery::LocalServiceDiscovery(
+    int peerPort, PeersCallback onPeers, std::string group, int port,
+    std::chrono::milliseconds interval)
+    : peerPort_(peerPort),
+      onPeers_(std::move(onPeers)),
+      group_(std::move(group)),
+      port_(port),
+      interval_(interval),
+      cookie_(randomCookie()) {}
+
+LocalServiceDiscovery::~LocalServiceDiscovery() { stop(); }
+
+/**
+ * Joins the multicast group and starts announcing and listening. Several
+ * clients on the same host share the port, and multicast loopback lets
+ * them find each other too.
+ */
+tl::expected<void, LsdError> LocalServiceDiscovery::start() {
+  sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock_ < 0) {
+    return tl::unexpected(LsdError{"Socket creation error"});
+  }
+
+  int enable = 1;
+  setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  setsockopt(sock_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port_);
+
+  ip_mreq membership{};
+  // Announces must not leave the local network.
+  unsigned char ttl = 1;
+  unsigned char loop = 1;
+  if (inet_pton(AF_INET, group_.c_str(), &membership.imr_multiaddr) != 1 ||
+      bind(sock_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) <
+          0 ||
+      setsockopt(sock_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+                 sizeof(membership)) < 0 ||
+      setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) <
+          0 ||
+      setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) <
+          0) {
+    close(sock_);
+    sock_ = -1;
+    return tl::unexpected(LsdError{
+        fmt::format("Failed to join multicast group {}:{}", group_, port_)});
+  }
+
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+  return {};
+}
+
+void LocalServiceDiscovery::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+
+  // Wakes up the thread waiting in poll
+  shutdown(sock_, SHUT_RDWR);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  close(sock_);
+  sock_ = -1;
+}
+
+void LocalServiceDiscovery::addTorrent(const std::string& infoHash) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    const std::string info_hash = toLower(infoHash);
+    if (std::ranges::find(infoHashes_, info_hash) != infoHashes_.end()) {
+      return;
+    }
+    infoHashes_.push_back(info_hash);
+  }
+  if (running_) {
+    announce();
+  }
+}
+
+void LocalServiceDiscovery::run() {
+  announce();
+  auto next_announce = std::chrono::steady_clock::now() + interval_;
+
+  char buffer[MAX_DATAGRAM];
+  while (running_) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_announce) {
+      announce();
+      next_announce = now + interval_;
+    }
+
+    auto wait = std::min(
+        std::chrono::duration_cast<std::chrono::milliseconds>(next_announce -
+                                                              now),
+        std::chrono::milliseconds(RECEIVE_POLL));
+    pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+    if (poll(&descriptor, 1, static_cast<int>(wait.count())) <= 0) {
+      continue;
+    }
+
+    sockaddr_in from{};
+    socklen_t length = sizeof(from);
+    ssize_t n = recvfrom(sock_, buffer, sizeof(buffer), 0,
+                         reinterpret_cast<sockaddr*>(&from), &length);
+    if (n <= 0) {
+      continue;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+    handleMessage(std::string(buffer, n), ip);
+  }
+}
+
+/**
+ * Multicasts one BT-SEARCH message for all our torrents.
+ */
+void LocalServiceDiscovery::announce() {
+  LsdAnnounce announce{.port = peerPort_, .cookie = cookie_};
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    announce.infoHashes = infoHashes_;
+  }
+  if (announce.infoHashes.empty()) {
+    return;
+  }
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port_);
+  inet_pton(AF_INET, group_.c_str(), &address.sin_addr);
+
+  const std::string message =
+      formatLsdAnnounce(announce, fmt::format("{}:{}", group_, port_));
+  if (sendto(sock_, message.data(), message.size(), 0,
+             reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    Logger::log("Failed to send local service discovery announce");
+  }
+}
+
+void LocalServiceDiscovery::handleMessage(const std::string& message,
+                                          const std::string& ip) {
+  auto announce = parseLsdAnnounce(message);
+  if (!announce || announce->cookie == cookie_) {
+    return;
+  }
+
+  for (const std::string& info_hash : announce->infoHashes) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (std::ranges::find(infoHashes_, info_hash) == infoHashes_.end()) {
+        continue;
+      }
+    }
+    std::vector<std::unique_ptr<Peer>> peers;
+    peers.push_back(
+        std::make_unique<Peer>(Peer{.ip = ip, .port = announce->port}));
+    onPeers_(info_hash, std::move(peers));
+  }
+}
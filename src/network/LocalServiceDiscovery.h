@@ -0,0 +1,81 @@
+#ifndef BITTORRENTCLIENT_LOCALSERVICEDISCOVERY_H
+#define BITTORRENTCLIENT_LOCALSERVICEDISCOVERY_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tl/expected.hpp>
+#include <vector>
+
+#include "network/Peer.h"
+
+struct LsdError {
+  std::string message;
+};
+
+// A BT-SEARCH message, announcing that the sender downloads the torrents
+// with the given (hex) info hashes on `port`.
+struct LsdAnnounce {
+  int port = 0;
+  std::vector<std::string> infoHashes;
+  // Lets a client recognise, and ignore, its own announces.
+  std::string cookie;
+};
+
+std::string formatLsdAnnounce(const LsdAnnounce& announce,
+                              const std::string& host);
+tl::expected<LsdAnnounce, LsdError> parseLsdAnnounce(
+    const std::string& message);
+
+/**
+ * Local Service Discovery (BEP 14): finds the peers of our torrents on the
+ * local network by multicasting BT-SEARCH messages and listening for those
+ * of other clients. Announces are sent when the service starts, when a
+ * torrent is added, and every `interval` afterwards. Peers are reported
+ * with the address the announce came from and the port it carried.
+ */
+class LocalServiceDiscovery {
+ public:
+  // Called from the service thread with the (hex) info hash of one of our
+  // torrents and the peer that announced it.
+  using PeersCallback = std::function<void(
+      const std::string& infoHash, std::vector<std::unique_ptr<Peer>> peers)>;
+
+  explicit LocalServiceDiscovery(
+      int peerPort, PeersCallback onPeers,
+      std::string group = "239.192.152.143", int port = 6771,
+      std::chrono::milliseconds interval = std::chrono::minutes(5));
+  ~LocalServiceDiscovery();
+
+  tl::expected<void, LsdError> start();
+  void stop();
+
+  // Starts looking for the peers of the torrent, with an announce right
+  // away if the service is running.
+  void addTorrent(const std::string& infoHash);
+
+ private:
+  const int peerPort_;
+  PeersCallback onPeers_;
+  const std::string group_;
+  const int port_;
+  const std::chrono::milliseconds interval_;
+  const std::string cookie_;
+
+  int sock_ = -1;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+
+  std::mutex lock_;
+  std::vector<std::string> infoHashes_;
+
+  void run();
+  void announce();
+  void handleMessage(const std::string& message, const std::string& ip);
+};
+
+#endif  // BITTORRENTCLIENT_LOCALSERVICEDISCOVERY_H
@@ -0,0 +1,95 @@
+#include "network/LocalServiceDiscovery.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+const std::string kInfoHash = "c9e15763f722f23e98a29decdfae341b98d53056";
+// Kept off the standard port so that the test does not talk to real clients.
+constexpr int kTestPort = 16771;
+}  // namespace
+
+TEST(LocalServiceDiscovery, FormatsAndParsesAnnounces) {
+  LsdAnnounce announce{.port = 6881,
+                       .infoHashes = {kInfoHash, std::string(40, 'a')},
+                       .cookie = "1234"};
+  std::string message =
+      formatLsdAnnounce(announce, "239.192.152.143:6771");
+  EXPECT_TRUE(message.starts_with("BT-SEARCH * HTTP/1.1\r\n"
+                                  "Host: 239.192.152.143:6771\r\n"
+                                  "Port: 6881\r\n"));
+
+  auto parsed = parseLsdAnnounce(message);
+  ASSERT_TRUE(parsed.has_value());
+  EXPECT_EQ(parsed->port, 6881);
+  EXPECT_EQ(parsed->infoHashes, announce.infoHashes);
+  EXPECT_EQ(parsed->cookie, "1234");
+
+  // Header names are case-insensitive and hashes are lower-cased.
+  parsed = parseLsdAnnounce(
+      "BT-SEARCH * HTTP/1.1\r\nPORT: 51413\r\n"
+      "infohash: C9E15763F722F23E98A29DECDFAE341B98D53056\r\n"
+      "Infohash: not-a-hash\r\n\r\n\r\n");
+  ASSERT_TRUE(parsed.has_value());
+  EXPECT_EQ(parsed->infoHashes, std::vector<std::string>{kInfoHash});
+
+  EXPECT_FALSE(parseLsdAnnounce("M-SEARCH * HTTP/1.1\r\n\r\n").has_value());
+  EXPECT_FALSE(parseLsdAnnounce("BT-SEARCH * HTTP/1.1\r\nPort: 6881\r\n\r\n")
+                   .has_value());
+  EXPECT_FALSE(parseLsdAnnounce("BT-SEARCH * HTTP/1.1\r\nPort: 99999\r\n"
+                                "Infohash: " +
+                                kInfoHash + "\r\n\r\n")
+                   .has_value());
+}
+
+TEST(LocalServiceDiscovery, FindsPeersOnTheSameHost) {
+  std::mutex lock;
+  std::condition_variable found;
+  std::vector<int> ports_seen_by_first;
+  std::vector<int> ports_seen_by_second;
+  auto collect = [&](std::vector<int>& ports) {
+    return [&](const std::string& info_hash,
+               std::vector<std::unique_ptr<Peer>> peers) {
+      EXPECT_EQ(info_hash, kInfoHash);
+      std::lock_guard<std::mutex> guard(lock);
+      for (const auto& peer : peers) {
+        ports.push_back(peer->port);
+      }
+      found.notify_all();
+    };
+  };
+
+  LocalServiceDiscovery first(6881, collect(ports_seen_by_first),
+                              "239.192.152.143", kTestPort,
+                              std::chrono::milliseconds(200));
+  LocalServiceDiscovery second(6882, collect(ports_seen_by_second),
+                               "239.192.152.143", kTestPort,
+                               std::chrono::milliseconds(200));
+  LocalServiceDiscovery other(6883, collect(ports_seen_by_first),
+                              "239.192.152.143", kTestPort,
+                              std::chrono::milliseconds(200));
+  first.addTorrent(kInfoHash);
+  second.addTorrent(kInfoHash);
+  other.addTorrent(std::string(40, 'b'));
+  ASSERT_TRUE(first.start().has_value());
+  ASSERT_TRUE(second.start().has_value());
+  ASSERT_TRUE(other.start().has_value());
+
+  std::unique_lock<std::mutex> guard(lock);
+  ASSERT_TRUE(found.wait_for(guard, std::chrono::seconds(5), [&] {
+    return !ports_seen_by_first.empty() && !ports_seen_by_second.empty();
+  }));
+  // Neither our own announces nor those of other torrents are reported.
+  for (int port : ports_seen_by_first) {
+    EXPECT_EQ(port, 6882);
+  }
+  for (int port : ports_seen_by_second) {
+    EXPECT_EQ(port, 6881);
+  }
+}
@@ -0,0 +1,52 @@
+#include "network/Peer.h"
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+std::vector<std::unique_ptr<Peer>> decodeCompactPeers(
+    const std::string& compact) {
+  std::vector<std::unique_ptr<Peer>> peers;
+
+  // Unmarshalls the peer information:
+  // Detailed explanation can be found here:
+  // https://blog.jse.li/posts/torrent/
+  // Essentially, every 6 bytes represent a single peer with the first 4
+  // bytes being the IP and the last 2 bytes being the port number.
+  const size_t peer_num = compact.length() / kCompactPeerSize;
+  peers.reserve(peer_num);
+  for (size_t i = 0; i < peer_num; i++) {
+    size_t offset = i * kCompactPeerSize;
+    std::stringstream peer_ip;
+    peer_ip << std::to_string(static_cast<uint8_t>(compact[offset])) << ".";
+    peer_ip << std::to_string(static_cast<uint8_t>(compact[offset + 1]))
+            << ".";
+    peer_ip << std::to_string(static_cast<uint8_t>(compact[offset + 2]))
+            << ".";
+    peer_ip << std::to_string(static_cast<uint8_t>(compact[offset + 3]));
+    int peer_port = utils::bytesToInt(compact.substr(offset + 4, 2));
+
+    peers.push_back(
+        std::make_unique<Peer>(Peer{.ip = peer_ip.str(), .port = peer_port}));
+  }
+  return peers;
+}
+
+std::string encodeCompactPeer(const Peer& peer) {
+  in_addr address{};
+  if (inet_pton(AF_INET, peer.ip.c_str(), &address) != 1 || peer.port < 0 ||
+      peer.port > UINT16_MAX) {
+    return "";
+  }
+
+  std::string compact(reinterpret_cast<const char*>(&address.s_addr), 4);
+  compact.push_back(static_cast<char>(peer.port >> 8));
+  compact.push_back(static_cast<char>(peer.port & 0xFF));
+  return compact;
+}
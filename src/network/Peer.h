@@ -0,0 +1,32 @@
+#ifndef BITTORRENTCLIENT_PEER_H
+#define BITTORRENTCLIENT_PEER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * An representation of peers which the reponse retrieved from the tracker.
+ * Contains a string that denotes the IP of the peer as well as a port number.
+ */
+struct Peer {
+  std::string ip;
+  int port;
+};
+
+// Every peer in the compact format takes 4 bytes of IPv4 address followed by
+// 2 bytes of port, both in network byte order.
+constexpr size_t kCompactPeerSize = 6;
+
+// Decodes a list of peers in the compact format, as sent by trackers and in
+// ut_pex messages. Trailing bytes that do not make up a whole peer are
+// ignored.
+std::vector<std::unique_ptr<Peer>> decodeCompactPeers(
+    const std::string& compact);
+
+// Encodes a peer in the compact format. Returns an empty string if its
+// address is not IPv4.
+std::string encodeCompactPeer(const Peer& peer);
+
+#endif  // BITTORRENTCLIENT_PEER_H
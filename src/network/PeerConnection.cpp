@@ -3,9 +3,10 @@
 #include <fmt/base.h>
 #include <fmt/core.h>
 #include <netinet/in.h>
-#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <memory>
 #include <stdexcept>
@@ -15,63 +16,126 @@
 
 #include "core/PeerRegistry.h"
 #include "network/BitTorrentMessage.h"
-#include "network/connect.h"
+#include "network/ExtensionProtocol.h"
+#include "utils/Bitset.h"
 #include "utils/utils.h"
 
+#define RESERVED_STARTING_POS 20
+#define RESERVED_LENGTH 8
 #define INFO_HASH_STARTING_POS 28
 #define PEER_ID_STARTING_POS 48
 #define HASH_LEN 20
-#define DUMMY_PEER_IP "0.0.0.0"
+#define HANDSHAKE_TIMEOUT 10    // 10 sec, until the bitfield is received
+#define KEEP_ALIVE_INTERVAL 120  // 2 min
+// Requests kept outstanding per peer when running with a PieceScheduler.
+#define REQUEST_PIPELINE 5
+// A peer that sends no block for this long is snubbing us and is replaced.
+#define SNUB_TIMEOUT 60  // 1 min
+// How often a standby connection checks whether it should keep its
+// connection alive or stop.
+#define STANDBY_POLL 1000  // 1 sec
 
 /**
  * Constructor of the class PeerConnection.
  * @param queue: the thread-safe queue that contains the available peers.
+ * @param connectionManager: dials the peers and hands over the connections
+ * established.
  * @param clientId: the peer ID of this C++ BitTorrent client. Generated in
  * the TorrentClient class.
  * @param infoHash: info hash of the Torrent file.
  * @param pieceManager: pointer to the PieceManager.
+ * @param peerTable: assigns the handle the peer is known by in the core.
+ * @param timerService: timers for the handshake timeout and keep-alives.
+ * @param scheduler: optional single-writer scheduler. When given, every
+ * update to the piece and peer state is posted to it instead of being made
+ * from this connection's thread.
+ * @param standbyPool: optional active slots. When given, a connection that
+ * is ready while every slot is taken waits in standby for one to free up.
  */
 PeerConnection::PeerConnection(
-    std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue, std::string clientId,
+    std::shared_ptr<PeerAddressBook> addressBook,
+    std::shared_ptr<ConnectionManager> connectionManager, std::string clientId,
     std::string infoHash, std::shared_ptr<PieceManager> pieceManager,
-    std::shared_ptr<PeerRegistry> peerRegistry)
-    : queue_(std::move(queue)),
+    std::shared_ptr<PeerRegistry> peerRegistry,
+    std::shared_ptr<PeerTable> peerTable,
+    std::shared_ptr<TimerService> timerService,
+    std::shared_ptr<PieceScheduler> scheduler,
+    std::shared_ptr<StandbyPool> standbyPool)
+    : addressBook_(std::move(addressBook)),
+      connectionManager_(std::move(connectionManager)),
       clientId_(std::move(clientId)),
       infoHash_(std::move(infoHash)),
       pieceManager_(std::move(pieceManager)),
-      peerRegistry_(std::move(peerRegistry)) {}
+      peerRegistry_(std::move(peerRegistry)),
+      peerTable_(std::move(peerTable)),
+      timerService_(std::move(timerService)),
+      timers_(std::make_shared<ConnectionTimers>()),
+      scheduler_(std::move(scheduler)),
+      outbox_(scheduler_ ? scheduler_->openOutbox() : nullptr),
+      standbyPool_(std::move(standbyPool)) {}
 
 /**
- * Destructor of the PeerConnection class. Closes the established TCP connection
+ * Destructor of the PeerConnection class. Closes the established connection
  * with the peer on object destruction.
  */
 PeerConnection::~PeerConnection() { closeSock(); }
 
 tl::expected<void, PeerConnectionError> PeerConnection::start() {
   while (!(terminated_ || pieceManager_->isComplete())) {
-    peer_ = queue_->pop_front();
-    // Terminates the thread if it has received a dummy Peer
-    if (peer_->ip == DUMMY_PEER_IP) {
+    // Terminates the thread once the connection manager has been stopped
+    auto established = connectionManager_->acquire();
+    if (!established) {
       return {};
     }
-
+    peer_ = std::move(established->peer);
+    stream_ = std::move(established->stream);
+
+    // Left over from the previous session, whose handle this peer may get.
+    // Cleared while no handle is held, so drops requested from here on,
+    // standby included, are kept.
+    dropRequested_ = kNoPeer;
+    bool connected = false;
     try {
       // Establishes connection with the peer, and lets it know
       // that we are interested.
       if (establishNewConnection()) {
-        while (!pieceManager_->isComplete()) {
+        connected = true;
+        sessionBytes_ = 0;
+        active_ = waitForActiveSlot();
+        sessionStart_ = std::chrono::steady_clock::now();
+        lastBlock_ = sessionStart_;
+        if (active_) {
+          reportChoked();
+        }
+        while (active_ && !pieceManager_->isComplete()) {
           BitTorrentMessage message = receiveMessage();
-          if (message.getMessageId() > 10)
+          const uint8_t id = message.getMessageId();
+          const bool known =
+              id <= kSeeding ||
+              (fastExtension_ && id >= kSuggestPiece && id <= kAllowedFast) ||
+              (extensionProtocol_ && id == kExtended);
+          if (!known) {
+            closeSock();
+            releasePeer(connected);
             return tl::make_unexpected(PeerConnectionError{
                 "Received invalid message Id from peer " + peerId_});
+          }
 
-          switch (message.getMessageId()) {
+          switch (id) {
             case kChoke:
               choked_ = true;
+              reportChoked();
+              // Outstanding requests are dropped by a choking peer; they
+              // expire and are handed out again by the PieceManager. With
+              // the Fast Extension, each of them is rejected instead.
+              if (!fastExtension_) {
+                requestsInFlight_ = 0;
+              }
               break;
 
             case kUnchoke:
               choked_ = false;
+              reportChoked();
               break;
 
             case kPiece: {
@@ -80,50 +144,168 @@ tl::expected<void, PeerConnectionError> PeerConnection::start() {
               int index = utils::bytesToInt(payload.substr(0, 4));
               int begin = utils::bytesToInt(payload.substr(4, 4));
               std::string block_data = payload.substr(8);
-              pieceManager_->blockReceived(index, begin, block_data);
+              sessionBytes_ += block_data.size();
+              lastBlock_ = std::chrono::steady_clock::now();
+              if (scheduler_) {
+                requestsInFlight_ = std::max(requestsInFlight_ - 1, 0);
+                scheduler_->post(SchedulerEvent{
+                    .type = SchedulerEventType::kBlockArrived,
+                    .peer = handle_,
+                    .pieceIndex = index,
+                    .blockOffset = begin,
+                    .data = std::move(block_data)});
+              } else {
+                pieceManager_->blockReceived(handle_, index, begin,
+                                             block_data);
+              }
               break;
             }
             case kHave: {
               std::string payload = message.getPayload();
               int piece_index = utils::bytesToInt(payload);
-              peerRegistry_->updatePeer(peerId_, piece_index);
+              if (scheduler_) {
+                scheduler_->post(
+                    SchedulerEvent{.type = SchedulerEventType::kPeerHave,
+                                   .peer = handle_,
+                                   .pieceIndex = piece_index});
+              } else {
+                peerRegistry_->updatePeer(handle_, piece_index);
+              }
               break;
             }
 
+            case kSuggestPiece:
+            case kRejectRequest:
+            case kAllowedFast:
+            case kRequest:
+              handleFastMessage(message);
+              break;
+
+            case kExtended:
+              handleExtendedMessage(message);
+              break;
+
             default:
               break;
           }
-          if (!choked_) {
-            if (!requestPending_) {
+          if (!choked_ || hasAllowedFast_) {
+            if (scheduler_) {
+              if (requestsInFlight_ < REQUEST_PIPELINE) {
+                requestBatch();
+              }
+            } else if (!requestPending_) {
               requestPiece();
             }
           }
+          if (timers_->keepAliveDue.exchange(false)) {
+            sendKeepAlive();
+          }
+          // Rotated out for a better peer, or snubbed: the slot goes to a
+          // connection in standby, and this one dials a fresh candidate.
+          if (dropRequested_ == handle_ || snubbed()) {
+            break;
+          }
         }
       }
     } catch (std::exception& e) {
-      closeSock();
     }
+    closeSock();
+    releasePeer(connected);
   }
   return {};
 }
 
+/**
+ * Ends the session with the peer if it is the one with the given handle,
+ * once the message being read has been handled, and returns whether it is.
+ * kNoPeer withdraws a drop requested before. Can be called from any thread.
+ */
+bool PeerConnection::drop(PeerHandle handle) {
+  if (handle != kNoPeer && handle_ != handle) {
+    return false;
+  }
+  dropRequested_ = handle;
+  return true;
+}
+
+/**
+ * A peer snubs us when it sends no block for SNUB_TIMEOUT, whether it keeps
+ * us choked or ignores our requests.
+ */
+bool PeerConnection::snubbed() const {
+  return std::chrono::steady_clock::now() - lastBlock_ >=
+         std::chrono::seconds(SNUB_TIMEOUT);
+}
+
+// Lets the peer's score account for the time it keeps us choked.
+void PeerConnection::reportChoked() {
+  if (scheduler_) {
+    scheduler_->post(SchedulerEvent{.type = SchedulerEventType::kPeerChoked,
+                                    .peer = handle_,
+                                    .choked = choked_});
+  } else {
+    pieceManager_->peerChoked(handle_, choked_);
+  }
+}
+
+/**
+ * Keeps the connection in standby until an active slot frees up, sending
+ * keep-alives meanwhile. The peer has our interest already, so it may have
+ * unchoked us by the time we take over. Returns false if the connection
+ * broke, the peer was dropped, or the download is over.
+ */
+bool PeerConnection::waitForActiveSlot() {
+  if (!standbyPool_) {
+    return true;
+  }
+  while (!(terminated_ || pieceManager_->isComplete())) {
+    switch (standbyPool_->activate(std::chrono::milliseconds(STANDBY_POLL))) {
+      case StandbyResult::kPromoted:
+        return true;
+      case StandbyResult::kClosed:
+        return false;
+      case StandbyResult::kTimeout:
+        break;
+    }
+    if (dropRequested_ == handle_) {
+      return false;
+    }
+    if (timers_->keepAliveDue.exchange(false) && !sendKeepAlive()) {
+      return false;
+    }
+  }
+  return false;
+}
+
+/**
+ * Hands the peer back to the address book with the outcome of the session,
+ * and its active slot to the connections in standby.
+ */
+void PeerConnection::releasePeer(bool connected) {
+  if (active_ && standbyPool_) {
+    standbyPool_->release();
+  }
+  active_ = false;
+  if (connected) {
+    addressBook_->disconnected(
+        *peer_, sessionBytes_,
+        std::chrono::steady_clock::now() - sessionStart_);
+  } else {
+    addressBook_->connectFailed(*peer_);
+  }
+}
+
 void PeerConnection::stop() { terminated_ = true; }
 
 tl::expected<void, PeerConnectionError> PeerConnection::performHandshake() {
-  // Connects to the peer
-  try {
-    auto sock_option = createConnection(peer_->ip, peer_->port);
-    sock_ = sock_option.value();
-  } catch (std::runtime_error& e) {
-    return tl::make_unexpected(PeerConnectionError{e.what()});
-  }
+  armHandshakeTimer();
 
   // Send the handshake message to the peer
   std::string handshake_message = createHandshakeMessage();
-  sendData(sock_, handshake_message);
+  stream_->send(handshake_message);
 
   // Receive the reply from the peer
-  auto reply_option = receiveData(sock_, handshake_message.length());
+  auto reply_option = stream_->receive(handshake_message.length());
 
   auto reply = reply_option.value();
   if (reply.empty()) {
@@ -131,6 +313,13 @@ tl::expected<void, PeerConnectionError> PeerConnection::performHandshake() {
         "Receive handshake from peer: FAILED [No response from peer]"});
   }
   peerId_ = reply.substr(PEER_ID_STARTING_POS, HASH_LEN);
+  const std::string reserved =
+      reply.substr(RESERVED_STARTING_POS, RESERVED_LENGTH);
+  fastExtension_ = (static_cast<uint8_t>(reserved[RESERVED_LENGTH - 1]) &
+                    kFastExtensionBit) != 0;
+  extensionProtocol_ =
+      (static_cast<uint8_t>(reserved[kExtensionProtocolByte]) &
+       kExtensionProtocolBit) != 0;
 
   std::string received_info_hash =
       reply.substr(INFO_HASH_STARTING_POS, HASH_LEN);
@@ -140,28 +329,235 @@ tl::expected<void, PeerConnectionError> PeerConnection::performHandshake() {
                             ": FAILED [Received mismatching info hash]"});
   }
 
+  // The piece and peer state of a peer is keyed by its handle, which a
+  // second connection to it would share and then drop along with the first.
+  handle_ = peerTable_->acquire(peerId_);
+  if (handle_ == kNoPeer) {
+    return tl::make_unexpected(
+        PeerConnectionError{"Perform handshake with peer " + peer_->ip +
+                            ": FAILED [Peer already connected]"});
+  }
+
   return {};
 }
 
+/**
+ * Receives the pieces the peer has. With the Fast Extension, a peer that has
+ * all or none of them sends HaveAll or HaveNone instead of a full bitfield;
+ * a HaveAll peer is registered as a seed without building its bitfield.
+ */
 tl::expected<void, PeerConnectionError> PeerConnection::receiveBitField() {
   // Receive BitField from the peer
   BitTorrentMessage message = receiveMessage();
-  if (message.getMessageId() != kBitField) {
+  const uint8_t id = message.getMessageId();
+  const size_t bitfield_length = (pieceManager_->pieceCount() + 7) / 8;
+  bool seed = false;
+  if (id == kBitField) {
+    peerBitField_ = message.getPayload();
+  } else if (fastExtension_ && id == kHaveNone) {
+    peerBitField_.assign(bitfield_length, '\0');
+  } else if (fastExtension_ && id == kHaveAll) {
+    peerBitField_ = Bitset(pieceManager_->pieceCount(), true).toBitfield();
+    seed = true;
+  } else {
     return tl::make_unexpected(PeerConnectionError{
         "Receive BitField from peer: FAILED [Wrong message ID]"});
   }
-  peerBitField_ = message.getPayload();
 
   // Informs the PieceManager of the BitField received
-  peerRegistry_->addPeer(peerId_, peerBitField_);
+  if (scheduler_) {
+    scheduler_->post(SchedulerEvent{
+        .type = seed ? SchedulerEventType::kPeerHaveAll
+                     : SchedulerEventType::kPeerBitfield,
+        .peer = handle_,
+        .data = seed ? std::string() : peerBitField_});
+  } else if (seed) {
+    peerRegistry_->addSeed(handle_);
+  } else {
+    peerRegistry_->addPeer(handle_, peerBitField_);
+  }
+
+  // The handshake is over; from now on keep the connection alive.
+  timerService_->cancel(timers_->handshakeTimer);
+  armKeepAliveTimer();
+  return {};
+}
+
+/**
+ * Sends the pieces we have. Only done when the Fast Extension is in use,
+ * since it requires every peer to start with one of these messages.
+ */
+tl::expected<void, PeerConnectionError> PeerConnection::sendBitField() {
+  if (!fastExtension_) {
+    return {};
+  }
+
+  std::string bitfield;
+  pieceManager_->copyBitfield(bitfield);
+  if (pieceManager_->isComplete()) {
+    stream_->send(BitTorrentMessage(kHaveAll).toString());
+  } else if (std::ranges::all_of(bitfield, [](char c) { return c == 0; })) {
+    stream_->send(BitTorrentMessage(kHaveNone).toString());
+  } else {
+    stream_->send(BitTorrentMessage(kBitField, bitfield).toString());
+  }
   return {};
 }
 
+/**
+ * Handles the Fast Extension messages that refer to a piece:
+ * - Reject: the block is handed out again at once instead of after its
+ *   request times out.
+ * - Allowed-Fast: the piece may be requested even while we are choked.
+ * - Suggest: the piece is preferred when a new piece is started.
+ * We never unchoke peers, so their requests are rejected right away.
+ */
+void PeerConnection::handleFastMessage(const BitTorrentMessage& message) {
+  const std::string payload = message.getPayload();
+  const int index = utils::bytesToInt(payload.substr(0, 4));
+
+  switch (message.getMessageId()) {
+    case kRequest:
+      if (fastExtension_) {
+        stream_->send(BitTorrentMessage(kRejectRequest, payload).toString());
+      }
+      break;
+
+    case kRejectRequest: {
+      const int begin = utils::bytesToInt(payload.substr(4, 4));
+      if (scheduler_) {
+        requestsInFlight_ = std::max(requestsInFlight_ - 1, 0);
+        scheduler_->post(
+            SchedulerEvent{.type = SchedulerEventType::kRequestRejected,
+                           .peer = handle_,
+                           .pieceIndex = index,
+                           .blockOffset = begin});
+      } else {
+        requestPending_ = false;
+        pieceManager_->requestRejected(handle_, index, begin);
+      }
+      break;
+    }
+
+    case kAllowedFast:
+      hasAllowedFast_ = true;
+      if (scheduler_) {
+        scheduler_->post(
+            SchedulerEvent{.type = SchedulerEventType::kAllowedFast,
+                           .peer = handle_,
+                           .pieceIndex = index});
+      } else {
+        pieceManager_->allowFast(handle_, index);
+      }
+      break;
+
+    case kSuggestPiece:
+      if (scheduler_) {
+        scheduler_->post(
+            SchedulerEvent{.type = SchedulerEventType::kSuggestPiece,
+                           .peer = handle_,
+                           .pieceIndex = index});
+      } else {
+        pieceManager_->suggestPiece(handle_, index);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void PeerConnection::sendExtensionHandshake() {
+  std::string payload(1, static_cast<char>(kExtensionHandshakeId));
+  payload += encodeExtensionHandshake();
+  stream_->send(BitTorrentMessage(kExtended, payload).toString());
+}
+
+/**
+ * Handles a message of the extension protocol. The only extension we
+ * support is ut_pex, which we receive but do not send, so nothing in the
+ * peer's extension handshake matters to us. The peers it reports having
+ * connected to are added to the address book for the other connections to
+ * pick up, without waiting for the next tracker announce.
+ */
+void PeerConnection::handleExtendedMessage(const BitTorrentMessage& message) {
+  const std::string payload = message.getPayload();
+  if (payload.empty() ||
+      static_cast<uint8_t>(payload[0]) != kPexMessageId) {
+    return;
+  }
+
+  auto pex = decodePexMessage(payload.substr(1));
+  if (!pex) {
+    return;
+  }
+  addressBook_->add(std::move(pex->added), PeerSource::kPex);
+}
+
+/**
+ * Shuts the stream down if the handshake and bitfield exchange have not
+ * completed within `HANDSHAKE_TIMEOUT` seconds, which fails the blocking
+ * read the connection is stuck in.
+ */
+void PeerConnection::armHandshakeTimer() {
+  {
+    std::lock_guard<std::mutex> guard(timers_->lock);
+    timers_->stream = stream_.get();
+  }
+  timers_->handshakeTimer = timerService_->schedule(
+      std::chrono::seconds(HANDSHAKE_TIMEOUT), [timers = timers_] {
+        std::lock_guard<std::mutex> guard(timers->lock);
+        if (timers->stream) {
+          timers->stream->shutdown();
+        }
+      });
+}
+
+/**
+ * Flags that a keep-alive is due; it is sent by the connection's own thread
+ * so that it never interleaves with another message on the stream.
+ */
+void PeerConnection::armKeepAliveTimer() {
+  timers_->keepAliveTimer = timerService_->schedule(
+      std::chrono::seconds(KEEP_ALIVE_INTERVAL),
+      [timers = timers_] { timers->keepAliveDue = true; });
+}
+
+bool PeerConnection::sendKeepAlive() {
+  // A keep-alive is a message of length zero, without id or payload.
+  const bool sent = stream_->send(std::string(4, '\0')).has_value();
+  armKeepAliveTimer();
+  return sent;
+}
+
 void PeerConnection::requestPiece() {
-  Block* block = pieceManager_->nextRequest(peerId_);
+  Block* block = pieceManager_->nextRequest(handle_, choked_);
 
   if (!block) return;
 
+  sendRequest(block);
+  requestPending_ = true;
+}
+
+/**
+ * Asks the scheduler for blocks to fill the free request slots and waits for
+ * its answer, which always comes even if it is empty.
+ */
+void PeerConnection::requestBatch() {
+  scheduler_->post(
+      SchedulerEvent{.type = SchedulerEventType::kRequestSlotFree,
+                     .peer = handle_,
+                     .slots = REQUEST_PIPELINE - requestsInFlight_,
+                     .choked = choked_,
+                     .outbox = outbox_});
+
+  for (const Block* block : outbox_->pop()) {
+    sendRequest(block);
+    requestsInFlight_++;
+  }
+}
+
+void PeerConnection::sendRequest(const Block* block) {
   int payload_length = 12;
   char temp[payload_length];
   // Needs to convert little-endian to big-endian
@@ -182,13 +578,12 @@ void PeerConnection::requestPiece() {
   info << "Offset: " << std::to_string(block->offset) << " ";
   info << "Length: " << std::to_string(block->length) << "]";
   std::string request_message = BitTorrentMessage(kRequest, payload).toString();
-  sendData(sock_, request_message);
-  requestPending_ = true;
+  stream_->send(request_message);
 }
 
 tl::expected<void, PeerConnectionError> PeerConnection::sendInterested() {
   std::string interested_message = BitTorrentMessage(kInterested).toString();
-  sendData(sock_, interested_message);
+  stream_->send(interested_message);
   return {};
 }
 
@@ -212,6 +607,11 @@ PeerConnection::establishNewConnection() {
     return tl::unexpected(bitfield_result.error());
   }
 
+  sendBitField();
+  if (extensionProtocol_) {
+    sendExtensionHandshake();
+  }
+
   sendInterested();
 
   return {};
@@ -219,7 +619,7 @@ PeerConnection::establishNewConnection() {
 
 std::string PeerConnection::createHandshakeMessage() {
   static constexpr char kProtocolName[] = "BitTorrent protocol";
-  static constexpr size_t kReservedBytes = 8;
+  static constexpr size_t kReservedBytes = RESERVED_LENGTH;
 
   std::ostringstream buffer;
 
@@ -227,8 +627,12 @@ std::string PeerConnection::createHandshakeMessage() {
   buffer.put(static_cast<char>(sizeof(kProtocolName) - 1));
   buffer.write(kProtocolName, sizeof(kProtocolName) - 1);
 
-  // Append 8 reserved bytes (all set to zero)
-  buffer.write("\0\0\0\0\0\0\0\0", kReservedBytes);
+  // Append 8 reserved bytes, advertising the Fast Extension and the
+  // extension protocol
+  char reserved[kReservedBytes] = {};
+  reserved[kExtensionProtocolByte] = kExtensionProtocolBit;
+  reserved[kReservedBytes - 1] = kFastExtensionBit;
+  buffer.write(reserved, kReservedBytes);
 
   // Append info hash and client ID
   buffer << utils::hexDecode(infoHash_) << clientId_;
@@ -237,8 +641,17 @@ std::string PeerConnection::createHandshakeMessage() {
   return buffer.str();
 }
 
+/**
+ * Reads the next message. A quiet peer is treated as if it had sent a
+ * keep-alive each time the read times out, a fraction of a second, so that
+ * the connection loop still gets to send our own keep-alives and to notice
+ * drops and snubs while nothing arrives.
+ */
 BitTorrentMessage PeerConnection::receiveMessage() const {
-  auto reply_option = receiveData(sock_, 0);
+  auto reply_option = stream_->receive(0);
+  if (!reply_option && reply_option.error().timedOut) {
+    return BitTorrentMessage(kEepAlive);
+  }
   std::string reply = reply_option.value();
   if (reply.empty()) {
     return BitTorrentMessage(kEepAlive);
@@ -252,21 +665,44 @@ BitTorrentMessage PeerConnection::receiveMessage() const {
 const std::string& PeerConnection::getPeerId() const { return peerId_; }
 
 void PeerConnection::closeSock() {
-  if (!sock_) {
+  if (!stream_) {
     return;
   }
 
-  close(sock_);
-  sock_ = {};
+  timerService_->cancel(timers_->handshakeTimer);
+  timerService_->cancel(timers_->keepAliveTimer);
+  timers_->keepAliveDue = false;
+  {
+    std::lock_guard<std::mutex> guard(timers_->lock);
+    timers_->stream = nullptr;
+  }
+
+  stream_.reset();
 
   requestPending_ = false;
+  requestsInFlight_ = 0;
+  fastExtension_ = false;
+  hasAllowedFast_ = false;
+  extensionProtocol_ = false;
+  choked_ = true;
 
   if (!peerBitField_.empty()) {
     peerBitField_.clear();
-    if (pieceManager_) {
+    if (scheduler_) {
+      scheduler_->post(SchedulerEvent{.type = SchedulerEventType::kPeerGone,
+                                      .peer = handle_});
+    } else if (pieceManager_) {
       if (!pieceManager_->isComplete()) {
-        peerRegistry_->removePeer(peerId_);
+        peerRegistry_->removePeer(handle_);
       }
+      pieceManager_->removePeer(handle_);
     }
   }
+
+  // Released only after the removal was made or posted, so a peer that is
+  // given the handle next cannot have its state dropped.
+  if (handle_ != kNoPeer) {
+    peerTable_->release(handle_);
+    handle_ = kNoPeer;
+  }
 }
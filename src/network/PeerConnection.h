@@ -2,13 +2,23 @@
 #ifndef BITTORRENTCLIENT_PEERCONNECTION_H
 #define BITTORRENTCLIENT_PEERCONNECTION_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 
 #include "PeerRetriever.h"
+#include "core/PeerAddressBook.h"
 #include "core/PeerRegistry.h"
 #include "core/PieceManager.h"
-#include "infra/Queue.h"
+#include "core/PeerTable.h"
+#include "core/PieceScheduler.h"
+#include "core/StandbyPool.h"
+#include "infra/TimerService.h"
 #include "network/BitTorrentMessage.h"
+#include "network/ConnectionManager.h"
+#include "network/Transport.h"
 
 using byte = unsigned char;
 
@@ -16,34 +26,86 @@ struct PeerConnectionError {
   std::string message;
 };
 
+/**
+ * State shared between a PeerConnection and the timers it arms. Timer
+ * callbacks only go through it, so a timer firing after the stream was
+ * closed can never shut down one that has since replaced it.
+ */
+struct ConnectionTimers {
+  std::mutex lock;
+  PeerStream* stream = nullptr;
+  TimerId handshakeTimer = 0;
+  TimerId keepAliveTimer = 0;
+  std::atomic<bool> keepAliveDue = false;
+};
+
 class PeerConnection {
  private:
-  int sock_{};
+  std::unique_ptr<PeerStream> stream_;
 
-  std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue_;
+  std::shared_ptr<PeerAddressBook> addressBook_;
+  std::shared_ptr<ConnectionManager> connectionManager_;
 
   bool choked_ = true;
   bool terminated_ = false;
+  // Holds one of the active slots of the standby pool.
+  bool active_ = false;
   bool requestPending_ = false;
+  // Requests sent and not answered yet (scheduler mode only).
+  int requestsInFlight_ = 0;
+  // Both sides advertised the Fast Extension (BEP 6) in the handshake.
+  bool fastExtension_ = false;
+  // The peer allowed us to request some pieces while choked.
+  bool hasAllowedFast_ = false;
+  // Both sides advertised the extension protocol (BEP 10).
+  bool extensionProtocol_ = false;
 
   const std::string clientId_;
   const std::string infoHash_;
 
   std::unique_ptr<Peer> peer_;
+  // When the current session started, and the bytes it delivered.
+  std::chrono::steady_clock::time_point sessionStart_;
+  uint64_t sessionBytes_ = 0;
+  std::chrono::steady_clock::time_point lastBlock_;
+  // Handle of a peer to drop, set from other threads.
+  std::atomic<PeerHandle> dropRequested_ = kNoPeer;
   std::string peerBitField_;
   std::string peerId_;
+  // Handle of the connected peer, kNoPeer between connections. Read by
+  // drop() from other threads.
+  std::atomic<PeerHandle> handle_ = kNoPeer;
 
   std::shared_ptr<PieceManager> pieceManager_;
   std::shared_ptr<PeerRegistry> peerRegistry_;
+  std::shared_ptr<PeerTable> peerTable_;
+  std::shared_ptr<TimerService> timerService_;
+  std::shared_ptr<ConnectionTimers> timers_;
+  // When set, piece and peer state is only touched through the scheduler.
+  std::shared_ptr<PieceScheduler> scheduler_;
+  std::shared_ptr<RequestOutbox> outbox_;
+  std::shared_ptr<StandbyPool> standbyPool_;
 
   std::string createHandshakeMessage();
   tl::expected<void, PeerConnectionError> performHandshake();
   tl::expected<void, PeerConnectionError> receiveBitField();
   tl::expected<void, PeerConnectionError> sendBitField();
+  void handleFastMessage(const BitTorrentMessage& message);
+  void sendExtensionHandshake();
+  void handleExtendedMessage(const BitTorrentMessage& message);
   tl::expected<void, PeerConnectionError> sendInterested();
   tl::expected<void, PeerConnectionError> receiveUnchoke();
   void requestPiece();
+  void requestBatch();
+  void sendRequest(const Block* block);
   void closeSock();
+  bool snubbed() const;
+  void reportChoked();
+  bool waitForActiveSlot();
+  void releasePeer(bool connected);
+  void armHandshakeTimer();
+  void armKeepAliveTimer();
+  bool sendKeepAlive();
   tl::expected<void, PeerConnectionError> establishNewConnection();
   BitTorrentMessage receiveMessage() const;
   BitTorrentMessage sendMessage(int bufferSize = 0) const;
@@ -55,13 +117,19 @@ class PeerConnection {
  public:
   const std::string& getPeerId() const;
 
-  explicit PeerConnection(std::shared_ptr<Queue<std::unique_ptr<Peer>>> queue,
+  explicit PeerConnection(std::shared_ptr<PeerAddressBook> addressBook,
+                          std::shared_ptr<ConnectionManager> connectionManager,
                           std::string clientId, std::string infoHash,
                           std::shared_ptr<PieceManager> pm,
-                          std::shared_ptr<PeerRegistry> peerRegistry);
+                          std::shared_ptr<PeerRegistry> peerRegistry,
+                          std::shared_ptr<PeerTable> peerTable,
+                          std::shared_ptr<TimerService> timerService,
+                          std::shared_ptr<PieceScheduler> scheduler = nullptr,
+                          std::shared_ptr<StandbyPool> standbyPool = nullptr);
   ~PeerConnection();
   tl::expected<void, PeerConnectionError> start();
   void stop();
+  bool drop(PeerHandle handle);
 };
 
 #endif  // BITTORRENTCLIENT_PEERCONNECTION_H
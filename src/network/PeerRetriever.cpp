@@ -25,22 +25,23 @@
  * @param announceURL: the HTTP URL to the tracker.
  * @param infoHash: the info hash of the Torrent file.
  * @param port: the TCP port this client listens on.
- * @param fileSize: the size of the file to be downloaded in bytes.
  */
 PeerRetriever::PeerRetriever(std::string peerId, std::string announceUrl,
-                             std::string infoHash, int port,
-                             const u_int64_t fileSize)
-    : fileSize_(fileSize) {
+                             std::string infoHash, int port) {
   this->peerId_ = std::move(peerId);
   this->announceUrl_ = std::move(announceUrl);
   this->infoHash_ = std::move(infoHash);
   this->port_ = port;
+
+  if (announceUrl_.starts_with("udp://")) {
+    udpTracker_ = std::make_unique<UdpTracker>(announceUrl_);
+  }
 }
 
 /**
- * Retrieves the list of peers from the URL specified by the 'announce'
- * property. The list of parameters and their descriptions are as follows (found
- * on this page https://markuseliasson.se/article/bittorrent-in-python/):
+ * Announces to the tracker and retrieves the list of peers. For HTTP
+ * trackers, the list of parameters and their descriptions are as follows
+ * (found on this page https://markuseliasson.se/article/bittorrent-in-python/):
  * - info_hash: the SHA1 hash of the info dict found in the .torrent.
  * - peer_id: a unique ID generated for this client.
  * - uploaded: the total number of bytes uploaded.
@@ -49,47 +50,100 @@ PeerRetriever::PeerRetriever(std::string peerId, std::string announceUrl,
  * - port: the TCP port this client listens on.
  * - compact: whether or not the client accepts a compacted list of peers or
  * not.
- * @return a vector that contains the information of all peers.
+ * - event: started, completed or stopped, left out for regular announces.
+ * - numwant: the number of peers wanted, left out to let the tracker decide.
+ * @return the peers and the announce intervals given by the tracker.
  */
-std::vector<std::unique_ptr<Peer>> PeerRetriever::retrievePeers(
-    uint64_t bytesDownloaded) {
-  cpr::Response res = cpr::Get(
-      cpr::Url{announceUrl_},
-      cpr::Parameters{{"info_hash", std::string(utils::hexDecode(infoHash_))},
-                      {"peer_id", std::string(peerId_)},
-                      {"port", std::to_string(port_)},
-                      {"uploaded", "0"},
-                      {"downloaded", std::to_string(bytesDownloaded)},
-                      {"left", std::to_string(fileSize_ - bytesDownloaded)},
-                      {"compact", "1"}},
-      cpr::Timeout{TRACKER_TIMEOUT});
+tl::expected<AnnounceResponse, PeerRetrieverError> PeerRetriever::announce(
+    const AnnounceParams& params) {
+  if (udpTracker_) {
+    return announceOverUdp(params);
+  }
+
+  cpr::Parameters parameters{
+      {"info_hash", std::string(utils::hexDecode(infoHash_))},
+      {"peer_id", std::string(peerId_)},
+      {"port", std::to_string(port_)},
+      {"uploaded", std::to_string(params.uploaded)},
+      {"downloaded", std::to_string(params.downloaded)},
+      {"left", std::to_string(params.left)},
+      {"compact", "1"}};
+  if (params.event != TrackerEvent::kNone) {
+    parameters.Add({"event", trackerEventName(params.event)});
+  }
+  if (params.numWant >= 0) {
+    parameters.Add({"numwant", std::to_string(params.numWant)});
+  }
+
+  cpr::Response res = cpr::Get(cpr::Url{announceUrl_}, parameters,
+                               cpr::Timeout{TRACKER_TIMEOUT});
 
   if (res.status_code != 200) {
-    Logger::log(
+    return tl::unexpected(PeerRetrieverError{
         fmt::format("Retrieving response from tracker: FAILED [ {}: {} ]",
-                    res.status_code, res.text));
-    return {};
+                    res.status_code, res.text)});
   }
 
-  auto peers = decodeResponse(res.text);
-
-  if (!peers.has_value()) {
-    Logger::log(fmt::format("Decoding tracker response: FAILED [ {} ]",
-                            peers.error().message.c_str()));
-    return {};
+  auto response = decodeResponse(res.text);
+  if (!response.has_value()) {
+    return tl::unexpected(PeerRetrieverError{
+        fmt::format("Decoding tracker response: FAILED [ {} ]",
+                    response.error().message)});
   }
 
   // Transfer ownership to caller
-  return std::move(peers.value());
+  return response;
 }
 
-tl::expected<std::vector<std::unique_ptr<Peer>>, PeerRetrieverError>
+tl::expected<AnnounceResponse, PeerRetrieverError>
+PeerRetriever::announceOverUdp(const AnnounceParams& params) {
+  auto response = udpTracker_->announce(
+      AnnounceRequest{.infoHash = utils::hexDecode(infoHash_),
+                      .peerId = peerId_,
+                      .port = port_,
+                      .params = params});
+
+  if (!response) {
+    return tl::unexpected(PeerRetrieverError{
+        fmt::format("Announcing to UDP tracker: FAILED [ {} ]",
+                    response.error().message)});
+  }
+  return std::move(*response);
+}
+
+tl::expected<AnnounceResponse, PeerRetrieverError>
 PeerRetriever::decodeResponse(std::string response) {
-  std::shared_ptr<bencoding::BItem> decoded_response =
-      bencoding::decode(response);
+  std::shared_ptr<bencoding::BItem> decoded_response;
+  try {
+    decoded_response = bencoding::decode(response);
+  } catch (const bencoding::DecodingError& e) {
+    return tl::unexpected(PeerRetrieverError{e.what()});
+  }
 
   std::shared_ptr<bencoding::BDictionary> response_dict =
       std::dynamic_pointer_cast<bencoding::BDictionary>(decoded_response);
+  if (!response_dict) {
+    return tl::unexpected(PeerRetrieverError{
+        "Response returned by the tracker is not a dictionary."});
+  }
+
+  if (auto failure = std::dynamic_pointer_cast<bencoding::BString>(
+          response_dict->getValue("failure reason"))) {
+    return tl::unexpected(
+        PeerRetrieverError{"Tracker failure: " + failure->value()});
+  }
+
+  AnnounceResponse announced;
+  auto read_int = [&](const std::string& key) {
+    auto item = std::dynamic_pointer_cast<bencoding::BInteger>(
+        response_dict->getValue(key));
+    return item ? static_cast<int>(item->value()) : 0;
+  };
+  announced.interval = read_int("interval");
+  announced.minInterval = read_int("min interval");
+  announced.seeders = read_int("complete");
+  announced.leechers = read_int("incomplete");
+
   std::shared_ptr<bencoding::BItem> peers_value =
       response_dict->getValue("peers");
   if (!peers_value) {
@@ -103,37 +157,16 @@ PeerRetriever::decodeResponse(std::string response) {
   // Handles the first case where peer information is sent in a binary blob
   // (compact)
   if (typeid(*peers_value) == typeid(bencoding::BString)) {
-    // Unmarshalls the peer information:
-    // Detailed explanation can be found here:
-    // https://blog.jse.li/posts/torrent/
-    // Essentially, every 6 bytes represent a single peer with the first 4
-    // bytes being the IP and the last 2 bytes being the port number.
-    const int peer_info_size = 6;
     std::string peers_string =
         std::dynamic_pointer_cast<bencoding::BString>(peers_value)->value();
 
-    if (peers_string.length() % peer_info_size != 0) {
+    if (peers_string.length() % kCompactPeerSize != 0) {
       return tl::unexpected(PeerRetrieverError{
           "Received malformed 'peers' from tracker. ['peers' length needs to "
           "be divisible by 6]"});
     }
 
-    const int peer_num = peers_string.length() / peer_info_size;
-    for (int i = 0; i < peer_num; i++) {
-      int offset = i * peer_info_size;
-      std::stringstream peer_ip;
-      peer_ip << std::to_string(static_cast<uint8_t>(peers_string[offset]))
-              << ".";
-      peer_ip << std::to_string(static_cast<uint8_t>(peers_string[offset + 1]))
-              << ".";
-      peer_ip << std::to_string(static_cast<uint8_t>(peers_string[offset + 2]))
-              << ".";
-      peer_ip << std::to_string(static_cast<uint8_t>(peers_string[offset + 3]));
-      int peer_port = utils::bytesToInt(peers_string.substr(offset + 4, 2));
-
-      peers.push_back(
-          std::make_unique<Peer>(Peer{.ip = peer_ip.str(), .port = peer_port}));
-    }
+    peers = decodeCompactPeers(peers_string);
   }
   // Handles the second case where peer information is stored in a list
   else if (typeid(*peers_value) == typeid(bencoding::BList)) {
@@ -173,5 +206,6 @@ PeerRetriever::decodeResponse(std::string response) {
     return tl::unexpected(PeerRetrieverError{
         "Received malformed 'peers' from tracker. [Unknown type]"});
   }
-  return peers;
+  announced.peers = std::move(peers);
+  return announced;
 }
@@ -6,20 +6,17 @@
 #include <tl/expected.hpp>
 #include <vector>
 
+#include "network/Announce.h"
+#include "network/Peer.h"
+#include "network/UdpTracker.h"
+
 struct PeerRetrieverError {
   std::string message;
 };
-/**
- * An representation of peers which the reponse retrieved from the tracker.
- * Contains a string that denotes the IP of the peer as well as a port number.
- */
-struct Peer {
-  std::string ip;
-  int port;
-};
 
 /**
- * Retrieves a list of peers by sending a GET request to the tracker.
+ * Retrieves a list of peers from the tracker: with a GET request for HTTP
+ * trackers, or through a UdpTracker for `udp://` announce URLs.
  */
 class PeerRetriever {
  private:
@@ -27,16 +24,20 @@ class PeerRetriever {
   std::string infoHash_;
   std::string peerId_;
   int port_;
-  const u_int64_t fileSize_;
+  // Set for udp:// trackers. Kept across announces so that its connection
+  // id is reused.
+  std::unique_ptr<UdpTracker> udpTracker_;
 
-  tl::expected<std::vector<std::unique_ptr<Peer>>, PeerRetrieverError>
-  decodeResponse(std::string response);
+  tl::expected<AnnounceResponse, PeerRetrieverError> decodeResponse(
+      std::string response);
+  tl::expected<AnnounceResponse, PeerRetrieverError> announceOverUdp(
+      const AnnounceParams& params);
 
  public:
   explicit PeerRetriever(std::string peerId, std::string announceUrL,
-                         std::string infoHash, int port, u_int64_t fileSize);
-  std::vector<std::unique_ptr<Peer>> retrievePeers(
-      u_int64_t bytesDownloaded = 0);
+                         std::string infoHash, int port);
+  tl::expected<AnnounceResponse, PeerRetrieverError> announce(
+      const AnnounceParams& params);
 };
 
 #endif  // BITTORRENTCLIENT_PEERRETRIEVER_H
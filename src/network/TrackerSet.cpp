@@ -0,0 +1,221 @@
+#include "network/TrackerSet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+// Weight given to the newest announce when updating the moving averages.
+constexpr double kSmoothingFactor = 0.3;
+// Used when the tracker does not give an interval or min interval.
+constexpr auto kDefaultInterval = std::chrono::minutes(5);
+constexpr auto kDefaultMinInterval = std::chrono::minutes(1);
+// A failed announce is retried after 15 s, doubling with every failure in
+// a row up to 30 minutes.
+constexpr auto kRetryDelay = std::chrono::seconds(15);
+constexpr auto kMaxRetryDelay = std::chrono::minutes(30);
+
+/**
+ * Peers already handed over in an announce round, so that a peer returned
+ * by several trackers is only handed over once.
+ */
+struct Round {
+  std::mutex lock;
+  std::unordered_set<std::string> seen;
+  TrackerSet::PeersCallback onPeers;
+};
+}  // namespace
+
+TrackerSet::TrackerSet(const std::vector<std::vector<std::string>>& tiers,
+                       AnnounceFunction announceFunction)
+    : state_(std::make_shared<State>()) {
+  state_->announceFunction = std::move(announceFunction);
+  std::unordered_set<std::string> urls;
+  for (size_t tier = 0; tier < tiers.size(); tier++) {
+    for (const std::string& url : tiers[tier]) {
+      if (urls.insert(url).second) {
+        state_->trackers.push_back(Tracker{
+            .stats = TrackerStats{.url = url, .tier = static_cast<int>(tier)}});
+      }
+    }
+  }
+}
+
+/**
+ * Peers per second of latency. Trackers that are failing rank last, and
+ * trackers with the same score keep their announce-list order.
+ */
+double TrackerSet::score(const TrackerStats& stats) {
+  if (stats.failures > 0) {
+    return -stats.failures;
+  }
+  if (!stats.hasSample) {
+    return 0;
+  }
+  return stats.peerYield / std::max(stats.latencyMs / 1000, 0.001);
+}
+
+/**
+ * Updates the measurements of a tracker with its answer, and schedules its
+ * next announce relative to when the request was sent.
+ */
+void TrackerSet::recordAnswer(
+    State& state, size_t tracker, TrackerEvent event, Clock::time_point sent,
+    Clock::duration latency,
+    const tl::expected<AnnounceResponse, TrackerError>& response) {
+  std::lock_guard<std::mutex> guard(state.lock);
+  Tracker& entry = state.trackers[tracker];
+  entry.busy = false;
+
+  TrackerStats& stats = entry.stats;
+  if (!response) {
+    stats.failures++;
+    stats.peerYield *= 1 - kSmoothingFactor;
+    auto delay = std::min<Clock::duration>(
+        kRetryDelay * (1 << std::min(stats.failures - 1, 16)),
+        kMaxRetryDelay);
+    entry.nextAnnounce = sent + delay;
+    entry.earliestAnnounce = sent + delay;
+    return;
+  }
+
+  const double latency_ms =
+      std::chrono::duration<double, std::milli>(latency).count();
+  const auto peers = static_cast<double>(response->peers.size());
+  if (stats.hasSample) {
+    stats.latencyMs = kSmoothingFactor * latency_ms +
+                      (1 - kSmoothingFactor) * stats.latencyMs;
+    stats.peerYield =
+        kSmoothingFactor * peers + (1 - kSmoothingFactor) * stats.peerYield;
+  } else {
+    stats.latencyMs = latency_ms;
+    stats.peerYield = peers;
+    stats.hasSample = true;
+  }
+  stats.failures = 0;
+  if (event == TrackerEvent::kStarted) {
+    entry.started = true;
+  } else if (event == TrackerEvent::kCompleted) {
+    entry.completed = true;
+  }
+
+  entry.nextAnnounce =
+      sent + (response->interval > 0
+                  ? Clock::duration(std::chrono::seconds(response->interval))
+                  : Clock::duration(kDefaultInterval));
+  entry.earliestAnnounce =
+      sent + (response->minInterval > 0
+                  ? Clock::duration(std::chrono::seconds(response->minInterval))
+                  : Clock::duration(kDefaultMinInterval));
+}
+
+std::vector<size_t> TrackerSet::rank(const std::vector<Tracker>& trackers) {
+  std::vector<size_t> order(trackers.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::stable_sort(order, [&](size_t a, size_t b) {
+    const TrackerStats& stats_a = trackers[a].stats;
+    const TrackerStats& stats_b = trackers[b].stats;
+    double score_a = score(stats_a);
+    double score_b = score(stats_b);
+    return score_a != score_b ? score_a > score_b
+                              : stats_a.tier < stats_b.tier;
+  });
+  return order;
+}
+
+int TrackerSet::announce(const AnnounceParams& params, PeersCallback onPeers,
+                         bool early, Clock::time_point now) {
+  auto round = std::make_shared<Round>();
+  round->onPeers = std::move(onPeers);
+
+  struct Target {
+    size_t tracker;
+    std::string url;
+    AnnounceParams params;
+  };
+  std::vector<Target> targets;
+  {
+    std::lock_guard<std::mutex> guard(state_->lock);
+    for (size_t i : rank(state_->trackers)) {
+      Tracker& tracker = state_->trackers[i];
+      AnnounceParams owed = params;
+      if (params.event != TrackerEvent::kStopped) {
+        owed.event = !tracker.started ? TrackerEvent::kStarted
+                     : params.event == TrackerEvent::kCompleted &&
+                             !tracker.completed
+                         ? TrackerEvent::kCompleted
+                         : TrackerEvent::kNone;
+      }
+
+      // An owed event is sent at once, unless the tracker is backing off
+      const bool due =
+          params.event == TrackerEvent::kStopped ||
+          (owed.event != TrackerEvent::kNone &&
+           tracker.stats.failures == 0) ||
+          now >= (early ? tracker.earliestAnnounce : tracker.nextAnnounce);
+      if (due && !tracker.busy) {
+        tracker.busy = true;
+        targets.push_back(Target{
+            .tracker = i, .url = tracker.stats.url, .params = owed});
+      }
+    }
+  }
+
+  for (Target& target : targets) {
+    state_->inFlight++;
+    std::thread([state = state_, round, target = std::move(target), now] {
+      const auto start = Clock::now();
+      auto response = state->announceFunction(target.url, target.params);
+      recordAnswer(*state, target.tracker, target.params.event, now,
+                   Clock::now() - start, response);
+      if (!response) {
+        state->inFlight--;
+        return;
+      }
+
+      auto& peers = response->peers;
+      {
+        std::lock_guard<std::mutex> guard(round->lock);
+        std::erase_if(peers, [&](const std::unique_ptr<Peer>& peer) {
+          return !round->seen
+                      .insert(peer->ip + ":" + std::to_string(peer->port))
+                      .second;
+        });
+        if (!peers.empty()) {
+          round->onPeers(std::move(peers));
+        }
+      }
+      state->inFlight--;
+    }).detach();
+  }
+  return static_cast<int>(targets.size());
+}
+
+int TrackerSet::inFlight() const { return state_->inFlight; }
+
+TrackerSet::Clock::time_point TrackerSet::nextDue() const {
+  std::lock_guard<std::mutex> guard(state_->lock);
+  auto next = Clock::time_point::max();
+  for (const Tracker& tracker : state_->trackers) {
+    if (!tracker.busy) {
+      next = std::min(next, tracker.nextAnnounce);
+    }
+  }
+  return next;
+}
+
+std::vector<TrackerStats> TrackerSet::ranking() const {
+  std::lock_guard<std::mutex> guard(state_->lock);
+  std::vector<TrackerStats> stats;
+  for (size_t i : rank(state_->trackers)) {
+    stats.push_back(state_->trackers[i].stats);
+  }
+  return stats;
+}
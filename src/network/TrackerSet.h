@@ -0,0 +1,114 @@
+#ifndef BITTORRENTCLIENT_TRACKERSET_H
+#define BITTORRENTCLIENT_TRACKERSET_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tl/expected.hpp>
+#include <vector>
+
+#include "network/Announce.h"
+#include "network/Peer.h"
+
+/**
+ * What has been measured about a tracker. Latency and yield (peers per
+ * announce) are exponentially weighted moving averages.
+ */
+struct TrackerStats {
+  std::string url;
+  // Tier in the announce-list, 0 being the first.
+  int tier = 0;
+  double latencyMs = 0;
+  double peerYield = 0;
+  bool hasSample = false;
+  // Announces in a row that failed.
+  int failures = 0;
+};
+
+/**
+ * The trackers of a torrent, from every tier of its announce-list (BEP 12).
+ * Instead of trying the tiers one after the other, every tracker is
+ * announced to at once on a thread of its own, and the peers are handed
+ * over as each tracker answers, minus those another tracker already
+ * returned in the same round. The first peers therefore arrive as soon as
+ * the fastest tracker has answered, however slow or dead the others are.
+ *
+ * Each tracker is only announced to again once the interval it asked for
+ * has passed, or, when more peers are needed, once its min interval has.
+ * Failed announces are retried with exponential backoff. `started` and
+ * `completed` are tracked per tracker: a tracker gets `started` until it
+ * has answered one, and `completed` once the download is complete until it
+ * has answered that, at once unless it is backing off. `stopped` goes to
+ * every tracker regardless. A tracker whose previous announce is still
+ * running is skipped. Trackers are ranked by the peers they yield per
+ * second of latency, which is the order in which they are announced to.
+ */
+class TrackerSet {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Announces to one tracker. Called on a worker thread, never twice at
+  // once for the same tracker.
+  using AnnounceFunction =
+      std::function<tl::expected<AnnounceResponse, TrackerError>(
+          const std::string& url, const AnnounceParams& params)>;
+  using PeersCallback =
+      std::function<void(std::vector<std::unique_ptr<Peer>> peers)>;
+
+  explicit TrackerSet(const std::vector<std::vector<std::string>>& tiers,
+                      AnnounceFunction announceFunction);
+
+  // Starts an announce round with the trackers that are due, or with all of
+  // them for `stopped`, and returns at once with their number. With
+  // `early`, trackers are due once their min interval has passed.
+  // `kCompleted` in `params` means the download is complete, and `kStarted`
+  // is the same as `kNone`: each tracker is sent the event it is owed.
+  // `onPeers` is called from the worker threads, one at a time, with the
+  // new peers of each answer.
+  int announce(const AnnounceParams& params, PeersCallback onPeers,
+               bool early = false, Clock::time_point now = Clock::now());
+
+  // Number of announces still running.
+  int inFlight() const;
+
+  // When the next tracker becomes due for a regular announce.
+  Clock::time_point nextDue() const;
+
+  // Trackers from best to worst.
+  std::vector<TrackerStats> ranking() const;
+
+ private:
+  struct Tracker {
+    TrackerStats stats;
+    bool busy = false;
+    // Regular announces wait for `nextAnnounce`, early ones for
+    // `earliestAnnounce`.
+    Clock::time_point nextAnnounce;
+    Clock::time_point earliestAnnounce;
+    // The tracker answered an announce with this event.
+    bool started = false;
+    bool completed = false;
+  };
+  // Shared with the worker threads, which may outlive the TrackerSet.
+  struct State {
+    std::mutex lock;
+    std::vector<Tracker> trackers;
+    AnnounceFunction announceFunction;
+    std::atomic<int> inFlight = 0;
+  };
+
+  std::shared_ptr<State> state_;
+
+  static double score(const TrackerStats& stats);
+  // Indices of the trackers from best to worst.
+  static std::vector<size_t> rank(const std::vector<Tracker>& trackers);
+  static void recordAnswer(
+      State& state, size_t tracker, TrackerEvent event, Clock::time_point sent,
+      Clock::duration latency,
+      const tl::expected<AnnounceResponse, TrackerError>& response);
+};
+
+#endif  // BITTORRENTCLIENT_TRACKERSET_H
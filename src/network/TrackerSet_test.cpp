@@ -0,0 +1,244 @@
+#include "network/TrackerSet.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::chrono::milliseconds;
+
+namespace {
+tl::expected<AnnounceResponse, TrackerError> makeResponse(
+    std::vector<int> ports, int interval = 0, int minInterval = 0) {
+  AnnounceResponse response;
+  response.interval = interval;
+  response.minInterval = minInterval;
+  for (int port : ports) {
+    response.peers.push_back(
+        std::make_unique<Peer>(Peer{.ip = "10.0.0.1", .port = port}));
+  }
+  return response;
+}
+
+const AnnounceParams kStarted{.event = TrackerEvent::kStarted};
+const AnnounceParams kRegular{};
+
+void ignorePeers(std::vector<std::unique_ptr<Peer>>) {}
+
+void waitIdle(const TrackerSet& trackers) {
+  while (trackers.inFlight() > 0) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+}
+
+/**
+ * Trackers in two tiers: "slow" takes 200 ms, "fast" 10 ms and "dead"
+ * fails. "slow" and "fast" share a peer.
+ */
+TrackerSet::AnnounceFunction fakeTrackers() {
+  return [](const std::string& url, const AnnounceParams&)
+             -> tl::expected<AnnounceResponse, TrackerError> {
+    if (url == "http://slow") {
+      std::this_thread::sleep_for(milliseconds(200));
+      return makeResponse({1, 2, 3});
+    }
+    if (url == "udp://fast:1") {
+      std::this_thread::sleep_for(milliseconds(10));
+      return makeResponse({3, 4});
+    }
+    return tl::unexpected(TrackerError{"Connection refused"});
+  };
+}
+}  // namespace
+
+TEST(TrackerSet, AnnouncesToAllTiersAndMergesPeers) {
+  TrackerSet trackers({{"http://slow", "http://dead"}, {"udp://fast:1"}},
+                      fakeTrackers());
+
+  std::mutex lock;
+  std::vector<std::vector<int>> batches;
+  const auto start = std::chrono::steady_clock::now();
+  milliseconds first_batch{};
+  trackers.announce(kStarted, [&](std::vector<std::unique_ptr<Peer>> peers) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (batches.empty()) {
+      first_batch = std::chrono::duration_cast<milliseconds>(
+          std::chrono::steady_clock::now() - start);
+    }
+    std::vector<int> ports;
+    for (const auto& peer : peers) {
+      ports.push_back(peer->port);
+    }
+    batches.push_back(ports);
+  });
+  waitIdle(trackers);
+
+  // The tier-2 tracker answers first, and the peer it shares with the slow
+  // tracker is only handed over once.
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[0], (std::vector<int>{3, 4}));
+  EXPECT_EQ(batches[1], (std::vector<int>{1, 2}));
+  EXPECT_LT(first_batch, milliseconds(150));
+}
+
+TEST(TrackerSet, RanksTrackersByYieldAndLatency) {
+  TrackerSet trackers({{"http://slow", "http://dead"}, {"udp://fast:1"}},
+                      fakeTrackers());
+
+  // Before any answer, the announce-list order is kept.
+  auto ranking = trackers.ranking();
+  ASSERT_EQ(ranking.size(), 3);
+  EXPECT_EQ(ranking[0].url, "http://slow");
+
+  trackers.announce(kStarted, ignorePeers);
+  waitIdle(trackers);
+
+  ranking = trackers.ranking();
+  EXPECT_EQ(ranking[0].url, "udp://fast:1");
+  EXPECT_EQ(ranking[1].url, "http://slow");
+  EXPECT_EQ(ranking[2].url, "http://dead");
+  EXPECT_EQ(ranking[2].failures, 1);
+  EXPECT_DOUBLE_EQ(ranking[0].peerYield, 2);
+}
+
+TEST(TrackerSet, SkipsTrackersStillAnnouncing) {
+  std::mutex lock;
+  int calls = 0;
+  TrackerSet trackers({{"http://slow"}},
+                      [&](const std::string&, const AnnounceParams&) {
+                        {
+                          std::lock_guard<std::mutex> guard(lock);
+                          calls++;
+                        }
+                        std::this_thread::sleep_for(milliseconds(50));
+                        return makeResponse({1});
+                      });
+
+  EXPECT_EQ(trackers.announce(kStarted, ignorePeers), 1);
+  EXPECT_EQ(trackers.announce(kStarted, ignorePeers), 0);
+  waitIdle(trackers);
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(TrackerSet, IgnoresDuplicateUrls) {
+  TrackerSet trackers({{"http://slow"}, {"http://slow", "udp://fast:1"}},
+                      fakeTrackers());
+  EXPECT_EQ(trackers.ranking().size(), 2);
+}
+
+TEST(TrackerSet, HonoursIntervalAndMinInterval) {
+  TrackerSet trackers({{"http://a"}}, [](const std::string&,
+                                         const AnnounceParams&) {
+    return makeResponse({1}, 1800, 600);
+  });
+  const auto start = TrackerSet::Clock::now();
+  using std::chrono::seconds;
+
+  EXPECT_EQ(trackers.announce(kStarted, ignorePeers, false, start), 1);
+  waitIdle(trackers);
+  EXPECT_EQ(trackers.nextDue(), start + seconds(1800));
+
+  // Regular announces wait for the interval, early ones for the min
+  // interval.
+  EXPECT_EQ(trackers.announce(kRegular, ignorePeers, false,
+                              start + seconds(900)),
+            0);
+  EXPECT_EQ(trackers.announce(kRegular, ignorePeers, true,
+                              start + seconds(599)),
+            0);
+  EXPECT_EQ(trackers.announce(kRegular, ignorePeers, true,
+                              start + seconds(600)),
+            1);
+  waitIdle(trackers);
+  EXPECT_EQ(trackers.nextDue(), start + seconds(2400));
+
+  // Events are sent regardless.
+  const AnnounceParams stopped{.event = TrackerEvent::kStopped};
+  EXPECT_EQ(trackers.announce(stopped, ignorePeers, false,
+                              start + seconds(601)),
+            1);
+  waitIdle(trackers);
+}
+
+TEST(TrackerSet, BacksOffFailingTrackers) {
+  TrackerSet trackers({{"http://dead"}}, fakeTrackers());
+  const auto start = TrackerSet::Clock::now();
+  using std::chrono::seconds;
+
+  trackers.announce(kStarted, ignorePeers, false, start);
+  waitIdle(trackers);
+  EXPECT_EQ(trackers.nextDue(), start + seconds(15));
+
+  trackers.announce(kRegular, ignorePeers, false, start + seconds(15));
+  waitIdle(trackers);
+  EXPECT_EQ(trackers.nextDue(), start + seconds(45));
+  EXPECT_EQ(trackers.ranking()[0].failures, 2);
+}
+
+TEST(TrackerSet, SendsEventsUntilEachTrackerAnswersThem) {
+  std::mutex lock;
+  bool failing = true;
+  std::vector<std::pair<std::string, TrackerEvent>> sent;
+  TrackerSet trackers(
+      {{"http://a", "http://flaky"}},
+      [&](const std::string& url, const AnnounceParams& params)
+          -> tl::expected<AnnounceResponse, TrackerError> {
+        std::lock_guard<std::mutex> guard(lock);
+        sent.emplace_back(url, params.event);
+        if (url == "http://flaky" && failing) {
+          return tl::unexpected(TrackerError{"Connection refused"});
+        }
+        return makeResponse({}, 1800, 600);
+      });
+  const auto start = TrackerSet::Clock::now();
+  using std::chrono::seconds;
+  const auto events_to = [&](const std::string& url) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<TrackerEvent> events;
+    for (const auto& [to, event] : sent) {
+      if (to == url) {
+        events.push_back(event);
+      }
+    }
+    return events;
+  };
+
+  trackers.announce(kStarted, ignorePeers, false, start);
+  waitIdle(trackers);
+
+  // The download completes while "flaky" still owes `started`: it is sent
+  // `started` again once its backoff is over, then `completed`.
+  const AnnounceParams completed{.event = TrackerEvent::kCompleted};
+  EXPECT_EQ(trackers.announce(completed, ignorePeers, false,
+                              start + seconds(1)),
+            1);
+  waitIdle(trackers);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    failing = false;
+  }
+  EXPECT_EQ(trackers.announce(completed, ignorePeers, false,
+                              start + seconds(15)),
+            1);
+  waitIdle(trackers);
+  EXPECT_EQ(trackers.announce(completed, ignorePeers, false,
+                              start + seconds(16)),
+            1);
+  waitIdle(trackers);
+  // Nothing is owed any more.
+  EXPECT_EQ(trackers.announce(completed, ignorePeers, false,
+                              start + seconds(17)),
+            0);
+
+  EXPECT_EQ(events_to("http://a"),
+            (std::vector<TrackerEvent>{TrackerEvent::kStarted,
+                                       TrackerEvent::kCompleted}));
+  EXPECT_EQ(events_to("http://flaky"),
+            (std::vector<TrackerEvent>{TrackerEvent::kStarted,
+                                       TrackerEvent::kStarted,
+                                       TrackerEvent::kCompleted}));
+}
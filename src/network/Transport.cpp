@@ -0,0 +1,34 @@
+#include "network/Transport.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tl/expected.hpp>
+
+#include "network/connect.h"
+
+TcpStream::TcpStream(int sock) : sock_(sock) {}
+
+TcpStream::~TcpStream() { close(sock_); }
+
+tl::expected<void, ConnectError> TcpStream::send(const std::string& data) {
+  return sendData(sock_, data);
+}
+
+tl::expected<std::string, ConnectError> TcpStream::receive(uint32_t size) {
+  return receiveData(sock_, size);
+}
+
+void TcpStream::shutdown() { ::shutdown(sock_, SHUT_RDWR); }
+
+tl::expected<std::unique_ptr<PeerStream>, ConnectError> TcpTransport::connect(
+    const Peer& peer) {
+  auto sock = createConnection(peer.ip, peer.port);
+  if (!sock) {
+    return tl::unexpected(sock.error());
+  }
+  return std::make_unique<TcpStream>(*sock);
+}
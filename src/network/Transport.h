@@ -0,0 +1,60 @@
+#ifndef BITTORRENTCLIENT_TRANSPORT_H
+#define BITTORRENTCLIENT_TRANSPORT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tl/expected.hpp>
+
+#include "network/Peer.h"
+#include "network/connect.h"
+
+/**
+ * A reliable, ordered byte stream to a peer.
+ */
+class PeerStream {
+ public:
+  virtual ~PeerStream() = default;
+
+  virtual tl::expected<void, ConnectError> send(const std::string& data) = 0;
+  // Reads `size` bytes or, when `size` is 0, one length-prefixed message
+  // without its prefix, like receiveData().
+  virtual tl::expected<std::string, ConnectError> receive(
+      uint32_t size = 0) = 0;
+  // Breaks the stream, failing the calls blocked on it. Can be called from
+  // any thread.
+  virtual void shutdown() = 0;
+};
+
+/**
+ * Opens streams to peers; implemented over TCP and over uTP.
+ */
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  virtual tl::expected<std::unique_ptr<PeerStream>, ConnectError> connect(
+      const Peer& peer) = 0;
+};
+
+// Owns a connected TCP socket, closing it when destroyed.
+class TcpStream : public PeerStream {
+ public:
+  explicit TcpStream(int sock);
+  ~TcpStream() override;
+
+  tl::expected<void, ConnectError> send(const std::string& data) override;
+  tl::expected<std::string, ConnectError> receive(uint32_t size) override;
+  void shutdown() override;
+
+ private:
+  const int sock_;
+};
+
+class TcpTransport : public Transport {
+ public:
+  tl::expected<std::unique_ptr<PeerStream>, ConnectError> connect(
+      const Peer& peer) override;
+};
+
+#endif  // BITTORRENTCLIENT_TRANSPORT_H
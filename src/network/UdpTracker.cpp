@@ -0,0 +1,303 @@
+#include "network/UdpTracker.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <tl/expected.hpp>
+#include <utility>
+#include <vector>
+
+#define PROTOCOL_ID 0x41727101980
+// A connection id may be used for one minute after it was received.
+#define CONNECTION_ID_LIFETIME 60  // 1 minute
+#define MAX_DATAGRAM 2048
+
+namespace {
+enum Action : int32_t {
+  kConnect = 0,
+  kAnnounce = 1,
+  kScrape = 2,
+  kError = 3,
+};
+
+// Size of the header of every response: action and transaction id.
+constexpr size_t kResponseHeader = 8;
+
+template <typename T>
+void appendInt(std::string& out, T value) {
+  for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> shift)));
+  }
+}
+
+template <typename T>
+T readInt(const std::string& in, size_t offset) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    value = (value << 8) | static_cast<uint8_t>(in[offset + i]);
+  }
+  return static_cast<T>(value);
+}
+
+uint32_t randomId() {
+  static thread_local std::mt19937 gen(std::random_device{}());
+  return gen();
+}
+}  // namespace
+
+tl::expected<std::pair<std::string, int>, UdpTrackerError> parseUdpTrackerUrl(
+    const std::string& url) {
+  const std::string scheme = "udp://";
+  if (!url.starts_with(scheme)) {
+    return tl::unexpected(UdpTrackerError{"Not a UDP tracker: " + url});
+  }
+
+  std::string authority = url.substr(scheme.size());
+  authority = authority.substr(0, authority.find('/'));
+  size_t colon = authority.rfind(':');
+  if (colon == std::string::npos || colon == 0 ||
+      colon + 1 == authority.size()) {
+    return tl::unexpected(UdpTrackerError{"Missing tracker port: " + url});
+  }
+
+  std::string port = authority.substr(colon + 1);
+  if (!std::ranges::all_of(port, [](unsigned char c) { return isdigit(c); }) ||
+      port.size() > 5 || std::stoi(port) > UINT16_MAX) {
+    return tl::unexpected(UdpTrackerError{"Invalid tracker port: " + url});
+  }
+  return std::make_pair(authority.substr(0, colon), std::stoi(port));
+}
+
+UdpTracker::UdpTracker(std::string announceUrl,
+                       std::chrono::milliseconds baseTimeout, int maxRetries)
+    : announceUrl_(std::move(announceUrl)),
+      baseTimeout_(baseTimeout),
+      maxRetries_(maxRetries),
+      key_(randomId()) {}
+
+UdpTracker::~UdpTracker() {
+  if (sock_ >= 0) {
+    close(sock_);
+  }
+}
+
+/**
+ * Resolves the tracker and creates a UDP socket bound to its address, so
+ * that datagrams from anyone else are dropped by the kernel.
+ */
+tl::expected<void, UdpTrackerError> UdpTracker::open() {
+  if (sock_ >= 0) {
+    return {};
+  }
+
+  auto address = parseUdpTrackerUrl(announceUrl_);
+  if (!address) {
+    return tl::unexpected(address.error());
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo* results = nullptr;
+  if (getaddrinfo(address->first.c_str(),
+                  std::to_string(address->second).c_str(), &hints,
+                  &results) != 0) {
+    return tl::unexpected(
+        UdpTrackerError{"Failed to resolve tracker " + address->first});
+  }
+
+  for (addrinfo* result = results; result; result = result->ai_next) {
+    int sock = socket(result->ai_family, result->ai_socktype,
+                      result->ai_protocol);
+    if (sock < 0) {
+      continue;
+    }
+    if (::connect(sock, result->ai_addr, result->ai_addrlen) == 0) {
+      sock_ = sock;
+      break;
+    }
+    close(sock);
+  }
+  freeaddrinfo(results);
+
+  if (sock_ < 0) {
+    return tl::unexpected(
+        UdpTrackerError{"Failed to create a socket for " + announceUrl_});
+  }
+  return {};
+}
+
+tl::expected<void, UdpTrackerError> UdpTracker::connect() {
+  auto response = transact(kConnect, "");
+  if (!response) {
+    return tl::unexpected(response.error());
+  }
+  if (response->size() < kResponseHeader + 8) {
+    return tl::unexpected(UdpTrackerError{"Truncated connect response"});
+  }
+
+  connectionId_ = readInt<uint64_t>(*response, kResponseHeader);
+  connectionExpiry_ =
+      Clock::now() + std::chrono::seconds(CONNECTION_ID_LIFETIME);
+  return {};
+}
+
+/**
+ * Each attempt waits twice as long as the one before, so together they wait
+ * baseTimeout * (2^(maxRetries + 1) - 1).
+ */
+std::chrono::milliseconds UdpTracker::retryBudget() const {
+  return baseTimeout_ * ((1 << (maxRetries_ + 1)) - 1);
+}
+
+/**
+ * Sends a request and waits for the response carrying the same transaction
+ * id, retransmitting with exponential backoff. Before every attempt other
+ * than a connect, a new connection id is obtained if the cached one has
+ * expired. Returns the whole response, header included.
+ */
+tl::expected<std::string, UdpTrackerError> UdpTracker::transact(
+    int32_t action, const std::string& body) {
+  char buffer[MAX_DATAGRAM];
+
+  for (int attempt = 0; attempt <= maxRetries_; attempt++) {
+    if (action != kConnect && Clock::now() >= connectionExpiry_) {
+      if (auto connected = connect(); !connected) {
+        return tl::unexpected(connected.error());
+      }
+    }
+
+    const uint32_t transaction_id = randomId();
+    std::string request;
+    request.reserve(16 + body.size());
+    appendInt<uint64_t>(request,
+                        action == kConnect ? PROTOCOL_ID : connectionId_);
+    appendInt<int32_t>(request, action);
+    appendInt<uint32_t>(request, transaction_id);
+    request += body;
+
+    if (send(sock_, request.data(), request.size(), 0) < 0) {
+      return tl::unexpected(
+          UdpTrackerError{"Failed to send to tracker " + announceUrl_});
+    }
+
+    const auto deadline = Clock::now() + baseTimeout_ * (1 << attempt);
+    while (true) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - Clock::now());
+      if (remaining.count() <= 0) {
+        break;
+      }
+
+      pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+      if (poll(&descriptor, 1, static_cast<int>(remaining.count())) <= 0) {
+        continue;
+      }
+
+      ssize_t n = recv(sock_, buffer, sizeof(buffer), 0);
+      if (n < static_cast<ssize_t>(kResponseHeader)) {
+        continue;
+      }
+      std::string response(buffer, n);
+      if (readInt<uint32_t>(response, 4) != transaction_id) {
+        continue;
+      }
+
+      int32_t response_action = readInt<int32_t>(response, 0);
+      if (response_action == kError) {
+        return tl::unexpected(UdpTrackerError{
+            "Tracker error: " + response.substr(kResponseHeader)});
+      }
+      if (response_action != action) {
+        return tl::unexpected(UdpTrackerError{"Unexpected tracker response"});
+      }
+      return response;
+    }
+  }
+
+  return tl::unexpected(
+      UdpTrackerError{"No response from tracker " + announceUrl_});
+}
+
+tl::expected<AnnounceResponse, UdpTrackerError> UdpTracker::announce(
+    const AnnounceRequest& request) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (auto opened = open(); !opened) {
+    return tl::unexpected(opened.error());
+  }
+
+  std::string body;
+  body.reserve(82);
+  body += request.infoHash;
+  body += request.peerId;
+  appendInt<uint64_t>(body, request.params.downloaded);
+  appendInt<uint64_t>(body, request.params.left);
+  appendInt<uint64_t>(body, request.params.uploaded);
+  appendInt<int32_t>(body, static_cast<int32_t>(request.params.event));
+  appendInt<uint32_t>(body, 0);  // IP address: the one the request came from
+  appendInt<uint32_t>(body, key_);
+  appendInt<int32_t>(body, request.params.numWant);
+  appendInt<uint16_t>(body, static_cast<uint16_t>(request.port));
+
+  auto response = transact(kAnnounce, body);
+  if (!response) {
+    return tl::unexpected(response.error());
+  }
+  if (response->size() < kResponseHeader + 12) {
+    return tl::unexpected(UdpTrackerError{"Truncated announce response"});
+  }
+
+  AnnounceResponse announced;
+  announced.interval = readInt<int32_t>(*response, kResponseHeader);
+  announced.leechers = readInt<int32_t>(*response, kResponseHeader + 4);
+  announced.seeders = readInt<int32_t>(*response, kResponseHeader + 8);
+  announced.peers = decodeCompactPeers(response->substr(kResponseHeader + 12));
+  return announced;
+}
+
+tl::expected<std::vector<ScrapeStats>, UdpTrackerError> UdpTracker::scrape(
+    const std::vector<std::string>& infoHashes) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (auto opened = open(); !opened) {
+    return tl::unexpected(opened.error());
+  }
+
+  std::vector<ScrapeStats> stats;
+  stats.reserve(infoHashes.size());
+  for (size_t first = 0; first < infoHashes.size();
+       first += kMaxScrapeHashes) {
+    const size_t count =
+        std::min(kMaxScrapeHashes, infoHashes.size() - first);
+    std::string body;
+    body.reserve(count * 20);
+    for (size_t i = first; i < first + count; i++) {
+      body += infoHashes[i];
+    }
+
+    auto response = transact(kScrape, body);
+    if (!response) {
+      return tl::unexpected(response.error());
+    }
+    if (response->size() < kResponseHeader + count * 12) {
+      return tl::unexpected(UdpTrackerError{"Truncated scrape response"});
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      size_t offset = kResponseHeader + i * 12;
+      stats.push_back(ScrapeStats{
+          .seeders = readInt<int32_t>(*response, offset),
+          .completed = readInt<int32_t>(*response, offset + 4),
+          .leechers = readInt<int32_t>(*response, offset + 8)});
+    }
+  }
+  return stats;
+}
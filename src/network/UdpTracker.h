@@ -0,0 +1,96 @@
+#ifndef BITTORRENTCLIENT_UDPTRACKER_H
+#define BITTORRENTCLIENT_UDPTRACKER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tl/expected.hpp>
+#include <vector>
+
+#include "network/Announce.h"
+#include "network/Peer.h"
+
+struct UdpTrackerError {
+  std::string message;
+};
+
+struct AnnounceRequest {
+  // Raw 20-byte info hash and peer id.
+  std::string infoHash;
+  std::string peerId;
+  int port = 0;
+  AnnounceParams params;
+};
+
+struct ScrapeStats {
+  int seeders = 0;
+  int completed = 0;
+  int leechers = 0;
+};
+
+/**
+ * Client of the UDP tracker protocol (BEP 15). An announce costs two small
+ * datagrams instead of a TCP and HTTP exchange, and the connection id
+ * obtained from the tracker is reused for as long as it stays valid, so
+ * most announces take a single round trip.
+ *
+ * Lost datagrams are retransmitted after 15 * 2^n seconds, n being the
+ * number of attempts so far, as the BEP specifies, but only up to
+ * `maxRetries` times: the BEP's 8 retries would have a dead tracker block
+ * the announce of its whole tier for over an hour, where the default of 2
+ * gives up after 105 s. The base timeout can be shortened for tests. Calls
+ * are serialised, and block until the tracker answers or the retries run
+ * out.
+ */
+class UdpTracker {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Info hashes that fit in a single scrape request.
+  static constexpr size_t kMaxScrapeHashes = 74;
+  static constexpr int kDefaultMaxRetries = 2;
+
+  explicit UdpTracker(std::string announceUrl,
+                      std::chrono::milliseconds baseTimeout =
+                          std::chrono::seconds(15),
+                      int maxRetries = kDefaultMaxRetries);
+  ~UdpTracker();
+
+  UdpTracker(const UdpTracker&) = delete;
+  UdpTracker& operator=(const UdpTracker&) = delete;
+
+  tl::expected<AnnounceResponse, UdpTrackerError> announce(
+      const AnnounceRequest& request);
+
+  // Stats for each of the given raw info hashes, in the same order. Hashes
+  // are sent in batches of kMaxScrapeHashes.
+  tl::expected<std::vector<ScrapeStats>, UdpTrackerError> scrape(
+      const std::vector<std::string>& infoHashes);
+
+  // Longest a request to the tracker waits before the retries run out.
+  std::chrono::milliseconds retryBudget() const;
+
+ private:
+  const std::string announceUrl_;
+  const std::chrono::milliseconds baseTimeout_;
+  const int maxRetries_;
+
+  std::mutex lock_;
+  int sock_ = -1;
+  uint64_t connectionId_ = 0;
+  Clock::time_point connectionExpiry_;
+  uint32_t key_;
+
+  tl::expected<void, UdpTrackerError> open();
+  tl::expected<void, UdpTrackerError> connect();
+  tl::expected<std::string, UdpTrackerError> transact(int32_t action,
+                                                      const std::string& body);
+};
+
+// Splits "udp://host:port[/path]" into its host and port.
+tl::expected<std::pair<std::string, int>, UdpTrackerError> parseUdpTrackerUrl(
+    const std::string& url);
+
+#endif  // BITTORRENTCLIENT_UDPTRACKER_H
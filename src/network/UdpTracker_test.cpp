@@ -0,0 +1,235 @@
+#include "network/UdpTracker.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::chrono::milliseconds;
+
+namespace {
+constexpr uint64_t kConnectionId = 0x1122334455667788;
+
+void appendInt32(std::string& out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>(value >> shift));
+  }
+}
+
+uint64_t readInt(const std::string& in, size_t offset, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; i++) {
+    value = (value << 8) | static_cast<uint8_t>(in[offset + i]);
+  }
+  return value;
+}
+
+/**
+ * In-process UDP tracker on the loopback interface. It hands out a single
+ * connection id, announces two peers, and reports the index of each info
+ * hash as its seeder count when scraped.
+ */
+class MockUdpTracker {
+ public:
+  std::atomic<int> connects = 0;
+  std::atomic<int> announces = 0;
+  std::atomic<int> scrapes = 0;
+  // Number of upcoming announce requests to ignore.
+  std::atomic<int> dropAnnounces = 0;
+
+  MockUdpTracker() {
+    sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(sock_, reinterpret_cast<sockaddr*>(&address), length);
+    getsockname(sock_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this] { serve(); });
+  }
+
+  ~MockUdpTracker() {
+    running_ = false;
+    thread_.join();
+    close(sock_);
+  }
+
+  std::string url() const {
+    return "udp://127.0.0.1:" + std::to_string(port_) + "/announce";
+  }
+
+ private:
+  int sock_;
+  int port_;
+  std::atomic<bool> running_ = true;
+  std::thread thread_;
+
+  void serve() {
+    char buffer[2048];
+    while (running_) {
+      pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+      if (poll(&descriptor, 1, 10) <= 0) {
+        continue;
+      }
+
+      sockaddr_in client{};
+      socklen_t length = sizeof(client);
+      ssize_t n = recvfrom(sock_, buffer, sizeof(buffer), 0,
+                           reinterpret_cast<sockaddr*>(&client), &length);
+      if (n < 16) {
+        continue;
+      }
+      std::string request(buffer, n);
+      std::string response = handle(request);
+      if (!response.empty()) {
+        sendto(sock_, response.data(), response.size(), 0,
+               reinterpret_cast<sockaddr*>(&client), length);
+      }
+    }
+  }
+
+  std::string handle(const std::string& request) {
+    const uint64_t connection_id = readInt(request, 0, 8);
+    const auto action = static_cast<uint32_t>(readInt(request, 8, 4));
+    const auto transaction_id = static_cast<uint32_t>(readInt(request, 12, 4));
+
+    std::string response;
+    appendInt32(response, action);
+    appendInt32(response, transaction_id);
+
+    if (action == 0) {
+      connects++;
+      appendInt32(response, kConnectionId >> 32);
+      appendInt32(response, static_cast<uint32_t>(kConnectionId));
+      return response;
+    }
+
+    if (connection_id != kConnectionId) {
+      std::string error;
+      appendInt32(error, 3);
+      appendInt32(error, transaction_id);
+      return error + "unknown connection id";
+    }
+
+    if (action == 1) {
+      if (dropAnnounces > 0) {
+        dropAnnounces--;
+        return "";
+      }
+      announces++;
+      appendInt32(response, 1800);  // interval
+      appendInt32(response, 5);     // leechers
+      appendInt32(response, 7);     // seeders
+      response += std::string("\x0A\x00\x00\x01\x1A\xE1", 6);
+      response += std::string("\x0A\x00\x00\x02\x1A\xE2", 6);
+      return response;
+    }
+
+    scrapes++;
+    const size_t hashes = (request.size() - 16) / 20;
+    for (size_t i = 0; i < hashes; i++) {
+      appendInt32(response, static_cast<uint8_t>(request[16 + i * 20]));
+      appendInt32(response, 0);
+      appendInt32(response, 0);
+    }
+    return response;
+  }
+};
+
+AnnounceRequest makeRequest() {
+  return AnnounceRequest{.infoHash = std::string(20, 'h'),
+                         .peerId = std::string(20, 'p'),
+                         .port = 6881,
+                         .params = AnnounceParams{.left = 1000}};
+}
+}  // namespace
+
+TEST(UdpTracker, ParsesUrl) {
+  auto address = parseUdpTrackerUrl("udp://tracker.example.org:1337/announce");
+  ASSERT_TRUE(address.has_value());
+  EXPECT_EQ(address->first, "tracker.example.org");
+  EXPECT_EQ(address->second, 1337);
+
+  EXPECT_FALSE(parseUdpTrackerUrl("http://tracker:80/announce").has_value());
+  EXPECT_FALSE(parseUdpTrackerUrl("udp://tracker/announce").has_value());
+  EXPECT_FALSE(parseUdpTrackerUrl("udp://tracker:99999").has_value());
+}
+
+TEST(UdpTracker, AnnouncesAndReusesConnectionId) {
+  MockUdpTracker mock;
+  UdpTracker tracker(mock.url(), milliseconds(200), 2);
+
+  auto first = tracker.announce(makeRequest());
+  ASSERT_TRUE(first.has_value()) << first.error().message;
+  EXPECT_EQ(first->interval, 1800);
+  EXPECT_EQ(first->leechers, 5);
+  EXPECT_EQ(first->seeders, 7);
+  ASSERT_EQ(first->peers.size(), 2);
+  EXPECT_EQ(first->peers[0]->ip, "10.0.0.1");
+  EXPECT_EQ(first->peers[0]->port, 6881);
+  EXPECT_EQ(first->peers[1]->port, 6882);
+
+  ASSERT_TRUE(tracker.announce(makeRequest()).has_value());
+  EXPECT_EQ(mock.connects, 1);
+  EXPECT_EQ(mock.announces, 2);
+}
+
+TEST(UdpTracker, RetransmitsLostRequests) {
+  MockUdpTracker mock;
+  mock.dropAnnounces = 2;
+  UdpTracker tracker(mock.url(), milliseconds(20), 3);
+
+  auto response = tracker.announce(makeRequest());
+  ASSERT_TRUE(response.has_value()) << response.error().message;
+  EXPECT_EQ(mock.announces, 1);
+  EXPECT_EQ(mock.dropAnnounces, 0);
+}
+
+TEST(UdpTracker, GivesUpAfterRetries) {
+  MockUdpTracker mock;
+  mock.dropAnnounces = 100;
+  UdpTracker tracker(mock.url(), milliseconds(5), 2);
+
+  auto response = tracker.announce(makeRequest());
+  ASSERT_FALSE(response.has_value());
+  // The first attempt and two retries.
+  EXPECT_EQ(mock.dropAnnounces, 97);
+}
+
+TEST(UdpTracker, DefaultRetriesGiveUpWithinTwoMinutes) {
+  UdpTracker tracker("udp://127.0.0.1:6969");
+  EXPECT_EQ(tracker.retryBudget(), std::chrono::seconds(105));
+  EXPECT_EQ(UdpTracker("udp://127.0.0.1:6969", milliseconds(5), 2)
+                .retryBudget(),
+            milliseconds(35));
+}
+
+TEST(UdpTracker, ScrapesInBatches) {
+  MockUdpTracker mock;
+  UdpTracker tracker(mock.url(), milliseconds(200), 2);
+
+  std::vector<std::string> hashes;
+  for (int i = 0; i < 100; i++) {
+    hashes.push_back(std::string(1, static_cast<char>(i)) +
+                     std::string(19, 'x'));
+  }
+
+  auto stats = tracker.scrape(hashes);
+  ASSERT_TRUE(stats.has_value()) << stats.error().message;
+  ASSERT_EQ(stats->size(), 100);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ((*stats)[i].seeders, i);
+  }
+  EXPECT_EQ(mock.scrapes, 2);
+  EXPECT_EQ(mock.connects, 1);
+}
@@ -0,0 +1,1061 @@
+#include "network/UtpSocket.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/RttEstimator.h"
+#include "network/Ledbat.h"
+#include "utils/utils.h"
+
+#define UTP_VERSION 1
+#define EXTENSION_SELECTIVE_ACK 1
+#define BATCH_SIZE 32
+// Batches read before the streams are serviced again.
+#define MAX_BATCHES 8
+#define MAX_DATAGRAM 2048
+#define RECEIVE_POLL 1000  // 1 sec, while no connection is open
+#define TIMER_TICK 10      // 10 ms, while connections are open
+#define SYN_INTERVAL 1000  // 1 sec between SYN retransmissions
+#define READ_TIMEOUT 300   // 300 ms for a message to start arriving
+// Retransmission timeouts in a row before the connection is given up.
+#define MAX_TIMEOUTS 6
+#define MAX_IN_FLIGHT 512
+#define MAX_OUT_OF_ORDER 1024
+// How long a closed stream waits for its FIN to be acknowledged.
+#define CLOSE_LINGER 10  // 10 sec
+
+namespace {
+using Clock = UtpSocket::Clock;
+
+// Packets the selective ACK covers after ack_nr + 1.
+constexpr int kSelectiveAckBits = UtpSocket::kSelectiveAckBytes * 8;
+
+/**
+ * Bytes appended at the back and consumed from the front, compacted once
+ * more than half of the storage has been consumed.
+ */
+class ByteQueue {
+ public:
+  size_t size() const { return data_.size() - offset_; }
+  bool empty() const { return size() == 0; }
+  void append(const std::string& data) { data_ += data; }
+  std::string take(size_t count) {
+    std::string taken = data_.substr(offset_, count);
+    offset_ += taken.size();
+    if (offset_ > data_.size() / 2) {
+      data_.erase(0, offset_);
+      offset_ = 0;
+    }
+    return taken;
+  }
+  void clear() {
+    data_.clear();
+    offset_ = 0;
+  }
+
+ private:
+  std::string data_;
+  size_t offset_ = 0;
+};
+
+uint32_t micros(Clock::time_point now) {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          now.time_since_epoch())
+          .count());
+}
+
+// Sequence numbers wrap around, so `a` comes before `b` if it is less than
+// half the range behind it.
+bool seqBefore(uint16_t a, uint16_t b) {
+  return static_cast<int16_t>(a - b) < 0;
+}
+
+uint64_t connectionKey(uint32_t address, uint16_t port, uint16_t id) {
+  return (static_cast<uint64_t>(address) << 32) |
+         (static_cast<uint64_t>(port) << 16) | id;
+}
+
+uint16_t randomId() {
+  thread_local std::mt19937 generator{std::random_device{}()};
+  return static_cast<uint16_t>(generator());
+}
+
+void put16(std::string& out, uint16_t value) {
+  out += static_cast<char>(value >> 8);
+  out += static_cast<char>(value & 0xFF);
+}
+
+void put32(std::string& out, uint32_t value) {
+  put16(out, static_cast<uint16_t>(value >> 16));
+  put16(out, static_cast<uint16_t>(value & 0xFFFF));
+}
+
+uint16_t get16(const char* data) {
+  return static_cast<uint16_t>((static_cast<uint8_t>(data[0]) << 8) |
+                               static_cast<uint8_t>(data[1]));
+}
+
+uint32_t get32(const char* data) {
+  return (static_cast<uint32_t>(get16(data)) << 16) | get16(data + 2);
+}
+}  // namespace
+
+std::string encodeUtpPacket(const UtpPacket& packet) {
+  std::string out;
+  out.reserve(kUtpHeaderSize + packet.selectiveAck.size() + 2 +
+              packet.payload.size());
+  out += static_cast<char>((static_cast<uint8_t>(packet.type) << 4) |
+                           UTP_VERSION);
+  out += static_cast<char>(packet.selectiveAck.empty()
+                               ? 0
+                               : EXTENSION_SELECTIVE_ACK);
+  put16(out, packet.connectionId);
+  put32(out, packet.timestamp);
+  put32(out, packet.timestampDifference);
+  put32(out, packet.windowSize);
+  put16(out, packet.seqNr);
+  put16(out, packet.ackNr);
+  if (!packet.selectiveAck.empty()) {
+    out += '\0';  // no further extension
+    out += static_cast<char>(packet.selectiveAck.size());
+    out += packet.selectiveAck;
+  }
+  out += packet.payload;
+  return out;
+}
+
+/**
+ * Decodes a datagram. Extensions other than the selective ACK are skipped.
+ */
+tl::expected<UtpPacket, UtpError> decodeUtpPacket(const char* data,
+                                                  size_t size) {
+  if (size < kUtpHeaderSize) {
+    return tl::unexpected(UtpError{"Packet too short"});
+  }
+  const auto type = static_cast<uint8_t>(data[0]) >> 4;
+  if ((static_cast<uint8_t>(data[0]) & 0x0F) != UTP_VERSION ||
+      type > static_cast<uint8_t>(UtpPacketType::kSyn)) {
+    return tl::unexpected(UtpError{"Not a uTP packet"});
+  }
+
+  UtpPacket packet{.type = static_cast<UtpPacketType>(type),
+                   .connectionId = get16(data + 2),
+                   .timestamp = get32(data + 4),
+                   .timestampDifference = get32(data + 8),
+                   .windowSize = get32(data + 12),
+                   .seqNr = get16(data + 16),
+                   .ackNr = get16(data + 18)};
+
+  size_t offset = kUtpHeaderSize;
+  auto extension = static_cast<uint8_t>(data[1]);
+  while (extension != 0) {
+    if (offset + 2 > size) {
+      return tl::unexpected(UtpError{"Truncated extension header"});
+    }
+    const auto next = static_cast<uint8_t>(data[offset]);
+    const auto length = static_cast<uint8_t>(data[offset + 1]);
+    offset += 2;
+    if (offset + length > size) {
+      return tl::unexpected(UtpError{"Truncated extension"});
+    }
+    if (extension == EXTENSION_SELECTIVE_ACK) {
+      if (length == 0 || length % 4 != 0) {
+        return tl::unexpected(UtpError{"Invalid selective ACK length"});
+      }
+      packet.selectiveAck.assign(data + offset, length);
+    }
+    offset += length;
+    extension = next;
+  }
+  packet.payload.assign(data + offset, size - offset);
+  return packet;
+}
+
+struct UtpSocket::Connection {
+  enum class State { kSynSent, kConnected, kClosed };
+
+  struct Outgoing {
+    UtpPacketType type;
+    uint16_t seqNr;
+    std::string payload;
+    Clock::time_point sentAt;
+    int transmissions = 0;
+    // Acknowledged by a selective ACK, ahead of the cumulative one.
+    bool acked = false;
+    bool resend = false;
+  };
+  struct Received {
+    UtpPacketType type;
+    std::string payload;
+  };
+
+  Connection(uint32_t address, uint16_t port)
+      : address(address), port(port), ledbat(kMaxPayload) {}
+
+  const uint32_t address;
+  const uint16_t port;
+  uint16_t recvId = 0;
+  uint16_t sendId = 0;
+  State state = State::kSynSent;
+  std::string error;
+  // A stream, or the accept queue, still refers to the connection.
+  bool open = true;
+  std::condition_variable changed;
+  // Set by connectAsync() until the handshake is over.
+  ConnectCallback onConnected;
+  Clock::time_point opened;
+  Clock::time_point lastSyn;
+  int synAttempts = 0;
+
+  // Sending
+  uint16_t seqNr = 1;
+  ByteQueue sendBuffer;
+  std::deque<Outgoing> inFlight;
+  Ledbat ledbat;
+  RttEstimator rtt;
+  uint32_t peerWindow = kReceiveBufferSize;
+  int timeouts = 0;
+  // The window was halved for a loss; until everything sent before it is
+  // acknowledged, further losses do not halve it again.
+  bool recovering = false;
+  uint16_t recoveryEnd = 0;
+  // The stream was closed; a FIN follows the buffered data.
+  bool closing = false;
+  bool finSent = false;
+  Clock::time_point closedAt;
+
+  // Receiving
+  uint16_t ackNr = 0;
+  ByteQueue receiveBuffer;
+  std::unordered_map<uint16_t, Received> outOfOrder;
+  size_t outOfOrderBytes = 0;
+  bool finReceived = false;
+  bool ackDue = false;
+  uint32_t replyMicros = 0;
+
+  size_t bytesInFlight() const {
+    size_t bytes = 0;
+    for (const Outgoing& packet : inFlight) {
+      if (packet.transmissions > 0 && !packet.acked && !packet.resend) {
+        bytes += packet.payload.size();
+      }
+    }
+    return bytes;
+  }
+
+  size_t bufferedBytes() const {
+    return receiveBuffer.size() + outOfOrderBytes;
+  }
+
+  uint32_t receiveWindow() const {
+    return static_cast<uint32_t>(
+        kReceiveBufferSize - std::min(bufferedBytes(), kReceiveBufferSize));
+  }
+
+  std::string endpoint() const {
+    char ip[INET_ADDRSTRLEN];
+    in_addr in{.s_addr = address};
+    inet_ntop(AF_INET, &in, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(port);
+  }
+};
+
+class UtpSocket::Stream : public PeerStream {
+ public:
+  Stream(std::shared_ptr<UtpSocket> socket,
+         std::shared_ptr<Connection> connection)
+      : socket_(std::move(socket)), connection_(std::move(connection)) {}
+
+  /**
+   * Closing the stream sends a FIN once the buffered data has gone out. The
+   * connection lingers in the socket until the FIN is acknowledged.
+   */
+  ~Stream() override {
+    {
+      std::lock_guard<std::mutex> guard(socket_->lock_);
+      connection_->open = false;
+      if (connection_->state == Connection::State::kConnected) {
+        connection_->closing = true;
+        connection_->closedAt = Clock::now();
+      }
+    }
+    socket_->wake();
+  }
+
+  tl::expected<void, ConnectError> send(const std::string& data) override {
+    {
+      std::unique_lock<std::mutex> lock(socket_->lock_);
+      connection_->changed.wait(lock, [this] {
+        return connection_->state != Connection::State::kConnected ||
+               connection_->sendBuffer.size() < kSendBufferSize;
+      });
+      if (connection_->state != Connection::State::kConnected) {
+        return tl::unexpected(ConnectError{connection_->error});
+      }
+      connection_->sendBuffer.append(data);
+    }
+    socket_->wake();
+    return {};
+  }
+
+  tl::expected<std::string, ConnectError> receive(uint32_t size) override {
+    constexpr uint32_t kLengthIndicatorSize = 4;
+    if (size > 0) {
+      return read(size, std::nullopt);
+    }
+
+    auto length = read(kLengthIndicatorSize,
+                       Clock::now() + std::chrono::milliseconds(READ_TIMEOUT));
+    if (!length) {
+      return length;
+    }
+    const uint32_t message_size = utils::bytesToInt(*length);
+    if (message_size > std::numeric_limits<uint16_t>::max()) {
+      return tl::unexpected(ConnectError{"Buffer size too large: " +
+                                         std::to_string(message_size)});
+    }
+    if (message_size == 0) {
+      return std::string();
+    }
+    return read(message_size, std::nullopt);
+  }
+
+  void shutdown() override {
+    {
+      std::lock_guard<std::mutex> guard(socket_->lock_);
+      if (connection_->state == Connection::State::kClosed) {
+        return;
+      }
+      socket_->sendReset(connection_->address, connection_->port,
+                         connection_->sendId);
+      socket_->fail(*connection_, "Stream shut down");
+    }
+    socket_->wake();
+  }
+
+ private:
+  std::shared_ptr<UtpSocket> socket_;
+  std::shared_ptr<Connection> connection_;
+
+  /**
+   * Waits for `size` bytes, until `deadline` if there is one. Like the TCP
+   * stream, a message that has started arriving is waited for until the
+   * connection fails.
+   */
+  tl::expected<std::string, ConnectError> read(
+      size_t size, std::optional<Clock::time_point> deadline) {
+    bool reopened = false;
+    std::string data;
+    {
+      std::unique_lock<std::mutex> lock(socket_->lock_);
+      Connection& connection = *connection_;
+      const auto ready = [&connection, size] {
+        return connection.receiveBuffer.size() >= size ||
+               connection.finReceived ||
+               connection.state == Connection::State::kClosed;
+      };
+      if (deadline) {
+        connection.changed.wait_until(lock, *deadline, ready);
+      } else {
+        connection.changed.wait(lock, ready);
+      }
+
+      if (connection.receiveBuffer.size() < size) {
+        if (connection.state == Connection::State::kClosed) {
+          return tl::unexpected(ConnectError{connection.error});
+        }
+        if (connection.finReceived) {
+          return tl::unexpected(
+              ConnectError{"Connection closed by " + connection.endpoint()});
+        }
+        return tl::unexpected(ConnectError{
+            .message = "Read timeout on uTP stream to " + connection.endpoint(),
+            .timedOut = true});
+      }
+
+      // A window too small for a packet is advertised again once there is
+      // room, or the sender would stall.
+      reopened = connection.receiveWindow() < kMaxPacketSize;
+      data = connection.receiveBuffer.take(size);
+      if (reopened) {
+        connection.ackDue = true;
+      }
+    }
+    if (reopened) {
+      socket_->wake();
+    }
+    return data;
+  }
+};
+
+UtpSocket::UtpSocket(std::chrono::milliseconds connectTimeout)
+    : connectTimeout_(connectTimeout) {}
+
+UtpSocket::~UtpSocket() { stop(); }
+
+tl::expected<void, UtpError> UtpSocket::start(int port,
+                                              const std::string& address) {
+  sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock_ < 0) {
+    return tl::unexpected(UtpError{"Socket creation error"});
+  }
+
+  sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  socklen_t length = sizeof(local);
+  if (inet_pton(AF_INET, address.c_str(), &local.sin_addr) != 1 ||
+      bind(sock_, reinterpret_cast<sockaddr*>(&local), length) < 0 ||
+      getsockname(sock_, reinterpret_cast<sockaddr*>(&local), &length) < 0) {
+    close(sock_);
+    sock_ = -1;
+    return tl::unexpected(
+        UtpError{"Failed to bind UDP port " + std::to_string(port)});
+  }
+  port_ = ntohs(local.sin_port);
+
+  wakeFd_ = eventfd(0, EFD_NONBLOCK);
+  if (wakeFd_ < 0) {
+    close(sock_);
+    sock_ = -1;
+    return tl::unexpected(UtpError{"Failed to create eventfd"});
+  }
+
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+  return {};
+}
+
+void UtpSocket::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  wake();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  std::vector<std::function<void()>> completions;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto& [key, connection] : connections_) {
+      fail(*connection, "uTP socket stopped");
+      if (auto completion = settle(connection)) {
+        completions.push_back(std::move(completion));
+      }
+    }
+    connections_.clear();
+    acceptQueue_.clear();
+    outbox_.clear();
+  }
+  accepted_.notify_all();
+  for (auto& completion : completions) {
+    completion();
+  }
+
+  close(sock_);
+  close(wakeFd_);
+  sock_ = -1;
+  wakeFd_ = -1;
+}
+
+tl::expected<std::unique_ptr<PeerStream>, ConnectError> UtpSocket::connect(
+    const Peer& peer) {
+  std::promise<tl::expected<std::unique_ptr<PeerStream>, ConnectError>>
+      outcome;
+  auto result = outcome.get_future();
+  connectAsync(peer, [&outcome](auto stream) {
+    outcome.set_value(std::move(stream));
+  });
+  return result.get();
+}
+
+/**
+ * Queues a SYN for the socket thread, which retransmits it every
+ * SYN_INTERVAL until it is answered or the connect timeout passes.
+ */
+void UtpSocket::connectAsync(const Peer& peer, ConnectCallback done) {
+  in_addr address{};
+  if (inet_pton(AF_INET, peer.ip.c_str(), &address) != 1) {
+    done(tl::unexpected(ConnectError{"Invalid address: " + peer.ip}));
+    return;
+  }
+
+  auto connection = std::make_shared<Connection>(
+      address.s_addr, static_cast<uint16_t>(peer.port));
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    // Checked under the lock so that stop() either sees the connection or
+    // this sees the socket stopped.
+    if (!running_) {
+      lock.unlock();
+      done(tl::unexpected(ConnectError{"uTP socket is not running"}));
+      return;
+    }
+    uint64_t key;
+    do {
+      connection->recvId = randomId();
+      key = connectionKey(connection->address, connection->port,
+                          connection->recvId);
+    } while (connections_.contains(key));
+    connection->sendId = connection->recvId + 1;
+    connection->opened = Clock::now();
+    connection->onConnected = std::move(done);
+    connections_[key] = connection;
+  }
+  wake();
+}
+
+/**
+ * Once a connection opened by connectAsync() is no longer waiting for the
+ * SYN to be answered, returns the call that reports it, to be made after
+ * lock_ is released.
+ */
+std::function<void()> UtpSocket::settle(
+    const std::shared_ptr<Connection>& connection) {
+  if (!connection->onConnected ||
+      connection->state == Connection::State::kSynSent) {
+    return nullptr;
+  }
+  ConnectCallback done = std::move(connection->onConnected);
+  connection->onConnected = nullptr;
+  if (connection->state != Connection::State::kConnected) {
+    connection->open = false;
+    return [done = std::move(done), error = connection->error] {
+      done(tl::unexpected(ConnectError{error}));
+    };
+  }
+  return [done = std::move(done), self = shared_from_this(), connection] {
+    done(std::make_unique<Stream>(self, connection));
+  };
+}
+
+void UtpSocket::listen(size_t backlog) {
+  std::lock_guard<std::mutex> guard(lock_);
+  backlog_ = backlog;
+}
+
+tl::expected<std::unique_ptr<PeerStream>, ConnectError> UtpSocket::accept(
+    std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(lock_);
+  accepted_.wait_for(lock, timeout,
+                     [this] { return !acceptQueue_.empty() || !running_; });
+  if (acceptQueue_.empty()) {
+    return tl::unexpected(ConnectError{"No incoming uTP connection"});
+  }
+  auto connection = std::move(acceptQueue_.front());
+  acceptQueue_.pop_front();
+  return std::make_unique<Stream>(shared_from_this(), std::move(connection));
+}
+
+void UtpSocket::wake() const {
+  const uint64_t one = 1;
+  [[maybe_unused]] auto written = write(wakeFd_, &one, sizeof(one));
+}
+
+void UtpSocket::run() {
+  std::array<std::array<char, MAX_DATAGRAM>, BATCH_SIZE> buffers;
+  std::array<sockaddr_in, BATCH_SIZE> senders;
+  std::array<iovec, BATCH_SIZE> vectors;
+  std::array<mmsghdr, BATCH_SIZE> headers;
+
+  while (running_) {
+    int timeout;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      timeout = connections_.empty() ? RECEIVE_POLL : TIMER_TICK;
+    }
+    std::array<pollfd, 2> descriptors = {
+        pollfd{.fd = sock_, .events = POLLIN, .revents = 0},
+        pollfd{.fd = wakeFd_, .events = POLLIN, .revents = 0}};
+    poll(descriptors.data(), descriptors.size(), timeout);
+    if (descriptors[1].revents & POLLIN) {
+      uint64_t count;
+      [[maybe_unused]] auto drained = read(wakeFd_, &count, sizeof(count));
+    }
+
+    struct Arrival {
+      UtpPacket packet;
+      uint32_t address;
+      uint16_t port;
+    };
+    std::vector<Arrival> arrivals;
+    for (int batch = 0; batch < MAX_BATCHES; batch++) {
+      for (size_t i = 0; i < BATCH_SIZE; i++) {
+        vectors[i] = iovec{.iov_base = buffers[i].data(),
+                           .iov_len = buffers[i].size()};
+        headers[i] = mmsghdr{};
+        headers[i].msg_hdr.msg_name = &senders[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        headers[i].msg_hdr.msg_iov = &vectors[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+      }
+      int received =
+          recvmmsg(sock_, headers.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+      if (received <= 0) {
+        break;
+      }
+      for (int i = 0; i < received; i++) {
+        auto packet = decodeUtpPacket(buffers[i].data(), headers[i].msg_len);
+        if (packet) {
+          arrivals.push_back(Arrival{.packet = std::move(*packet),
+                                     .address = senders[i].sin_addr.s_addr,
+                                     .port = ntohs(senders[i].sin_port)});
+        }
+      }
+      if (received < BATCH_SIZE) {
+        break;
+      }
+    }
+
+    std::vector<Datagram> outgoing;
+    std::vector<std::function<void()>> completions;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      const auto now = Clock::now();
+      for (const Arrival& arrival : arrivals) {
+        handlePacket(arrival.packet, arrival.address, arrival.port, now);
+      }
+      for (auto it = connections_.begin(); it != connections_.end();) {
+        pump(*it->second, now);
+        if (auto completion = settle(it->second)) {
+          completions.push_back(std::move(completion));
+        }
+        if (it->second->state == Connection::State::kClosed &&
+            !it->second->open) {
+          it = connections_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      outgoing.swap(outbox_);
+    }
+    flush(outgoing);
+    for (auto& completion : completions) {
+      completion();
+    }
+  }
+}
+
+void UtpSocket::flush(std::vector<Datagram>& datagrams) const {
+  std::array<sockaddr_in, BATCH_SIZE> receivers;
+  std::array<iovec, BATCH_SIZE> vectors;
+  std::array<mmsghdr, BATCH_SIZE> headers;
+
+  size_t sent = 0;
+  while (sent < datagrams.size()) {
+    const size_t count = std::min<size_t>(BATCH_SIZE, datagrams.size() - sent);
+    for (size_t i = 0; i < count; i++) {
+      Datagram& datagram = datagrams[sent + i];
+      receivers[i] = sockaddr_in{};
+      receivers[i].sin_family = AF_INET;
+      receivers[i].sin_addr.s_addr = datagram.address;
+      receivers[i].sin_port = htons(datagram.port);
+      vectors[i] = iovec{.iov_base = datagram.data.data(),
+                         .iov_len = datagram.data.size()};
+      headers[i] = mmsghdr{};
+      headers[i].msg_hdr.msg_name = &receivers[i];
+      headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      headers[i].msg_hdr.msg_iov = &vectors[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    int written = sendmmsg(sock_, headers.data(), count, 0);
+    // A datagram that cannot be sent is dropped, like one lost on the way.
+    sent += written > 0 ? written : 1;
+  }
+}
+
+void UtpSocket::handlePacket(const UtpPacket& packet, uint32_t address,
+                             uint16_t port, Clock::time_point now) {
+  if (packet.type == UtpPacketType::kSyn) {
+    const uint16_t recv_id = packet.connectionId + 1;
+    auto it = connections_.find(connectionKey(address, port, recv_id));
+    if (it != connections_.end()) {
+      // Our answer to the SYN was lost
+      it->second->ackDue = true;
+      return;
+    }
+    if (acceptQueue_.size() >= backlog_) {
+      sendReset(address, port, packet.connectionId);
+      return;
+    }
+
+    auto connection = std::make_shared<Connection>(address, port);
+    connection->recvId = recv_id;
+    connection->sendId = packet.connectionId;
+    connection->state = Connection::State::kConnected;
+    connection->opened = now;
+    connection->seqNr = randomId();
+    connection->ackNr = packet.seqNr;
+    connection->peerWindow = packet.windowSize;
+    connection->replyMicros = micros(now) - packet.timestamp;
+    connection->ackDue = true;
+    connections_[connectionKey(address, port, recv_id)] = connection;
+    acceptQueue_.push_back(std::move(connection));
+    accepted_.notify_one();
+    return;
+  }
+
+  auto it =
+      connections_.find(connectionKey(address, port, packet.connectionId));
+  if (it == connections_.end() && packet.type == UtpPacketType::kReset) {
+    // A reset answering a packet of ours carries the id we send with.
+    it = std::ranges::find_if(connections_, [&](const auto& entry) {
+      const Connection& connection = *entry.second;
+      return connection.address == address && connection.port == port &&
+             connection.sendId == packet.connectionId;
+    });
+  }
+  if (it == connections_.end()) {
+    if (packet.type != UtpPacketType::kReset) {
+      sendReset(address, port, packet.connectionId);
+    }
+    return;
+  }
+
+  Connection& connection = *it->second;
+  if (connection.state == Connection::State::kClosed) {
+    return;
+  }
+  if (packet.type == UtpPacketType::kReset) {
+    fail(connection, "Connection reset by " + connection.endpoint());
+    return;
+  }
+
+  connection.replyMicros = micros(now) - packet.timestamp;
+  connection.peerWindow = packet.windowSize;
+
+  if (connection.state == Connection::State::kSynSent) {
+    // The answer to our SYN, or data that overtook it.
+    if (packet.type != UtpPacketType::kState &&
+        packet.type != UtpPacketType::kData) {
+      return;
+    }
+    connection.state = Connection::State::kConnected;
+    connection.ackNr = packet.seqNr - 1;
+    connection.seqNr = 2;
+    if (connection.synAttempts == 1) {
+      connection.rtt.addSample(
+          std::chrono::duration_cast<RttEstimator::Duration>(
+              now - connection.lastSyn));
+    }
+    connection.changed.notify_all();
+  }
+
+  if (packet.timestampDifference != 0) {
+    connection.ledbat.addDelaySample(packet.timestampDifference, now);
+  }
+  handleAck(connection, packet, now);
+  if (packet.type == UtpPacketType::kData ||
+      packet.type == UtpPacketType::kFin) {
+    handlePayload(connection, packet);
+  }
+}
+
+/**
+ * Drops the packets the peer acknowledged, cumulatively or selectively,
+ * and marks for retransmission those it reports missing while at least
+ * three later packets arrived.
+ */
+void UtpSocket::handleAck(Connection& connection, const UtpPacket& packet,
+                          Clock::time_point now) {
+  // Acknowledges something we never sent
+  if (!seqBefore(packet.ackNr, connection.seqNr)) {
+    return;
+  }
+
+  const size_t flight_size = connection.bytesInFlight();
+  size_t acked_bytes = 0;
+  bool progressed = false;
+  std::optional<Clock::duration> rtt;
+
+  auto& in_flight = connection.inFlight;
+  while (!in_flight.empty() &&
+         !seqBefore(packet.ackNr, in_flight.front().seqNr)) {
+    const auto& front = in_flight.front();
+    if (!front.acked) {
+      acked_bytes += front.payload.size();
+      // Karn's algorithm: retransmitted packets give no RTT sample.
+      if (front.transmissions == 1) {
+        rtt = now - front.sentAt;
+      }
+    }
+    in_flight.pop_front();
+    progressed = true;
+  }
+
+  if (!packet.selectiveAck.empty()) {
+    const size_t bits = packet.selectiveAck.size() * 8;
+    for (auto& outgoing : in_flight) {
+      const uint16_t bit = outgoing.seqNr - packet.ackNr - 2;
+      if (bit >= bits || outgoing.acked ||
+          (static_cast<uint8_t>(packet.selectiveAck[bit / 8]) &
+           (1 << (bit % 8))) == 0) {
+        continue;
+      }
+      outgoing.acked = true;
+      outgoing.resend = false;
+      acked_bytes += outgoing.payload.size();
+      progressed = true;
+    }
+
+    bool lost = false;
+    int acked_later = 0;
+    for (auto it = in_flight.rbegin(); it != in_flight.rend(); ++it) {
+      if (it->acked) {
+        acked_later++;
+      } else if (acked_later >= 3 && it->transmissions == 1 && !it->resend) {
+        it->resend = true;
+        lost = true;
+      }
+    }
+    if (lost && !connection.recovering) {
+      connection.ledbat.onLoss();
+      connection.recovering = true;
+      connection.recoveryEnd = connection.seqNr;
+    }
+  }
+
+  if (connection.recovering &&
+      (in_flight.empty() ||
+       !seqBefore(in_flight.front().seqNr, connection.recoveryEnd))) {
+    connection.recovering = false;
+  }
+
+  if (!progressed) {
+    return;
+  }
+  if (rtt) {
+    connection.rtt.addSample(
+        std::chrono::duration_cast<RttEstimator::Duration>(*rtt));
+  }
+  connection.timeouts = 0;
+  connection.ledbat.onAck(acked_bytes, flight_size);
+  if (connection.finSent && in_flight.empty()) {
+    connection.state = Connection::State::kClosed;
+    connection.error = "Connection closed";
+  }
+  connection.changed.notify_all();
+}
+
+/**
+ * Delivers the payload in order, keeping packets that arrive ahead of a
+ * missing one until it comes. Data beyond the receive buffer, from a sender
+ * that ignores the window we advertise, is dropped without being
+ * acknowledged.
+ */
+void UtpSocket::handlePayload(Connection& connection,
+                              const UtpPacket& packet) {
+  connection.ackDue = true;
+  const auto ahead = static_cast<int16_t>(
+      packet.seqNr - static_cast<uint16_t>(connection.ackNr + 1));
+  if (ahead < 0 || connection.finReceived ||
+      connection.bufferedBytes() + packet.payload.size() >
+          kReceiveBufferSize) {
+    return;
+  }
+  if (ahead > 0) {
+    if (ahead < MAX_OUT_OF_ORDER &&
+        connection.outOfOrder
+            .try_emplace(packet.seqNr,
+                         Connection::Received{.type = packet.type,
+                                              .payload = packet.payload})
+            .second) {
+      connection.outOfOrderBytes += packet.payload.size();
+    }
+    return;
+  }
+
+  Connection::Received next{.type = packet.type, .payload = packet.payload};
+  while (true) {
+    connection.ackNr++;
+    if (next.type == UtpPacketType::kFin) {
+      connection.finReceived = true;
+      connection.outOfOrder.clear();
+      connection.outOfOrderBytes = 0;
+      break;
+    }
+    connection.receiveBuffer.append(next.payload);
+
+    auto it = connection.outOfOrder.find(connection.ackNr + 1);
+    if (it == connection.outOfOrder.end()) {
+      break;
+    }
+    next = std::move(it->second);
+    connection.outOfOrder.erase(it);
+    connection.outOfOrderBytes -= next.payload.size();
+  }
+  connection.changed.notify_all();
+}
+
+/**
+ * Does what is due on the connection: retransmitting the SYN, handling a
+ * retransmission timeout, sending what the windows allow, and
+ * acknowledging what arrived if no data packet did it already.
+ */
+void UtpSocket::pump(Connection& connection, Clock::time_point now) {
+  using State = Connection::State;
+  if (connection.state == State::kClosed) {
+    return;
+  }
+
+  if (connection.state == State::kSynSent) {
+    if (now - connection.opened >= connectTimeout_) {
+      fail(connection, "Connection timeout to " + connection.endpoint());
+    } else if (now - connection.lastSyn >=
+               std::chrono::milliseconds(SYN_INTERVAL)) {
+      sendPacket(connection, UtpPacketType::kSyn, 1, "");
+      connection.lastSyn = now;
+      connection.synAttempts++;
+    }
+    return;
+  }
+
+  if (connection.closing &&
+      now - connection.closedAt >= std::chrono::seconds(CLOSE_LINGER)) {
+    fail(connection, "Connection closed");
+    return;
+  }
+
+  auto& in_flight = connection.inFlight;
+  auto oldest = std::ranges::find_if(in_flight, [](const auto& outgoing) {
+    return outgoing.transmissions > 0 && !outgoing.acked && !outgoing.resend;
+  });
+  if (oldest != in_flight.end() &&
+      now - oldest->sentAt >= connection.rtt.timeout()) {
+    if (++connection.timeouts > MAX_TIMEOUTS) {
+      sendReset(connection.address, connection.port, connection.sendId);
+      fail(connection, "Connection to " + connection.endpoint() +
+                           " timed out");
+      return;
+    }
+    connection.rtt.backoff();
+    connection.ledbat.onTimeout();
+    for (auto& outgoing : in_flight) {
+      if (!outgoing.acked) {
+        outgoing.resend = true;
+      }
+    }
+  }
+
+  // One packet may always be in flight, so that a zero window is probed.
+  const size_t window =
+      std::min<size_t>(connection.ledbat.window(), connection.peerWindow);
+  size_t flight = connection.bytesInFlight();
+  const auto fits = [&flight, window](size_t size) {
+    return flight == 0 || flight + size <= window;
+  };
+  const auto transmit = [&](Connection::Outgoing& outgoing) {
+    outgoing.sentAt = now;
+    outgoing.transmissions++;
+    outgoing.resend = false;
+    flight += outgoing.payload.size();
+    sendPacket(connection, outgoing.type, outgoing.seqNr, outgoing.payload);
+  };
+
+  for (auto& outgoing : in_flight) {
+    if (outgoing.resend) {
+      if (!fits(outgoing.payload.size())) {
+        break;
+      }
+      transmit(outgoing);
+    }
+  }
+
+  bool drained = false;
+  while (!connection.sendBuffer.empty() && in_flight.size() < MAX_IN_FLIGHT &&
+         fits(std::min(kMaxPayload, connection.sendBuffer.size()))) {
+    in_flight.push_back(Connection::Outgoing{
+        .type = UtpPacketType::kData,
+        .seqNr = connection.seqNr++,
+        .payload = connection.sendBuffer.take(kMaxPayload)});
+    transmit(in_flight.back());
+    drained = true;
+  }
+  if (drained) {
+    connection.changed.notify_all();
+  }
+
+  if (connection.closing && !connection.finSent &&
+      connection.sendBuffer.empty()) {
+    in_flight.push_back(Connection::Outgoing{.type = UtpPacketType::kFin,
+                                             .seqNr = connection.seqNr++});
+    transmit(in_flight.back());
+    connection.finSent = true;
+  }
+
+  if (connection.ackDue) {
+    sendPacket(connection, UtpPacketType::kState, connection.seqNr, "");
+  }
+}
+
+void UtpSocket::sendPacket(Connection& connection, UtpPacketType type,
+                           uint16_t seqNr, const std::string& payload) {
+  UtpPacket packet{
+      .type = type,
+      .connectionId = type == UtpPacketType::kSyn ? connection.recvId
+                                                  : connection.sendId,
+      .timestamp = micros(Clock::now()),
+      .timestampDifference = connection.replyMicros,
+      .windowSize = connection.receiveWindow(),
+      .seqNr = seqNr,
+      .ackNr = connection.ackNr,
+      .payload = payload};
+
+  if (!connection.outOfOrder.empty()) {
+    packet.selectiveAck.assign(kSelectiveAckBytes, '\0');
+    for (int bit = 0; bit < kSelectiveAckBits; bit++) {
+      if (connection.outOfOrder.contains(
+              static_cast<uint16_t>(connection.ackNr + 2 + bit))) {
+        packet.selectiveAck[bit / 8] = static_cast<char>(
+            packet.selectiveAck[bit / 8] | (1 << (bit % 8)));
+      }
+    }
+  }
+
+  outbox_.push_back(Datagram{.address = connection.address,
+                             .port = connection.port,
+                             .data = encodeUtpPacket(packet)});
+  connection.ackDue = false;
+}
+
+void UtpSocket::sendReset(uint32_t address, uint16_t port,
+                          uint16_t connectionId) {
+  UtpPacket packet{.type = UtpPacketType::kReset,
+                   .connectionId = connectionId,
+                   .timestamp = micros(Clock::now())};
+  outbox_.push_back(Datagram{
+      .address = address, .port = port, .data = encodeUtpPacket(packet)});
+}
+
+void UtpSocket::fail(Connection& connection, const std::string& message) {
+  connection.state = Connection::State::kClosed;
+  connection.error = message;
+  connection.inFlight.clear();
+  connection.sendBuffer.clear();
+  connection.changed.notify_all();
+}
@@ -0,0 +1,152 @@
+#ifndef BITTORRENTCLIENT_UTPSOCKET_H
+#define BITTORRENTCLIENT_UTPSOCKET_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tl/expected.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "network/Peer.h"
+#include "network/Transport.h"
+
+struct UtpError {
+  std::string message;
+};
+
+enum class UtpPacketType : uint8_t {
+  kData = 0,
+  kFin = 1,
+  kState = 2,
+  kReset = 3,
+  kSyn = 4,
+};
+
+// A uTP packet (BEP 29). Timestamps are in microseconds.
+struct UtpPacket {
+  UtpPacketType type = UtpPacketType::kData;
+  uint16_t connectionId = 0;
+  uint32_t timestamp = 0;
+  // The sender's clock when it received our last packet, minus that
+  // packet's timestamp: the one-way delay of our packets.
+  uint32_t timestampDifference = 0;
+  uint32_t windowSize = 0;
+  uint16_t seqNr = 0;
+  uint16_t ackNr = 0;
+  // Selective ACK extension: bit i is set when packet ackNr + 2 + i has
+  // been received. Empty if absent, otherwise a multiple of 4 bytes.
+  std::string selectiveAck;
+  std::string payload;
+};
+
+constexpr size_t kUtpHeaderSize = 20;
+
+std::string encodeUtpPacket(const UtpPacket& packet);
+tl::expected<UtpPacket, UtpError> decodeUtpPacket(const char* data,
+                                                  size_t size);
+
+/**
+ * uTP (BEP 29): reliable streams over a single UDP socket, with LEDBAT
+ * congestion control so that bulk transfers yield to other traffic.
+ *
+ * One thread owns the socket. It reads datagrams in batches with recvmmsg,
+ * hands payloads to the streams, acknowledges everything that arrived in
+ * the batch at once, and writes the packets that the congestion windows
+ * allow in batches with sendmmsg. Streams only buffer data and wake it up.
+ *
+ * Receivers acknowledge with selective ACKs. A packet reported missing
+ * while three later ones arrived is retransmitted at once and halves the
+ * window; one not acknowledged within the retransmission timeout resets
+ * the window to a single packet.
+ *
+ * Must be owned by a std::shared_ptr, which the streams keep a copy of.
+ */
+class UtpSocket : public Transport,
+                  public std::enable_shared_from_this<UtpSocket> {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kMaxPacketSize = 1400;
+  // Room is left for a selective ACK in every packet.
+  static constexpr size_t kSelectiveAckBytes = 8;
+  static constexpr size_t kMaxPayload =
+      kMaxPacketSize - kUtpHeaderSize - 2 - kSelectiveAckBytes;
+  static constexpr size_t kReceiveBufferSize = size_t{1} << 20;
+  static constexpr size_t kSendBufferSize = size_t{1} << 20;
+
+  explicit UtpSocket(
+      std::chrono::milliseconds connectTimeout = std::chrono::seconds(2));
+  ~UtpSocket() override;
+
+  // Binds the UDP socket (port 0 picks a free one, see port()).
+  tl::expected<void, UtpError> start(int port,
+                                     const std::string& address = "0.0.0.0");
+  void stop();
+  int port() const { return port_; }
+
+  using ConnectCallback = std::function<void(
+      tl::expected<std::unique_ptr<PeerStream>, ConnectError>)>;
+
+  tl::expected<std::unique_ptr<PeerStream>, ConnectError> connect(
+      const Peer& peer) override;
+  // Like connect() without waiting: `done` is called exactly once with the
+  // outcome, from the socket thread or from stop().
+  void connectAsync(const Peer& peer, ConnectCallback done);
+
+  // Incoming connections are refused with a reset until listen() is
+  // called; then up to `backlog` of them wait for accept().
+  void listen(size_t backlog = 16);
+  tl::expected<std::unique_ptr<PeerStream>, ConnectError> accept(
+      std::chrono::milliseconds timeout);
+
+ private:
+  struct Connection;
+  class Stream;
+  struct Datagram {
+    uint32_t address;
+    uint16_t port;
+    std::string data;
+  };
+
+  const std::chrono::milliseconds connectTimeout_;
+
+  int sock_ = -1;
+  // Wakes up the socket thread when a stream has something to send.
+  int wakeFd_ = -1;
+  int port_ = 0;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+
+  std::mutex lock_;
+  // By remote address and port and by the id the connection receives on.
+  std::unordered_map<uint64_t, std::shared_ptr<Connection>> connections_;
+  std::condition_variable accepted_;
+  std::deque<std::shared_ptr<Connection>> acceptQueue_;
+  size_t backlog_ = 0;
+  std::vector<Datagram> outbox_;
+
+  void run();
+  void wake() const;
+  void flush(std::vector<Datagram>& datagrams) const;
+  void handlePacket(const UtpPacket& packet, uint32_t address, uint16_t port,
+                    Clock::time_point now);
+  void handleAck(Connection& connection, const UtpPacket& packet,
+                 Clock::time_point now);
+  void handlePayload(Connection& connection, const UtpPacket& packet);
+  void pump(Connection& connection, Clock::time_point now);
+  void sendPacket(Connection& connection, UtpPacketType type, uint16_t seqNr,
+                  const std::string& payload);
+  void sendReset(uint32_t address, uint16_t port, uint16_t connectionId);
+  void fail(Connection& connection, const std::string& message);
+  std::function<void()> settle(const std::shared_ptr<Connection>& connection);
+};
+
+#endif  // BITTORRENTCLIENT_UTPSOCKET_H
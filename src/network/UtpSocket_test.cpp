@@ -0,0 +1,355 @@
+#include "network/UtpSocket.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "network/Ledbat.h"
+
+namespace {
+/**
+ * Relays datagrams between a client and a server on loopback, delaying
+ * each of them and dropping some at random, to simulate a lossy WAN link.
+ */
+class ImpairedLink {
+ public:
+  ImpairedLink(int serverPort, std::chrono::milliseconds delay,
+               double lossRate)
+      : delay_(delay), lossRate_(lossRate) {
+    sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(sock_, reinterpret_cast<sockaddr*>(&address), length);
+    getsockname(sock_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+
+    server_.sin_family = AF_INET;
+    server_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_.sin_port = htons(serverPort);
+    thread_ = std::thread([this] { run(); });
+  }
+
+  ~ImpairedLink() {
+    running_ = false;
+    thread_.join();
+    close(sock_);
+  }
+
+  int port() const { return port_; }
+
+ private:
+  const std::chrono::milliseconds delay_;
+  const double lossRate_;
+  int sock_;
+  int port_;
+  sockaddr_in server_{};
+  sockaddr_in client_{};
+  std::atomic<bool> running_ = true;
+  std::thread thread_;
+
+  void run() {
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::multimap<std::chrono::steady_clock::time_point,
+                  std::pair<sockaddr_in, std::string>>
+        queued;
+    char buffer[2048];
+
+    while (running_) {
+      pollfd descriptor{.fd = sock_, .events = POLLIN, .revents = 0};
+      poll(&descriptor, 1, 1);
+
+      sockaddr_in from{};
+      socklen_t length = sizeof(from);
+      ssize_t n;
+      while ((n = recvfrom(sock_, buffer, sizeof(buffer), MSG_DONTWAIT,
+                           reinterpret_cast<sockaddr*>(&from), &length)) >
+             0) {
+        const bool from_server = from.sin_port == server_.sin_port;
+        if (!from_server) {
+          client_ = from;
+        }
+        if (chance(generator) >= lossRate_) {
+          queued.emplace(std::chrono::steady_clock::now() + delay_,
+                         std::make_pair(from_server ? client_ : server_,
+                                        std::string(buffer, n)));
+        }
+        length = sizeof(from);
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      while (!queued.empty() && queued.begin()->first <= now) {
+        const auto& [to, data] = queued.begin()->second;
+        sendto(sock_, data.data(), data.size(), 0,
+               reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+        queued.erase(queued.begin());
+      }
+    }
+  }
+};
+
+std::string randomData(size_t size) {
+  std::mt19937 generator(7);
+  std::string data(size, '\0');
+  for (char& c : data) {
+    c = static_cast<char>(generator());
+  }
+  return data;
+}
+
+/**
+ * Sends `data` from a client to a server through `port` in 16 KiB chunks
+ * and returns what the server read.
+ */
+std::string transfer(const std::shared_ptr<UtpSocket>& client,
+                     const std::shared_ptr<UtpSocket>& server, int port,
+                     const std::string& data) {
+  auto outgoing = client->connect(Peer{.ip = "127.0.0.1", .port = port});
+  EXPECT_TRUE(outgoing.has_value());
+  if (!outgoing) {
+    return "";
+  }
+  auto incoming = server->accept(std::chrono::seconds(1));
+  EXPECT_TRUE(incoming.has_value());
+  if (!incoming) {
+    return "";
+  }
+
+  std::thread sender([&outgoing, &data] {
+    constexpr size_t kChunk = 16384;
+    for (size_t offset = 0; offset < data.size(); offset += kChunk) {
+      EXPECT_TRUE((*outgoing)->send(data.substr(offset, kChunk)).has_value());
+    }
+  });
+
+  std::string received;
+  while (received.size() < data.size()) {
+    auto chunk = (*incoming)->receive(
+        std::min<uint32_t>(16384, data.size() - received.size()));
+    if (!chunk) {
+      ADD_FAILURE() << chunk.error().message;
+      break;
+    }
+    received += *chunk;
+  }
+  sender.join();
+  return received;
+}
+}  // namespace
+
+TEST(UtpPacket, EncodesAndDecodesHeaderAndSelectiveAck) {
+  UtpPacket packet{.type = UtpPacketType::kState,
+                   .connectionId = 0xBEEF,
+                   .timestamp = 123456789,
+                   .timestampDifference = 4321,
+                   .windowSize = 1 << 20,
+                   .seqNr = 65535,
+                   .ackNr = 17,
+                   .selectiveAck = std::string("\x05\0\0\x80", 4),
+                   .payload = "data"};
+  std::string encoded = encodeUtpPacket(packet);
+  ASSERT_EQ(encoded.size(), kUtpHeaderSize + 2 + 4 + 4);
+  EXPECT_EQ(static_cast<uint8_t>(encoded[0]), 0x21);
+
+  auto decoded = decodeUtpPacket(encoded.data(), encoded.size());
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->type, UtpPacketType::kState);
+  EXPECT_EQ(decoded->connectionId, 0xBEEF);
+  EXPECT_EQ(decoded->timestamp, 123456789u);
+  EXPECT_EQ(decoded->timestampDifference, 4321u);
+  EXPECT_EQ(decoded->windowSize, 1u << 20);
+  EXPECT_EQ(decoded->seqNr, 65535);
+  EXPECT_EQ(decoded->ackNr, 17);
+  EXPECT_EQ(decoded->selectiveAck, packet.selectiveAck);
+  EXPECT_EQ(decoded->payload, "data");
+
+  EXPECT_FALSE(decodeUtpPacket(encoded.data(), kUtpHeaderSize - 1));
+  // Truncated inside the extension
+  EXPECT_FALSE(decodeUtpPacket(encoded.data(), kUtpHeaderSize + 4));
+  encoded[0] = 0x22;  // version 2
+  EXPECT_FALSE(decodeUtpPacket(encoded.data(), encoded.size()));
+}
+
+TEST(Ledbat, GrowsBelowTargetAndBacksOffAboveIt) {
+  constexpr size_t kMss = 1000;
+  Ledbat ledbat(kMss);
+  auto now = Ledbat::Clock::now();
+  EXPECT_EQ(ledbat.window(), 2 * kMss);
+
+  // No queuing delay: one window acknowledged adds about one packet.
+  ledbat.addDelaySample(20000, now);
+  for (int i = 0; i < 10; i++) {
+    const size_t window = ledbat.window();
+    ledbat.onAck(window, window);
+  }
+  EXPECT_EQ(ledbat.queuingDelay(), 0);
+  const size_t grown = ledbat.window();
+  EXPECT_GE(grown, 11 * kMss);
+
+  // A window that is not used does not grow.
+  ledbat.onAck(kMss, kMss);
+  EXPECT_EQ(ledbat.window(), grown);
+
+  // 200 ms of queuing, twice the target: the window shrinks.
+  for (int i = 0; i < 4; i++) {
+    ledbat.addDelaySample(220000, now);
+  }
+  EXPECT_EQ(ledbat.queuingDelay(), 200000);
+  ledbat.onAck(grown, grown);
+  EXPECT_LT(ledbat.window(), grown);
+
+  // The base delay only rises again once old minutes have rolled out.
+  for (int i = 0; i < Ledbat::kBaseHistory; i++) {
+    now += std::chrono::minutes(1);
+    ledbat.addDelaySample(220000, now);
+  }
+  EXPECT_EQ(ledbat.queuingDelay(), 0);
+
+  const size_t before_loss = ledbat.window();
+  ledbat.onLoss();
+  EXPECT_EQ(ledbat.window(), std::max(before_loss / 2, 2 * kMss));
+  ledbat.onTimeout();
+  EXPECT_EQ(ledbat.window(), kMss);
+}
+
+TEST(UtpSocket, TransfersOverLoopback) {
+  auto server = std::make_shared<UtpSocket>();
+  auto client = std::make_shared<UtpSocket>();
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  ASSERT_TRUE(client->start(0, "127.0.0.1").has_value());
+  server->listen();
+
+  const std::string data = randomData(4 << 20);
+  EXPECT_TRUE(transfer(client, server, server->port(), data) == data);
+}
+
+TEST(UtpSocket, RecoversFromDelayAndLoss) {
+  auto server = std::make_shared<UtpSocket>();
+  auto client = std::make_shared<UtpSocket>(std::chrono::seconds(5));
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  ASSERT_TRUE(client->start(0, "127.0.0.1").has_value());
+  server->listen();
+
+  // 20 ms each way and 3% of the packets lost in both directions
+  ImpairedLink link(server->port(), std::chrono::milliseconds(20), 0.03);
+  const std::string data = randomData(512 << 10);
+  EXPECT_TRUE(transfer(client, server, link.port(), data) == data);
+}
+
+TEST(UtpSocket, MessagesAreFramedAndClosingEndsTheStream) {
+  auto server = std::make_shared<UtpSocket>();
+  auto client = std::make_shared<UtpSocket>();
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  ASSERT_TRUE(client->start(0, "127.0.0.1").has_value());
+  server->listen();
+
+  auto outgoing =
+      client->connect(Peer{.ip = "127.0.0.1", .port = server->port()});
+  ASSERT_TRUE(outgoing.has_value());
+  auto incoming = server->accept(std::chrono::seconds(1));
+  ASSERT_TRUE(incoming.has_value());
+
+  ASSERT_TRUE((*outgoing)->send(std::string("\0\0\0\x03", 4) + "abc"));
+  auto message = (*incoming)->receive();
+  ASSERT_TRUE(message.has_value());
+  EXPECT_EQ(*message, "abc");
+
+  // Nothing arrives: reading a message times out like on TCP, and can be
+  // tried again.
+  auto idle = (*incoming)->receive();
+  ASSERT_FALSE(idle.has_value());
+  EXPECT_TRUE(idle.error().timedOut);
+
+  outgoing->reset();
+  auto closed = (*incoming)->receive(1);
+  ASSERT_FALSE(closed.has_value());
+  EXPECT_NE(closed.error().message.find("closed"), std::string::npos);
+  EXPECT_FALSE(closed.error().timedOut);
+}
+
+TEST(UtpSocket, RefusedAndUnansweredConnectionsFail) {
+  auto server = std::make_shared<UtpSocket>();
+  auto client = std::make_shared<UtpSocket>(std::chrono::milliseconds(300));
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  ASSERT_TRUE(client->start(0, "127.0.0.1").has_value());
+
+  // Not listening: the SYN is answered with a reset.
+  auto refused =
+      client->connect(Peer{.ip = "127.0.0.1", .port = server->port()});
+  ASSERT_FALSE(refused.has_value());
+  EXPECT_NE(refused.error().message.find("reset"), std::string::npos);
+
+  const int port = server->port();
+  server->stop();
+  auto unanswered = client->connect(Peer{.ip = "127.0.0.1", .port = port});
+  ASSERT_FALSE(unanswered.has_value());
+  EXPECT_NE(unanswered.error().message.find("timeout"), std::string::npos);
+}
+
+TEST(UtpSocket, DropsDataBeyondTheReceiveBuffer) {
+  auto server = std::make_shared<UtpSocket>();
+  ASSERT_TRUE(server->start(0, "127.0.0.1").has_value());
+  server->listen();
+
+  // A raw peer that ignores the window the server advertises.
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in to{};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(server->port());
+  inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+  auto send = [sock, &to](const UtpPacket& packet) {
+    const std::string encoded = encodeUtpPacket(packet);
+    sendto(sock, encoded.data(), encoded.size(), 0,
+           reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+  };
+  send(UtpPacket{.type = UtpPacketType::kSyn,
+                 .connectionId = 100,
+                 .windowSize = 1 << 20,
+                 .seqNr = 1});
+  auto incoming = server->accept(std::chrono::seconds(1));
+  ASSERT_TRUE(incoming.has_value());
+
+  constexpr size_t kFits =
+      UtpSocket::kReceiveBufferSize / UtpSocket::kMaxPayload;
+  const std::string payload(UtpSocket::kMaxPayload, 'x');
+  for (uint16_t i = 0; i < kFits + 50; i++) {
+    send(UtpPacket{.connectionId = 101,
+                   .windowSize = 1 << 20,
+                   .seqNr = static_cast<uint16_t>(2 + i),
+                   .payload = payload});
+    if (i % 10 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  // The highest packet acknowledged, nothing being read from the stream.
+  uint16_t acked = 0;
+  char buffer[2048];
+  pollfd descriptor{.fd = sock, .events = POLLIN, .revents = 0};
+  while (poll(&descriptor, 1, 200) > 0) {
+    ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+    auto packet = decodeUtpPacket(buffer, n);
+    if (packet && packet->type == UtpPacketType::kState) {
+      acked = std::max(acked, packet->ackNr);
+    }
+  }
+  close(sock);
+
+  EXPECT_GT(acked, 1);
+  EXPECT_LE(acked, 1 + kFits);
+}
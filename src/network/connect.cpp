@@ -123,8 +123,9 @@ tl::expected<std::string, ConnectError> receiveData(int sock,
           ConnectError{"Polling error on socket" + std::to_string(sock)});
     }
     if (ret == 0) {
-      return tl::unexpected(
-          ConnectError{"Read timeout on socket " + std::to_string(sock)});
+      return tl::unexpected(ConnectError{
+          .message = "Read timeout on socket " + std::to_string(sock),
+          .timedOut = true});
     }
 
     char length_buffer[kLengthIndicatorSize] = {};
@@ -7,6 +7,9 @@
 
 struct ConnectError {
   std::string message;
+  // No message started arriving before the read timeout. Nothing was
+  // consumed, so the read can be retried.
+  bool timedOut = false;
 };
 
 // Networks
@@ -0,0 +1,273 @@
+#include "utils/Bitset.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+size_t paddedWords(size_t size) {
+  constexpr size_t kBlockBits = 512;
+  return (size + kBlockBits - 1) / kBlockBits * 8;
+}
+
+// Words may be set concurrently through atomicSet(); a relaxed atomic load
+// compiles to a plain load but keeps the portable kernels free of races.
+inline uint64_t loadWord(const uint64_t* word) {
+  return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(*word))
+      .load(std::memory_order_relaxed);
+}
+
+// Applies `op` to the words at the same index of both operands. Words of
+// `other` past its end read as zero.
+template <typename OpT>
+uint64_t combine(uint64_t word, const uint64_t* other, size_t otherWords,
+                 size_t index, OpT op) {
+  return op(word, index < otherWords ? loadWord(other + index) : 0);
+}
+
+#if defined(__AVX2__)
+// Per-byte popcount by nibble lookup (Mula et al.), summed into 64-bit lanes.
+inline __m256i popcount256(__m256i v) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i low = _mm256_and_si256(v, low_mask);
+  __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low),
+                                   _mm256_shuffle_epi8(lookup, high));
+  return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+#endif
+}  // namespace
+
+Bitset::Bitset(size_t size, bool value)
+    : words_(paddedWords(size), 0), size_(size) {
+  if (!value) {
+    return;
+  }
+  std::fill(words_.begin(), words_.begin() + size / 64, UINT64_MAX);
+  if (size % 64 != 0) {
+    words_[size / 64] = (uint64_t{1} << (size % 64)) - 1;
+  }
+}
+
+Bitset Bitset::fromBitfield(const std::string& bitfield) {
+  Bitset bits(bitfield.size() * 8);
+  for (size_t i = 0; i < bitfield.size(); i++) {
+    // Reverse the bit order within the byte: wire bit 7 is piece 8 * i.
+    uint64_t byte = static_cast<unsigned char>(bitfield[i]);
+    byte = ((byte & 0xF0) >> 4) | ((byte & 0x0F) << 4);
+    byte = ((byte & 0xCC) >> 2) | ((byte & 0x33) << 2);
+    byte = ((byte & 0xAA) >> 1) | ((byte & 0x55) << 1);
+    bits.words_[i / 8] |= byte << (8 * (i % 8));
+  }
+  return bits;
+}
+
+std::string Bitset::toBitfield() const {
+  std::string bitfield((size_ + 7) / 8, '\0');
+  for (size_t i = 0; i < bitfield.size(); i++) {
+    uint64_t byte = (words_[i / 8] >> (8 * (i % 8))) & 0xFF;
+    byte = ((byte & 0xF0) >> 4) | ((byte & 0x0F) << 4);
+    byte = ((byte & 0xCC) >> 2) | ((byte & 0x33) << 2);
+    byte = ((byte & 0xAA) >> 1) | ((byte & 0x55) << 1);
+    bitfield[i] = static_cast<char>(byte);
+  }
+  return bitfield;
+}
+
+size_t Bitset::count() const { return countOp(nullptr, Op::kSelf); }
+
+size_t Bitset::countAnd(const Bitset& other) const {
+  return countOp(&other, Op::kAnd);
+}
+
+size_t Bitset::countAndNot(const Bitset& other) const {
+  return countOp(&other, Op::kAndNot);
+}
+
+size_t Bitset::findNext(size_t from) const {
+  return findOp(nullptr, Op::kSelf, from);
+}
+
+size_t Bitset::findNextAnd(const Bitset& other, size_t from) const {
+  return findOp(&other, Op::kAnd, from);
+}
+
+size_t Bitset::findNextAndNot(const Bitset& other, size_t from) const {
+  return findOp(&other, Op::kAndNot, from);
+}
+
+/**
+ * Population count of this bitset combined word by word with `other`. Both
+ * are padded to whole 64-byte blocks, so the vector loops cover the shared
+ * words exactly; any words past the end of `other` are handled afterwards.
+ */
+size_t Bitset::countOp(const Bitset* other, Op op) const {
+  const uint64_t* a = words_.data();
+  const uint64_t* b = other ? other->words_.data() : nullptr;
+  const size_t words = words_.size();
+  const size_t shared = other ? std::min(words, other->words_.size()) : words;
+
+  size_t total = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i sums = _mm256_setzero_si256();
+  for (; i < shared; i += 4) {
+    __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(a + i));
+    if (op == Op::kAnd) {
+      v = _mm256_and_si256(
+          v, _mm256_load_si256(reinterpret_cast<const __m256i*>(b + i)));
+    } else if (op == Op::kAndNot) {
+      v = _mm256_andnot_si256(
+          _mm256_load_si256(reinterpret_cast<const __m256i*>(b + i)), v);
+    }
+    sums = _mm256_add_epi64(sums, popcount256(v));
+  }
+  total += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+           _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  for (; i < shared; i += 2) {
+    uint64x2_t v = vld1q_u64(a + i);
+    if (op == Op::kAnd) {
+      v = vandq_u64(v, vld1q_u64(b + i));
+    } else if (op == Op::kAndNot) {
+      v = vbicq_u64(v, vld1q_u64(b + i));
+    }
+    total += vaddlvq_u8(vcntq_u8(vreinterpretq_u8_u64(v)));
+  }
+#else
+  for (; i < shared; i++) {
+    uint64_t word = loadWord(a + i);
+    if (op == Op::kAnd) {
+      word &= loadWord(b + i);
+    } else if (op == Op::kAndNot) {
+      word &= ~loadWord(b + i);
+    }
+    total += std::popcount(word);
+  }
+#endif
+
+  // Past the end of `other`: nothing is left of an AND, everything of an
+  // AND-NOT.
+  if (op != Op::kAnd) {
+    for (; i < words; i++) {
+      total += std::popcount(loadWord(a + i));
+    }
+  }
+  return total;
+}
+
+/**
+ * Index of the first bit at or after `from` that is set in this bitset
+ * combined with `other`. Whole 64-byte blocks that combine to zero are
+ * skipped with one vector test each.
+ */
+size_t Bitset::findOp(const Bitset* other, Op op, size_t from) const {
+  if (from >= size_) {
+    return npos;
+  }
+
+  const uint64_t* a = words_.data();
+  const uint64_t* b = other ? other->words_.data() : nullptr;
+  const size_t words = words_.size();
+  const size_t other_words = other ? other->words_.size() : 0;
+
+  auto word_at = [&](size_t index) {
+    switch (op) {
+      case Op::kAnd:
+        return combine(loadWord(a + index), b, other_words, index,
+                       [](uint64_t x, uint64_t y) { return x & y; });
+      case Op::kAndNot:
+        return combine(loadWord(a + index), b, other_words, index,
+                       [](uint64_t x, uint64_t y) { return x & ~y; });
+      default:
+        return loadWord(a + index);
+    }
+  };
+
+  // Finish the block `from` falls in word by word.
+  size_t index = from / 64;
+  uint64_t word = word_at(index) & (UINT64_MAX << (from % 64));
+  size_t block_end = (index / kBlockWords + 1) * kBlockWords;
+  while (word == 0) {
+    if (++index == block_end) {
+      break;
+    }
+    word = word_at(index);
+  }
+  if (word != 0) {
+    return index * 64 + std::countr_zero(word);
+  }
+
+  const size_t shared = other ? std::min(words, other_words) : words;
+  for (; index < words; index += kBlockWords) {
+    bool empty;
+    if (index + kBlockWords > shared && op != Op::kSelf) {
+      // Past the end of `other`; rare enough to do word by word.
+      empty = true;
+      for (size_t i = index; i < index + kBlockWords; i++) {
+        empty = empty && word_at(i) == 0;
+      }
+    } else {
+#if defined(__AVX2__)
+      __m256i v0 =
+          _mm256_load_si256(reinterpret_cast<const __m256i*>(a + index));
+      __m256i v1 =
+          _mm256_load_si256(reinterpret_cast<const __m256i*>(a + index + 4));
+      if (op != Op::kSelf) {
+        __m256i w0 =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(b + index));
+        __m256i w1 = _mm256_load_si256(
+            reinterpret_cast<const __m256i*>(b + index + 4));
+        if (op == Op::kAnd) {
+          v0 = _mm256_and_si256(v0, w0);
+          v1 = _mm256_and_si256(v1, w1);
+        } else {
+          v0 = _mm256_andnot_si256(w0, v0);
+          v1 = _mm256_andnot_si256(w1, v1);
+        }
+      }
+      __m256i any = _mm256_or_si256(v0, v1);
+      empty = _mm256_testz_si256(any, any);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+      uint64x2_t any = vdupq_n_u64(0);
+      for (size_t i = index; i < index + kBlockWords; i += 2) {
+        uint64x2_t v = vld1q_u64(a + i);
+        if (op == Op::kAnd) {
+          v = vandq_u64(v, vld1q_u64(b + i));
+        } else if (op == Op::kAndNot) {
+          v = vbicq_u64(v, vld1q_u64(b + i));
+        }
+        any = vorrq_u64(any, v);
+      }
+      empty = vmaxvq_u32(vreinterpretq_u32_u64(any)) == 0;
+#else
+      uint64_t any = 0;
+      for (size_t i = index; i < index + kBlockWords; i++) {
+        any |= word_at(i);
+      }
+      empty = any == 0;
+#endif
+    }
+    if (empty) {
+      continue;
+    }
+
+    for (size_t i = index; i < index + kBlockWords; i++) {
+      if (uint64_t found = word_at(i)) {
+        return i * 64 + std::countr_zero(found);
+      }
+    }
+  }
+  return npos;
+}
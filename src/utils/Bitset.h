@@ -0,0 +1,113 @@
+#ifndef BITTORRENTCLIENT_BITSET_H
+#define BITTORRENTCLIENT_BITSET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
+
+// Allocator returning storage aligned to `Alignment` bytes, so that SIMD
+// kernels can use aligned loads.
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  explicit AlignedAllocator(const AlignedAllocator<U, Alignment>& /*other*/) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+  }
+  void deallocate(T* p, size_t /*n*/) {
+    ::operator delete(p, std::align_val_t{Alignment});
+  }
+
+  bool operator==(const AlignedAllocator& /*other*/) const { return true; }
+};
+
+/**
+ * Fixed-size set of bits packed into 64-bit words, used for per-piece state
+ * and peer bitfields. The words live in 64-byte aligned storage padded to a
+ * whole number of 64-byte blocks, and bits past size() are always clear, so
+ * the set operations below run over whole blocks without tail handling.
+ *
+ * count, countAnd(Not) and findNextAnd(Not) use AVX2 or NEON when the build
+ * targets them (see BITTORRENT_NATIVE_ARCH) and portable code otherwise.
+ *
+ * A bitset shared with concurrent readers is only modified through
+ * atomicSet(). Readers see each 64-bit word either before or after a
+ * change, so a scan may miss a bit that is being set, never more. The
+ * portable kernels read words with relaxed atomic loads; the vector ones
+ * rely on aligned vector loads not tearing 64-bit words.
+ */
+class Bitset {
+ public:
+  static constexpr size_t npos = SIZE_MAX;
+
+  Bitset() = default;
+  explicit Bitset(size_t size, bool value = false);
+
+  // Builds a bitset from a BEP 3 bitfield, where piece 0 is the high bit of
+  // the first byte. It holds 8 bits per byte of the bitfield.
+  static Bitset fromBitfield(const std::string& bitfield);
+  std::string toBitfield() const;
+
+  size_t size() const { return size_; }
+
+  bool test(size_t index) const {
+    return (words_[index / 64] >> (index % 64)) & 1;
+  }
+  void set(size_t index) { words_[index / 64] |= uint64_t{1} << (index % 64); }
+  void reset(size_t index) {
+    words_[index / 64] &= ~(uint64_t{1} << (index % 64));
+  }
+
+  bool atomicTest(size_t index) const {
+    return (std::atomic_ref<uint64_t>(const_cast<uint64_t&>(words_[index / 64]))
+                .load(std::memory_order_relaxed) >>
+            (index % 64)) &
+           1;
+  }
+  void atomicSet(size_t index) {
+    std::atomic_ref<uint64_t>(words_[index / 64])
+        .fetch_or(uint64_t{1} << (index % 64), std::memory_order_relaxed);
+  }
+
+  size_t count() const;
+  bool all() const { return count() == size_; }
+  bool none() const { return findFirst() == npos; }
+
+  // Number of bits set both here and in `other`.
+  size_t countAnd(const Bitset& other) const;
+  // Number of bits set here but not in `other`.
+  size_t countAndNot(const Bitset& other) const;
+
+  // Index of the first set bit at or after `from`, or npos.
+  size_t findNext(size_t from) const;
+  size_t findFirst() const { return findNext(0); }
+  // Same, for the bits set both here and in `other`.
+  size_t findNextAnd(const Bitset& other, size_t from) const;
+  // Same, for the bits set here but not in `other`.
+  size_t findNextAndNot(const Bitset& other, size_t from) const;
+
+ private:
+  static constexpr size_t kBlockWords = 8;  // 64 bytes
+
+  std::vector<uint64_t, AlignedAllocator<uint64_t, 64>> words_;
+  size_t size_ = 0;
+
+  enum class Op { kSelf, kAnd, kAndNot };
+  size_t countOp(const Bitset* other, Op op) const;
+  size_t findOp(const Bitset* other, Op op, size_t from) const;
+};
+
+#endif  // BITTORRENTCLIENT_BITSET_H
@@ -0,0 +1,99 @@
+#include "utils/Bitset.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+TEST(BitsetTest, SetResetAndCount) {
+  Bitset bits(130);
+  EXPECT_TRUE(bits.none());
+
+  bits.set(0);
+  bits.set(64);
+  bits.set(129);
+  EXPECT_TRUE(bits.test(64));
+  EXPECT_FALSE(bits.test(63));
+  EXPECT_EQ(bits.count(), 3);
+
+  bits.reset(64);
+  EXPECT_FALSE(bits.test(64));
+  EXPECT_EQ(bits.count(), 2);
+}
+
+TEST(BitsetTest, FilledBitsetKeepsTailClear) {
+  Bitset bits(70, true);
+  EXPECT_EQ(bits.count(), 70);
+  EXPECT_TRUE(bits.all());
+  EXPECT_EQ(bits.findNext(69), 69);
+  EXPECT_EQ(bits.findNext(70), Bitset::npos);
+}
+
+TEST(BitsetTest, FindNextSkipsEmptyWords) {
+  Bitset bits(300);
+  EXPECT_EQ(bits.findFirst(), Bitset::npos);
+
+  bits.set(5);
+  bits.set(257);
+  EXPECT_EQ(bits.findFirst(), 5);
+  EXPECT_EQ(bits.findNext(6), 257);
+  EXPECT_EQ(bits.findNext(258), Bitset::npos);
+}
+
+TEST(BitsetTest, ConvertsBitfieldsInWireOrder) {
+  std::string bitfield("\x80\x01\x40", 3);
+  Bitset bits = Bitset::fromBitfield(bitfield);
+
+  EXPECT_EQ(bits.size(), 24);
+  EXPECT_TRUE(bits.test(0));
+  EXPECT_TRUE(bits.test(15));
+  EXPECT_TRUE(bits.test(17));
+  EXPECT_EQ(bits.count(), 3);
+  EXPECT_EQ(bits.toBitfield(), bitfield);
+}
+
+TEST(BitsetTest, SetOperationsMatchBitByBitResults) {
+  // Sizes around the 64-byte block boundary, with operands of different
+  // lengths.
+  for (size_t size : {1, 63, 64, 511, 512, 513, 5000}) {
+    Bitset peer(size);
+    Bitset have(size / 2 + 1);
+    for (size_t i = 0; i < size; i += 3) {
+      peer.set(i);
+    }
+    for (size_t i = 0; i < have.size(); i += 2) {
+      have.set(i);
+    }
+
+    size_t both = 0;
+    size_t peer_only = 0;
+    size_t first_both = Bitset::npos;
+    size_t first_peer_only = Bitset::npos;
+    for (size_t i = 0; i < size; i++) {
+      bool in_have = i < have.size() && have.test(i);
+      if (peer.test(i) && in_have) {
+        both++;
+        first_both = std::min(first_both, i);
+      }
+      if (peer.test(i) && !in_have) {
+        peer_only++;
+        first_peer_only = std::min(first_peer_only, i);
+      }
+    }
+
+    EXPECT_EQ(peer.countAnd(have), both) << size;
+    EXPECT_EQ(peer.countAndNot(have), peer_only) << size;
+    EXPECT_EQ(peer.findNextAnd(have, 0), first_both) << size;
+    EXPECT_EQ(peer.findNextAndNot(have, 0), first_peer_only) << size;
+  }
+}
+
+TEST(BitsetTest, FindNextAndNotSkipsOwnedPieces) {
+  Bitset peer(2000, true);
+  Bitset have(2000, true);
+  have.reset(1500);
+
+  EXPECT_EQ(peer.countAndNot(have), 1);
+  EXPECT_EQ(peer.findNextAndNot(have, 0), 1500);
+  EXPECT_EQ(peer.findNextAndNot(have, 1501), Bitset::npos);
+}
@@ -106,3 +106,41 @@ TorrentFileParser::getAnnounce() const {
   }
   return std::dynamic_pointer_cast<bencoding::BString>(announce_item)->value();
 }
+
+tl::expected<std::vector<std::vector<std::string>>, TorrentFileParserError>
+TorrentFileParser::getAnnounceList() const {
+  std::vector<std::vector<std::string>> tiers;
+
+  auto announce_list =
+      std::dynamic_pointer_cast<bencoding::BList>(get("announce-list"));
+  if (announce_list) {
+    for (const auto& tier_item : *announce_list) {
+      auto tier_list = std::dynamic_pointer_cast<bencoding::BList>(tier_item);
+      if (!tier_list) {
+        return tl::unexpected(TorrentFileParserError{
+            "Torrent file is malformed. ['announce-list' tier is not a "
+            "list]"});
+      }
+
+      std::vector<std::string> tier;
+      for (const auto& url_item : *tier_list) {
+        auto url = std::dynamic_pointer_cast<bencoding::BString>(url_item);
+        if (url && !url->value().empty()) {
+          tier.push_back(url->value());
+        }
+      }
+      if (!tier.empty()) {
+        tiers.push_back(std::move(tier));
+      }
+    }
+  }
+
+  if (tiers.empty()) {
+    auto announce = getAnnounce();
+    if (!announce) {
+      return tl::unexpected(announce.error());
+    }
+    tiers.push_back({*announce});
+  }
+  return tiers;
+}
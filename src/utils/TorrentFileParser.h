@@ -30,6 +30,11 @@ class TorrentFileParser {
       const;
   [[nodiscard]] tl::expected<std::string, TorrentFileParserError> getAnnounce()
       const;
+  // Tiers of tracker URLs from 'announce-list' (BEP 12), or a single tier
+  // holding 'announce' if the torrent has no list.
+  [[nodiscard]] tl::expected<std::vector<std::vector<std::string>>,
+                             TorrentFileParserError>
+  getAnnounceList() const;
   [[nodiscard]] std::shared_ptr<bencoding::BItem> get(std::string key) const;
   [[nodiscard]] std::string getInfoHash() const;
   [[nodiscard]] tl::expected<std::vector<std::string>, TorrentFileParserError>
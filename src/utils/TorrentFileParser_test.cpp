@@ -2,6 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
 // TEST(PieceManagerTest, init) {
 //   TorrentFileParser tfp = TorrentFileParser("");
 //   EXPECT_EQ(tfp.getFileName(), "debian-12.5.0-amd64-netinst.iso");
@@ -36,3 +41,32 @@ TEST(PieceManagerTest, splitPieceHashes) {
   EXPECT_EQ(output.has_value(), true);
   EXPECT_EQ(output.value().size(), result);
 }
+
+TEST(PieceManagerTest, getAnnounceListFallsBackToAnnounce) {
+  TorrentFileParser tfp = TorrentFileParser("debian.torrent");
+  auto tiers = tfp.getAnnounceList();
+  ASSERT_TRUE(tiers.has_value());
+  ASSERT_EQ(tiers->size(), 1);
+  EXPECT_EQ(tiers->front(), std::vector<std::string>{
+                                "http://bttracker.debian.org:6969/announce"});
+}
+
+TEST(PieceManagerTest, getAnnounceList) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "announce_list.torrent")
+          .string();
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "d8:announce13:http://a/annc13:announce-listll13:http://a/annc"
+            "13:udp://b:1/annel13:http://c/annceee";
+  }
+
+  TorrentFileParser tfp = TorrentFileParser(path);
+  auto tiers = tfp.getAnnounceList();
+  ASSERT_TRUE(tiers.has_value());
+  ASSERT_EQ(tiers->size(), 2);
+  EXPECT_EQ((*tiers)[0],
+            (std::vector<std::string>{"http://a/annc", "udp://b:1/ann"}));
+  EXPECT_EQ((*tiers)[1], std::vector<std::string>{"http://c/annc"});
+  std::filesystem::remove(path);
+}
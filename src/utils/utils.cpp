@@ -3,6 +3,7 @@
 #include <array>
 #include <bitset>
 #include <cctype>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <iomanip>
@@ -10,6 +11,7 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <system_error>
 
 using std::array;
 
@@ -110,4 +112,40 @@ std::string formatTime(int64_t seconds) {
   }
   return result;
 }
+
+/**
+ * Whether every string of the bencoded message fits in the message. The
+ * decoder allocates a string of the announced length before reading it, so
+ * a forged length would have it allocate gigabytes.
+ */
+// NOLINTNEXTLINE(misc-use-internal-linkage)
+bool bencodedStringsFit(const std::string& message) {
+  size_t offset = 0;
+  while (offset < message.size()) {
+    const char c = message[offset];
+    if (c == 'i') {
+      offset = message.find('e', offset);
+      if (offset == std::string::npos) {
+        return false;
+      }
+      offset++;
+    } else if (c < '0' || c > '9') {
+      offset++;
+    } else {
+      const size_t colon = message.find(':', offset);
+      if (colon == std::string::npos) {
+        return false;
+      }
+      size_t length = 0;
+      auto [end, error] = std::from_chars(message.data() + offset,
+                                          message.data() + colon, length);
+      if (error != std::errc() || end != message.data() + colon ||
+          length > message.size() - colon - 1) {
+        return false;
+      }
+      offset = colon + 1 + length;
+    }
+  }
+  return true;
+}
 }  // namespace utils
@@ -20,5 +20,7 @@ int bytesToInt(std::string bytes);
 
 std::string formatTime(int64_t seconds);
 
+bool bencodedStringsFit(const std::string& message);
+
 #endif  // BITTORRENTCLIENT_UTILS_H
 }